@@ -0,0 +1,328 @@
+#include "adaptive_multiset.h"
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+std::atomic<int> storageMode(STORAGE_AUTO);
+std::atomic<double> sparseFillThreshold(0.125); // a sparse entry is twice the size of a dense slot
+
+size_t countNonZero(const DenseMultiset& multiset) {
+    size_t nonZero = 0;
+    const int* a = multiset.data();
+    for (size_t i = 0; i < multiset.size(); i++) {
+        nonZero += a[i] != 0;
+    }
+    return nonZero;
+}
+
+} // namespace
+
+StorageMode getStorageMode() {
+    return static_cast<StorageMode>(storageMode.load(std::memory_order_relaxed));
+}
+
+void setStorageMode(StorageMode mode) {
+    storageMode.store(mode, std::memory_order_relaxed);
+}
+
+double getSparseFillThreshold() {
+    return sparseFillThreshold.load(std::memory_order_relaxed);
+}
+
+void setSparseFillThreshold(double ratio) {
+    sparseFillThreshold.store(ratio, std::memory_order_relaxed);
+}
+
+const char* storageModeName(StorageMode mode) {
+    switch (mode) {
+        case STORAGE_DENSE: return "dense";
+        case STORAGE_SPARSE: return "sparse";
+        default: return "auto";
+    }
+}
+
+AdaptiveMultiset::AdaptiveMultiset() : form(FORM_DENSE) {}
+
+AdaptiveMultiset::AdaptiveMultiset(const DenseMultiset& multiset) : form(FORM_DENSE), dense(multiset) {
+    applyStoragePolicy();
+}
+
+AdaptiveMultiset::AdaptiveMultiset(const SparseMultiset& multiset) : form(FORM_SPARSE), sparseForm(multiset) {
+    applyStoragePolicy();
+}
+
+AdaptiveMultiset::AdaptiveMultiset(DenseMultiset&& multiset) : form(FORM_DENSE), dense(std::move(multiset)) {
+    applyStoragePolicy();
+}
+
+AdaptiveMultiset::AdaptiveMultiset(SparseMultiset&& multiset) : form(FORM_SPARSE), sparseForm(std::move(multiset)) {
+    applyStoragePolicy();
+}
+
+AdaptiveMultiset::AdaptiveMultiset(BitsetMultiset&& multiset, const CapArray& unitCaps)
+    : form(FORM_BITSET), bits(std::move(multiset)), bitsCaps(unitCaps) {
+    if (!unitCaps || unitCaps->size() != bits.size()) {
+        throw invalid_argument("AdaptiveMultiset: caps array does not match universe size");
+    }
+    applyStoragePolicy();
+}
+
+const CapArray& AdaptiveMultiset::sharedCaps() const {
+    switch (form) {
+        case FORM_SPARSE: return sparseForm.sharedCaps();
+        case FORM_BITSET: return bitsCaps;
+        default: return dense.sharedCaps();
+    }
+}
+
+DenseMultiset AdaptiveMultiset::toDense() const {
+    if (form == FORM_SPARSE) return ::toDense(sparseForm);
+    if (form == FORM_DENSE) return dense;
+    DenseMultiset result(bits.getBitWidth(), bitsCaps);
+    int* counts = result.data();
+    for (size_t i = 0; i < bits.size(); i++) counts[i] = bits.count(i);
+    return result;
+}
+
+SparseMultiset AdaptiveMultiset::toSparse() const {
+    if (form == FORM_SPARSE) return sparseForm;
+    if (form == FORM_DENSE) return ::toSparse(dense);
+    return ::toSparse(toDense());
+}
+
+const DenseMultiset& AdaptiveMultiset::denseForm(DenseMultiset& scratch) const {
+    if (form == FORM_DENSE) return dense;
+    scratch = toDense();
+    return scratch;
+}
+
+int AdaptiveMultiset::getBitWidth() const {
+    switch (form) {
+        case FORM_SPARSE: return sparseForm.getBitWidth();
+        case FORM_BITSET: return bits.getBitWidth();
+        default: return dense.getBitWidth();
+    }
+}
+
+size_t AdaptiveMultiset::size() const {
+    switch (form) {
+        case FORM_SPARSE: return sparseForm.size();
+        case FORM_BITSET: return bits.size();
+        default: return dense.size();
+    }
+}
+
+size_t AdaptiveMultiset::support() const {
+    switch (form) {
+        case FORM_SPARSE: return sparseForm.support();
+        case FORM_BITSET: return static_cast<size_t>(sumMultisets(bits));
+        default: return countNonZero(dense);
+    }
+}
+
+double AdaptiveMultiset::fillRatio() const {
+    return size() == 0 ? 0.0 : static_cast<double>(support()) / static_cast<double>(size());
+}
+
+int AdaptiveMultiset::count(size_t rank) const {
+    switch (form) {
+        case FORM_SPARSE: return sparseForm.count(rank);
+        case FORM_BITSET: return bits.count(rank);
+        default: return dense.count(rank);
+    }
+}
+
+void AdaptiveMultiset::set(size_t rank, int multiplicity) {
+    if (form == FORM_BITSET && (multiplicity == 0 || multiplicity == 1)) {
+        bits.set(rank, multiplicity == 1);
+        return;
+    }
+    if (form == FORM_BITSET) convertTo(FORM_DENSE); // the bitset cannot hold it
+    if (form == FORM_SPARSE) {
+        sparseForm.set(rank, multiplicity);
+    } else {
+        dense.set(rank, multiplicity);
+    }
+}
+
+void AdaptiveMultiset::adoptUniverse(int bitWidth, const CapArray& caps) {
+    if (form == FORM_BITSET) {
+        if (caps && caps->size() == bits.size() && bitWidth == bits.getBitWidth() && hasUnitCaps(*caps)) {
+            bitsCaps = caps;
+            return;
+        }
+        convertTo(FORM_DENSE);
+    }
+    if (form == FORM_SPARSE) {
+        sparseForm.adoptUniverse(bitWidth, caps);
+    } else {
+        dense.adoptUniverse(bitWidth, caps);
+    }
+}
+
+bool AdaptiveMultiset::presenceOnly() const {
+    if (form == FORM_BITSET) return true;
+    if (!hasUnitCaps(*sharedCaps())) return false;
+    if (form == FORM_SPARSE) {
+        const vector<SparseEntry>& entries = sparseForm.getEntries();
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].multiplicity != 1) return false;
+        }
+        return true;
+    }
+    const int* a = dense.data();
+    for (size_t i = 0; i < dense.size(); i++) {
+        if (a[i] != 0 && a[i] != 1) return false;
+    }
+    return true;
+}
+
+void AdaptiveMultiset::convertTo(Form target) {
+    if (target == form) return;
+    if (target == FORM_DENSE) {
+        dense = toDense();
+    } else if (target == FORM_SPARSE) {
+        sparseForm = toSparse();
+    } else {
+        bitsCaps = sharedCaps();
+        if (form == FORM_DENSE) {
+            bits = toBitset(dense);
+        } else {
+            bits = BitsetMultiset(sparseForm.getBitWidth());
+            const vector<SparseEntry>& entries = sparseForm.getEntries();
+            for (size_t i = 0; i < entries.size(); i++) bits.set(entries[i].rank);
+        }
+    }
+    if (form == FORM_DENSE) dense = DenseMultiset();
+    else if (form == FORM_SPARSE) sparseForm = SparseMultiset();
+    else {
+        bits = BitsetMultiset();
+        bitsCaps.reset();
+    }
+    form = target;
+}
+
+void AdaptiveMultiset::applyStoragePolicy() {
+    Form target;
+    switch (getStorageMode()) {
+        case STORAGE_DENSE: target = FORM_DENSE; break;
+        case STORAGE_SPARSE: target = FORM_SPARSE; break;
+        default:
+            if (presenceOnly()) {
+                // A sparse entry takes 64 bits, the bitset one bit per element
+                target = fillRatio() < 1.0 / 64 ? FORM_SPARSE : FORM_BITSET;
+            } else {
+                target = fillRatio() < getSparseFillThreshold() ? FORM_SPARSE : FORM_DENSE;
+            }
+            break;
+    }
+    convertTo(target);
+}
+
+// Set operations
+AdaptiveMultiset unionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    if (m1.isBitset() && m2.isBitset()) {
+        return AdaptiveMultiset(unionMultisets(m1.getBitset(), m2.getBitset()), m1.sharedCaps());
+    }
+    if (m1.isSparse() && m2.isSparse()) {
+        return AdaptiveMultiset(unionMultisets(m1.getSparse(), m2.getSparse()));
+    }
+    DenseMultiset scratch1, scratch2;
+    return AdaptiveMultiset(unionMultisets(m1.denseForm(scratch1), m2.denseForm(scratch2)));
+}
+
+AdaptiveMultiset intersectionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    if (m1.isBitset() && m2.isBitset()) {
+        return AdaptiveMultiset(intersectionMultisets(m1.getBitset(), m2.getBitset()), m1.sharedCaps());
+    }
+    if (m1.isSparse() && m2.isSparse()) {
+        return AdaptiveMultiset(intersectionMultisets(m1.getSparse(), m2.getSparse()));
+    }
+    DenseMultiset scratch1, scratch2;
+    return AdaptiveMultiset(intersectionMultisets(m1.denseForm(scratch1), m2.denseForm(scratch2)));
+}
+
+AdaptiveMultiset differenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    if (m1.isBitset() && m2.isBitset()) {
+        return AdaptiveMultiset(differenceMultisets(m1.getBitset(), m2.getBitset()), m1.sharedCaps());
+    }
+    if (m1.isSparse() && m2.isSparse()) {
+        return AdaptiveMultiset(differenceMultisets(m1.getSparse(), m2.getSparse()));
+    }
+    DenseMultiset scratch1, scratch2;
+    return AdaptiveMultiset(differenceMultisets(m1.denseForm(scratch1), m2.denseForm(scratch2)));
+}
+
+AdaptiveMultiset symmetricDifferenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    if (m1.isBitset() && m2.isBitset()) {
+        return AdaptiveMultiset(symmetricDifferenceMultisets(m1.getBitset(), m2.getBitset()), m1.sharedCaps());
+    }
+    if (m1.isSparse() && m2.isSparse()) {
+        return AdaptiveMultiset(symmetricDifferenceMultisets(m1.getSparse(), m2.getSparse()));
+    }
+    DenseMultiset scratch1, scratch2;
+    return AdaptiveMultiset(symmetricDifferenceMultisets(m1.denseForm(scratch1), m2.denseForm(scratch2)));
+}
+
+AdaptiveMultiset complementMultiset(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) {
+        return AdaptiveMultiset(complementMultiset(multiset.getBitset()), multiset.sharedCaps());
+    }
+    if (multiset.isSparse()) {
+        return AdaptiveMultiset(complementMultiset(multiset.getSparse()));
+    }
+    return AdaptiveMultiset(complementMultiset(multiset.getDense()));
+}
+
+// Arithmetic operations
+int sumMultisets(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) return sumMultisets(multiset.getBitset());
+    return multiset.isSparse() ? sumMultisets(multiset.getSparse()) : sumMultisets(multiset.getDense());
+}
+
+int arithmeticDifferenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return diff > 0 ? diff : 0; // Ensure non-negative result
+}
+
+int productMultisets(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) return productMultisets(multiset.getBitset());
+    return multiset.isSparse() ? productMultisets(multiset.getSparse()) : productMultisets(multiset.getDense());
+}
+
+int divisionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    int sum2 = sumMultisets(m2);
+    if (sum2 == 0) {
+        cout << "Division by zero error!\n";
+        return 0;
+    }
+    return sumMultisets(m1) / sum2; // Integer division
+}
+
+// Gray-weighted arithmetic
+long long weightedSum(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) return weightedSum(multiset.getBitset());
+    return multiset.isSparse() ? weightedSum(multiset.getSparse()) : weightedSum(multiset.getDense());
+}
+
+long long weightedDifference(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+long double weightedProduct(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) return weightedProduct(multiset.getBitset());
+    return multiset.isSparse() ? weightedProduct(multiset.getSparse()) : weightedProduct(multiset.getDense());
+}
+
+double weightedDivision(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2) {
+    long long denom = weightedSum(m2);
+    if (denom == 0) {
+        cout << "Division by zero error!\n";
+        return 0.0;
+    }
+    long long numer = weightedSum(m1);
+    return static_cast<double>(numer) / static_cast<double>(denom);
+}
@@ -0,0 +1,90 @@
+#ifndef ADAPTIVE_MULTISET_H
+#define ADAPTIVE_MULTISET_H
+
+#include "bitset_multiset.h"
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+
+// Storage policy: AUTO picks sparse below the fill threshold and dense above
+// it, and a bitset when every cap is 1 (presence only) unless sparse is
+// smaller still; DENSE and SPARSE force one representation for every result.
+enum StorageMode {
+    STORAGE_AUTO = 0,
+    STORAGE_DENSE = 1,
+    STORAGE_SPARSE = 2
+};
+
+StorageMode getStorageMode();
+void setStorageMode(StorageMode mode);
+double getSparseFillThreshold();
+void setSparseFillThreshold(double ratio); // fraction of non-zero elements
+const char* storageModeName(StorageMode mode);
+
+// Multiset that holds a dense, sparse or bitset representation, chosen by
+// the storage policy whenever it is built or produced by an operation.
+class AdaptiveMultiset {
+private:
+    enum Form { FORM_DENSE, FORM_SPARSE, FORM_BITSET };
+    Form form;
+    DenseMultiset dense;
+    SparseMultiset sparseForm;
+    BitsetMultiset bits;
+    CapArray bitsCaps; // the unit caps of the bitset form, kept for the other forms
+
+    bool presenceOnly() const; // every cap 1 and every multiplicity 0 or 1
+    void convertTo(Form target);
+
+public:
+    AdaptiveMultiset();
+    explicit AdaptiveMultiset(const DenseMultiset& multiset);
+    explicit AdaptiveMultiset(const SparseMultiset& multiset);
+    explicit AdaptiveMultiset(DenseMultiset&& multiset);  // takes over the arrays of an operation result
+    explicit AdaptiveMultiset(SparseMultiset&& multiset);
+    AdaptiveMultiset(BitsetMultiset&& multiset, const CapArray& unitCaps); // every cap must be 1
+
+    bool isSparse() const { return form == FORM_SPARSE; }
+    bool isBitset() const { return form == FORM_BITSET; }
+    const DenseMultiset& getDense() const { return dense; }        // valid when neither sparse nor bitset
+    const SparseMultiset& getSparse() const { return sparseForm; } // valid when isSparse()
+    const BitsetMultiset& getBitset() const { return bits; }       // valid when isBitset()
+    const CapArray& sharedCaps() const;
+    DenseMultiset toDense() const;
+    SparseMultiset toSparse() const;
+    // The dense form: the stored array when the multiset is dense, otherwise
+    // a conversion kept in scratch
+    const DenseMultiset& denseForm(DenseMultiset& scratch) const;
+
+    int getBitWidth() const;
+    size_t size() const;
+    size_t support() const;
+    double fillRatio() const;
+
+    int count(size_t rank) const;
+    void set(size_t rank, int multiplicity);
+    void adoptUniverse(int bitWidth, const CapArray& caps); // keeps the multiplicities
+
+    void applyStoragePolicy(); // convert if the policy asks for the other form
+};
+
+// Set operations: two bitsets combine word by word, two sparse operands are
+// merged, anything else runs the dense kernels; the result then follows the
+// storage policy
+AdaptiveMultiset unionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+AdaptiveMultiset intersectionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+AdaptiveMultiset differenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+AdaptiveMultiset symmetricDifferenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+AdaptiveMultiset complementMultiset(const AdaptiveMultiset& multiset);
+
+// Arithmetic operations
+int sumMultisets(const AdaptiveMultiset& multiset);
+int arithmeticDifferenceMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+int productMultisets(const AdaptiveMultiset& multiset);
+int divisionMultisets(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+
+// Gray-weighted arithmetic
+long long weightedSum(const AdaptiveMultiset& multiset);
+long long weightedDifference(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+long double weightedProduct(const AdaptiveMultiset& multiset);
+double weightedDivision(const AdaptiveMultiset& m1, const AdaptiveMultiset& m2);
+
+#endif // ADAPTIVE_MULTISET_H
@@ -0,0 +1,455 @@
+#include "batch_session.h"
+#include "gray_code.h"
+#include "multiset_export.h"
+#include "multiset_file.h"
+#include "multiset_ingest.h"
+#include "op_stats.h"
+#include "product_engine.h"
+#include "random_multiset.h"
+#include "multiset_collection.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+static long long parseInteger(const string& text, const char* what) {
+    size_t used = 0;
+    long long value = 0;
+    try {
+        value = stoll(text, &used);
+    } catch (const exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != text.size()) {
+        throw invalid_argument(string("invalid ") + what + " '" + text + "'");
+    }
+    return value;
+}
+
+static void requireArgs(const vector<string>& args, size_t minCount, size_t maxCount, const string& usage) {
+    if (args.size() < minCount || args.size() > maxCount) {
+        throw invalid_argument("usage: " + usage);
+    }
+}
+
+BatchSession::BatchSession() : bitWidth(0), stdoutAllowed(true) {}
+
+void BatchSession::requireUniverse() const {
+    if (!caps) {
+        throw invalid_argument("no universe defined");
+    }
+}
+
+size_t BatchSession::parseElement(const string& code) const {
+    uint32_t gray;
+    if (static_cast<int>(code.size()) != bitWidth || !parseGrayCode(code, gray)) {
+        throw invalid_argument("'" + code + "' is not an element of the universe");
+    }
+    return grayDecode(gray);
+}
+
+const AdaptiveMultiset& BatchSession::lookup(const string& name) const {
+    map<string, AdaptiveMultiset>::const_iterator it = multisets.find(name);
+    if (it == multisets.end()) {
+        throw invalid_argument("unknown multiset '" + name + "'");
+    }
+    return it->second;
+}
+
+void BatchSession::putMultiset(const string& name, const AdaptiveMultiset& multiset) {
+    multisets[name] = multiset;
+}
+
+bool BatchSession::execute(const string& line, ostream& out) {
+    istringstream tokens(line);
+    string command;
+    if (!(tokens >> command) || command[0] == '#') {
+        return true; // blank line or comment, no result line
+    }
+    vector<string> args;
+    string arg;
+    while (tokens >> arg) args.push_back(arg);
+
+    if (command == "quit") {
+        out << "ok\n";
+        return false;
+    }
+    // Buffer the result so a failing command never leaves a partial "ok" line
+    ostringstream result;
+    try {
+#if MULTISET_STATS
+        if (opStatsEnabled()) {
+            // Successful commands are recorded under their own name
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            dispatch(command, args, result);
+            chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - start;
+            recordOpStat(registerOpStat("batch " + command),
+                         static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()), 0, 0);
+        } else {
+            dispatch(command, args, result);
+        }
+#else
+        dispatch(command, args, result);
+#endif
+        out << result.str();
+    } catch (const exception& e) {
+        out << "error " << e.what() << "\n";
+    }
+    return true;
+}
+
+int BatchSession::run(istream& in, ostream& out) {
+    int failures = 0;
+    string line;
+    ostringstream result;
+    while (getline(in, line)) {
+        result.str("");
+        bool more = execute(line, result);
+        const string& text = result.str();
+        if (text.compare(0, 6, "error ") == 0) failures++;
+        out << text;
+        if (!more) break;
+    }
+    out.flush();
+    return failures;
+}
+
+// Commands that only read the session; their result depends on the line alone
+static bool isQuery(const string& command) {
+    static const char* const queries[] = {"sum", "wsum", "product", "wproduct", "adiff", "wdiff",
+                                          "div", "wdiv", "print", "list"};
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        if (command == queries[i]) return true;
+    }
+    return false;
+}
+
+size_t BatchSession::executeBatch(const vector<string>& lines, vector<string>& results) {
+    results.assign(lines.size(), string());
+    map<string, size_t> answered; // normalized query -> index of its first result
+    size_t evaluated = 0;
+    ostringstream result;
+    for (size_t i = 0; i < lines.size(); i++) {
+        istringstream tokens(lines[i]);
+        string key, token;
+        while (tokens >> token) key += key.empty() ? token : " " + token;
+        if (key.empty() || key[0] == '#') continue;
+
+        string command = key.substr(0, key.find(' '));
+        if (isQuery(command)) {
+            map<string, size_t>::const_iterator it = answered.find(key);
+            if (it != answered.end()) {
+                results[i] = results[it->second];
+                continue;
+            }
+            answered[key] = i;
+        } else {
+            answered.clear(); // anything else may change what a query returns
+        }
+        result.str("");
+        execute(key, result);
+        results[i] = result.str();
+        evaluated++;
+    }
+    return evaluated;
+}
+
+void BatchSession::dispatch(const string& command, const vector<string>& args, ostream& out) {
+    if (command == "universe") {
+        requireArgs(args, 2, 3, "universe <bits> <maxCap> [seed]");
+        long long bits = parseInteger(args[0], "bit width");
+        long long maxCap = parseInteger(args[1], "cardinality");
+        if (bits < 1 || bits > MAX_GRAY_BITS) {
+            throw invalid_argument("bit width must be between 1 and " + to_string(MAX_GRAY_BITS));
+        }
+        if (maxCap < 1) {
+            throw invalid_argument("maximum cardinality must be positive");
+        }
+        mt19937 g(args.size() == 3 ? static_cast<unsigned>(parseInteger(args[2], "seed")) : random_device()());
+        uniform_int_distribution<int> cardinalityDist(1, static_cast<int>(maxCap));
+        vector<int> newCaps = makeUniverseCaps(static_cast<int>(bits));
+        for (size_t i = 0; i < newCaps.size(); i++) {
+            newCaps[i] = cardinalityDist(g);
+        }
+        bitWidth = static_cast<int>(bits);
+        caps = makeCapArray(newCaps);
+        multisets.clear();
+        out << "ok " << newCaps.size() << "\n";
+    } else if (command == "cap") {
+        requireArgs(args, 2, 2, "cap <code> <value>");
+        requireUniverse();
+        size_t rank = parseElement(args[0]);
+        long long value = parseInteger(args[1], "cardinality");
+        if (value < 0) throw invalid_argument("cardinality must be non-negative");
+        vector<int> newCaps(*caps);
+        newCaps[rank] = static_cast<int>(value);
+        caps = makeCapArray(newCaps);
+        // Resident multisets move to the new caps, clamped to them, so binary
+        // operations never see operands with different caps
+        for (map<string, AdaptiveMultiset>::iterator it = multisets.begin(); it != multisets.end(); ++it) {
+            AdaptiveMultiset& multiset = it->second;
+            if (multiset.size() != caps->size()) continue;
+            multiset.adoptUniverse(bitWidth, caps);
+            if (multiset.count(rank) > value) multiset.set(rank, static_cast<int>(value));
+            multiset.applyStoragePolicy(); // caps of all 1 may now allow a bitset, or no longer
+
+        }
+        out << "ok\n";
+    } else if (command == "set") {
+        requireArgs(args, 1, static_cast<size_t>(-1), "set <name> [<code>:<mult> ...]");
+        requireUniverse();
+        vector<pair<size_t, int> > ranked;
+        for (size_t i = 1; i < args.size(); i++) {
+            size_t colon = args[i].find(':');
+            if (colon == string::npos) throw invalid_argument("expected <code>:<mult>, got '" + args[i] + "'");
+            size_t rank = parseElement(args[i].substr(0, colon));
+            long long multiplicity = parseInteger(args[i].substr(colon + 1), "multiplicity");
+            if (multiplicity < 0 || multiplicity > (*caps)[rank]) {
+                throw invalid_argument("multiplicity of " + args[i].substr(0, colon) + " must be between 0 and " +
+                                       to_string((*caps)[rank]));
+            }
+            ranked.push_back(make_pair(rank, static_cast<int>(multiplicity)));
+        }
+        stable_sort(ranked.begin(), ranked.end(),
+                    [](const pair<size_t, int>& x, const pair<size_t, int>& y) { return x.first < y.first; });
+        SparseMultiset multiset(bitWidth, caps);
+        for (size_t i = 0; i < ranked.size(); i++) {
+            if (i + 1 < ranked.size() && ranked[i + 1].first == ranked[i].first) continue; // last one wins
+            multiset.append(ranked[i].first, ranked[i].second);
+        }
+        multisets[args[0]] = AdaptiveMultiset(multiset);
+        out << "ok " << multiset.support() << "\n";
+    } else if (command == "random") {
+        requireArgs(args, 2, 4, "random <name> <cardinality> [seed] [uniform|multinomial]");
+        requireUniverse();
+        long long cardinality = parseInteger(args[1], "cardinality");
+        RandomDistribution distribution = RANDOM_UNIFORM;
+        if (args.size() == 4) {
+            if (args[3] == "multinomial") distribution = RANDOM_MULTINOMIAL;
+            else if (args[3] != "uniform") throw invalid_argument("distribution must be uniform or multinomial");
+        }
+        uint64_t seed;
+        if (args.size() >= 3) {
+            seed = static_cast<uint64_t>(parseInteger(args[2], "seed"));
+        } else {
+            random_device rd;
+            seed = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+        }
+        DenseMultiset multiset(bitWidth, caps);
+        uint64_t available = totalCapacity(multiset);
+        if (cardinality < 0 || static_cast<uint64_t>(cardinality) > available) {
+            throw invalid_argument("cardinality must be between 0 and " + to_string(available));
+        }
+        fillRandomMultiset(multiset, static_cast<uint64_t>(cardinality), seed, distribution);
+        multisets[args[0]] = AdaptiveMultiset(multiset);
+        out << "ok " << cardinality << "\n";
+    } else if (command == "union" || command == "intersection" || command == "difference" || command == "symdiff") {
+        requireArgs(args, 3, 3, command + " <dst> <a> <b>");
+        const AdaptiveMultiset& a = lookup(args[1]);
+        const AdaptiveMultiset& b = lookup(args[2]);
+        AdaptiveMultiset result;
+        if (command == "union") result = unionMultisets(a, b);
+        else if (command == "intersection") result = intersectionMultisets(a, b);
+        else if (command == "difference") result = differenceMultisets(a, b);
+        else result = symmetricDifferenceMultisets(a, b);
+        multisets[args[0]] = result;
+        out << "ok " << result.support() << "\n";
+    } else if (command == "complement") {
+        requireArgs(args, 2, 2, "complement <dst> <a>");
+        AdaptiveMultiset result = complementMultiset(lookup(args[1]));
+        multisets[args[0]] = result;
+        out << "ok " << result.support() << "\n";
+    } else if (command == "unionall" || command == "intersectall" || command == "addall" || command == "atleast") {
+        // N-ary forms: one merge or dense pass over all the operands
+        bool threshold = command == "atleast";
+        requireArgs(args, threshold ? 3 : 2, static_cast<size_t>(-1),
+                    threshold ? "atleast <dst> <t> <a> [<b> ...]" : command + " <dst> <a> [<b> ...]");
+        size_t first = threshold ? 2 : 1;
+        vector<const AdaptiveMultiset*> inputs;
+        for (size_t i = first; i < args.size(); i++) inputs.push_back(&lookup(args[i]));
+        AdaptiveMultiset result;
+        if (command == "unionall") result = unionAll(inputs);
+        else if (command == "intersectall") result = intersectionAll(inputs);
+        else if (command == "addall") result = additiveUnionAll(inputs);
+        else {
+            long long t = parseInteger(args[1], "threshold");
+            if (t < 1) throw invalid_argument("threshold must be positive");
+            result = atLeastAll(inputs, static_cast<size_t>(t));
+        }
+        multisets[args[0]] = result;
+        out << "ok " << result.support() << "\n";
+    } else if (command == "sum") {
+        requireArgs(args, 1, 1, "sum <a>");
+        out << "ok " << sumMultisets(lookup(args[0])) << "\n";
+    } else if (command == "product" || command == "wproduct") {
+        string usage = command + " <a> [" + (command == "wproduct" ? "float|" : "") + "checked|exact|log|mod [modulus]]";
+        requireArgs(args, 1, 3, usage);
+        const AdaptiveMultiset& a = lookup(args[0]);
+        string mode = args.size() >= 2 ? args[1] : (command == "product" ? "checked" : "float");
+        uint64_t modulus = PRODUCT_DEFAULT_MODULUS;
+        if (args.size() == 3) {
+            if (mode != "mod") throw invalid_argument("usage: " + usage);
+            long long value = parseInteger(args[2], "modulus");
+            if (value <= 0) throw invalid_argument("modulus must be positive");
+            modulus = static_cast<uint64_t>(value);
+        }
+        if (command == "wproduct" && mode == "float") {
+            out << "ok " << setprecision(17) << static_cast<double>(weightedProduct(a)) << "\n";
+        } else {
+            ProductMode productMode;
+            if (mode == "checked") productMode = PRODUCT_CHECKED;
+            else if (mode == "exact") productMode = PRODUCT_EXACT;
+            else if (mode == "log") productMode = PRODUCT_LOG;
+            else if (mode == "mod") productMode = PRODUCT_MODULAR;
+            else throw invalid_argument("usage: " + usage);
+            ProductEngine engine = command == "product" ? productFactors(a) : weightedProductFactors(a);
+            out << "ok " << engine.format(productMode, modulus) << "\n";
+        }
+    } else if (command == "wsum") {
+        requireArgs(args, 1, 1, "wsum <a>");
+        out << "ok " << weightedSum(lookup(args[0])) << "\n";
+    } else if (command == "adiff") {
+        requireArgs(args, 2, 2, "adiff <a> <b>");
+        out << "ok " << arithmeticDifferenceMultisets(lookup(args[0]), lookup(args[1])) << "\n";
+    } else if (command == "wdiff") {
+        requireArgs(args, 2, 2, "wdiff <a> <b>");
+        out << "ok " << weightedDifference(lookup(args[0]), lookup(args[1])) << "\n";
+    } else if (command == "div") {
+        requireArgs(args, 2, 2, "div <a> <b>");
+        const AdaptiveMultiset& b = lookup(args[1]);
+        if (sumMultisets(b) == 0) throw invalid_argument("division by zero");
+        out << "ok " << divisionMultisets(lookup(args[0]), b) << "\n";
+    } else if (command == "wdiv") {
+        requireArgs(args, 2, 2, "wdiv <a> <b>");
+        const AdaptiveMultiset& b = lookup(args[1]);
+        if (weightedSum(b) == 0) throw invalid_argument("division by zero");
+        out << "ok " << setprecision(17) << weightedDivision(lookup(args[0]), b) << "\n";
+    } else if (command == "print") {
+        requireArgs(args, 1, 1, "print <name>");
+        const AdaptiveMultiset& multiset = lookup(args[0]);
+        out << "ok " << multiset.support();
+        if (multiset.isSparse()) {
+            const vector<SparseEntry>& entries = multiset.getSparse().getEntries();
+            for (size_t i = 0; i < entries.size(); i++) {
+                out << ' ' << grayCodeToString(grayEncode(entries[i].rank), bitWidth) << ':' << entries[i].multiplicity;
+            }
+        } else {
+            DenseMultiset scratch;
+            const DenseMultiset& dense = multiset.denseForm(scratch);
+            for (size_t i = 0; i < dense.size(); i++) {
+                if (dense.count(i) == 0) continue;
+                out << ' ' << grayCodeToString(grayEncode(static_cast<uint32_t>(i)), bitWidth) << ':' << dense.count(i);
+            }
+        }
+        out << "\n";
+    } else if (command == "save") {
+        requireArgs(args, 2, 3, "save <name> <path> [rle]");
+        if (args.size() == 3 && args[2] != "rle") throw invalid_argument("unknown save format '" + args[2] + "'");
+        const AdaptiveMultiset& multiset = lookup(args[0]);
+        if (args.size() == 3) {
+            DenseMultiset scratch;
+            saveMultiset(args[1], multiset.isSparse() ? toRunLength(multiset.getSparse())
+                                                      : toRunLength(multiset.denseForm(scratch)));
+        } else {
+            saveMultiset(args[1], multiset);
+        }
+        out << "ok\n";
+    } else if (command == "export") {
+        requireArgs(args, 2, 3, "export <name> <path|-> [csv|jsonl|binary]");
+        ExportOptions options;
+        if (args.size() == 3 && !parseExportFormat(args[2], options.format)) {
+            throw invalid_argument("unknown export format '" + args[2] + "'");
+        }
+        if (args[1] == "-" && !stdoutAllowed) {
+            throw invalid_argument("export to stdout is not available in this session; give a path");
+        }
+        ExportStats stats = exportMultisetFile(args[1], lookup(args[0]), options);
+        out << "ok " << stats.records << " " << stats.bytes << "\n";
+    } else if (command == "load") {
+        requireArgs(args, 2, 2, "load <name> <path>");
+        AdaptiveMultiset multiset = loadMultiset(args[1]);
+        if (!caps) {
+            // No universe yet: adopt the one stored in the file
+            bitWidth = multiset.getBitWidth();
+            caps = multiset.sharedCaps();
+        } else if (multiset.getBitWidth() != bitWidth) {
+            throw invalid_argument("file universe has " + to_string(multiset.getBitWidth()) + " bits, session has " +
+                                   to_string(bitWidth));
+        } else {
+            // Operations take the caps of their first operand, so a multiset
+            // with its own caps would give order-dependent results
+            if (*multiset.sharedCaps() != *caps) throw invalid_argument("file caps differ from the session's universe");
+        }
+        multisets[args[0]] = multiset;
+        out << "ok " << multiset.support() << "\n";
+    } else if (command == "ingest") {
+        requireArgs(args, 2, 4, "ingest <name> <path> [gray|int] [threads]");
+        requireUniverse();
+        IngestOptions options;
+        if (args.size() >= 3) {
+            if (args[2] == "gray") options.format = KEYS_GRAY_CODE;
+            else if (args[2] == "int") options.format = KEYS_INTEGER;
+            else throw invalid_argument("key format must be gray or int");
+        }
+        if (args.size() == 4) {
+            long long threads = parseInteger(args[3], "threads");
+            if (threads < 1 || threads > 1024) throw invalid_argument("threads must be between 1 and 1024");
+            options.threads = static_cast<unsigned>(threads);
+        }
+        IngestStats stats;
+        AdaptiveMultiset multiset(ingestMultisetFile(args[1], bitWidth, caps, options, &stats));
+        multisets[args[0]] = multiset;
+        out << "ok " << stats.tokens << ' ' << stats.ignored << "\n";
+    } else if (command == "threads") {
+        requireArgs(args, 1, 2, "threads <n> [threshold]");
+        long long threads = parseInteger(args[0], "threads");
+        if (threads < 0 || threads > 1024) throw invalid_argument("threads must be between 0 and 1024");
+        if (args.size() == 2) {
+            long long threshold = parseInteger(args[1], "threshold");
+            if (threshold < 0) throw invalid_argument("threshold must be non-negative");
+            setParallelThreshold(static_cast<size_t>(threshold));
+        }
+        setThreadCount(static_cast<unsigned>(threads));
+        out << "ok " << getThreadCount() << "\n";
+    } else if (command == "stats") {
+        requireArgs(args, 1, 2, "stats on|off|reset|dump <path>");
+        if (args[0] == "on" || args[0] == "off" || args[0] == "reset") {
+            requireArgs(args, 1, 1, "stats " + args[0]);
+            if (args[0] == "reset") resetOpStats();
+            else setOpStatsEnabled(args[0] == "on");
+        } else if (args[0] == "dump") {
+            requireArgs(args, 2, 2, "stats dump <path>");
+            ofstream file(args[1].c_str());
+            if (!file) throw runtime_error("cannot write " + args[1]);
+            writeOpStatsJson(file);
+        } else {
+            throw invalid_argument("usage: stats on|off|reset|dump <path>");
+        }
+        out << "ok\n";
+    } else if (command == "drop") {
+        requireArgs(args, 1, 1, "drop <name>");
+        lookup(args[0]);
+        multisets.erase(args[0]);
+        out << "ok\n";
+    } else if (command == "list") {
+        requireArgs(args, 0, 0, "list");
+        out << "ok " << multisets.size();
+        for (map<string, AdaptiveMultiset>::const_iterator it = multisets.begin(); it != multisets.end(); ++it) {
+            out << ' ' << it->first;
+        }
+        out << "\n";
+    } else if (command == "storage") {
+        requireArgs(args, 1, 1, "storage auto|dense|sparse");
+        if (args[0] == "auto") setStorageMode(STORAGE_AUTO);
+        else if (args[0] == "dense") setStorageMode(STORAGE_DENSE);
+        else if (args[0] == "sparse") setStorageMode(STORAGE_SPARSE);
+        else throw invalid_argument("unknown storage mode '" + args[0] + "'");
+        out << "ok\n";
+    } else {
+        throw invalid_argument("unknown command '" + command + "'");
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef BATCH_SESSION_H
+#define BATCH_SESSION_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "adaptive_multiset.h"
+
+using namespace std;
+
+// Non-interactive command interpreter. One command per line, one result
+// line per command: "ok [values...]" or "error <message>". The universe and
+// all named multisets stay resident between commands.
+//
+//   universe <bits> <maxCap> [seed]   new universe, caps drawn from 1..maxCap
+//   cap <code> <value>                change one element's cap; resident multisets are clamped to it
+//   set <name> [<code>:<mult> ...]    define a multiset
+//   random <name> <cardinality> [seed] [uniform|multinomial]   exact cardinality within the caps
+//   union|intersection|difference|symdiff <dst> <a> <b>
+//   complement <dst> <a>
+//   unionall|intersectall|addall <dst> <a> [<b> ...]   N-ary max / min / clamped sum
+//   atleast <dst> <t> <a> [<b> ...]   elements present in at least t operands
+//   sum|wsum <a>
+//   product <a> [checked|exact|log|mod [modulus]]         checked by default, see product_engine.h
+//   wproduct <a> [float|checked|exact|log|mod [modulus]]  long double by default
+//   adiff|div|wdiff|wdiv <a> <b>
+//   save <name> <path> [rle] | load <name> <path>   binary format, see multiset_file.h
+//   export <name> <path|-> [csv|jsonl|binary]  non-zero elements, see multiset_export.h
+//   ingest <name> <path> [gray|int] [threads]  count keys in a text file
+//   threads <n> [threshold]           worker threads (0 = all cores), parallel cutoff
+//   stats on|off|reset|dump <path>    per-command instrumentation, JSON dump
+//   print <name> | drop <name> | list | storage auto|dense|sparse | quit
+// Blank lines and lines starting with '#' are ignored.
+class BatchSession {
+private:
+    int bitWidth;
+    CapArray caps;
+    map<string, AdaptiveMultiset> multisets;
+    bool stdoutAllowed; // "export <name> -" writes to this process's stdout
+
+    void requireUniverse() const;
+    size_t parseElement(const string& code) const;
+    const AdaptiveMultiset& lookup(const string& name) const;
+    void dispatch(const string& command, const vector<string>& args, ostream& out);
+
+public:
+    BatchSession();
+
+    // Runs one command line; returns false once "quit" has been executed
+    bool execute(const string& line, ostream& out);
+    // Runs commands until end of input or "quit"; returns the number of failed commands
+    int run(istream& in, ostream& out);
+    // Runs queued lines in order, one result string per line ("" for blank
+    // lines and comments). A read-only query (sum, product, print, ...) that
+    // repeats within the batch with no other command in between is evaluated
+    // once and its result reused. "quit" is the caller's to handle. Returns
+    // the number of commands actually evaluated.
+    size_t executeBatch(const vector<string>& lines, vector<string>& results);
+
+    int getBitWidth() const { return bitWidth; }
+    const CapArray& getCaps() const { return caps; }
+    bool hasMultiset(const string& name) const { return multisets.count(name) != 0; }
+    const AdaptiveMultiset& getMultiset(const string& name) const { return lookup(name); }
+    void putMultiset(const string& name, const AdaptiveMultiset& multiset);
+    // A session driven over a socket turns this off: its stdout is not the client's
+    void allowStdout(bool allowed) { stdoutAllowed = allowed; }
+};
+
+#endif // BATCH_SESSION_H
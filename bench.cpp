@@ -0,0 +1,321 @@
+#include "funcs.h"
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "gray_code.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <sys/resource.h>
+
+// Benchmark for every public operation of MultisetProgram (map form) and of
+// the dense and sparse engines, swept over bit widths and fill densities.
+//
+//   bench_multiset [--min-bits N] [--max-bits N] [--densities d1,d2,...]
+//                  [--map-max-bits N] [--engines map,dense,sparse,gray]
+//                  [--min-time seconds] [--json path]
+//
+// Times are per universe element, so engines compare directly.
+
+struct BenchOptions {
+    int minBits;
+    int maxBits;
+    int mapMaxBits; // the map form needs ~100 bytes per element, keep it small
+    vector<double> densities;
+    set<string> engines;
+    double minTime;
+    string jsonPath;
+
+    BenchOptions() : minBits(1), maxBits(24), mapMaxBits(16), minTime(0.01), jsonPath("bench_multiset.json") {
+        densities.push_back(0.01);
+        densities.push_back(0.1);
+        densities.push_back(0.5);
+        densities.push_back(1.0);
+        engines.insert("gray");
+        engines.insert("map");
+        engines.insert("dense");
+        engines.insert("sparse");
+    }
+};
+
+struct BenchResult {
+    string engine;
+    string operation;
+    int bits;
+    double density;
+    size_t elements;
+    double seconds;   // per call
+    long peakRssKb;   // peak of the whole process so far, not of this row
+    long rssGrowthKb; // how much this row raised that peak
+};
+
+static volatile long long benchSink = 0; // keeps results observable
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+// Repeats op until minTime has passed; returns seconds per call. One
+// untimed call first takes the page and cache faults of a cold start.
+template <typename Op>
+static double timeOperation(Op op, double minTime) {
+    typedef chrono::steady_clock Clock;
+    op();
+    long long calls = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+        op();
+        calls++;
+        elapsed = chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minTime);
+    return elapsed / static_cast<double>(calls);
+}
+
+// Products throw overflow_error once they leave the int range; the check
+// is part of the timed work
+template <typename Product>
+static int checkedProductOrZero(Product product) {
+    try {
+        return product();
+    } catch (const overflow_error&) {
+        return 0;
+    }
+}
+
+// Deterministic test data: caps 1..10, a density fraction of elements
+// non-zero; the last element is always present so no divisor is zero
+static DenseMultiset makeOperand(int bits, const CapArray& caps, double density, unsigned seed) {
+    DenseMultiset result(bits, caps);
+    unsigned state = seed;
+    unsigned threshold = static_cast<unsigned>(density * 4294967295.0);
+    for (size_t i = 0; i < result.size(); i++) {
+        state = state * 1664525u + 1013904223u;
+        if (state <= threshold) {
+            result.set(i, 1 + static_cast<int>((state >> 8) % static_cast<unsigned>(caps->at(i))));
+        }
+    }
+    result.set(result.size() - 1, 1);
+    return result;
+}
+
+class BenchRunner {
+private:
+    const BenchOptions& options;
+    vector<BenchResult> results;
+    string engine;
+    int bits;
+    double density;
+
+public:
+    explicit BenchRunner(const BenchOptions& options) : options(options), bits(0), density(0.0) {}
+
+    void select(const string& engineName, int bitWidth, double fill) {
+        engine = engineName;
+        bits = bitWidth;
+        density = fill;
+    }
+
+    template <typename Op>
+    void measure(const string& operation, Op op) {
+        BenchResult result;
+        result.engine = engine;
+        result.operation = operation;
+        result.bits = bits;
+        result.density = density;
+        result.elements = size_t(1) << bits;
+        long peakBefore = peakRssKb();
+        result.seconds = timeOperation(op, options.minTime);
+        result.peakRssKb = peakRssKb();
+        result.rssGrowthKb = result.peakRssKb - peakBefore;
+        results.push_back(result);
+        printRow(result);
+    }
+
+    static void printHeader() {
+        cout << left << setw(7) << "engine" << setw(14) << "operation" << right << setw(5) << "bits"
+             << setw(9) << "density" << setw(12) << "ns/elem" << setw(13) << "Melem/s" << setw(11) << "+peak MB"
+             << setw(14) << "proc peak MB" << "\n";
+        cout << string(85, '-') << "\n";
+    }
+
+    static void printRow(const BenchResult& r) {
+        double nsPerElement = r.seconds * 1e9 / static_cast<double>(r.elements);
+        double throughput = static_cast<double>(r.elements) / r.seconds / 1e6;
+        cout << left << setw(7) << r.engine << setw(14) << r.operation << right << setw(5) << r.bits
+             << setw(9) << fixed << setprecision(2) << r.density << setw(12) << setprecision(3) << nsPerElement
+             << setw(13) << setprecision(1) << throughput << setw(11) << setprecision(1) << r.rssGrowthKb / 1024.0
+             << setw(14) << r.peakRssKb / 1024.0 << "\n";
+        cout.unsetf(ios::floatfield);
+    }
+
+    void writeJson(ostream& out) const {
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& r = results[i];
+            out << "  {\"engine\": \"" << r.engine << "\", \"operation\": \"" << r.operation << "\", \"bits\": "
+                << r.bits << ", \"density\": " << r.density << ", \"elements\": " << r.elements
+                << ", \"ns_per_element\": " << setprecision(6) << r.seconds * 1e9 / static_cast<double>(r.elements)
+                << ", \"elements_per_second\": " << static_cast<double>(r.elements) / r.seconds
+                << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"rss_growth_kb\": " << r.rssGrowthKb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "]\n";
+    }
+};
+
+static void benchGray(BenchRunner& runner, int bits) {
+    MultisetProgram program;
+    runner.select("gray", bits, 1.0);
+    runner.measure("generate", [&]() { benchSink += static_cast<long long>(program.generateGrayCode(bits).size()); });
+    vector<uint32_t> codes(size_t(1) << bits);
+    runner.measure("fill_codes", [&]() { fillGrayCodes(bits, codes.data()); benchSink += codes.back(); });
+    vector<string> strings = program.generateGrayCode(bits);
+    runner.measure("grayToInt", [&]() {
+        long long total = 0;
+        for (size_t i = 0; i < strings.size(); i++) total += MultisetProgram::grayToInt(strings[i]);
+        benchSink += total;
+    });
+}
+
+static void benchMap(BenchRunner& runner, int bits, double density, const vector<int>& capValues,
+                     const DenseMultiset& a, const DenseMultiset& b) {
+    MultisetProgram program;
+    program.initializeUniverse(bits, capValues);
+    map<string, int> m1 = program.fromDense(a);
+    map<string, int> m2 = program.fromDense(b);
+    runner.select("map", bits, density);
+    runner.measure("union", [&]() { benchSink += program.unionMultisets(m1, m2).size(); });
+    runner.measure("intersection", [&]() { benchSink += program.intersectionMultisets(m1, m2).size(); });
+    runner.measure("difference", [&]() { benchSink += program.differenceMultisets(m1, m2).size(); });
+    runner.measure("symdiff", [&]() { benchSink += program.symmetricDifferenceMultisets(m1, m2).size(); });
+    runner.measure("complement", [&]() { benchSink += program.complementMultiset(m1).size(); });
+    runner.measure("sum", [&]() { benchSink += program.sumMultisets(m1); });
+    runner.measure("adiff", [&]() { benchSink += program.arithmeticDifferenceMultisets(m1, m2); });
+    runner.measure("product", [&]() { benchSink += checkedProductOrZero([&]() { return program.productMultisets(m1); }); });
+    runner.measure("division", [&]() { benchSink += program.divisionMultisets(m1, m2); });
+    runner.measure("wsum", [&]() { benchSink += program.weightedSum(m1); });
+    runner.measure("wdiff", [&]() { benchSink += program.weightedDifference(m1, m2); });
+    runner.measure("wproduct", [&]() { benchSink += static_cast<long long>(program.weightedProduct(m1) != 0); });
+    runner.measure("wdivision", [&]() { benchSink += static_cast<long long>(program.weightedDivision(m1, m2)); });
+}
+
+// Same operation list for the rank-indexed engines
+template <typename Multiset>
+static void benchEngine(BenchRunner& runner, const string& engine, int bits, double density,
+                        const Multiset& m1, const Multiset& m2) {
+    runner.select(engine, bits, density);
+    runner.measure("union", [&]() { benchSink += unionMultisets(m1, m2).size(); });
+    runner.measure("intersection", [&]() { benchSink += intersectionMultisets(m1, m2).size(); });
+    runner.measure("difference", [&]() { benchSink += differenceMultisets(m1, m2).size(); });
+    runner.measure("symdiff", [&]() { benchSink += symmetricDifferenceMultisets(m1, m2).size(); });
+    runner.measure("complement", [&]() { benchSink += complementMultiset(m1).size(); });
+    runner.measure("sum", [&]() { benchSink += sumMultisets(m1); });
+    runner.measure("adiff", [&]() { benchSink += arithmeticDifferenceMultisets(m1, m2); });
+    runner.measure("product", [&]() { benchSink += checkedProductOrZero([&]() { return productMultisets(m1); }); });
+    runner.measure("division", [&]() { benchSink += divisionMultisets(m1, m2); });
+    runner.measure("wsum", [&]() { benchSink += weightedSum(m1); });
+    runner.measure("wdiff", [&]() { benchSink += weightedDifference(m1, m2); });
+    runner.measure("wproduct", [&]() { benchSink += static_cast<long long>(weightedProduct(m1) != 0); });
+    runner.measure("wdivision", [&]() { benchSink += static_cast<long long>(weightedDivision(m1, m2)); });
+}
+
+static vector<string> splitList(const string& text) {
+    vector<string> items;
+    stringstream stream(text);
+    string item;
+    while (getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static bool parseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << flag << "\n";
+            return false;
+        }
+        string value = argv[++i];
+        if (flag == "--min-bits") options.minBits = atoi(value.c_str());
+        else if (flag == "--max-bits") options.maxBits = atoi(value.c_str());
+        else if (flag == "--map-max-bits") options.mapMaxBits = atoi(value.c_str());
+        else if (flag == "--min-time") options.minTime = atof(value.c_str());
+        else if (flag == "--json") options.jsonPath = value;
+        else if (flag == "--densities") {
+            options.densities.clear();
+            vector<string> items = splitList(value);
+            for (size_t k = 0; k < items.size(); k++) options.densities.push_back(atof(items[k].c_str()));
+        } else if (flag == "--engines") {
+            vector<string> items = splitList(value);
+            options.engines = set<string>(items.begin(), items.end());
+        } else {
+            cerr << "Unknown option " << flag << "\n";
+            return false;
+        }
+    }
+    if (options.minBits < 1 || options.maxBits > MAX_GRAY_BITS || options.minBits > options.maxBits) {
+        cerr << "Bit widths must satisfy 1 <= min <= max <= " << MAX_GRAY_BITS << "\n";
+        return false;
+    }
+    for (size_t k = 0; k < options.densities.size(); k++) {
+        if (options.densities[k] <= 0.0 || options.densities[k] > 1.0) {
+            cerr << "Densities must be in (0, 1]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        return 2;
+    }
+
+    BenchRunner runner(options);
+    BenchRunner::printHeader();
+    for (int bits = options.minBits; bits <= options.maxBits; bits++) {
+        if (options.engines.count("gray")) {
+            benchGray(runner, bits);
+        }
+        vector<int> capValues(size_t(1) << bits);
+        unsigned state = 7u + static_cast<unsigned>(bits);
+        for (size_t i = 0; i < capValues.size(); i++) {
+            state = state * 1664525u + 1013904223u;
+            capValues[i] = 1 + static_cast<int>((state >> 16) % 10);
+        }
+        CapArray caps = makeCapArray(capValues);
+
+        for (size_t d = 0; d < options.densities.size(); d++) {
+            double density = options.densities[d];
+            DenseMultiset a = makeOperand(bits, caps, density, 1u);
+            DenseMultiset b = makeOperand(bits, caps, density, 2u);
+            if (options.engines.count("map") && bits <= options.mapMaxBits) {
+                benchMap(runner, bits, density, capValues, a, b);
+            }
+            if (options.engines.count("dense")) {
+                benchEngine(runner, "dense", bits, density, a, b);
+            }
+            if (options.engines.count("sparse")) {
+                SparseMultiset s1 = toSparse(a);
+                SparseMultiset s2 = toSparse(b);
+                benchEngine(runner, "sparse", bits, density, s1, s2);
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        ofstream json(options.jsonPath.c_str());
+        if (!json) {
+            cerr << "Cannot write " << options.jsonPath << "\n";
+            return 1;
+        }
+        runner.writeJson(json);
+        cout << "\nResults written to " << options.jsonPath << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,284 @@
+#include "bitset_multiset.h"
+#include "multiset_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static int popcount64(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<int>((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+static int lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static size_t wordsFor(size_t ranks) {
+    return (ranks + 63) / 64;
+}
+
+BitsetMultiset::BitsetMultiset() : bitWidth(0), universe(1), words(1, 0) {}
+
+BitsetMultiset::BitsetMultiset(int bitWidth)
+    : bitWidth(bitWidth), universe(size_t(1) << bitWidth), words(wordsFor(size_t(1) << bitWidth), 0) {}
+
+void BitsetMultiset::set(size_t rank, bool present) {
+    uint64_t bit = uint64_t(1) << (rank & 63);
+    if (present) {
+        words[rank >> 6] |= bit;
+    } else {
+        words[rank >> 6] &= ~bit;
+    }
+}
+
+void BitsetMultiset::clear() {
+    fill(words.begin(), words.end(), 0);
+}
+
+bool BitsetMultiset::sameUniverse(const BitsetMultiset& other) const {
+    return bitWidth == other.bitWidth && universe == other.universe;
+}
+
+bool hasUnitCaps(const vector<int>& caps) {
+    for (size_t i = 0; i < caps.size(); i++) {
+        if (caps[i] != 1) return false;
+    }
+    return true;
+}
+
+// Universe checks and the mask of the valid bits in the last word
+static void requireSameUniverse(int width1, size_t size1, int width2, size_t size2) {
+    if (width1 != width2 || size1 != size2) {
+        throw invalid_argument("BitsetMultiset: operands belong to different universes");
+    }
+}
+
+static uint64_t lastWordMask(size_t universe) {
+    size_t used = universe & 63;
+    return used == 0 ? ~uint64_t(0) : (uint64_t(1) << used) - 1;
+}
+
+BitsetMultiset toBitset(const DenseMultiset& multiset) {
+    BitsetMultiset result(multiset.getBitWidth());
+    const int* counts = multiset.data();
+    uint64_t* out = result.data();
+    size_t universe = multiset.size();
+    parallelFor(result.wordCount(), [&](size_t, size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) {
+            uint64_t word = 0;
+            size_t last = min(universe, (w + 1) * 64);
+            for (size_t i = w * 64; i < last; i++) {
+                word |= uint64_t(counts[i] > 0) << (i & 63);
+            }
+            out[w] = word;
+        }
+    });
+    return result;
+}
+
+DenseMultiset toDense(const BitsetMultiset& multiset) {
+    DenseMultiset result(multiset.getBitWidth(), makeCapArray(vector<int>(multiset.size(), 1)));
+    int* counts = result.data();
+    for (size_t i = 0; i < multiset.size(); i++) counts[i] = multiset.count(i);
+    return result;
+}
+
+// Bitset with bitset: one word operation per 64 elements
+template <typename WordOp>
+static BitsetMultiset wordwise(const BitsetMultiset& m1, const BitsetMultiset& m2, WordOp op) {
+    requireSameUniverse(m1.getBitWidth(), m1.size(), m2.getBitWidth(), m2.size());
+    BitsetMultiset result(m1.getBitWidth());
+    const uint64_t* a = m1.data();
+    const uint64_t* b = m2.data();
+    uint64_t* out = result.data();
+    parallelFor(result.wordCount(), [&](size_t, size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) out[w] = op(a[w], b[w]);
+    });
+    return result;
+}
+
+BitsetMultiset unionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    return wordwise(m1, m2, [](uint64_t a, uint64_t b) { return a | b; });
+}
+
+BitsetMultiset intersectionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    return wordwise(m1, m2, [](uint64_t a, uint64_t b) { return a & b; });
+}
+
+BitsetMultiset differenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    return wordwise(m1, m2, [](uint64_t a, uint64_t b) { return a & ~b; });
+}
+
+BitsetMultiset symmetricDifferenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    return wordwise(m1, m2, [](uint64_t a, uint64_t b) { return a ^ b; });
+}
+
+BitsetMultiset complementMultiset(const BitsetMultiset& multiset) {
+    BitsetMultiset result(multiset.getBitWidth());
+    const uint64_t* a = multiset.data();
+    uint64_t* out = result.data();
+    parallelFor(result.wordCount(), [&](size_t, size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) out[w] = ~a[w];
+    });
+    out[result.wordCount() - 1] &= lastWordMask(result.size());
+    return result;
+}
+
+// Mixed forms go through the scalar element definitions, so they agree with
+// the dense kernels by construction. Bitset first: result bits from the
+// element value with cap 1.
+template <typename ElementOp>
+static BitsetMultiset mixedBitset(const BitsetMultiset& m1, const DenseMultiset& m2, ElementOp op) {
+    requireSameUniverse(m1.getBitWidth(), m1.size(), m2.getBitWidth(), m2.size());
+    BitsetMultiset result(m1.getBitWidth());
+    const uint64_t* a = m1.data();
+    const int* b = m2.data();
+    const int* capB = m2.capData();
+    uint64_t* out = result.data();
+    size_t universe = m1.size();
+    parallelFor(result.wordCount(), [&](size_t, size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) {
+            uint64_t word = 0;
+            size_t last = min(universe, (w + 1) * 64);
+            for (size_t i = w * 64; i < last; i++) {
+                int value = op(static_cast<int>((a[w] >> (i & 63)) & 1), b[i], capB[i]);
+                word |= uint64_t(value > 0) << (i & 63);
+            }
+            out[w] = word;
+        }
+    });
+    return result;
+}
+
+// Counted first: a dense result with the first operand's caps
+template <typename ElementOp>
+static DenseMultiset mixedDense(const DenseMultiset& m1, const BitsetMultiset& m2, ElementOp op) {
+    requireSameUniverse(m1.getBitWidth(), m1.size(), m2.getBitWidth(), m2.size());
+    DenseMultiset result(m1.getBitWidth(), m1.sharedCaps());
+    const int* a = m1.data();
+    const int* capA = m1.capData();
+    int* out = result.data();
+    parallelFor(m1.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) out[i] = op(a[i], m2.count(i), capA[i]);
+    });
+    return result;
+}
+
+BitsetMultiset unionMultisets(const BitsetMultiset& m1, const DenseMultiset& m2) {
+    return mixedBitset(m1, m2, [](int a, int b, int) { return unionElement(a, b, 1); });
+}
+
+BitsetMultiset intersectionMultisets(const BitsetMultiset& m1, const DenseMultiset& m2) {
+    return mixedBitset(m1, m2, [](int a, int b, int) { return intersectionElement(a, b, 1); });
+}
+
+BitsetMultiset differenceMultisets(const BitsetMultiset& m1, const DenseMultiset& m2) {
+    return mixedBitset(m1, m2, [](int a, int b, int) { return differenceElement(a, b, 1); });
+}
+
+BitsetMultiset symmetricDifferenceMultisets(const BitsetMultiset& m1, const DenseMultiset& m2) {
+    return mixedBitset(m1, m2, [](int a, int b, int capB) { return symmetricDifferenceElement(a, b, 1, capB); });
+}
+
+DenseMultiset unionMultisets(const DenseMultiset& m1, const BitsetMultiset& m2) {
+    return mixedDense(m1, m2, [](int a, int b, int capA) { return unionElement(a, b, capA); });
+}
+
+DenseMultiset intersectionMultisets(const DenseMultiset& m1, const BitsetMultiset& m2) {
+    return mixedDense(m1, m2, [](int a, int b, int capA) { return intersectionElement(a, b, capA); });
+}
+
+DenseMultiset differenceMultisets(const DenseMultiset& m1, const BitsetMultiset& m2) {
+    return mixedDense(m1, m2, [](int a, int b, int capA) { return differenceElement(a, b, capA); });
+}
+
+DenseMultiset symmetricDifferenceMultisets(const DenseMultiset& m1, const BitsetMultiset& m2) {
+    return mixedDense(m1, m2, [](int a, int b, int capA) { return symmetricDifferenceElement(a, b, capA, 1); });
+}
+
+// Arithmetic operations
+int sumMultisets(const BitsetMultiset& multiset) {
+    const uint64_t* words = multiset.data();
+    unsigned sum = parallelReduce(multiset.wordCount(), 0u, [words](size_t begin, size_t end) {
+        unsigned partial = 0;
+        for (size_t w = begin; w < end; w++) partial += static_cast<unsigned>(popcount64(words[w]));
+        return partial;
+    }, [](unsigned a, unsigned b) { return a + b; });
+    return static_cast<int>(sum);
+}
+
+int arithmeticDifferenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return max(0, diff); // Ensure non-negative result
+}
+
+int productMultisets(const BitsetMultiset&) {
+    return 1; // every present element has multiplicity 1
+}
+
+int divisionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    int sum2 = sumMultisets(m2);
+    if (sum2 == 0) {
+        cout << "Division by zero error!\n";
+        return 0;
+    }
+    return sumMultisets(m1) / sum2; // Integer division
+}
+
+// Gray-weighted arithmetic: the value of a set bit is its rank
+long long weightedSum(const BitsetMultiset& multiset) {
+    const uint64_t* words = multiset.data();
+    unsigned long long total = parallelReduce(multiset.wordCount(), 0ull, [words](size_t begin, size_t end) {
+        unsigned long long partial = 0;
+        for (size_t w = begin; w < end; w++) {
+            for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+                partial += w * 64 + static_cast<unsigned>(lowestBit(word));
+            }
+        }
+        return partial;
+    }, [](unsigned long long a, unsigned long long b) { return a + b; });
+    return static_cast<long long>(total);
+}
+
+long long weightedDifference(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+long double weightedProduct(const BitsetMultiset& multiset) {
+    if (multiset.test(0)) {
+        return 0.0L; // any zero value to positive power makes whole product zero
+    }
+    long double product = 1.0L;
+    for (size_t w = 0; w < multiset.wordCount(); w++) {
+        for (uint64_t word = multiset.data()[w]; word != 0; word &= word - 1) {
+            product *= static_cast<long double>(w * 64 + static_cast<unsigned>(lowestBit(word)));
+        }
+    }
+    return product;
+}
+
+double weightedDivision(const BitsetMultiset& m1, const BitsetMultiset& m2) {
+    long long denom = weightedSum(m2);
+    if (denom == 0) {
+        cout << "Division by zero error!\n";
+        return 0.0;
+    }
+    long long numer = weightedSum(m1);
+    return static_cast<double>(numer) / static_cast<double>(denom);
+}
@@ -0,0 +1,83 @@
+#ifndef BITSET_MULTISET_H
+#define BITSET_MULTISET_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+
+using namespace std;
+
+// Multiset over a Gray-code universe in which every cap is 1, so each
+// element is either present or not: one bit per Gray rank, packed into
+// 64-bit words (1/32 of a DenseMultiset). Set operations are word-wide
+// OR / AND / ANDNOT / XOR and the sums are popcounts.
+class BitsetMultiset {
+private:
+    int bitWidth;
+    size_t universe;        // number of ranks
+    vector<uint64_t> words; // bit (rank % 64) of word (rank / 64); bits past the universe stay 0
+
+public:
+    BitsetMultiset();
+    explicit BitsetMultiset(int bitWidth);
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return universe; }
+    size_t wordCount() const { return words.size(); }
+
+    bool test(size_t rank) const { return (words[rank >> 6] >> (rank & 63)) & 1; }
+    int count(size_t rank) const { return test(rank) ? 1 : 0; }
+    int cap(size_t) const { return 1; }
+    void set(size_t rank, bool present = true);
+    void reset(size_t rank) { set(rank, false); }
+    void clear();
+
+    uint64_t* data() { return words.data(); }
+    const uint64_t* data() const { return words.data(); }
+    const vector<uint64_t>& getWords() const { return words; }
+
+    bool sameUniverse(const BitsetMultiset& other) const;
+};
+
+// True when every cap is 1, i.e. a dense multiset of this universe loses
+// nothing as a bitset
+bool hasUnitCaps(const vector<int>& caps);
+
+// Conversion: an element is present when its multiplicity is positive; the
+// dense form gets caps of 1
+BitsetMultiset toBitset(const DenseMultiset& multiset);
+DenseMultiset toDense(const BitsetMultiset& multiset);
+
+// Set operations (same results as the dense operations with all caps 1)
+BitsetMultiset unionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+BitsetMultiset intersectionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+BitsetMultiset differenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+BitsetMultiset symmetricDifferenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+BitsetMultiset complementMultiset(const BitsetMultiset& multiset);
+
+// Mixed operations with a counted multiset: the bitset counts as
+// multiplicities 0/1 with caps 1, and as everywhere the result takes the
+// first operand's caps. A bitset first operand therefore gives a bitset.
+BitsetMultiset unionMultisets(const BitsetMultiset& m1, const DenseMultiset& m2);
+BitsetMultiset intersectionMultisets(const BitsetMultiset& m1, const DenseMultiset& m2);
+BitsetMultiset differenceMultisets(const BitsetMultiset& m1, const DenseMultiset& m2);
+BitsetMultiset symmetricDifferenceMultisets(const BitsetMultiset& m1, const DenseMultiset& m2);
+DenseMultiset unionMultisets(const DenseMultiset& m1, const BitsetMultiset& m2);
+DenseMultiset intersectionMultisets(const DenseMultiset& m1, const BitsetMultiset& m2);
+DenseMultiset differenceMultisets(const DenseMultiset& m1, const BitsetMultiset& m2);
+DenseMultiset symmetricDifferenceMultisets(const DenseMultiset& m1, const BitsetMultiset& m2);
+
+// Arithmetic operations
+int sumMultisets(const BitsetMultiset& multiset); // popcount
+int arithmeticDifferenceMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+int productMultisets(const BitsetMultiset& multiset);
+int divisionMultisets(const BitsetMultiset& m1, const BitsetMultiset& m2);
+
+// Gray-weighted arithmetic over the set bits
+long long weightedSum(const BitsetMultiset& multiset);
+long long weightedDifference(const BitsetMultiset& m1, const BitsetMultiset& m2);
+long double weightedProduct(const BitsetMultiset& multiset);
+double weightedDivision(const BitsetMultiset& m1, const BitsetMultiset& m2);
+
+#endif // BITSET_MULTISET_H
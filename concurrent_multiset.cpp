@@ -0,0 +1,233 @@
+#include "concurrent_multiset.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+static atomic<unsigned> nextThreadTicket(0);
+
+static uint64_t packCell(uint32_t copies, uint32_t credit) {
+    return (static_cast<uint64_t>(credit) << 32) | copies;
+}
+
+static uint32_t cellCopies(uint64_t word) { return static_cast<uint32_t>(word); }
+static uint32_t cellCredit(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+
+// Registers an update (or a read of the hot-key table) on the caller's
+// shard. If a pause is under way it backs out and waits, so pause() sees
+// every slot drop to zero and no update starts until resume(). Only the
+// increment and the check after it must be sequentially consistent (they
+// pair with the store and loads in pause()); the rest is acquire/release.
+class ConcurrentMultiset::UpdateScope {
+private:
+    const ConcurrentMultiset& owner;
+    size_t shard;
+
+public:
+    explicit UpdateScope(const ConcurrentMultiset& multiset) : owner(multiset), shard(multiset.shardOf()) {
+        atomic<unsigned>& active = owner.writers[shard].active;
+        for (;;) {
+            while (owner.paused.load(memory_order_acquire)) this_thread::yield();
+            active.fetch_add(1);
+            if (!owner.paused.load()) break;
+            active.fetch_sub(1, memory_order_release);
+        }
+    }
+    ~UpdateScope() { owner.writers[shard].active.fetch_sub(1, memory_order_release); }
+    size_t getShard() const { return shard; }
+};
+
+ConcurrentMultiset::ConcurrentMultiset(int bitWidth, const CapArray& caps, unsigned shards)
+    : bitWidth(bitWidth), caps(caps), counts(caps->size()),
+      writers(shards == 0 ? getThreadCount() : shards), paused(false) {
+    if (caps->size() != (size_t(1) << bitWidth)) {
+        throw invalid_argument("ConcurrentMultiset: caps do not match the bit width");
+    }
+}
+
+ConcurrentMultiset::ConcurrentMultiset(const DenseMultiset& initial, unsigned shards)
+    : bitWidth(initial.getBitWidth()), caps(initial.sharedCaps()), counts(initial.size()),
+      writers(shards == 0 ? getThreadCount() : shards), paused(false) {
+    for (size_t i = 0; i < initial.size(); i++) {
+        if (initial.count(i) < 0 || initial.count(i) > initial.cap(i)) {
+            throw invalid_argument("ConcurrentMultiset: multiplicities must be between 0 and the cap");
+        }
+        counts[i].store(initial.count(i), memory_order_relaxed);
+    }
+}
+
+size_t ConcurrentMultiset::shardOf() const {
+    static thread_local unsigned ticket = nextThreadTicket.fetch_add(1);
+    return ticket % writers.size();
+}
+
+void ConcurrentMultiset::pause() const {
+    pauseLock.lock();
+    paused.store(true);
+    for (size_t i = 0; i < writers.size(); i++) {
+        while (writers[i].active.load() != 0) this_thread::yield();
+    }
+}
+
+void ConcurrentMultiset::resume() const {
+    paused.store(false, memory_order_release);
+    pauseLock.unlock();
+}
+
+ConcurrentMultiset::HotKey* ConcurrentMultiset::hotKey(size_t rank) const {
+    if (hotSlot.empty() || hotSlot[rank] < 0) return 0;
+    return hot[static_cast<size_t>(hotSlot[rank])].get();
+}
+
+int ConcurrentMultiset::insert(size_t rank, int copies) {
+    if (rank >= counts.size()) throw out_of_range("ConcurrentMultiset: rank outside the universe");
+    if (copies <= 0) return 0;
+    UpdateScope scope(*this);
+    HotKey* key = hotKey(rank);
+    int limit = (*caps)[rank];
+    if (key) return insertHot(*key, scope.getShard(), copies, limit);
+
+    int current = counts[rank].load(memory_order_relaxed);
+    int next;
+    do {
+        if (current >= limit) return 0;
+        next = copies > limit - current ? limit : current + copies;
+    } while (!counts[rank].compare_exchange_weak(current, next, memory_order_relaxed));
+    return next - current;
+}
+
+int ConcurrentMultiset::remove(size_t rank, int copies) {
+    if (rank >= counts.size()) throw out_of_range("ConcurrentMultiset: rank outside the universe");
+    if (copies <= 0) return 0;
+    UpdateScope scope(*this);
+    HotKey* key = hotKey(rank);
+    if (key) return removeHot(*key, scope.getShard(), copies);
+
+    int current = counts[rank].load(memory_order_relaxed);
+    int next;
+    do {
+        if (current <= 0) return 0;
+        next = copies > current ? 0 : current - copies;
+    } while (!counts[rank].compare_exchange_weak(current, next, memory_order_relaxed));
+    return current - next;
+}
+
+// Spends the shard's credit first, then takes a batch from the pool, and
+// only when the pool is empty pulls back credit parked on other shards
+int ConcurrentMultiset::insertHot(HotKey& key, size_t shard, int copies, int cap) {
+    int moved = 0;
+    atomic<uint64_t>& own = key.cells[shard].word;
+    while (moved < copies) {
+        uint64_t word = own.load(memory_order_relaxed);
+        uint32_t credit = cellCredit(word);
+        if (credit > 0) {
+            uint32_t take = min(credit, static_cast<uint32_t>(copies - moved));
+            if (own.compare_exchange_weak(word, packCell(cellCopies(word) + take, credit - take), memory_order_relaxed)) {
+                moved += static_cast<int>(take);
+            }
+            continue;
+        }
+
+        int want = max(copies - moved, HOT_CREDIT_BATCH);
+        int available = key.pool.load(memory_order_relaxed);
+        while (available > 0 &&
+               !key.pool.compare_exchange_weak(available, available - min(available, want), memory_order_relaxed)) {
+        }
+        if (available > 0) {
+            own.fetch_add(packCell(0, static_cast<uint32_t>(min(available, want))), memory_order_relaxed);
+            continue;
+        }
+
+        int reclaimed = 0;
+        for (size_t i = 0; i < key.cells.size(); i++) {
+            atomic<uint64_t>& cell = key.cells[i].word;
+            uint64_t other = cell.load(memory_order_relaxed);
+            while (cellCredit(other) > 0 &&
+                   !cell.compare_exchange_weak(other, packCell(cellCopies(other), 0), memory_order_relaxed)) {
+            }
+            reclaimed += static_cast<int>(cellCredit(other));
+        }
+        if (reclaimed > 0) {
+            key.pool.fetch_add(reclaimed, memory_order_relaxed);
+        } else if (hotCount(key) >= cap) {
+            break;
+        } else {
+            this_thread::yield(); // credit is on its way from the pool to another shard
+        }
+    }
+    return moved;
+}
+
+// Takes copies from the own shard first; a removed copy becomes credit
+int ConcurrentMultiset::removeHot(HotKey& key, size_t shard, int copies) {
+    int moved = 0;
+    for (size_t step = 0; step < key.cells.size() && moved < copies; step++) {
+        atomic<uint64_t>& cell = key.cells[(shard + step) % key.cells.size()].word;
+        uint64_t word = cell.load(memory_order_relaxed);
+        for (;;) {
+            uint32_t held = cellCopies(word);
+            if (held == 0) break;
+            uint32_t take = min(held, static_cast<uint32_t>(copies - moved));
+            if (cell.compare_exchange_weak(word, packCell(held - take, cellCredit(word) + take), memory_order_relaxed)) {
+                moved += static_cast<int>(take);
+                break;
+            }
+        }
+    }
+    return moved;
+}
+
+int ConcurrentMultiset::hotCount(const HotKey& key) {
+    int total = 0;
+    for (size_t i = 0; i < key.cells.size(); i++) {
+        total += static_cast<int>(cellCopies(key.cells[i].word.load(memory_order_relaxed)));
+    }
+    return total;
+}
+
+int ConcurrentMultiset::count(size_t rank) const {
+    if (rank >= counts.size()) throw out_of_range("ConcurrentMultiset: rank outside the universe");
+    UpdateScope scope(*this);
+    const HotKey* key = hotKey(rank);
+    return key ? hotCount(*key) : counts[rank].load(memory_order_relaxed);
+}
+
+bool ConcurrentMultiset::isHot(size_t rank) const {
+    if (rank >= counts.size()) throw out_of_range("ConcurrentMultiset: rank outside the universe");
+    UpdateScope scope(*this);
+    return hotKey(rank) != 0;
+}
+
+void ConcurrentMultiset::makeHot(size_t rank) {
+    if (rank >= counts.size()) throw out_of_range("ConcurrentMultiset: rank outside the universe");
+    pause();
+    try {
+        if (!hotKey(rank)) {
+            unique_ptr<HotKey> key(new HotKey(writers.size()));
+            int current = counts[rank].load(memory_order_relaxed);
+            key->cells[0].word.store(packCell(static_cast<uint32_t>(current), 0), memory_order_relaxed);
+            key->pool.store((*caps)[rank] - current, memory_order_relaxed);
+            if (hotSlot.empty()) hotSlot.assign(counts.size(), -1);
+            hot.push_back(unique_ptr<HotKey>());
+            hot.back().swap(key);
+            hotSlot[rank] = static_cast<int>(hot.size() - 1);
+            counts[rank].store(0, memory_order_relaxed);
+        }
+    } catch (...) {
+        resume();
+        throw;
+    }
+    resume();
+}
+
+DenseMultiset ConcurrentMultiset::snapshot() const {
+    DenseMultiset result(bitWidth, caps);
+    int* out = result.data();
+    pause();
+    for (size_t i = 0; i < counts.size(); i++) out[i] = counts[i].load(memory_order_relaxed);
+    for (size_t i = 0; i < hotSlot.size(); i++) {
+        if (hotSlot[i] >= 0) out[i] = hotCount(*hot[static_cast<size_t>(hotSlot[i])]);
+    }
+    resume();
+    return result;
+}
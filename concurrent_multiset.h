@@ -0,0 +1,96 @@
+#ifndef CONCURRENT_MULTISET_H
+#define CONCURRENT_MULTISET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "dense_multiset.h"
+
+using namespace std;
+
+// Credits a hot-key shard takes from the shared pool at a time
+const int HOT_CREDIT_BATCH = 16;
+
+// Dense multiset that any number of threads may update at once. Every rank
+// is an atomic counter; insert and remove are compare-and-swap loops that
+// stop at the cap and at 0, so the caps hold at every instant. Updates do
+// not lock or wait for each other; they wait only while snapshot() or
+// makeHot() runs.
+//
+// A key that many threads hit can be made hot: its count is then spread
+// over one counter per shard (threads are assigned shards round-robin).
+// Room below the cap is handed out to the shards as credits, a batch at a
+// time, so an insert usually touches only its own shard's cache line.
+//
+// snapshot() returns a point-in-time DenseMultiset for the ordinary set
+// operations. It blocks: updates are held back while it copies the
+// counters (writers wait, they are not lost) and continue afterwards. This
+// is deliberate. A lock-free point-in-time copy would need a version per
+// slot and a reader that retries under steady writes; here an update pays
+// one increment and one decrement on its own shard's slot, and snapshots
+// are expected to be rare next to updates.
+class ConcurrentMultiset {
+private:
+    // Padded to a cache line so shards do not share one
+    struct WriterSlot {
+        atomic<unsigned> active; // updates in flight on this shard
+        char padding[64 - sizeof(atomic<unsigned>)];
+    };
+    struct ShardCell {
+        atomic<uint64_t> word; // low half: copies held, high half: unused credit
+        char padding[64 - sizeof(atomic<uint64_t>)];
+    };
+    struct HotKey {
+        atomic<int> pool; // cap minus copies minus credit held by the shards
+        vector<ShardCell> cells;
+        explicit HotKey(size_t shards) : pool(0), cells(shards) {}
+    };
+    class UpdateScope;
+
+    int bitWidth;
+    CapArray caps;
+    vector<atomic<int>> counts;
+    vector<int> hotSlot; // index into hot by rank, -1 for ordinary keys; empty until a key is hot
+    vector<unique_ptr<HotKey> > hot;
+    mutable vector<WriterSlot> writers;
+    mutable atomic<bool> paused;
+    mutable mutex pauseLock; // one snapshot or makeHot at a time
+
+    size_t shardOf() const;
+    void pause() const;  // waits until no update is in flight
+    void resume() const;
+    HotKey* hotKey(size_t rank) const;
+    int insertHot(HotKey& key, size_t shard, int copies, int cap);
+    int removeHot(HotKey& key, size_t shard, int copies);
+    static int hotCount(const HotKey& key);
+
+    ConcurrentMultiset(const ConcurrentMultiset&);
+    ConcurrentMultiset& operator=(const ConcurrentMultiset&);
+
+public:
+    // shards = 0 uses getThreadCount()
+    ConcurrentMultiset(int bitWidth, const CapArray& caps, unsigned shards = 0);
+    explicit ConcurrentMultiset(const DenseMultiset& initial, unsigned shards = 0); // throws if over a cap
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return counts.size(); }
+    int cap(size_t rank) const { return (*caps)[rank]; }
+    unsigned shardCount() const { return static_cast<unsigned>(writers.size()); }
+
+    // Both return how many copies they moved: insert stops at the cap and
+    // remove at 0. Safe to call from any thread.
+    int insert(size_t rank, int copies = 1);
+    int remove(size_t rank, int copies = 1);
+    int count(size_t rank) const; // current value, may be stale by the time it returns
+
+    // Spreads one key over the shards; waits for in-flight updates like snapshot
+    void makeHot(size_t rank);
+    bool isHot(size_t rank) const;
+
+    DenseMultiset snapshot() const;
+};
+
+#endif // CONCURRENT_MULTISET_H
@@ -0,0 +1,359 @@
+#include "dense_multiset.h"
+#include "multiset_kernels.h"
+#include "product_engine.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+CapArray makeCapArray(const vector<int>& caps) {
+    return make_shared<vector<int> >(caps);
+}
+
+vector<int> makeUniverseCaps(int bitWidth) {
+    size_t size = size_t(1) << bitWidth;
+    string tooLarge = "a universe of 2^" + to_string(bitWidth) + " elements does not fit in memory";
+    long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0 &&
+        size > static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize) / (2 * sizeof(int))) {
+        throw runtime_error(tooLarge);
+    }
+    try {
+        return vector<int>(size, 0);
+    } catch (const bad_alloc&) {
+        throw runtime_error(tooLarge);
+    } catch (const length_error&) {
+        throw runtime_error(tooLarge);
+    }
+}
+
+DenseMultiset::DenseMultiset() : bitWidth(0), counts(1, 0), caps(makeCapArray(vector<int>(1, 0))) {}
+
+DenseMultiset::DenseMultiset(int bitWidth)
+    : bitWidth(bitWidth), counts(size_t(1) << bitWidth, 0),
+      caps(makeCapArray(vector<int>(size_t(1) << bitWidth, 0))) {}
+
+DenseMultiset::DenseMultiset(int bitWidth, const vector<int>& caps)
+    : bitWidth(bitWidth), counts(size_t(1) << bitWidth, 0), caps(makeCapArray(caps)) {
+    if (caps.size() != counts.size()) {
+        throw invalid_argument("DenseMultiset: caps array does not match universe size");
+    }
+}
+
+DenseMultiset::DenseMultiset(int bitWidth, const CapArray& caps)
+    : bitWidth(bitWidth), counts(size_t(1) << bitWidth, 0), caps(caps) {
+    if (!caps || caps->size() != counts.size()) {
+        throw invalid_argument("DenseMultiset: caps array does not match universe size");
+    }
+}
+
+void DenseMultiset::setCap(size_t rank, int cardinality) {
+    if (caps.use_count() != 1) {
+        caps = makeCapArray(*caps);
+    }
+    // The array was created non-const by makeCapArray and is not shared here
+    const_cast<vector<int>&>(*caps)[rank] = cardinality;
+}
+
+void DenseMultiset::clear() {
+    fill(counts.begin(), counts.end(), 0);
+}
+
+void DenseMultiset::adoptUniverse(int width, const CapArray& newCaps) {
+    if (!newCaps || newCaps->size() != (size_t(1) << width)) {
+        throw invalid_argument("DenseMultiset: caps array does not match universe size");
+    }
+    bitWidth = width;
+    if (counts.size() != newCaps->size()) {
+        counts.assign(newCaps->size(), 0);
+    }
+    caps = newCaps;
+}
+
+DenseView DenseMultiset::view() const {
+    DenseView result = {bitWidth, counts.size(), counts.data(), caps->data()};
+    return result;
+}
+
+bool DenseMultiset::sameUniverse(const DenseMultiset& other) const {
+    return bitWidth == other.bitWidth && counts.size() == other.counts.size();
+}
+
+static void requireSameUniverse(const DenseView& m1, const DenseView& m2) {
+    if (m1.bitWidth != m2.bitWidth || m1.size != m2.size) {
+        throw invalid_argument("DenseMultiset: operands belong to different universes");
+    }
+}
+
+// Result array for an operation: shares the caps when the operand owns them
+static DenseMultiset resultFor(const DenseView& m, const CapArray& caps) {
+    if (caps) {
+        return DenseMultiset(m.bitWidth, caps);
+    }
+    return DenseMultiset(m.bitWidth, makeCapArray(vector<int>(m.caps, m.caps + m.size)));
+}
+
+// Set operations (vectorized kernels, see multiset_kernels.h). Large
+// universes are split into Gray-prefix blocks that run on the thread pool;
+// every element is computed independently, so the result is the same.
+typedef void (*BinaryKernel)(const int*, const int*, const int*, int*, size_t);
+
+// Element-wise, so out may alias either operand
+static void binaryKernelBlocks(const DenseView& m1, const DenseView& m2, int* out, BinaryKernel kernel) {
+    parallelFor(m1.size, [&](size_t, size_t begin, size_t end) {
+        kernel(m1.counts + begin, m2.counts + begin, m1.caps + begin, out + begin, end - begin);
+    });
+}
+
+static void symmetricDifferenceBlocks(const DenseView& m1, const DenseView& m2, int* out) {
+    parallelFor(m1.size, [&](size_t, size_t begin, size_t end) {
+        symmetricDifferenceKernel(m1.counts + begin, m2.counts + begin, m1.caps + begin, m2.caps + begin,
+                                  out + begin, end - begin);
+    });
+}
+
+static void complementBlocks(const DenseView& m, int* out) {
+    parallelFor(m.size, [&](size_t, size_t begin, size_t end) {
+        complementKernel(m.counts + begin, m.caps + begin, out + begin, end - begin);
+    });
+}
+
+static DenseMultiset binaryOf(const DenseView& m1, const DenseView& m2, const CapArray& caps, BinaryKernel kernel) {
+    requireSameUniverse(m1, m2);
+    DenseMultiset result = resultFor(m1, caps);
+    binaryKernelBlocks(m1, m2, result.data(), kernel);
+    return result;
+}
+
+static DenseMultiset unionOf(const DenseView& m1, const DenseView& m2, const CapArray& caps) {
+    return binaryOf(m1, m2, caps, unionKernel);
+}
+
+static DenseMultiset intersectionOf(const DenseView& m1, const DenseView& m2, const CapArray& caps) {
+    return binaryOf(m1, m2, caps, intersectionKernel);
+}
+
+static DenseMultiset differenceOf(const DenseView& m1, const DenseView& m2, const CapArray& caps) {
+    return binaryOf(m1, m2, caps, differenceKernel);
+}
+
+static DenseMultiset symmetricDifferenceOf(const DenseView& m1, const DenseView& m2, const CapArray& caps) {
+    // Fused (M1 - M2) U (M2 - M1), no intermediate arrays
+    requireSameUniverse(m1, m2);
+    DenseMultiset result = resultFor(m1, caps);
+    symmetricDifferenceBlocks(m1, m2, result.data());
+    return result;
+}
+
+static DenseMultiset complementOf(const DenseView& m, const CapArray& caps) {
+    DenseMultiset result = resultFor(m, caps);
+    complementBlocks(m, result.data());
+    return result;
+}
+
+DenseMultiset unionMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return unionOf(m1.view(), m2.view(), m1.sharedCaps());
+}
+
+DenseMultiset intersectionMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return intersectionOf(m1.view(), m2.view(), m1.sharedCaps());
+}
+
+DenseMultiset differenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return differenceOf(m1.view(), m2.view(), m1.sharedCaps());
+}
+
+DenseMultiset symmetricDifferenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return symmetricDifferenceOf(m1.view(), m2.view(), m1.sharedCaps());
+}
+
+DenseMultiset complementMultiset(const DenseMultiset& multiset) {
+    return complementOf(multiset.view(), multiset.sharedCaps());
+}
+
+DenseMultiset unionMultisets(const DenseView& m1, const DenseView& m2) {
+    return unionOf(m1, m2, CapArray());
+}
+
+DenseMultiset intersectionMultisets(const DenseView& m1, const DenseView& m2) {
+    return intersectionOf(m1, m2, CapArray());
+}
+
+DenseMultiset differenceMultisets(const DenseView& m1, const DenseView& m2) {
+    return differenceOf(m1, m2, CapArray());
+}
+
+DenseMultiset symmetricDifferenceMultisets(const DenseView& m1, const DenseView& m2) {
+    return symmetricDifferenceOf(m1, m2, CapArray());
+}
+
+DenseMultiset complementMultiset(const DenseView& multiset) {
+    return complementOf(multiset, CapArray());
+}
+
+// Output-parameter and in-place forms. The views are taken before dst is
+// resized, which only happens when dst is not an operand.
+static void binaryInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2, BinaryKernel kernel) {
+    DenseView v1 = m1.view(), v2 = m2.view();
+    requireSameUniverse(v1, v2);
+    dst.adoptUniverse(m1.getBitWidth(), m1.sharedCaps());
+    binaryKernelBlocks(v1, v2, dst.data(), kernel);
+}
+
+void unionInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2) {
+    binaryInto(dst, m1, m2, unionKernel);
+}
+
+void intersectionInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2) {
+    binaryInto(dst, m1, m2, intersectionKernel);
+}
+
+void differenceInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2) {
+    binaryInto(dst, m1, m2, differenceKernel);
+}
+
+void symmetricDifferenceInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2) {
+    DenseView v1 = m1.view(), v2 = m2.view();
+    requireSameUniverse(v1, v2);
+    CapArray capsB = m2.sharedCaps(); // v2.caps must outlive dst dropping them when dst is m2
+    dst.adoptUniverse(m1.getBitWidth(), m1.sharedCaps());
+    symmetricDifferenceBlocks(v1, v2, dst.data());
+}
+
+void complementInto(DenseMultiset& dst, const DenseMultiset& multiset) {
+    DenseView v = multiset.view();
+    dst.adoptUniverse(multiset.getBitWidth(), multiset.sharedCaps());
+    complementBlocks(v, dst.data());
+}
+
+DenseMultiset& operator|=(DenseMultiset& m1, const DenseMultiset& m2) {
+    unionInto(m1, m1, m2);
+    return m1;
+}
+
+DenseMultiset& operator&=(DenseMultiset& m1, const DenseMultiset& m2) {
+    intersectionInto(m1, m1, m2);
+    return m1;
+}
+
+DenseMultiset& operator-=(DenseMultiset& m1, const DenseMultiset& m2) {
+    differenceInto(m1, m1, m2);
+    return m1;
+}
+
+DenseMultiset& operator^=(DenseMultiset& m1, const DenseMultiset& m2) {
+    symmetricDifferenceInto(m1, m1, m2);
+    return m1;
+}
+
+// Arithmetic operations. Sums are accumulated in unsigned arithmetic, so
+// overflow wraps (instead of being undefined) and partial results from
+// parallel blocks combine to exactly the serial value. Products are
+// overflow-checked (product_engine.h).
+static unsigned plusWrapped(unsigned a, unsigned b) { return a + b; }
+static unsigned long long plusWrapped64(unsigned long long a, unsigned long long b) { return a + b; }
+
+int sumMultisets(const DenseView& multiset) {
+    const int* counts = multiset.counts;
+    unsigned sum = parallelReduce(multiset.size, 0u, [counts](size_t begin, size_t end) {
+        unsigned partial = 0;
+        for (size_t i = begin; i < end; i++) partial += static_cast<unsigned>(counts[i]);
+        return partial;
+    }, plusWrapped);
+    return static_cast<int>(sum);
+}
+
+int arithmeticDifferenceMultisets(const DenseView& m1, const DenseView& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return max(0, diff); // Ensure non-negative result
+}
+
+int productMultisets(const DenseView& multiset) {
+    // Only elements present in the multiset take part, as in the map version
+    return checkedIntProduct(productFactors(multiset));
+}
+
+int divisionMultisets(const DenseView& m1, const DenseView& m2) {
+    int sum2 = sumMultisets(m2);
+    if (sum2 == 0) {
+        cout << "Division by zero error!\n";
+        return 0;
+    }
+    return sumMultisets(m1) / sum2; // Integer division
+}
+
+int sumMultisets(const DenseMultiset& multiset) {
+    return sumMultisets(multiset.view());
+}
+
+int arithmeticDifferenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return arithmeticDifferenceMultisets(m1.view(), m2.view());
+}
+
+int productMultisets(const DenseMultiset& multiset) {
+    return productMultisets(multiset.view());
+}
+
+int divisionMultisets(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return divisionMultisets(m1.view(), m2.view());
+}
+
+// Gray-weighted arithmetic
+long long weightedSum(const DenseView& multiset) {
+    const int* counts = multiset.counts;
+    unsigned long long total = parallelReduce(multiset.size, 0ull, [counts](size_t begin, size_t end) {
+        unsigned long long partial = 0;
+        for (size_t i = begin; i < end; i++) {
+            partial += static_cast<unsigned long long>(static_cast<long long>(counts[i]) * static_cast<long long>(i));
+        }
+        return partial;
+    }, plusWrapped64);
+    return static_cast<long long>(total);
+}
+
+long long weightedDifference(const DenseView& m1, const DenseView& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+long double weightedProduct(const DenseView& multiset) {
+    long double product = 1.0L;
+    for (size_t i = 0; i < multiset.size; i++) {
+        int multiplicity = multiset.counts[i];
+        if (multiplicity <= 0) continue;
+        if (i == 0) {
+            return 0.0L; // any zero value to positive power makes whole product zero
+        }
+        product *= powerBySquaring(static_cast<long double>(i), static_cast<uint64_t>(multiplicity));
+    }
+    return product;
+}
+
+double weightedDivision(const DenseView& m1, const DenseView& m2) {
+    long long denom = weightedSum(m2);
+    if (denom == 0) {
+        cout << "Division by zero error!\n";
+        return 0.0;
+    }
+    long long numer = weightedSum(m1);
+    return static_cast<double>(numer) / static_cast<double>(denom);
+}
+
+long long weightedSum(const DenseMultiset& multiset) {
+    return weightedSum(multiset.view());
+}
+
+long long weightedDifference(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return weightedDifference(m1.view(), m2.view());
+}
+
+long double weightedProduct(const DenseMultiset& multiset) {
+    return weightedProduct(multiset.view());
+}
+
+double weightedDivision(const DenseMultiset& m1, const DenseMultiset& m2) {
+    return weightedDivision(m1.view(), m2.view());
+}
@@ -0,0 +1,115 @@
+#ifndef DENSE_MULTISET_H
+#define DENSE_MULTISET_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+using namespace std;
+
+// Cardinality caps of a universe, by Gray rank. Shared between the
+// multisets of one universe and copied only when a cap is changed.
+typedef shared_ptr<const vector<int> > CapArray;
+CapArray makeCapArray(const vector<int>& caps);
+
+// Zeroed caps for a universe of the given width. Throws runtime_error when
+// a universe that size cannot be held (its caps and one multiplicity array
+// would exceed physical memory, or the allocation fails).
+vector<int> makeUniverseCaps(int bitWidth);
+
+// Read-only view of dense multiplicity and cap arrays owned elsewhere
+// (a DenseMultiset or a memory-mapped file)
+struct DenseView {
+    int bitWidth;
+    size_t size;
+    const int* counts;
+    const int* caps;
+};
+
+// Multiset over a Gray-code universe stored as a contiguous array of
+// multiplicities indexed by Gray rank (the position of the code in
+// generateGrayCode order). Cardinality caps live in a parallel array.
+class DenseMultiset {
+private:
+    int bitWidth;
+    vector<int> counts; // multiplicity by Gray rank
+    CapArray caps;      // max cardinality by Gray rank
+
+public:
+    DenseMultiset();
+    explicit DenseMultiset(int bitWidth);
+    DenseMultiset(int bitWidth, const vector<int>& caps);
+    DenseMultiset(int bitWidth, const CapArray& caps);
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return counts.size(); }
+
+    int count(size_t rank) const { return counts[rank]; }
+    int cap(size_t rank) const { return (*caps)[rank]; }
+    void set(size_t rank, int multiplicity) { counts[rank] = multiplicity; }
+    void setCap(size_t rank, int cardinality); // copies the caps first if they are shared
+    void clear(); // zero all multiplicities, keep caps
+    void adoptUniverse(int bitWidth, const CapArray& caps); // keeps the buffer when the size matches
+
+    int* data() { return counts.data(); }
+    const int* data() const { return counts.data(); }
+    const int* capData() const { return caps->data(); }
+    const vector<int>& getCounts() const { return counts; }
+    const vector<int>& getCaps() const { return *caps; }
+    const CapArray& sharedCaps() const { return caps; }
+    DenseView view() const;
+
+    bool sameUniverse(const DenseMultiset& other) const;
+};
+
+// Set operations (same results as the map-based MultisetProgram versions;
+// the result takes its caps from the first operand)
+DenseMultiset unionMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset intersectionMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset differenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset symmetricDifferenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset complementMultiset(const DenseMultiset& multiset);
+
+// Same operations on views; the result gets its own copy of the caps
+DenseMultiset unionMultisets(const DenseView& m1, const DenseView& m2);
+DenseMultiset intersectionMultisets(const DenseView& m1, const DenseView& m2);
+DenseMultiset differenceMultisets(const DenseView& m1, const DenseView& m2);
+DenseMultiset symmetricDifferenceMultisets(const DenseView& m1, const DenseView& m2);
+DenseMultiset complementMultiset(const DenseView& multiset);
+
+// Output-parameter forms: dst takes the first operand's universe and caps and
+// reuses its own buffer, so repeated calls allocate nothing. dst may be an operand.
+void unionInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2);
+void intersectionInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2);
+void differenceInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2);
+void symmetricDifferenceInto(DenseMultiset& dst, const DenseMultiset& m1, const DenseMultiset& m2);
+void complementInto(DenseMultiset& dst, const DenseMultiset& multiset);
+
+// In-place forms: m1 |= m2 is unionInto(m1, m1, m2), and so on
+DenseMultiset& operator|=(DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset& operator&=(DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset& operator-=(DenseMultiset& m1, const DenseMultiset& m2);
+DenseMultiset& operator^=(DenseMultiset& m1, const DenseMultiset& m2);
+
+// Arithmetic operations; products throw overflow_error when they do not
+// fit in an int (see product_engine.h for exact, log and modular values)
+int sumMultisets(const DenseMultiset& multiset);
+int arithmeticDifferenceMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+int productMultisets(const DenseMultiset& multiset);
+int divisionMultisets(const DenseMultiset& m1, const DenseMultiset& m2);
+int sumMultisets(const DenseView& multiset);
+int arithmeticDifferenceMultisets(const DenseView& m1, const DenseView& m2);
+int productMultisets(const DenseView& multiset);
+int divisionMultisets(const DenseView& m1, const DenseView& m2);
+
+// Gray-weighted arithmetic (the integer value of an element is its Gray rank)
+long long weightedSum(const DenseMultiset& multiset);
+long long weightedDifference(const DenseMultiset& m1, const DenseMultiset& m2);
+long double weightedProduct(const DenseMultiset& multiset);
+double weightedDivision(const DenseMultiset& m1, const DenseMultiset& m2);
+long long weightedSum(const DenseView& multiset);
+long long weightedDifference(const DenseView& m1, const DenseView& m2);
+long double weightedProduct(const DenseView& multiset);
+double weightedDivision(const DenseView& m1, const DenseView& m2);
+
+#endif // DENSE_MULTISET_H
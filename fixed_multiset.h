@@ -0,0 +1,250 @@
+#ifndef FIXED_MULTISET_H
+#define FIXED_MULTISET_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "dense_multiset.h"
+#include "gray_code.h"
+#include "multiset_kernels.h"
+#include "product_engine.h"
+
+using namespace std;
+
+// Widest universe with a compile-time specialization (256 elements)
+const int FIXED_MAX_BITS = 8;
+
+template <int Bits>
+constexpr array<uint32_t, size_t(1) << Bits> makeFixedGrayCodes() {
+    array<uint32_t, size_t(1) << Bits> codes{};
+    for (size_t rank = 0; rank < codes.size(); rank++) codes[rank] = grayEncode(static_cast<uint32_t>(rank));
+    return codes;
+}
+
+template <int Bits>
+constexpr array<uint32_t, size_t(1) << Bits> makeFixedGrayRanks() {
+    array<uint32_t, size_t(1) << Bits> ranks{};
+    for (size_t rank = 0; rank < ranks.size(); rank++) ranks[grayEncode(static_cast<uint32_t>(rank))] = static_cast<uint32_t>(rank);
+    return ranks;
+}
+
+// Gray codes by rank and ranks by code (the grayToInt values), computed
+// by the compiler
+template <int Bits>
+struct FixedGrayTable {
+    static constexpr array<uint32_t, size_t(1) << Bits> codes = makeFixedGrayCodes<Bits>();
+    static constexpr array<uint32_t, size_t(1) << Bits> ranks = makeFixedGrayRanks<Bits>();
+};
+
+// Calls body(i) for i = 0 .. N-1 as one unrolled sequence of statements
+template <typename Body, size_t... I>
+inline void unrolledFor(const Body& body, index_sequence<I...>) {
+    (body(I), ...);
+}
+
+template <size_t N, typename Body>
+inline void unrolledFor(const Body& body) {
+    unrolledFor(body, make_index_sequence<N>());
+}
+
+// Multiset over a Gray-code universe of a width fixed at compile time,
+// stored in std::arrays indexed by Gray rank like DenseMultiset. Loops over
+// the universe are unrolled and use the element definitions of
+// multiset_kernels.h, which compile to min/max/select without branches, so
+// results match the dense operations exactly. Convert with toFixed / toDense.
+template <int Bits>
+class FixedMultiset {
+    static_assert(Bits >= 1 && Bits <= FIXED_MAX_BITS, "FixedMultiset: width outside 1..FIXED_MAX_BITS");
+
+public:
+    static constexpr size_t Size = size_t(1) << Bits;
+    typedef FixedGrayTable<Bits> Table;
+
+private:
+    array<int, Size> counts;
+    array<int, Size> caps;
+
+public:
+    FixedMultiset() : counts{}, caps{} {}
+    explicit FixedMultiset(const array<int, Size>& caps) : counts{}, caps(caps) {}
+
+    static constexpr int getBitWidth() { return Bits; }
+    static constexpr size_t size() { return Size; }
+    static constexpr uint32_t codeOf(size_t rank) { return Table::codes[rank]; }
+    static constexpr size_t rankOf(uint32_t code) { return Table::ranks[code]; }
+
+    int count(size_t rank) const { return counts[rank]; }
+    int cap(size_t rank) const { return caps[rank]; }
+    int countOfCode(uint32_t code) const { return counts[rankOf(code)]; }
+    void set(size_t rank, int multiplicity) { counts[rank] = multiplicity; }
+    void setCap(size_t rank, int cardinality) { caps[rank] = cardinality; }
+    void clear() { counts.fill(0); }
+
+    int* data() { return counts.data(); }
+    const int* data() const { return counts.data(); }
+    const int* capData() const { return caps.data(); }
+    const array<int, Size>& getCounts() const { return counts; }
+    const array<int, Size>& getCaps() const { return caps; }
+
+    bool operator==(const FixedMultiset& other) const { return counts == other.counts && caps == other.caps; }
+    bool operator!=(const FixedMultiset& other) const { return !(*this == other); }
+};
+
+// Set operations (the result takes the first operand's caps)
+template <int Bits>
+FixedMultiset<Bits> unionMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    FixedMultiset<Bits> result(m1.getCaps());
+    int* out = result.data();
+    const int *a = m1.data(), *b = m2.data(), *cap = m1.capData();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) { out[i] = unionElement(a[i], b[i], cap[i]); });
+    return result;
+}
+
+template <int Bits>
+FixedMultiset<Bits> intersectionMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    FixedMultiset<Bits> result(m1.getCaps());
+    int* out = result.data();
+    const int *a = m1.data(), *b = m2.data(), *cap = m1.capData();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) { out[i] = intersectionElement(a[i], b[i], cap[i]); });
+    return result;
+}
+
+template <int Bits>
+FixedMultiset<Bits> differenceMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    FixedMultiset<Bits> result(m1.getCaps());
+    int* out = result.data();
+    const int *a = m1.data(), *b = m2.data(), *cap = m1.capData();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) { out[i] = differenceElement(a[i], b[i], cap[i]); });
+    return result;
+}
+
+template <int Bits>
+FixedMultiset<Bits> symmetricDifferenceMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    FixedMultiset<Bits> result(m1.getCaps());
+    int* out = result.data();
+    const int *a = m1.data(), *b = m2.data(), *capA = m1.capData(), *capB = m2.capData();
+    unrolledFor<FixedMultiset<Bits>::Size>(
+        [&](size_t i) { out[i] = symmetricDifferenceElement(a[i], b[i], capA[i], capB[i]); });
+    return result;
+}
+
+template <int Bits>
+FixedMultiset<Bits> complementMultiset(const FixedMultiset<Bits>& multiset) {
+    FixedMultiset<Bits> result(multiset.getCaps());
+    int* out = result.data();
+    const int *a = multiset.data(), *cap = multiset.capData();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) { out[i] = complementElement(a[i], cap[i]); });
+    return result;
+}
+
+// Arithmetic operations, wrapping like the dense ones
+template <int Bits>
+int sumMultisets(const FixedMultiset<Bits>& multiset) {
+    unsigned sum = 0;
+    const int* a = multiset.data();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) { sum += static_cast<unsigned>(a[i]); });
+    return static_cast<int>(sum);
+}
+
+template <int Bits>
+int arithmeticDifferenceMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return max(0, diff);
+}
+
+// Overflow-checked like the dense version (throws overflow_error)
+template <int Bits>
+int productMultisets(const FixedMultiset<Bits>& multiset) {
+    ProductHistogram histogram;
+    const int* a = multiset.data();
+    // An absent element contributes a factor of 1
+    for (size_t i = 0; i < FixedMultiset<Bits>::Size; i++) {
+        if (a[i] != 0) histogram[a[i]]++;
+    }
+    return checkedIntProduct(groupedFactors(histogram));
+}
+
+// Gray-weighted arithmetic; the weight of rank i is i, so the table of
+// grayToInt values is never consulted
+template <int Bits>
+long long weightedSum(const FixedMultiset<Bits>& multiset) {
+    unsigned long long total = 0;
+    const int* a = multiset.data();
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) {
+        total += static_cast<unsigned long long>(static_cast<long long>(a[i]) * static_cast<long long>(i));
+    });
+    return static_cast<long long>(total);
+}
+
+template <int Bits>
+long long weightedDifference(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+template <int Bits>
+long double weightedProduct(const FixedMultiset<Bits>& multiset) {
+    const int* a = multiset.data();
+    if (a[0] > 0) return 0.0L; // 0 to a positive power
+    long double product = 1.0L;
+    unrolledFor<FixedMultiset<Bits>::Size>([&](size_t i) {
+        if (i > 0 && a[i] > 0) product *= powerBySquaring(static_cast<long double>(i), static_cast<uint64_t>(a[i]));
+    });
+    return product;
+}
+
+// Division by zero returns 0 without the dense versions' console message
+template <int Bits>
+int divisionMultisets(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    int sum2 = sumMultisets(m2);
+    return sum2 == 0 ? 0 : sumMultisets(m1) / sum2;
+}
+
+template <int Bits>
+double weightedDivision(const FixedMultiset<Bits>& m1, const FixedMultiset<Bits>& m2) {
+    long long denom = weightedSum(m2);
+    return denom == 0 ? 0.0 : static_cast<double>(weightedSum(m1)) / static_cast<double>(denom);
+}
+
+// Conversion to and from the dynamic form; toFixed throws invalid_argument
+// if the widths differ
+template <int Bits>
+FixedMultiset<Bits> toFixed(const DenseMultiset& multiset) {
+    if (multiset.getBitWidth() != Bits) {
+        throw invalid_argument("FixedMultiset: expected a " + to_string(Bits) + "-bit universe");
+    }
+    FixedMultiset<Bits> result;
+    for (size_t i = 0; i < FixedMultiset<Bits>::Size; i++) {
+        result.set(i, multiset.count(i));
+        result.setCap(i, multiset.cap(i));
+    }
+    return result;
+}
+
+template <int Bits>
+DenseMultiset toDense(const FixedMultiset<Bits>& multiset) {
+    const array<int, FixedMultiset<Bits>::Size>& caps = multiset.getCaps();
+    DenseMultiset result(Bits, vector<int>(caps.begin(), caps.end()));
+    for (size_t i = 0; i < FixedMultiset<Bits>::Size; i++) result.set(i, multiset.count(i));
+    return result;
+}
+
+// Runs body(integral_constant<int, Bits>()) for a width known only at run
+// time, so callers can take the specialized path; returns false when the
+// width has no specialization
+template <typename Body, int Bits = 1>
+bool dispatchFixedWidth(int bitWidth, const Body& body) {
+    if (bitWidth == Bits) {
+        body(integral_constant<int, Bits>());
+        return true;
+    }
+    if constexpr (Bits < FIXED_MAX_BITS) {
+        return dispatchFixedWidth<Body, Bits + 1>(bitWidth, body);
+    } else {
+        return false;
+    }
+}
+
+#endif // FIXED_MULTISET_H
@@ -1,33 +1,56 @@
 #include "funcs.h"
+#include "batch_session.h"
+#include "op_stats.h"
 #include <cassert>
 
-MultisetProgram::MultisetProgram() : bitWidth(0) {}
+MultisetProgram::MultisetProgram() : bitWidth(0), randomStreams(0) {
+    random_device rd;
+    randomSeed = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+}
 
-// Generate binary Gray code
+// Generate binary Gray code: integer codes (rank ^ (rank >> 1)) formatted as strings
 vector<string> MultisetProgram::generateGrayCode(int n) {
+    OP_STATS_SCOPE(stats, "generate_gray_code");
+    OP_STATS_ELEMENTS(stats, grayCodeCount(n));
     if (n <= 0) return {""};
-    if (n == 1) return {"0", "1"};
     
-    vector<string> prev = generateGrayCode(n - 1);
+    GrayCodeRange codes(n);
     vector<string> result;
-    
-    // Add 0 prefix to previous codes
-    for (const string& code : prev) {
-        result.push_back("0" + code);
+    result.reserve(static_cast<size_t>(codes.size()));
+    for (uint32_t code : codes) {
+        result.push_back(grayCodeToString(code, n));
     }
-    
-    // Add 1 prefix to reversed previous codes
-    for (int i = prev.size() - 1; i >= 0; i--) {
-        result.push_back("1" + prev[i]);
+    OP_STATS_BYTES(stats, result.capacity() * sizeof(string) + (n >= 16 ? result.size() * (n + 1) : 0));
+    return result;
+}
+
+// Universe element lookup by Gray code string
+bool MultisetProgram::rankOf(const string& element, size_t& rank) const {
+    uint32_t code;
+    if (static_cast<int>(element.size()) != bitWidth || !parseGrayCode(element, code)) {
+        return false;
+    }
+    rank = grayDecode(code);
+    return rank < universeCardinality.size();
+}
+
+int MultisetProgram::cardinalityOf(const string& element) const {
+    size_t rank;
+    return rankOf(element, rank) ? universeCardinality[rank] : 0;
+}
+
+vector<string> MultisetProgram::getUniverse() const {
+    vector<string> result;
+    result.reserve(universeSize());
+    for (size_t i = 0; i < universeSize(); i++) {
+        result.push_back(elementAt(i));
     }
-    
     return result;
 }
 
 // Initialize universe with Gray codes and cardinality
 void MultisetProgram::initializeUniverse() {
-    universe = generateGrayCode(bitWidth);
-    universeCardinality.clear();
+    universeCardinality = makeUniverseCaps(bitWidth);
     
     // Ask for maximum cardinality for the universe
     int maxUniverseCardinality;
@@ -43,16 +66,25 @@ void MultisetProgram::initializeUniverse() {
     mt19937 g(rd());
     uniform_int_distribution<int> cardinalityDist(1, maxUniverseCardinality);
     
-    for (const string& element : universe) {
-        universeCardinality[element] = cardinalityDist(g);
+    for (size_t i = 0; i < universeCardinality.size(); i++) {
+        universeCardinality[i] = cardinalityDist(g);
+    }
+}
+
+// Initialize universe non-interactively from caps given in Gray rank order
+void MultisetProgram::initializeUniverse(int bitWidth, const vector<int>& cardinalityByRank) {
+    universeCardinality = makeUniverseCaps(bitWidth);
+    this->bitWidth = bitWidth;
+    for (size_t i = 0; i < universeCardinality.size() && i < cardinalityByRank.size(); i++) {
+        universeCardinality[i] = cardinalityByRank[i];
     }
 }
 
 // Display universe
 void MultisetProgram::displayUniverse() {
     cout << "\nUniverse (Gray codes with max cardinality):\n";
-    for (size_t i = 0; i < universe.size(); i++) {
-        cout << i + 1 << ". " << universe[i] << " (" << universeCardinality[universe[i]] << ")" << endl;
+    for (size_t i = 0; i < universeSize(); i++) {
+        cout << i + 1 << ". " << elementAt(i) << " (" << universeCardinality[i] << ")" << endl;
     }
 }
 
@@ -63,29 +95,29 @@ void MultisetProgram::createMultisetManually(map<string, int>& multiset, const s
     
     // First, set cardinality for each universe element
     cout << "First, set the maximum cardinality for each universe element:\n";
-    for (size_t i = 0; i < universe.size(); i++) {
+    for (size_t i = 0; i < universeSize(); i++) {
         int cardinality;
-        cout << "Enter max cardinality for " << universe[i] << " (1-10): ";
+        cout << "Enter max cardinality for " << elementAt(i) << " (1-10): ";
         while (!(cin >> cardinality) || cardinality < 1 || cardinality > 10) {
             cout << "Invalid input! Enter a number between 1 and 10: ";
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
         }
-        universeCardinality[universe[i]] = cardinality;
+        universeCardinality[i] = cardinality;
     }
     
     // Then, set multiplicity for each element
     cout << "\nNow, set the multiplicity for each universe element:\n";
-    for (size_t i = 0; i < universe.size(); i++) {
+    for (size_t i = 0; i < universeSize(); i++) {
         int multiplicity;
-        cout << "Enter multiplicity for " << universe[i] << " (0 to " << universeCardinality[universe[i]] << ", 0 to skip): ";
-        while (!(cin >> multiplicity) || multiplicity < 0 || multiplicity > universeCardinality[universe[i]]) {
-            cout << "Invalid input! Enter a number between 0 and " << universeCardinality[universe[i]] << ": ";
+        cout << "Enter multiplicity for " << elementAt(i) << " (0 to " << universeCardinality[i] << ", 0 to skip): ";
+        while (!(cin >> multiplicity) || multiplicity < 0 || multiplicity > universeCardinality[i]) {
+            cout << "Invalid input! Enter a number between 0 and " << universeCardinality[i] << ": ";
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
         }
         if (multiplicity > 0) {
-            multiset[universe[i]] = multiplicity;
+            multiset[elementAt(i)] = multiplicity;
         }
     }
 }
@@ -94,31 +126,20 @@ void MultisetProgram::createMultisetManually(map<string, int>& multiset, const s
 void MultisetProgram::createMultisetAutomatically(map<string, int>& multiset, const string& name, int cardinality) {
     cout << "\nCreating " << name << " automatically with cardinality " << cardinality << ":\n";
     multiset.clear();
-    
-    // First, set random cardinality (1-10) for each universe element
-    random_device rd;
-    mt19937 g(rd());
-    uniform_int_distribution<int> cardinalityDist(1, 10);
-    
-    for (const string& element : universe) {
-        universeCardinality[element] = cardinalityDist(g);
-    }
-    
-    // Randomly distribute cardinality among universe elements
-    vector<int> indices(universe.size());
-    iota(indices.begin(), indices.end(), 0);
-    shuffle(indices.begin(), indices.end(), g);
-    
-    int remaining = cardinality;
-    for (size_t i = 0; i < indices.size() && remaining > 0; i++) {
-        int maxMultiplicity = universeCardinality[universe[indices[i]]];
-        int multiplicity = (i == indices.size() - 1) ? min(remaining, maxMultiplicity) : 
-                          min(rand() % (remaining + 1), maxMultiplicity);
-        if (multiplicity > 0) {
-            multiset[universe[indices[i]]] = multiplicity;
-        }
-        remaining -= multiplicity;
+
+    // Exactly `cardinality` units within the universe caps, every placement of
+    // the units equally likely; the seed and stream make the run reproducible
+    DenseMultiset dense(bitWidth, getCapArray());
+    uint64_t capacity = totalCapacity(dense);
+    uint64_t units = static_cast<uint64_t>(max(cardinality, 0));
+    if (units > capacity) {
+        cout << "Cardinality exceeds the universe capacity " << capacity << "; using " << capacity << "\n";
+        units = capacity;
     }
+    uint64_t stream = randomStreams++;
+    cout << "(seed " << randomSeed << ", stream " << stream << ")\n";
+    fillRandomMultiset(dense, units, counterHash(randomSeed, stream, 0));
+    multiset = fromDense(dense);
 }
 
 // Display multiset
@@ -129,12 +150,72 @@ void MultisetProgram::displayMultiset(const map<string, int>& multiset, const st
         return;
     }
     for (const auto& pair : multiset) {
-        cout << pair.first << ": " << pair.second << " (" << universeCardinality[pair.first] << ")" << endl;
+        cout << pair.first << ": " << pair.second << " (" << cardinalityOf(pair.first) << ")\n";
+    }
+}
+
+// Conversion to the rank-indexed forms: index i holds the element of Gray rank i
+CapArray MultisetProgram::getCapArray() const {
+    vector<int> caps(static_cast<size_t>(grayCodeCount(bitWidth)), 0);
+    for (size_t i = 0; i < universeCardinality.size() && i < caps.size(); i++) {
+        caps[i] = universeCardinality[i];
     }
+    return makeCapArray(caps);
+}
+
+DenseMultiset MultisetProgram::toDense(const map<string, int>& multiset) const {
+    DenseMultiset result(bitWidth, getCapArray());
+    for (const auto& pair : multiset) {
+        size_t rank;
+        if (rankOf(pair.first, rank)) {
+            result.set(rank, pair.second);
+        }
+    }
+    return result;
+}
+
+map<string, int> MultisetProgram::fromDense(const DenseMultiset& multiset) const {
+    map<string, int> result;
+    for (size_t i = 0; i < multiset.size(); i++) {
+        if (multiset.count(i) != 0) {
+            result[grayCodeToString(grayEncode(static_cast<uint32_t>(i)), multiset.getBitWidth())] = multiset.count(i);
+        }
+    }
+    return result;
+}
+
+SparseMultiset MultisetProgram::toSparse(const map<string, int>& multiset) const {
+    // Map order is string order, not rank order, so sort before appending
+    vector<pair<size_t, int> > ranked;
+    ranked.reserve(multiset.size());
+    for (const auto& pair : multiset) {
+        size_t rank;
+        if (rankOf(pair.first, rank)) {
+            ranked.push_back(make_pair(rank, pair.second));
+        }
+    }
+    sort(ranked.begin(), ranked.end());
+    SparseMultiset result(bitWidth, getCapArray());
+    result.reserve(ranked.size());
+    for (size_t i = 0; i < ranked.size(); i++) {
+        result.append(ranked[i].first, ranked[i].second);
+    }
+    return result;
+}
+
+map<string, int> MultisetProgram::fromSparse(const SparseMultiset& multiset) const {
+    map<string, int> result;
+    const vector<SparseEntry>& entries = multiset.getEntries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        result[grayCodeToString(grayEncode(entries[i].rank), multiset.getBitWidth())] = entries[i].multiplicity;
+    }
+    return result;
 }
 
 // Set operations
 map<string, int> MultisetProgram::unionMultisets(const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "union");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     map<string, int> result;
     set<string> allKeys;
     
@@ -142,57 +223,223 @@ map<string, int> MultisetProgram::unionMultisets(const map<string, int>& m1, con
     for (const auto& pair : m2) allKeys.insert(pair.first);
     
     for (const string& key : allKeys) {
-        int maxCardinality = universeCardinality[key];
+        int maxCardinality = cardinalityOf(key);
         int unionValue = max(m1.count(key) ? m1.at(key) : 0, m2.count(key) ? m2.at(key) : 0);
         result[key] = min(unionValue, maxCardinality); // Respect cardinality limit
     }
+    OP_STATS_BYTES(stats, estimateMapBytes(allKeys.size() + result.size(), bitWidth));
     return result;
 }
 
 map<string, int> MultisetProgram::intersectionMultisets(const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "intersection");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     map<string, int> result;
     for (const auto& pair : m1) {
         if (m2.count(pair.first)) {
-            int maxCardinality = universeCardinality[pair.first];
+            int maxCardinality = cardinalityOf(pair.first);
             int intersectionValue = min(pair.second, m2.at(pair.first));
             result[pair.first] = min(intersectionValue, maxCardinality); // Respect cardinality limit
         }
     }
+    OP_STATS_BYTES(stats, estimateMapBytes(result.size(), bitWidth));
     return result;
 }
 
 map<string, int> MultisetProgram::differenceMultisets(const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "difference");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     map<string, int> result;
     for (const auto& pair : m1) {
-        int maxCardinality = universeCardinality[pair.first];
+        int maxCardinality = cardinalityOf(pair.first);
         int diff = pair.second - (m2.count(pair.first) ? m2.at(pair.first) : 0);
         if (diff > 0) {
             result[pair.first] = min(diff, maxCardinality); // Respect cardinality limit
         }
     }
+    OP_STATS_BYTES(stats, estimateMapBytes(result.size(), bitWidth));
     return result;
 }
 
 map<string, int> MultisetProgram::symmetricDifferenceMultisets(const map<string, int>& m1, const map<string, int>& m2) {
-    map<string, int> diff1 = differenceMultisets(m1, m2);
-    map<string, int> diff2 = differenceMultisets(m2, m1);
-    return unionMultisets(diff1, diff2);
+    OP_STATS_SCOPE(stats, "symmetric_difference");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
+    // (M1 - M2) U (M2 - M1) in one merge, without the two intermediate maps
+    map<string, int> result;
+    mergeSymmetricDifference(result, m1, m2);
+    OP_STATS_BYTES(stats, estimateMapBytes(result.size(), bitWidth));
+    return result;
 }
 
 map<string, int> MultisetProgram::complementMultiset(const map<string, int>& multiset) {
+    OP_STATS_SCOPE(stats, "complement");
+    OP_STATS_ELEMENTS(stats, universeSize());
     map<string, int> result;
-    for (const string& element : universe) {
+    for (size_t i = 0; i < universeSize(); i++) {
+        string element = elementAt(i);
         int multiplicity = multiset.count(element) ? multiset.at(element) : 0;
-        int maxCardinality = universeCardinality[element];
+        int maxCardinality = universeCardinality[i];
         if (multiplicity == 0) {
             result[element] = maxCardinality; // Complement uses actual max cardinality
         }
     }
+    OP_STATS_BYTES(stats, estimateMapBytes(result.size(), bitWidth));
     return result;
 }
 
+// Writes (key, value) pairs in increasing key order over the old contents of
+// a map: surviving keys keep their nodes, missing ones are inserted at the
+// right position and the rest are erased
+namespace {
+class SortedMapWriter {
+private:
+    map<string, int>& dst;
+    map<string, int>::iterator pos;
+
+public:
+    explicit SortedMapWriter(map<string, int>& dst) : dst(dst), pos(dst.begin()) {}
+
+    void put(const string& key, int value) {
+        while (pos != dst.end() && pos->first < key) pos = dst.erase(pos);
+        if (pos != dst.end() && pos->first == key) {
+            pos->second = value;
+            ++pos;
+        } else {
+            dst.insert(pos, make_pair(key, value));
+        }
+    }
+
+    void finish() { dst.erase(pos, dst.end()); }
+};
+}
+
+// The merges below advance past a key before writing it, so when dst is an
+// operand the writer only ever erases entries that have already been read
+void MultisetProgram::unionInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "union_into");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
+    SortedMapWriter out(dst);
+    map<string, int>::const_iterator i = m1.begin(), j = m2.begin();
+    while (i != m1.end() || j != m2.end()) {
+        const string* key;
+        int a = 0, b = 0;
+        if (j == m2.end() || (i != m1.end() && i->first < j->first)) {
+            key = &i->first;
+            a = (i++)->second;
+        } else if (i == m1.end() || j->first < i->first) {
+            key = &j->first;
+            b = (j++)->second;
+        } else {
+            key = &i->first;
+            a = (i++)->second;
+            b = (j++)->second;
+        }
+        out.put(*key, min(max(a, b), cardinalityOf(*key)));
+    }
+    out.finish();
+}
+
+void MultisetProgram::intersectionInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "intersection_into");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
+    SortedMapWriter out(dst);
+    map<string, int>::const_iterator i = m1.begin(), j = m2.begin();
+    while (i != m1.end() && j != m2.end()) {
+        if (i->first < j->first) {
+            ++i;
+        } else if (j->first < i->first) {
+            ++j;
+        } else {
+            const string& key = i->first;
+            int value = min(i->second, j->second);
+            ++i;
+            ++j;
+            out.put(key, min(value, cardinalityOf(key)));
+        }
+    }
+    out.finish();
+}
+
+void MultisetProgram::differenceInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "difference_into");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
+    SortedMapWriter out(dst);
+    map<string, int>::const_iterator j = m2.begin();
+    for (map<string, int>::const_iterator i = m1.begin(); i != m1.end();) {
+        while (j != m2.end() && j->first < i->first) ++j;
+        const string& key = i->first;
+        int diff = i->second - ((j != m2.end() && j->first == key) ? j->second : 0);
+        ++i;
+        if (diff > 0) {
+            out.put(key, min(diff, cardinalityOf(key)));
+        }
+    }
+    out.finish();
+}
+
+void MultisetProgram::symmetricDifferenceInto(map<string, int>& dst, const map<string, int>& m1,
+                                              const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "symmetric_difference_into");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
+    mergeSymmetricDifference(dst, m1, m2);
+}
+
+void MultisetProgram::mergeSymmetricDifference(map<string, int>& dst, const map<string, int>& m1,
+                                               const map<string, int>& m2) const {
+    // Single merge: at most one of the two differences is positive at a key
+    SortedMapWriter out(dst);
+    map<string, int>::const_iterator i = m1.begin(), j = m2.begin();
+    while (i != m1.end() || j != m2.end()) {
+        const string* key;
+        int a = 0, b = 0;
+        if (j == m2.end() || (i != m1.end() && i->first < j->first)) {
+            key = &i->first;
+            a = (i++)->second;
+        } else if (i == m1.end() || j->first < i->first) {
+            key = &j->first;
+            b = (j++)->second;
+        } else {
+            key = &i->first;
+            a = (i++)->second;
+            b = (j++)->second;
+        }
+        int diff = a - b > 0 ? a - b : b - a;
+        if (diff > 0) {
+            out.put(*key, min(diff, cardinalityOf(*key)));
+        }
+    }
+    out.finish();
+}
+
+void MultisetProgram::complementInto(map<string, int>& dst, const map<string, int>& multiset) {
+    // Codes of one width sort like their integer values, so walk the
+    // universe in code order next to the multiset
+    OP_STATS_SCOPE(stats, "complement_into");
+    OP_STATS_ELEMENTS(stats, universeSize());
+    SortedMapWriter out(dst);
+    static thread_local string element; // codes over 15 bits do not fit the small-string buffer
+    element.assign(static_cast<size_t>(bitWidth), '0');
+    map<string, int>::const_iterator it = multiset.begin();
+    for (uint64_t code = 0; code < universeSize(); code++) {
+        for (int bit = 0; bit < bitWidth; bit++) {
+            element[bit] = ((code >> (bitWidth - 1 - bit)) & 1) ? '1' : '0';
+        }
+        while (it != multiset.end() && it->first < element) ++it;
+        int multiplicity = 0;
+        if (it != multiset.end() && it->first == element) {
+            multiplicity = (it++)->second;
+        }
+        if (multiplicity == 0) {
+            out.put(element, universeCardinality[grayDecode(static_cast<uint32_t>(code))]);
+        }
+    }
+    out.finish();
+}
+
 // Arithmetic operations
 int MultisetProgram::sumMultisets(const map<string, int>& multiset) {
+    OP_STATS_SCOPE(stats, "sum");
+    OP_STATS_ELEMENTS(stats, multiset.size());
     int sum = 0;
     for (const auto& pair : multiset) {
         sum += pair.second;
@@ -201,19 +448,22 @@ int MultisetProgram::sumMultisets(const map<string, int>& multiset) {
 }
 
 int MultisetProgram::arithmeticDifferenceMultisets(const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "arithmetic_difference");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     int diff = sumMultisets(m1) - sumMultisets(m2);
     return max(0, diff); // Ensure non-negative result
 }
 
 int MultisetProgram::productMultisets(const map<string, int>& multiset) {
-    int product = 1;
-    for (const auto& pair : multiset) {
-        product *= pair.second;
-    }
-    return product;
+    OP_STATS_SCOPE(stats, "product");
+    OP_STATS_ELEMENTS(stats, multiset.size());
+    // Throws overflow_error rather than wrap; productFactors gives the exact value
+    return checkedIntProduct(productFactors(multiset));
 }
 
 int MultisetProgram::divisionMultisets(const map<string, int>& m1, const map<string, int>& m2) {
+    OP_STATS_SCOPE(stats, "division");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     int sum2 = sumMultisets(m2);
     if (sum2 == 0) {
         cout << "Division by zero error!\n";
@@ -224,7 +474,12 @@ int MultisetProgram::divisionMultisets(const map<string, int>& m1, const map<str
 
 // Gray-weighted arithmetic helpers
 int MultisetProgram::grayToInt(const string& grayBits) {
-    //Gray code string to integer: prefix XOR method
+    // Gray code string to integer: prefix XOR method
+    uint32_t code;
+    if (parseGrayCode(grayBits, code)) {
+        return static_cast<int>(grayDecode(code)); // 8 characters per step, branchless prefix XOR
+    }
+    // Anything that is not a 0/1 string: characters other than '1' count as 0
     int result = 0;
     int bitAccumulator = 0; // current binary bit value as we scan MSB->LSB
     for (char c : grayBits) {
@@ -236,6 +491,8 @@ int MultisetProgram::grayToInt(const string& grayBits) {
 }
 
 long long MultisetProgram::weightedSum(const map<string, int>& multiset) const {
+    OP_STATS_SCOPE(stats, "weighted_sum");
+    OP_STATS_ELEMENTS(stats, multiset.size());
     long long total = 0;
     for (const auto& kv : multiset) {
         const string& gray = kv.first;
@@ -246,11 +503,16 @@ long long MultisetProgram::weightedSum(const map<string, int>& multiset) const {
 }
 
 long long MultisetProgram::weightedDifference(const map<string, int>& m1, const map<string, int>& m2) const {
+    OP_STATS_SCOPE(stats, "weighted_difference");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     return weightedSum(m1) - weightedSum(m2);
 }
 
 long double MultisetProgram::weightedProduct(const map<string, int>& multiset) const {
-    // Product over (value(gray) ^ multiplicity). Use long double to handle growth.
+    OP_STATS_SCOPE(stats, "weighted_product");
+    OP_STATS_ELEMENTS(stats, multiset.size());
+    // Product over (value(gray) ^ multiplicity), powers by squaring. Use long double to handle growth;
+    // weightedProductFactors gives the exact value
     long double product = 1.0L;
     for (const auto& kv : multiset) {
         const string& gray = kv.first;
@@ -259,14 +521,38 @@ long double MultisetProgram::weightedProduct(const map<string, int>& multiset) c
         if (value == 0 && multiplicity > 0) {
             return 0.0L; // any zero value to positive power makes whole product zero
         }
-        for (int i = 0; i < multiplicity; i++) {
-            product *= static_cast<long double>(value);
+        if (multiplicity > 0) {
+            product *= powerBySquaring(static_cast<long double>(value), static_cast<uint64_t>(multiplicity));
         }
     }
     return product;
 }
 
+ProductEngine MultisetProgram::productFactors(const map<string, int>& multiset) const {
+    map<int, uint64_t> histogram;
+    for (const auto& pair : multiset) {
+        histogram[pair.second]++;
+    }
+    ProductEngine engine;
+    for (const auto& entry : histogram) {
+        engine.multiply(entry.first, entry.second);
+    }
+    return engine;
+}
+
+ProductEngine MultisetProgram::weightedProductFactors(const map<string, int>& multiset) const {
+    ProductEngine engine;
+    for (const auto& kv : multiset) {
+        if (kv.second > 0) {
+            engine.multiply(grayToInt(kv.first), static_cast<uint64_t>(kv.second));
+        }
+    }
+    return engine;
+}
+
 double MultisetProgram::weightedDivision(const map<string, int>& m1, const map<string, int>& m2) const {
+    OP_STATS_SCOPE(stats, "weighted_division");
+    OP_STATS_ELEMENTS(stats, m1.size() + m2.size());
     long long denom = weightedSum(m2);
     if (denom == 0) {
         cout << "Division by zero error!\n";
@@ -276,14 +562,33 @@ double MultisetProgram::weightedDivision(const map<string, int>& m1, const map<s
     return static_cast<double>(numer) / static_cast<double>(denom);
 }
 
+// The interactive sums are tracker queries rather than map scans; they keep
+// their "sum" and "weighted_sum" rows under --stats, and the one scan that
+// builds each tracker is recorded as "track"
+static TrackedMultiset trackMultiset(const DenseMultiset& multiset) {
+    OP_STATS_SCOPE(stats, "track");
+    OP_STATS_ELEMENTS(stats, multiset.size());
+    return TrackedMultiset(multiset);
+}
+
+static long long trackedSum(const TrackedMultiset& multiset) {
+    OP_STATS_SCOPE(stats, "sum");
+    return multiset.cardinality();
+}
+
+static long long trackedWeightedSum(const TrackedMultiset& multiset) {
+    OP_STATS_SCOPE(stats, "weighted_sum");
+    return multiset.weightedSum();
+}
+
 // Main menu
 void MultisetProgram::run() {
     cout << "=== Multiset Operations Program ===\n";
     
     // Get bit width
-    cout << "Enter bit width for Gray code (1-10): ";
-    while (!(cin >> bitWidth) || bitWidth < 1 || bitWidth > 10) {
-        cout << "Invalid input! Enter a number between 1 and 10: ";
+    cout << "Enter bit width for Gray code (1-" << MAX_INTERACTIVE_BITS << "): ";
+    while (!(cin >> bitWidth) || bitWidth < 1 || bitWidth > MAX_INTERACTIVE_BITS) {
+        cout << "Invalid input! Enter a number between 1 and " << MAX_INTERACTIVE_BITS << ": ";
         cin.clear();
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
     }
@@ -365,26 +670,50 @@ void MultisetProgram::run() {
     map<string, int> comp2Result = complementMultiset(multiset2);
     displayMultiset(comp2Result, "Complement of M2");
     
+    // Both multisets are scanned once; every sum below is an O(1) query
+    TrackedMultiset tracked1 = trackMultiset(toDense(multiset1));
+    TrackedMultiset tracked2 = trackMultiset(toDense(multiset2));
+    int sum1 = static_cast<int>(trackedSum(tracked1));
+    int sum2 = static_cast<int>(trackedSum(tracked2));
+    long long weighted1 = trackedWeightedSum(tracked1);
+    long long weighted2 = trackedWeightedSum(tracked2);
+
     cout << "\n=== Arithmetic Operations ===\n";
-    cout << "Sum of M1: " << sumMultisets(multiset1) << endl;
-    cout << "Sum of M2: " << sumMultisets(multiset2) << endl;
-    cout << "Arithmetic Difference (M1 - M2): " << arithmeticDifferenceMultisets(multiset1, multiset2) << endl;
-    cout << "Arithmetic Difference (M2 - M1): " << arithmeticDifferenceMultisets(multiset2, multiset1) << endl;
-    cout << "Product of M1: " << productMultisets(multiset1) << endl;
-    cout << "Product of M2: " << productMultisets(multiset2) << endl;
-    cout << "Division (M1 / M2): " << divisionMultisets(multiset1, multiset2) << endl;
-    cout << "Division (M2 / M1): " << divisionMultisets(multiset2, multiset1) << endl;
+    cout << "Sum of M1: " << sum1 << endl;
+    cout << "Sum of M2: " << sum2 << endl;
+    cout << "Arithmetic Difference (M1 - M2): " << max(0, sum1 - sum2) << endl;
+    cout << "Arithmetic Difference (M2 - M1): " << max(0, sum2 - sum1) << endl;
+    cout << "Product of M1: " << productFactors(multiset1).format(PRODUCT_CHECKED) << endl;
+    cout << "Product of M2: " << productFactors(multiset2).format(PRODUCT_CHECKED) << endl;
+    if (sum2 == 0) cout << "Division by zero error!\n";
+    cout << "Division (M1 / M2): " << (sum2 == 0 ? 0 : sum1 / sum2) << endl;
+    if (sum1 == 0) cout << "Division by zero error!\n";
+    cout << "Division (M2 / M1): " << (sum1 == 0 ? 0 : sum2 / sum1) << endl;
 
     // Gray-weighted arithmetic section
     cout << "\n=== Gray-weighted Arithmetic (values derived from Gray → integer) ===\n";
-    cout << "Weighted Sum of M1: " << weightedSum(multiset1) << endl;
-    cout << "Weighted Sum of M2: " << weightedSum(multiset2) << endl;
-    cout << "Weighted Difference (M1 - M2): " << weightedDifference(multiset1, multiset2) << endl;
-    cout << "Weighted Difference (M2 - M1): " << weightedDifference(multiset2, multiset1) << endl;
+    cout << "Weighted Sum of M1: " << weighted1 << endl;
+    cout << "Weighted Sum of M2: " << weighted2 << endl;
+    cout << "Weighted Difference (M1 - M2): " << weighted1 - weighted2 << endl;
+    cout << "Weighted Difference (M2 - M1): " << weighted2 - weighted1 << endl;
     cout << "Weighted Product of M1: " << fixed << setprecision(2) << (double)weightedProduct(multiset1) << endl;
     cout << "Weighted Product of M2: " << fixed << setprecision(2) << (double)weightedProduct(multiset2) << endl;
-    cout << "Weighted Division (M1 / M2): " << fixed << setprecision(2) << weightedDivision(multiset1, multiset2) << endl;
-    cout << "Weighted Division (M2 / M1): " << fixed << setprecision(2) << weightedDivision(multiset2, multiset1) << endl;
+    if (weighted2 == 0) cout << "Division by zero error!\n";
+    cout << "Weighted Division (M1 / M2): " << fixed << setprecision(2)
+         << (weighted2 == 0 ? 0.0 : static_cast<double>(weighted1) / static_cast<double>(weighted2)) << endl;
+    if (weighted1 == 0) cout << "Division by zero error!\n";
+    cout << "Weighted Division (M2 / M1): " << fixed << setprecision(2)
+         << (weighted1 == 0 ? 0.0 : static_cast<double>(weighted2) / static_cast<double>(weighted1)) << endl;
+
+    if (opStatsEnabled()) {
+        printOpStats(cout);
+    }
+}
+
+// Batch mode: commands from a script or stream, no prompts
+int MultisetProgram::runBatch(istream& in, ostream& out) {
+    BatchSession session;
+    return session.run(in, out);
 }
 
 // Test functions
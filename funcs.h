@@ -13,29 +13,65 @@
 #include <cstdlib>
 #include <ctime>
 #include <random>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "gray_code.h"
+#include "product_engine.h"
+#include "random_multiset.h"
+#include "tracked_multiset.h"
+#include "fixed_multiset.h"
 
 using namespace std;
 
+// Widest universe the interactive program accepts: it lists every element
+// and builds complements as maps. Batch mode goes up to MAX_GRAY_BITS.
+const int MAX_INTERACTIVE_BITS = 16;
+
 class MultisetProgram {
 private:
     int bitWidth;
-    vector<string> universe;
-    map<string, int> universeCardinality; // Max cardinality for each universe element
+    vector<int> universeCardinality; // Max cardinality for each universe element, by Gray rank
     map<string, int> multiset1;
     map<string, int> multiset2;
+    uint64_t randomSeed;    // seed of the automatically created multisets
+    uint64_t randomStreams; // multisets created so far; each one uses its own stream
+
+    // Shared by the symmetric difference forms, which record their own stats
+    void mergeSymmetricDifference(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2) const;
     
 public:
     MultisetProgram();
+
+    // Universe element access (codes are formatted only on demand)
+    size_t universeSize() const { return universeCardinality.size(); }
+    string elementAt(size_t rank) const { return grayCodeToString(grayEncode(static_cast<uint32_t>(rank)), bitWidth); }
+    bool rankOf(const string& element, size_t& rank) const; // false if not an element of the universe
+    int cardinalityOf(const string& element) const;        // 0 for elements outside the universe
     
     // Gray code generation
     vector<string> generateGrayCode(int n);
     void initializeUniverse();
+    void initializeUniverse(int bitWidth, const vector<int>& cardinalityByRank);
     void displayUniverse();
     
     // Multiset creation and display
     void createMultisetManually(map<string, int>& multiset, const string& name);
     void createMultisetAutomatically(map<string, int>& multiset, const string& name, int cardinality);
+    void setRandomSeed(uint64_t seed) { randomSeed = seed; randomStreams = 0; } // reproducible runs
+    uint64_t getRandomSeed() const { return randomSeed; }
     void displayMultiset(const map<string, int>& multiset, const string& name);
+
+    // Conversion between the map form and the rank-indexed dense/sparse forms
+    CapArray getCapArray() const;
+    DenseMultiset toDense(const map<string, int>& multiset) const;
+    map<string, int> fromDense(const DenseMultiset& multiset) const;
+    SparseMultiset toSparse(const map<string, int>& multiset) const;
+    map<string, int> fromSparse(const SparseMultiset& multiset) const;
+    // Compile-time widths (fixed_multiset.h); toFixed throws if Bits != bitWidth
+    template <int Bits>
+    FixedMultiset<Bits> toFixed(const map<string, int>& multiset) const { return ::toFixed<Bits>(toDense(multiset)); }
+    template <int Bits>
+    map<string, int> fromFixed(const FixedMultiset<Bits>& multiset) const { return fromDense(::toDense(multiset)); }
     
     // Set operations
     map<string, int> unionMultisets(const map<string, int>& m1, const map<string, int>& m2);
@@ -43,6 +79,15 @@ public:
     map<string, int> differenceMultisets(const map<string, int>& m1, const map<string, int>& m2);
     map<string, int> symmetricDifferenceMultisets(const map<string, int>& m1, const map<string, int>& m2);
     map<string, int> complementMultiset(const map<string, int>& multiset);
+
+    // Output-parameter forms: dst is rewritten in key order, keeping the nodes
+    // of keys that survive, so recomputing a result of the same shape makes no
+    // heap allocations. dst may be one of the operands.
+    void unionInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2);
+    void intersectionInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2);
+    void differenceInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2);
+    void symmetricDifferenceInto(map<string, int>& dst, const map<string, int>& m1, const map<string, int>& m2);
+    void complementInto(map<string, int>& dst, const map<string, int>& multiset);
     
     // Arithmetic operations
     int sumMultisets(const map<string, int>& multiset);
@@ -56,12 +101,18 @@ public:
     long long weightedDifference(const map<string, int>& m1, const map<string, int>& m2) const;
     long double weightedProduct(const map<string, int>& multiset) const;
     double weightedDivision(const map<string, int>& m1, const map<string, int>& m2) const;
+
+    // Exact / log / modular products (product_engine.h): plain factors are the
+    // multiplicities of all entries, weighted ones value ^ multiplicity
+    ProductEngine productFactors(const map<string, int>& multiset) const;
+    ProductEngine weightedProductFactors(const map<string, int>& multiset) const;
     
     // Main program flow
     void run();
+    int runBatch(istream& in, ostream& out); // non-interactive, see batch_session.h
     
     // Getters for testing
-    const vector<string>& getUniverse() const { return universe; }
+    vector<string> getUniverse() const;
     const map<string, int>& getMultiset1() const { return multiset1; }
     const map<string, int>& getMultiset2() const { return multiset2; }
     int getBitWidth() const { return bitWidth; }
@@ -0,0 +1,111 @@
+#include "gray_code.h"
+#include "multiset_kernels.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAY_X86_BATCH 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+void grayDecodeScalar(const uint32_t* codes, uint32_t* values, size_t count) {
+    for (size_t i = 0; i < count; i++) values[i] = grayDecode(codes[i]);
+}
+
+#ifdef GRAY_X86_BATCH
+// Same five shift-XOR steps on 4 or 8 codes at a time
+__attribute__((target("sse4.1")))
+void grayDecodeSse41(const uint32_t* codes, uint32_t* values, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + i));
+        v = _mm_xor_si128(v, _mm_srli_epi32(v, 1));
+        v = _mm_xor_si128(v, _mm_srli_epi32(v, 2));
+        v = _mm_xor_si128(v, _mm_srli_epi32(v, 4));
+        v = _mm_xor_si128(v, _mm_srli_epi32(v, 8));
+        v = _mm_xor_si128(v, _mm_srli_epi32(v, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), v);
+    }
+    grayDecodeScalar(codes + i, values + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void grayDecodeAvx2(const uint32_t* codes, uint32_t* values, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 1));
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 2));
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 4));
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 8));
+        v = _mm256_xor_si256(v, _mm256_srli_epi32(v, 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), v);
+    }
+    grayDecodeScalar(codes + i, values + i, count - i);
+}
+#endif
+
+} // namespace
+
+void grayDecodeBatch(const uint32_t* codes, uint32_t* values, size_t count) {
+#ifdef GRAY_X86_BATCH
+    SimdLevel level = getSimdLevel();
+    if (level == SIMD_AVX2) {
+        grayDecodeAvx2(codes, values, count);
+        return;
+    }
+    if (level == SIMD_SSE41) {
+        grayDecodeSse41(codes, values, count);
+        return;
+    }
+#endif
+    grayDecodeScalar(codes, values, count);
+}
+
+void fillGrayCodes(int bits, uint32_t* out) {
+    fillGrayCodes(0, static_cast<size_t>(grayCodeCount(bits)), out);
+}
+
+void fillGrayCodes(uint64_t firstRank, size_t count, uint32_t* out) {
+    uint32_t rank = static_cast<uint32_t>(firstRank);
+    for (size_t i = 0; i < count; i++, rank++) {
+        out[i] = grayEncode(rank);
+    }
+}
+
+string grayCodeToString(uint32_t code, int bits) {
+    string result(bits, '0');
+    for (int i = bits - 1; i >= 0; i--, code >>= 1) {
+        if (code & 1u) result[i] = '1';
+    }
+    return result;
+}
+
+bool parseGrayCode(const string& bits, uint32_t& code) {
+    return parseGrayCode(bits.data(), bits.size(), code);
+}
+
+bool parseGrayCode(const char* bits, size_t length, uint32_t& code) {
+    if (length > static_cast<size_t>(MAX_GRAY_BITS)) return false;
+    uint32_t value = 0;
+    size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Eight characters per step: check that every byte is '0' or '1', then
+    // gather the low bits into one byte, first character in the top bit
+    for (; i + 8 <= length; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, bits + i, 8);
+        if ((chunk & ~0x0101010101010101ull) != 0x3030303030303030ull) return false;
+        uint64_t packed = ((chunk & 0x0101010101010101ull) * 0x8040201008040201ull) >> 56;
+        value = (value << 8) | static_cast<uint32_t>(packed);
+    }
+#endif
+    for (; i < length; i++) {
+        char c = bits[i];
+        if (c != '0' && c != '1') return false;
+        value = (value << 1) | static_cast<uint32_t>(c - '0');
+    }
+    code = value;
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef GRAY_CODE_H
+#define GRAY_CODE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+using namespace std;
+
+// Largest supported Gray code width
+const int MAX_GRAY_BITS = 32;
+
+// Reflected binary Gray code of a rank and its inverse. Binary bit i is the
+// XOR of Gray bits i and above; five doubling shifts give that prefix XOR
+// without a loop or branch.
+constexpr uint32_t grayEncode(uint32_t rank) { return rank ^ (rank >> 1); }
+constexpr uint32_t grayDecode(uint32_t code) {
+    code ^= code >> 1;
+    code ^= code >> 2;
+    code ^= code >> 4;
+    code ^= code >> 8;
+    code ^= code >> 16;
+    return code;
+}
+
+// values[i] = grayDecode(codes[i]) with the SIMD level of multiset_kernels.h;
+// values may be codes
+void grayDecodeBatch(const uint32_t* codes, uint32_t* values, size_t count);
+
+// Number of codes of the given width
+constexpr uint64_t grayCodeCount(int bits) { return uint64_t(1) << bits; }
+
+// Bulk generation into a caller-supplied buffer: out[i] = code of rank (firstRank + i)
+void fillGrayCodes(int bits, uint32_t* out);
+void fillGrayCodes(uint64_t firstRank, size_t count, uint32_t* out);
+
+// String form, only needed for display and for the map-based API
+string grayCodeToString(uint32_t code, int bits);
+bool parseGrayCode(const string& bits, uint32_t& code); // false if not a 0/1 string of <= 32 chars
+bool parseGrayCode(const char* bits, size_t length, uint32_t& code);
+
+// Lazy range over all codes of a width, in generation order
+class GrayCodeRange {
+private:
+    int bits;
+
+public:
+    class iterator {
+    private:
+        uint64_t rank;
+
+    public:
+        typedef input_iterator_tag iterator_category;
+        typedef uint32_t value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const uint32_t* pointer;
+        typedef uint32_t reference;
+
+        explicit iterator(uint64_t rank) : rank(rank) {}
+        uint32_t operator*() const { return grayEncode(static_cast<uint32_t>(rank)); }
+        iterator& operator++() { ++rank; return *this; }
+        iterator operator++(int) { iterator old = *this; ++rank; return old; }
+        bool operator==(const iterator& other) const { return rank == other.rank; }
+        bool operator!=(const iterator& other) const { return rank != other.rank; }
+    };
+
+    explicit GrayCodeRange(int bits) : bits(bits) {}
+
+    iterator begin() const { return iterator(0); }
+    iterator end() const { return iterator(grayCodeCount(bits)); }
+    uint64_t size() const { return grayCodeCount(bits); }
+    uint32_t operator[](uint64_t rank) const { return grayEncode(static_cast<uint32_t>(rank)); }
+    string toString(uint64_t rank) const { return grayCodeToString((*this)[rank], bits); }
+};
+
+#endif // GRAY_CODE_H
@@ -1,7 +1,95 @@
 #include "funcs.h"
+#include "multiset_server.h"
+#include "op_stats.h"
+#include <csignal>
+#include <fstream>
 
-int main() {
-    srand(time(0));
+static MultisetServer* activeServer = 0;
+
+static void stopServer(int) {
+    if (activeServer) activeServer->stop();
+}
+
+static void writeStatsJson(const string& path) {
+    if (path.empty()) return;
+    ofstream file(path.c_str());
+    if (!file) {
+        cerr << "Cannot write " << path << endl;
+        return;
+    }
+    writeOpStatsJson(file);
+}
+
+int main(int argc, char* argv[]) {
+    // --stats records per-operation statistics and reports them at the end
+    // (a table, or JSON with --stats-json <path>); --seed <n> makes the
+    // automatically created multisets reproducible
+    vector<string> args;
+    string statsJsonPath;
+    bool seeded = false;
+    uint64_t seed = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stats") {
+            setOpStatsEnabled(true);
+        } else if (arg == "--stats-json" && i + 1 < argc) {
+            setOpStatsEnabled(true);
+            statsJsonPath = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seeded = true;
+            seed = strtoull(argv[++i], 0, 10);
+        } else {
+            args.push_back(arg);
+        }
+    }
+    
+    // Batch mode: lab1 --batch [script]  (reads stdin when no script is given)
+    if (!args.empty() && args[0] == "--batch") {
+        MultisetProgram program;
+        int failures;
+        if (args.size() > 1) {
+            ifstream script(args[1].c_str());
+            if (!script) {
+                cerr << "Cannot open script " << args[1] << endl;
+                return 2;
+            }
+            failures = program.runBatch(script, cout);
+        } else {
+            failures = program.runBatch(cin, cout);
+        }
+        if (opStatsEnabled() && statsJsonPath.empty()) {
+            printOpStats(cerr); // stdout carries the result protocol
+        }
+        writeStatsJson(statsJsonPath);
+        return failures == 0 ? 0 : 1;
+    }
+    
+    // Server mode: lab1 --serve <socket>  (batch commands over a Unix socket;
+    // SIGINT / SIGTERM or a "shutdown" request stop it)
+    if (!args.empty() && args[0] == "--serve") {
+        if (args.size() != 2) {
+            cerr << "Usage: lab1 --serve <socket path>" << endl;
+            return 2;
+        }
+        try {
+            MultisetServer server(args[1]);
+            struct Registration { // unregisters before the server is destroyed, even on a throw
+                explicit Registration(MultisetServer* server) { activeServer = server; }
+                ~Registration() { activeServer = 0; }
+            } registration(&server);
+            signal(SIGINT, stopServer);
+            signal(SIGTERM, stopServer);
+            server.serve();
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        if (opStatsEnabled() && statsJsonPath.empty()) {
+            printOpStats(cerr);
+        }
+        writeStatsJson(statsJsonPath);
+        return 0;
+    }
     
     cout << "Choose mode:\n";
     cout << "1. Run main program\n";
@@ -17,7 +105,9 @@ int main() {
     
     if (choice == 1) {
         MultisetProgram program;
-        program.run();
+        if (seeded) program.setRandomSeed(seed);
+        program.run(); // prints the statistics table when recording
+        writeStatsJson(statsJsonPath);
     } else {
         runTests();
     }
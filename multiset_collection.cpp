@@ -0,0 +1,302 @@
+#include "multiset_collection.h"
+#include "multiset_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+enum CollectionOp {
+    COLLECTION_UNION,
+    COLLECTION_INTERSECTION,
+    COLLECTION_SUM,
+    COLLECTION_THRESHOLD
+};
+
+const size_t FOLD_TILE = 2048; // output ranks kept in L1 while the inputs stream past
+
+// One input of the dense pass: a multiplicity array or sorted sparse entries
+struct FoldInput {
+    const int* counts;
+    const SparseEntry* entries;
+    size_t support;
+};
+
+FoldInput denseInput(const DenseMultiset& multiset) {
+    FoldInput input = {multiset.data(), 0, 0};
+    return input;
+}
+
+FoldInput sparseInput(const SparseMultiset& multiset) {
+    FoldInput input = {0, multiset.getEntries().data(), multiset.support()};
+    return input;
+}
+
+int additiveElement(int a, int b, int cap) {
+    long long value = static_cast<long long>(a) + b;
+    return value < cap ? static_cast<int>(value) : cap;
+}
+
+int presenceElement(int present, size_t threshold, int cap) {
+    return static_cast<size_t>(present) >= threshold ? min(1, cap) : 0;
+}
+
+void requireInputs(size_t count, size_t threshold) {
+    if (count == 0) throw invalid_argument("multiset collection: at least one multiset is required");
+    if (threshold == 0) throw invalid_argument("multiset collection: threshold must be positive");
+}
+
+void requireSameUniverse(int width1, size_t size1, int width2, size_t size2) {
+    if (width1 != width2 || size1 != size2) {
+        throw invalid_argument("multiset collection: operands belong to different universes");
+    }
+}
+
+// Folds one input into out[begin, end); threshold counts presences
+void foldTile(CollectionOp op, const FoldInput& input, const int* caps, int* out, size_t begin, size_t end) {
+    size_t n = end - begin;
+    if (input.counts) {
+        const int* a = input.counts;
+        switch (op) {
+            case COLLECTION_UNION: unionKernel(out + begin, a + begin, caps + begin, out + begin, n); break;
+            case COLLECTION_INTERSECTION: intersectionKernel(out + begin, a + begin, caps + begin, out + begin, n); break;
+            case COLLECTION_SUM:
+                for (size_t i = begin; i < end; i++) out[i] = additiveElement(out[i], a[i], caps[i]);
+                break;
+            case COLLECTION_THRESHOLD:
+                for (size_t i = begin; i < end; i++) out[i] += a[i] > 0;
+                break;
+        }
+        return;
+    }
+    // Sparse input: only its entries in the tile; absent ranks count as 0
+    SparseEntry key = {static_cast<uint32_t>(begin), 0};
+    const SparseEntry* entry = lower_bound(input.entries, input.entries + input.support, key,
+                                           [](const SparseEntry& x, const SparseEntry& y) { return x.rank < y.rank; });
+    const SparseEntry* last = input.entries + input.support;
+    size_t next = begin; // intersection: ranks before this are settled
+    for (; entry != last && entry->rank < end; ++entry) {
+        size_t r = entry->rank;
+        switch (op) {
+            case COLLECTION_UNION: out[r] = unionElement(out[r], entry->multiplicity, caps[r]); break;
+            case COLLECTION_INTERSECTION:
+                fill(out + next, out + r, 0);
+                out[r] = intersectionElement(out[r], entry->multiplicity, caps[r]);
+                next = r + 1;
+                break;
+            case COLLECTION_SUM: out[r] = additiveElement(out[r], entry->multiplicity, caps[r]); break;
+            case COLLECTION_THRESHOLD: out[r] += entry->multiplicity > 0; break;
+        }
+    }
+    if (op == COLLECTION_INTERSECTION) fill(out + next, out + end, 0);
+}
+
+// Single pass over the ranks: each tile starts from the identity of the
+// operation and folds in every input before moving on
+DenseMultiset densePass(CollectionOp op, const vector<FoldInput>& inputs, int bitWidth, const CapArray& caps,
+                        size_t threshold) {
+    DenseMultiset result(bitWidth, caps);
+    int* out = result.data();
+    const int* capData = result.capData();
+    parallelFor(result.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; tile += FOLD_TILE) {
+            size_t tileEnd = min(end, tile + FOLD_TILE);
+            if (op == COLLECTION_INTERSECTION) copy(capData + tile, capData + tileEnd, out + tile);
+            for (size_t k = 0; k < inputs.size(); k++) foldTile(op, inputs[k], capData, out, tile, tileEnd);
+            if (op == COLLECTION_THRESHOLD) {
+                for (size_t i = tile; i < tileEnd; i++) out[i] = presenceElement(out[i], threshold, capData[i]);
+            }
+        }
+    });
+    return result;
+}
+
+// k-way merge: a heap holds the next rank of every input that has one
+SparseMultiset sparseMerge(CollectionOp op, const vector<const SparseMultiset*>& inputs, size_t threshold) {
+    const SparseMultiset& first = *inputs[0];
+    SparseMultiset result(first.getBitWidth(), first.sharedCaps());
+    typedef pair<uint32_t, size_t> Cursor; // (rank, input)
+    priority_queue<Cursor, vector<Cursor>, greater<Cursor> > heap;
+    vector<size_t> position(inputs.size(), 0);
+    for (size_t k = 0; k < inputs.size(); k++) {
+        if (inputs[k]->support() > 0) heap.push(Cursor(inputs[k]->getEntries()[0].rank, k));
+        else if (op == COLLECTION_INTERSECTION) return result;
+    }
+    while (!heap.empty()) {
+        uint32_t rank = heap.top().first;
+        size_t inputsAtRank = 0, present = 0;
+        int value = 0;
+        while (!heap.empty() && heap.top().first == rank) {
+            size_t k = heap.top().second;
+            heap.pop();
+            const vector<SparseEntry>& entries = inputs[k]->getEntries();
+            int multiplicity = entries[position[k]].multiplicity;
+            if (inputsAtRank == 0) value = multiplicity;
+            else if (op == COLLECTION_UNION) value = max(value, multiplicity);
+            else if (op == COLLECTION_INTERSECTION) value = min(value, multiplicity);
+            else if (op == COLLECTION_SUM) value = additiveElement(value, multiplicity, first.cap(rank));
+            inputsAtRank++;
+            present += multiplicity > 0;
+            if (++position[k] < entries.size()) heap.push(Cursor(entries[position[k]].rank, k));
+        }
+        int cap = first.cap(rank);
+        switch (op) {
+            case COLLECTION_UNION: value = unionElement(value, 0, cap); break;
+            case COLLECTION_INTERSECTION: value = inputsAtRank == inputs.size() ? intersectionElement(value, value, cap) : 0; break;
+            case COLLECTION_SUM: value = min(value, cap); break;
+            case COLLECTION_THRESHOLD: value = presenceElement(static_cast<int>(present), threshold, cap); break;
+        }
+        if (value != 0) result.append(rank, value);
+    }
+    return result;
+}
+
+DenseMultiset denseAll(CollectionOp op, const vector<const DenseMultiset*>& inputs, size_t threshold) {
+    requireInputs(inputs.size(), threshold);
+    vector<FoldInput> folds;
+    for (size_t k = 0; k < inputs.size(); k++) {
+        requireSameUniverse(inputs[0]->getBitWidth(), inputs[0]->size(), inputs[k]->getBitWidth(), inputs[k]->size());
+        folds.push_back(denseInput(*inputs[k]));
+    }
+    return densePass(op, folds, inputs[0]->getBitWidth(), inputs[0]->sharedCaps(), threshold);
+}
+
+SparseMultiset sparseAll(CollectionOp op, const vector<const SparseMultiset*>& inputs, size_t threshold) {
+    requireInputs(inputs.size(), threshold);
+    for (size_t k = 1; k < inputs.size(); k++) {
+        requireSameUniverse(inputs[0]->getBitWidth(), inputs[0]->size(), inputs[k]->getBitWidth(), inputs[k]->size());
+    }
+    return sparseMerge(op, inputs, threshold);
+}
+
+AdaptiveMultiset adaptiveAll(CollectionOp op, const vector<const AdaptiveMultiset*>& inputs, size_t threshold) {
+    requireInputs(inputs.size(), threshold);
+    bool allSparse = true;
+    for (size_t k = 0; k < inputs.size(); k++) {
+        requireSameUniverse(inputs[0]->getBitWidth(), inputs[0]->size(), inputs[k]->getBitWidth(), inputs[k]->size());
+        allSparse = allSparse && inputs[k]->isSparse();
+    }
+    if (allSparse) {
+        vector<const SparseMultiset*> sparse;
+        for (size_t k = 0; k < inputs.size(); k++) sparse.push_back(&inputs[k]->getSparse());
+        return AdaptiveMultiset(sparseMerge(op, sparse, threshold));
+    }
+    vector<FoldInput> folds;
+    vector<DenseMultiset> scratch(inputs.size()); // dense forms of bitset operands
+    for (size_t k = 0; k < inputs.size(); k++) {
+        folds.push_back(inputs[k]->isSparse() ? sparseInput(inputs[k]->getSparse())
+                                              : denseInput(inputs[k]->denseForm(scratch[k])));
+    }
+    const AdaptiveMultiset& first = *inputs[0];
+    const CapArray& caps = first.sharedCaps();
+    return AdaptiveMultiset(densePass(op, folds, first.getBitWidth(), caps, threshold));
+}
+
+} // namespace
+
+DenseMultiset unionAll(const vector<const DenseMultiset*>& inputs) {
+    return denseAll(COLLECTION_UNION, inputs, 1);
+}
+
+DenseMultiset intersectionAll(const vector<const DenseMultiset*>& inputs) {
+    return denseAll(COLLECTION_INTERSECTION, inputs, 1);
+}
+
+DenseMultiset additiveUnionAll(const vector<const DenseMultiset*>& inputs) {
+    return denseAll(COLLECTION_SUM, inputs, 1);
+}
+
+DenseMultiset atLeastAll(const vector<const DenseMultiset*>& inputs, size_t threshold) {
+    return denseAll(COLLECTION_THRESHOLD, inputs, threshold);
+}
+
+SparseMultiset unionAll(const vector<const SparseMultiset*>& inputs) {
+    return sparseAll(COLLECTION_UNION, inputs, 1);
+}
+
+SparseMultiset intersectionAll(const vector<const SparseMultiset*>& inputs) {
+    return sparseAll(COLLECTION_INTERSECTION, inputs, 1);
+}
+
+SparseMultiset additiveUnionAll(const vector<const SparseMultiset*>& inputs) {
+    return sparseAll(COLLECTION_SUM, inputs, 1);
+}
+
+SparseMultiset atLeastAll(const vector<const SparseMultiset*>& inputs, size_t threshold) {
+    return sparseAll(COLLECTION_THRESHOLD, inputs, threshold);
+}
+
+AdaptiveMultiset unionAll(const vector<const AdaptiveMultiset*>& inputs) {
+    return adaptiveAll(COLLECTION_UNION, inputs, 1);
+}
+
+AdaptiveMultiset intersectionAll(const vector<const AdaptiveMultiset*>& inputs) {
+    return adaptiveAll(COLLECTION_INTERSECTION, inputs, 1);
+}
+
+AdaptiveMultiset additiveUnionAll(const vector<const AdaptiveMultiset*>& inputs) {
+    return adaptiveAll(COLLECTION_SUM, inputs, 1);
+}
+
+AdaptiveMultiset atLeastAll(const vector<const AdaptiveMultiset*>& inputs, size_t threshold) {
+    return adaptiveAll(COLLECTION_THRESHOLD, inputs, threshold);
+}
+
+// Named collection
+MultisetCollection::MultisetCollection() : bitWidth(0) {}
+
+MultisetCollection::MultisetCollection(int bitWidth, const CapArray& caps) : bitWidth(bitWidth), caps(caps) {}
+
+vector<string> MultisetCollection::names() const {
+    vector<string> result;
+    for (map<string, AdaptiveMultiset>::const_iterator it = members.begin(); it != members.end(); ++it) {
+        result.push_back(it->first);
+    }
+    return result;
+}
+
+void MultisetCollection::add(const string& name, const AdaptiveMultiset& multiset) {
+    requireSameUniverse(bitWidth, caps ? caps->size() : 0, multiset.getBitWidth(), multiset.size());
+    members[name] = multiset;
+}
+
+bool MultisetCollection::remove(const string& name) {
+    return members.erase(name) != 0;
+}
+
+const AdaptiveMultiset& MultisetCollection::get(const string& name) const {
+    map<string, AdaptiveMultiset>::const_iterator it = members.find(name);
+    if (it == members.end()) throw invalid_argument("multiset collection: unknown multiset '" + name + "'");
+    return it->second;
+}
+
+vector<const AdaptiveMultiset*> MultisetCollection::select(const vector<string>& names) const {
+    vector<const AdaptiveMultiset*> result;
+    if (names.empty()) {
+        for (map<string, AdaptiveMultiset>::const_iterator it = members.begin(); it != members.end(); ++it) {
+            result.push_back(&it->second);
+        }
+    } else {
+        for (size_t i = 0; i < names.size(); i++) result.push_back(&get(names[i]));
+    }
+    return result;
+}
+
+AdaptiveMultiset MultisetCollection::unionAll(const vector<string>& names) const {
+    return ::unionAll(select(names));
+}
+
+AdaptiveMultiset MultisetCollection::intersectionAll(const vector<string>& names) const {
+    return ::intersectionAll(select(names));
+}
+
+AdaptiveMultiset MultisetCollection::additiveUnionAll(const vector<string>& names) const {
+    return ::additiveUnionAll(select(names));
+}
+
+AdaptiveMultiset MultisetCollection::atLeast(size_t threshold, const vector<string>& names) const {
+    return ::atLeastAll(select(names), threshold);
+}
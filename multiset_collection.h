@@ -0,0 +1,73 @@
+#ifndef MULTISET_COLLECTION_H
+#define MULTISET_COLLECTION_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "adaptive_multiset.h"
+
+using namespace std;
+
+// N-ary operations over K multisets of one universe, for non-negative
+// multiplicities; the result takes the caps of the first input:
+//   unionAll          out = min(max of the K multiplicities, cap)
+//   intersectionAll   out = min(min of the K multiplicities, cap)
+//   additiveUnionAll  out = min(sum of the K multiplicities, cap)
+//   atLeastAll        out = min(1, cap) for elements present in at least
+//                     `threshold` inputs (threshold >= 1), 0 otherwise
+// Sparse inputs are combined by one k-way merge over their sorted entries.
+// Dense (or mixed) inputs are combined in a single pass over the ranks: the
+// output is built in cache-sized tiles, each folding in all K inputs through
+// the SIMD kernels, so no intermediate multisets are made and the extra
+// memory does not depend on K. Results equal the pairwise folds.
+DenseMultiset unionAll(const vector<const DenseMultiset*>& inputs);
+DenseMultiset intersectionAll(const vector<const DenseMultiset*>& inputs);
+DenseMultiset additiveUnionAll(const vector<const DenseMultiset*>& inputs);
+DenseMultiset atLeastAll(const vector<const DenseMultiset*>& inputs, size_t threshold);
+
+SparseMultiset unionAll(const vector<const SparseMultiset*>& inputs);
+SparseMultiset intersectionAll(const vector<const SparseMultiset*>& inputs);
+SparseMultiset additiveUnionAll(const vector<const SparseMultiset*>& inputs);
+SparseMultiset atLeastAll(const vector<const SparseMultiset*>& inputs, size_t threshold);
+
+// All sparse inputs are merged, anything else takes the dense pass; the
+// result then follows the storage policy
+AdaptiveMultiset unionAll(const vector<const AdaptiveMultiset*>& inputs);
+AdaptiveMultiset intersectionAll(const vector<const AdaptiveMultiset*>& inputs);
+AdaptiveMultiset additiveUnionAll(const vector<const AdaptiveMultiset*>& inputs);
+AdaptiveMultiset atLeastAll(const vector<const AdaptiveMultiset*>& inputs, size_t threshold);
+
+// Named multisets of one universe, combined all at once
+class MultisetCollection {
+private:
+    int bitWidth;
+    CapArray caps;
+    map<string, AdaptiveMultiset> members;
+
+public:
+    MultisetCollection();
+    MultisetCollection(int bitWidth, const CapArray& caps);
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return members.size(); }
+    bool contains(const string& name) const { return members.count(name) != 0; }
+    vector<string> names() const; // sorted
+
+    void add(const string& name, const AdaptiveMultiset& multiset); // replaces a member of the same name
+    bool remove(const string& name);
+    void clear() { members.clear(); }
+    const AdaptiveMultiset& get(const string& name) const;
+
+    // Members by name, or every member when names is empty
+    vector<const AdaptiveMultiset*> select(const vector<string>& names = vector<string>()) const;
+
+    AdaptiveMultiset unionAll(const vector<string>& names = vector<string>()) const;
+    AdaptiveMultiset intersectionAll(const vector<string>& names = vector<string>()) const;
+    AdaptiveMultiset additiveUnionAll(const vector<string>& names = vector<string>()) const;
+    AdaptiveMultiset atLeast(size_t threshold, const vector<string>& names = vector<string>()) const;
+};
+
+#endif // MULTISET_COLLECTION_H
@@ -0,0 +1,241 @@
+#include "multiset_export.h"
+#include "gray_code.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool parseExportFormat(const string& name, ExportFormat& format) {
+    if (name == "csv") {
+        format = EXPORT_CSV;
+    } else if (name == "jsonl") {
+        format = EXPORT_JSON_LINES;
+    } else if (name == "binary") {
+        format = EXPORT_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ExportWriter::ExportWriter(const string& path, size_t bufferBytes)
+    : fd(-1), ownsFd(false), buffer(bufferBytes < 4096 ? 4096 : bufferBytes), used(0), written(0) {
+    if (path == "-") {
+        fd = STDOUT_FILENO;
+        // Anything already printed through the streams goes first
+        cout.flush();
+        fflush(stdout);
+    } else {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw runtime_error("cannot create " + path);
+        ownsFd = true;
+    }
+}
+
+ExportWriter::ExportWriter(int fd, size_t bufferBytes)
+    : fd(fd), ownsFd(false), buffer(bufferBytes < 4096 ? 4096 : bufferBytes), used(0), written(0) {}
+
+ExportWriter::~ExportWriter() {
+    try {
+        flush();
+    } catch (const runtime_error&) {
+    }
+    if (ownsFd) close(fd);
+}
+
+void ExportWriter::drain() {
+    size_t sent = 0;
+    while (sent < used) {
+        ssize_t wrote = write(fd, buffer.data() + sent, used - sent);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            used = 0; // drop the rest so the destructor does not retry
+            throw runtime_error(string("export: write failed: ") + strerror(errno));
+        }
+        sent += static_cast<size_t>(wrote);
+    }
+    written += used;
+    used = 0;
+}
+
+char* ExportWriter::reserve(size_t bytes) {
+    if (buffer.size() - used < bytes) {
+        drain();
+        if (buffer.size() < bytes) buffer.resize(bytes);
+    }
+    return buffer.data() + used;
+}
+
+void ExportWriter::append(const char* data, size_t length) {
+    if (length >= buffer.size()) {
+        // Too big to be worth copying: write it through
+        drain();
+        size_t sent = 0;
+        while (sent < length) {
+            ssize_t wrote = write(fd, data + sent, length - sent);
+            if (wrote < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("export: write failed: ") + strerror(errno));
+            }
+            sent += static_cast<size_t>(wrote);
+        }
+        written += length;
+        return;
+    }
+    memcpy(reserve(length), data, length);
+    used += length;
+}
+
+void ExportWriter::flush() {
+    if (used > 0) drain();
+}
+
+// "00" .. "99", so each division by 100 yields two digits
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t formatUnsigned(uint64_t value, char* out) {
+    char digits[20];
+    size_t pos = sizeof(digits);
+    while (value >= 100) {
+        const char* pair = DIGIT_PAIRS + (value % 100) * 2;
+        value /= 100;
+        digits[--pos] = pair[1];
+        digits[--pos] = pair[0];
+    }
+    if (value >= 10) {
+        const char* pair = DIGIT_PAIRS + value * 2;
+        digits[--pos] = pair[1];
+        digits[--pos] = pair[0];
+    } else {
+        digits[--pos] = static_cast<char>('0' + value);
+    }
+    size_t length = sizeof(digits) - pos;
+    memcpy(out, digits + pos, length);
+    return length;
+}
+
+size_t formatInteger(long long value, char* out) {
+    if (value >= 0) return formatUnsigned(static_cast<uint64_t>(value), out);
+    *out = '-';
+    return 1 + formatUnsigned(~static_cast<uint64_t>(value) + 1, out + 1);
+}
+
+static size_t appendLiteral(char* out, const char* text) {
+    size_t length = strlen(text);
+    memcpy(out, text, length);
+    return length;
+}
+
+static size_t formatCode(uint32_t code, int bitWidth, char* out) {
+    for (int i = bitWidth - 1; i >= 0; i--, code >>= 1) out[i] = static_cast<char>('0' + (code & 1u));
+    return static_cast<size_t>(bitWidth);
+}
+
+namespace {
+
+// Writes the records of one multiset; counts records and bytes
+class RecordEmitter {
+private:
+    ExportWriter& out;
+    ExportFormat format;
+    int bitWidth;
+    size_t recordBytes; // upper bound for one text record
+    uint64_t startBytes;
+    uint64_t records;
+
+public:
+    RecordEmitter(ExportWriter& out, ExportFormat format, int bitWidth)
+        : out(out), format(format), bitWidth(bitWidth), recordBytes(96 + static_cast<size_t>(bitWidth)),
+          startBytes(out.bytesWritten()), records(0) {
+        if (format == EXPORT_CSV) out.append("code,rank,multiplicity,cap\n", 27);
+    }
+
+    void emit(uint32_t rank, int multiplicity, int cap) {
+        records++;
+        if (format == EXPORT_BINARY) {
+            int32_t record[3] = {static_cast<int32_t>(rank), multiplicity, cap};
+            memcpy(out.reserve(sizeof(record)), record, sizeof(record));
+            out.commit(sizeof(record));
+            return;
+        }
+        char* start = out.reserve(recordBytes);
+        char* p = start;
+        if (format == EXPORT_CSV) {
+            p += formatCode(grayEncode(rank), bitWidth, p);
+            *p++ = ',';
+            p += formatUnsigned(rank, p);
+            *p++ = ',';
+            p += formatInteger(multiplicity, p);
+            *p++ = ',';
+            p += formatInteger(cap, p);
+        } else {
+            p += appendLiteral(p, "{\"code\":\"");
+            p += formatCode(grayEncode(rank), bitWidth, p);
+            p += appendLiteral(p, "\",\"rank\":");
+            p += formatUnsigned(rank, p);
+            p += appendLiteral(p, ",\"multiplicity\":");
+            p += formatInteger(multiplicity, p);
+            p += appendLiteral(p, ",\"cap\":");
+            p += formatInteger(cap, p);
+            *p++ = '}';
+        }
+        *p++ = '\n';
+        out.commit(static_cast<size_t>(p - start));
+    }
+
+    ExportStats finish() const {
+        ExportStats stats;
+        stats.records = records;
+        stats.bytes = out.bytesWritten() - startBytes;
+        return stats;
+    }
+};
+
+} // namespace
+
+ExportStats exportMultiset(ExportWriter& out, const DenseView& multiset, const ExportOptions& options) {
+    RecordEmitter emitter(out, options.format, multiset.bitWidth);
+    for (size_t i = 0; i < multiset.size; i++) {
+        if (multiset.counts[i] == 0 && !options.includeZeros) continue;
+        emitter.emit(static_cast<uint32_t>(i), multiset.counts[i], multiset.caps[i]);
+    }
+    return emitter.finish();
+}
+
+ExportStats exportMultiset(ExportWriter& out, const SparseView& multiset, const ExportOptions& options) {
+    RecordEmitter emitter(out, options.format, multiset.bitWidth);
+    if (options.includeZeros) {
+        // Walk the universe, filling the gaps between entries
+        size_t next = 0;
+        for (size_t i = 0; i < multiset.size; i++) {
+            int multiplicity = 0;
+            if (next < multiset.support && multiset.entries[next].rank == i) multiplicity = multiset.entries[next++].multiplicity;
+            emitter.emit(static_cast<uint32_t>(i), multiplicity, multiset.caps[i]);
+        }
+    } else {
+        for (size_t i = 0; i < multiset.support; i++) {
+            const SparseEntry& entry = multiset.entries[i];
+            emitter.emit(entry.rank, entry.multiplicity, multiset.caps[entry.rank]);
+        }
+    }
+    return emitter.finish();
+}
+
+ExportStats exportMultiset(ExportWriter& out, const AdaptiveMultiset& multiset, const ExportOptions& options) {
+    DenseMultiset scratch;
+    return multiset.isSparse() ? exportMultiset(out, multiset.getSparse().view(), options)
+                               : exportMultiset(out, multiset.denseForm(scratch).view(), options);
+}
+
+ExportStats exportMultisetFile(const string& path, const AdaptiveMultiset& multiset, const ExportOptions& options) {
+    ExportWriter out(path, options.bufferBytes);
+    ExportStats stats = exportMultiset(out, multiset, options);
+    out.flush();
+    return stats;
+}
@@ -0,0 +1,81 @@
+#ifndef MULTISET_EXPORT_H
+#define MULTISET_EXPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "adaptive_multiset.h"
+
+using namespace std;
+
+// Output formats, one record per element in rank order:
+//   CSV         header "code,rank,multiplicity,cap", then e.g. "0110,4,3,5"
+//   JSON lines  {"code":"0110","rank":4,"multiplicity":3,"cap":5}
+//   binary      {uint32 rank, int32 multiplicity, int32 cap}, host byte order, no header
+enum ExportFormat {
+    EXPORT_CSV = 0,
+    EXPORT_JSON_LINES = 1,
+    EXPORT_BINARY = 2
+};
+
+bool parseExportFormat(const string& name, ExportFormat& format); // "csv", "jsonl", "binary"
+
+struct ExportOptions {
+    ExportFormat format;
+    bool includeZeros; // also write elements with multiplicity 0
+    size_t bufferBytes;
+
+    ExportOptions() : format(EXPORT_CSV), includeZeros(false), bufferBytes(size_t(1) << 20) {}
+};
+
+struct ExportStats {
+    uint64_t records;
+    uint64_t bytes;
+};
+
+// Buffered writer over a file descriptor: output is formatted straight into
+// one large buffer and handed to write(2) when it fills, never per line.
+// Throws runtime_error on I/O failure.
+class ExportWriter {
+private:
+    int fd;
+    bool ownsFd;
+    vector<char> buffer;
+    size_t used;
+    uint64_t written;
+
+    void drain();
+
+    ExportWriter(const ExportWriter&);
+    ExportWriter& operator=(const ExportWriter&);
+
+public:
+    explicit ExportWriter(const string& path, size_t bufferBytes = size_t(1) << 20); // "-" is stdout
+    ExportWriter(int fd, size_t bufferBytes); // not closed by the writer
+    ~ExportWriter(); // flushes; errors are lost, call flush() to see them
+
+    // Room for at least `bytes` more characters; returns where to write them
+    char* reserve(size_t bytes);
+    void commit(size_t bytes) { used += bytes; }
+    void append(const char* data, size_t length);
+    void flush();
+    uint64_t bytesWritten() const { return written + used; }
+};
+
+// Decimal digits of value at out; returns the number written (at most 20)
+size_t formatUnsigned(uint64_t value, char* out);
+size_t formatInteger(long long value, char* out);
+
+ExportStats exportMultiset(ExportWriter& out, const DenseView& multiset, const ExportOptions& options = ExportOptions());
+ExportStats exportMultiset(ExportWriter& out, const SparseView& multiset, const ExportOptions& options = ExportOptions());
+ExportStats exportMultiset(ExportWriter& out, const AdaptiveMultiset& multiset,
+                           const ExportOptions& options = ExportOptions());
+
+// Whole file ("-" for stdout), flushed before returning
+ExportStats exportMultisetFile(const string& path, const AdaptiveMultiset& multiset,
+                               const ExportOptions& options = ExportOptions());
+
+#endif // MULTISET_EXPORT_H
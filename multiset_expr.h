@@ -0,0 +1,262 @@
+#ifndef MULTISET_EXPR_H
+#define MULTISET_EXPR_H
+
+#include "dense_multiset.h"
+#include "multiset_kernels.h"
+#include "product_engine.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+// Lazy expressions over dense multisets. Writing a | b, a & b, a - b, a ^ b,
+// ~a or clampToCaps(a) on DenseMultiset or DenseView operands builds a small
+// expression object instead of a result; evaluate() then computes the whole
+// tree in one pass over the universe, and sumMultisets / productMultisets /
+// weightedSum reduce it without materializing anything:
+//
+//   DenseMultiset sym = evaluate((a - b) | (b - a));
+//   long long w = weightedSum(a & b);
+//
+// Every node gives the same values as the corresponding materialized
+// operation, including its cap (a binary result takes the first operand's
+// caps). Expressions hold pointers to their operands, so they must not
+// outlive them; evaluate them in the statement that builds them.
+
+struct MultisetExprBase {};
+
+// Leaf: one dense multiset or view
+class DenseTerm : public MultisetExprBase {
+private:
+    DenseView v;
+    const CapArray* owner; // caps a result can share, null for a view
+
+public:
+    explicit DenseTerm(const DenseMultiset& m) : v(m.view()), owner(&m.sharedCaps()) {}
+    explicit DenseTerm(const DenseView& view) : v(view), owner(0) {}
+
+    int at(size_t rank) const { return v.counts[rank]; }
+    int capAt(size_t rank) const { return v.caps[rank]; }
+    const DenseTerm& front() const { return *this; }
+    void checkUniverse(const DenseView& universe) const {
+        if (v.bitWidth != universe.bitWidth || v.size != universe.size) {
+            throw invalid_argument("DenseMultiset: operands belong to different universes");
+        }
+    }
+
+    const DenseView& view() const { return v; }
+    CapArray sharedCaps() const { return owner ? *owner : makeCapArray(vector<int>(v.caps, v.caps + v.size)); }
+};
+
+template <typename L, typename R>
+class BinaryExpr : public MultisetExprBase {
+protected:
+    L left;
+    R right;
+
+public:
+    BinaryExpr(const L& left, const R& right) : left(left), right(right) {}
+
+    int capAt(size_t rank) const { return left.capAt(rank); }
+    const DenseTerm& front() const { return left.front(); }
+    void checkUniverse(const DenseView& universe) const {
+        left.checkUniverse(universe);
+        right.checkUniverse(universe);
+    }
+};
+
+template <typename L, typename R>
+class UnionExpr : public BinaryExpr<L, R> {
+public:
+    UnionExpr(const L& left, const R& right) : BinaryExpr<L, R>(left, right) {}
+    int at(size_t rank) const {
+        return unionElement(this->left.at(rank), this->right.at(rank), this->left.capAt(rank));
+    }
+};
+
+template <typename L, typename R>
+class IntersectionExpr : public BinaryExpr<L, R> {
+public:
+    IntersectionExpr(const L& left, const R& right) : BinaryExpr<L, R>(left, right) {}
+    int at(size_t rank) const {
+        return intersectionElement(this->left.at(rank), this->right.at(rank), this->left.capAt(rank));
+    }
+};
+
+template <typename L, typename R>
+class DifferenceExpr : public BinaryExpr<L, R> {
+public:
+    DifferenceExpr(const L& left, const R& right) : BinaryExpr<L, R>(left, right) {}
+    int at(size_t rank) const {
+        return differenceElement(this->left.at(rank), this->right.at(rank), this->left.capAt(rank));
+    }
+};
+
+template <typename L, typename R>
+class SymmetricDifferenceExpr : public BinaryExpr<L, R> {
+public:
+    SymmetricDifferenceExpr(const L& left, const R& right) : BinaryExpr<L, R>(left, right) {}
+    int at(size_t rank) const {
+        return symmetricDifferenceElement(this->left.at(rank), this->right.at(rank),
+                                          this->left.capAt(rank), this->right.capAt(rank));
+    }
+};
+
+template <typename E>
+class ComplementExpr : public MultisetExprBase {
+private:
+    E operand;
+
+public:
+    explicit ComplementExpr(const E& operand) : operand(operand) {}
+    int at(size_t rank) const { return complementElement(operand.at(rank), operand.capAt(rank)); }
+    int capAt(size_t rank) const { return operand.capAt(rank); }
+    const DenseTerm& front() const { return operand.front(); }
+    void checkUniverse(const DenseView& universe) const { operand.checkUniverse(universe); }
+};
+
+// Multiplicities forced into [0, cap]; for operands that were filled
+// without the caps (raw counts, mapped files)
+template <typename E>
+class ClampExpr : public MultisetExprBase {
+private:
+    E operand;
+
+public:
+    explicit ClampExpr(const E& operand) : operand(operand) {}
+    int at(size_t rank) const {
+        int value = operand.at(rank);
+        int cap = operand.capAt(rank);
+        return value < 0 ? 0 : (value < cap ? value : cap);
+    }
+    int capAt(size_t rank) const { return operand.capAt(rank); }
+    const DenseTerm& front() const { return operand.front(); }
+    void checkUniverse(const DenseView& universe) const { operand.checkUniverse(universe); }
+};
+
+// Operand type of an expression: multisets and views become leaves, expression
+// nodes are used as they are. Anything else has no ExprOperand::type, which
+// keeps the operators below out of overload resolution.
+template <typename T, typename Enable = void>
+struct ExprOperand {};
+
+template <typename T>
+struct ExprOperand<T, typename enable_if<is_base_of<MultisetExprBase, T>::value>::type> {
+    typedef T type;
+    static const T& wrap(const T& expr) { return expr; }
+};
+
+template <>
+struct ExprOperand<DenseMultiset> {
+    typedef DenseTerm type;
+    static DenseTerm wrap(const DenseMultiset& m) { return DenseTerm(m); }
+};
+
+template <>
+struct ExprOperand<DenseView> {
+    typedef DenseTerm type;
+    static DenseTerm wrap(const DenseView& v) { return DenseTerm(v); }
+};
+
+template <typename L, typename R>
+UnionExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type> operator|(const L& l, const R& r) {
+    return UnionExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type>(
+        ExprOperand<L>::wrap(l), ExprOperand<R>::wrap(r));
+}
+
+template <typename L, typename R>
+IntersectionExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type> operator&(const L& l, const R& r) {
+    return IntersectionExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type>(
+        ExprOperand<L>::wrap(l), ExprOperand<R>::wrap(r));
+}
+
+template <typename L, typename R>
+DifferenceExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type> operator-(const L& l, const R& r) {
+    return DifferenceExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type>(
+        ExprOperand<L>::wrap(l), ExprOperand<R>::wrap(r));
+}
+
+template <typename L, typename R>
+SymmetricDifferenceExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type> operator^(const L& l, const R& r) {
+    return SymmetricDifferenceExpr<typename ExprOperand<L>::type, typename ExprOperand<R>::type>(
+        ExprOperand<L>::wrap(l), ExprOperand<R>::wrap(r));
+}
+
+template <typename E>
+ComplementExpr<typename ExprOperand<E>::type> operator~(const E& e) {
+    return ComplementExpr<typename ExprOperand<E>::type>(ExprOperand<E>::wrap(e));
+}
+
+template <typename E>
+ClampExpr<typename ExprOperand<E>::type> clampToCaps(const E& e) {
+    return ClampExpr<typename ExprOperand<E>::type>(ExprOperand<E>::wrap(e));
+}
+
+// Evaluation. dst takes the universe and caps of the leftmost operand and
+// keeps its buffer; it may itself be an operand, since every rank is read
+// before it is written.
+template <typename E>
+typename enable_if<is_base_of<MultisetExprBase, E>::value>::type evaluateInto(DenseMultiset& dst, const E& expr) {
+    const DenseView& universe = expr.front().view();
+    expr.checkUniverse(universe);
+    CapArray previous = dst.sharedCaps(); // an operand may still read these caps
+    dst.adoptUniverse(universe.bitWidth, expr.front().sharedCaps());
+    int* out = dst.data();
+    parallelFor(universe.size, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) out[i] = expr.at(i);
+    });
+}
+
+template <typename E>
+typename enable_if<is_base_of<MultisetExprBase, E>::value, DenseMultiset>::type evaluate(const E& expr) {
+    DenseMultiset result;
+    evaluateInto(result, expr);
+    return result;
+}
+
+// Reductions straight from an expression, with the same wrap-around
+// arithmetic as the DenseMultiset versions
+template <typename E>
+typename enable_if<is_base_of<MultisetExprBase, E>::value, int>::type sumMultisets(const E& expr) {
+    const DenseView& universe = expr.front().view();
+    expr.checkUniverse(universe);
+    unsigned sum = parallelReduce(universe.size, 0u, [&](size_t begin, size_t end) {
+        unsigned partial = 0;
+        for (size_t i = begin; i < end; i++) partial += static_cast<unsigned>(expr.at(i));
+        return partial;
+    }, [](unsigned a, unsigned b) { return a + b; });
+    return static_cast<int>(sum);
+}
+
+template <typename E>
+typename enable_if<is_base_of<MultisetExprBase, E>::value, int>::type productMultisets(const E& expr) {
+    const DenseView& universe = expr.front().view();
+    expr.checkUniverse(universe);
+    ProductHistogram histogram = parallelReduce(universe.size, ProductHistogram(), [&](size_t begin, size_t end) {
+        ProductHistogram partial;
+        for (size_t i = begin; i < end; i++) {
+            int value = expr.at(i);
+            if (value != 0) partial[value]++;
+        }
+        return partial;
+    }, mergeProductHistograms);
+    return checkedIntProduct(groupedFactors(histogram)); // throws overflow_error like the dense version
+}
+
+template <typename E>
+typename enable_if<is_base_of<MultisetExprBase, E>::value, long long>::type weightedSum(const E& expr) {
+    const DenseView& universe = expr.front().view();
+    expr.checkUniverse(universe);
+    unsigned long long total = parallelReduce(universe.size, 0ull, [&](size_t begin, size_t end) {
+        unsigned long long partial = 0;
+        for (size_t i = begin; i < end; i++) {
+            partial += static_cast<unsigned long long>(static_cast<long long>(expr.at(i)) * static_cast<long long>(i));
+        }
+        return partial;
+    }, [](unsigned long long a, unsigned long long b) { return a + b; });
+    return static_cast<long long>(total);
+}
+
+#endif // MULTISET_EXPR_H
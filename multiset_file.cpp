@@ -0,0 +1,232 @@
+#include "multiset_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t alignTo64(uint64_t offset) {
+    return (offset + 63) & ~uint64_t(63);
+}
+
+static MultisetFileHeader makeHeader(int bitWidth, bool sparse, uint64_t entryCount, uint64_t entryBytes) {
+    MultisetFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MULTISET_FILE_MAGIC, sizeof(header.magic));
+    header.version = MULTISET_FILE_VERSION;
+    header.byteOrder = MULTISET_FILE_BYTE_ORDER;
+    header.bitWidth = static_cast<uint32_t>(bitWidth);
+    header.counterWidth = sizeof(int);
+    header.flags = sparse ? MULTISET_FILE_SPARSE : 0;
+    header.entryCount = entryCount;
+    header.countsOffset = alignTo64(sizeof(MultisetFileHeader));
+    header.capsOffset = alignTo64(header.countsOffset + entryCount * entryBytes);
+    header.fileSize = header.capsOffset + (uint64_t(1) << bitWidth) * sizeof(int);
+    return header;
+}
+
+static void writeAt(FILE* file, uint64_t& position, uint64_t offset, const void* data, size_t bytes,
+                    const string& path) {
+    static const char padding[64] = {0};
+    if (offset > position && fwrite(padding, 1, static_cast<size_t>(offset - position), file) != offset - position) {
+        throw runtime_error("cannot write " + path);
+    }
+    if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes) {
+        throw runtime_error("cannot write " + path);
+    }
+    position = offset + bytes;
+}
+
+static void writeFile(const string& path, const MultisetFileHeader& header, const void* counts,
+                      size_t countBytes, const void* caps) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw runtime_error("cannot create " + path);
+    }
+    try {
+        uint64_t position = 0;
+        writeAt(file, position, 0, &header, sizeof(header), path);
+        writeAt(file, position, header.countsOffset, counts, countBytes, path);
+        writeAt(file, position, header.capsOffset, caps, static_cast<size_t>(header.fileSize - header.capsOffset), path);
+    } catch (...) {
+        fclose(file);
+        throw;
+    }
+    if (fclose(file) != 0) {
+        throw runtime_error("cannot write " + path);
+    }
+}
+
+// Writers
+void saveMultiset(const string& path, const DenseView& multiset) {
+    MultisetFileHeader header = makeHeader(multiset.bitWidth, false, multiset.size, sizeof(int));
+    writeFile(path, header, multiset.counts, multiset.size * sizeof(int), multiset.caps);
+}
+
+void saveMultiset(const string& path, const SparseView& multiset) {
+    MultisetFileHeader header = makeHeader(multiset.bitWidth, true, multiset.support, sizeof(SparseEntry));
+    writeFile(path, header, multiset.entries, multiset.support * sizeof(SparseEntry), multiset.caps);
+}
+
+void saveMultiset(const string& path, const DenseMultiset& multiset) {
+    saveMultiset(path, multiset.view());
+}
+
+void saveMultiset(const string& path, const SparseMultiset& multiset) {
+    saveMultiset(path, multiset.view());
+}
+
+void saveMultiset(const string& path, const AdaptiveMultiset& multiset) {
+    if (multiset.isSparse()) {
+        saveMultiset(path, multiset.getSparse().view());
+    } else {
+        DenseMultiset scratch;
+        saveMultiset(path, multiset.denseForm(scratch).view());
+    }
+}
+
+void saveMultiset(const string& path, const RunLengthMultiset& multiset) {
+    RunArray caps = RunArray::encode(multiset.sharedCaps()->data(), multiset.size());
+    const vector<uint8_t>& countBytes = multiset.getRuns().getBytes();
+    MultisetFileHeader header = makeHeader(multiset.getBitWidth(), false, countBytes.size(), 1);
+    header.flags = MULTISET_FILE_RUN_LENGTH;
+    header.fileSize = header.capsOffset + caps.getBytes().size();
+    writeFile(path, header, countBytes.data(), countBytes.size(), caps.getBytes().data());
+}
+
+// Memory-mapped reader
+
+// True when [offset, offset + bytes) ends at or before limit
+static bool fitsWithin(uint64_t offset, uint64_t bytes, uint64_t limit) {
+    return offset <= limit && bytes <= limit - offset;
+}
+
+MappedMultiset::MappedMultiset(const string& path) : address(MAP_FAILED), length(0), header(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("cannot open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MultisetFileHeader)) {
+        close(fd);
+        throw runtime_error(path + " is not a multiset file");
+    }
+    length = static_cast<size_t>(info.st_size);
+    address = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw runtime_error("cannot map " + path);
+    }
+
+    // Validate the header and the layout, so the views never point past the
+    // mapping; sizes are compared by subtraction to rule out overflow
+    header = static_cast<const MultisetFileHeader*>(address);
+    const char* problem = 0;
+    if (memcmp(header->magic, MULTISET_FILE_MAGIC, sizeof(header->magic)) != 0) problem = "bad magic";
+    else if (header->version != MULTISET_FILE_VERSION) problem = "unsupported version";
+    else if (header->byteOrder != MULTISET_FILE_BYTE_ORDER) problem = "foreign byte order";
+    else if (header->counterWidth != sizeof(int)) problem = "unsupported counter width";
+    else if (header->bitWidth > 32 || header->bitWidth >= sizeof(size_t) * 8) problem = "bad bit width";
+    else if (header->countsOffset < sizeof(MultisetFileHeader) || header->countsOffset % 64 != 0 ||
+             header->capsOffset < header->countsOffset || header->capsOffset % 64 != 0) {
+        problem = "truncated or inconsistent layout";
+    } else if (isRunLength()) {
+        if (isSparse() || !fitsWithin(header->countsOffset, header->entryCount, header->capsOffset) ||
+            header->capsOffset > header->fileSize || header->fileSize > length) {
+            problem = "truncated or inconsistent layout";
+        }
+    } else {
+        uint64_t entryBytes = isSparse() ? sizeof(SparseEntry) : sizeof(int);
+        uint64_t universe = uint64_t(1) << header->bitWidth;
+        if ((!isSparse() && header->entryCount != universe) || (isSparse() && header->entryCount > universe) ||
+            !fitsWithin(header->countsOffset, header->entryCount * entryBytes, header->capsOffset) ||
+            !fitsWithin(header->capsOffset, universe * sizeof(int), length)) {
+            problem = "truncated or inconsistent layout";
+        } else if (isSparse()) {
+            // Operations index caps by rank, so ranks are checked once here
+            const SparseEntry* entries =
+                reinterpret_cast<const SparseEntry*>(static_cast<const char*>(address) + header->countsOffset);
+            for (uint64_t i = 0; i < header->entryCount && !problem; i++) {
+                if (entries[i].rank >= universe) problem = "rank outside the universe";
+                else if (i > 0 && entries[i].rank <= entries[i - 1].rank) problem = "sparse ranks out of order";
+            }
+        }
+    }
+    if (problem) {
+        munmap(address, length);
+        throw runtime_error(path + ": " + problem);
+    }
+}
+
+MappedMultiset::~MappedMultiset() {
+    if (address != MAP_FAILED) {
+        munmap(address, length);
+    }
+}
+
+DenseView MappedMultiset::denseView() const {
+    if (isSparse() || isRunLength()) {
+        throw logic_error(string("MappedMultiset::denseView: file holds a ") + (isSparse() ? "sparse" : "run-length") +
+                          " multiset");
+    }
+    const char* base = static_cast<const char*>(address);
+    DenseView result = {getBitWidth(), size(), reinterpret_cast<const int*>(base + header->countsOffset),
+                        reinterpret_cast<const int*>(base + header->capsOffset)};
+    return result;
+}
+
+SparseView MappedMultiset::sparseView() const {
+    if (!isSparse()) {
+        throw logic_error("MappedMultiset::sparseView: file holds a dense multiset");
+    }
+    const char* base = static_cast<const char*>(address);
+    SparseView result = {getBitWidth(), size(), reinterpret_cast<const SparseEntry*>(base + header->countsOffset),
+                         static_cast<size_t>(header->entryCount),
+                         reinterpret_cast<const int*>(base + header->capsOffset)};
+    return result;
+}
+
+AdaptiveMultiset MappedMultiset::load() const {
+    if (isRunLength()) {
+        return AdaptiveMultiset(toDense(loadRunLength()));
+    }
+    const char* base = static_cast<const char*>(address);
+    const int* capsBegin = reinterpret_cast<const int*>(base + header->capsOffset);
+    CapArray caps = makeCapArray(vector<int>(capsBegin, capsBegin + size()));
+    if (isSparse()) {
+        SparseView view = sparseView();
+        SparseMultiset result(getBitWidth(), caps);
+        result.reserve(view.support);
+        for (size_t i = 0; i < view.support; i++) {
+            result.append(view.entries[i].rank, view.entries[i].multiplicity); // ranks were checked on open
+        }
+        return AdaptiveMultiset(result);
+    }
+    DenseView view = denseView();
+    DenseMultiset result(getBitWidth(), caps);
+    copy(view.counts, view.counts + view.size, result.data());
+    return AdaptiveMultiset(result);
+}
+
+RunLengthMultiset MappedMultiset::loadRunLength() const {
+    if (!isRunLength()) {
+        AdaptiveMultiset multiset = load();
+        DenseMultiset scratch;
+        return multiset.isSparse() ? toRunLength(multiset.getSparse()) : toRunLength(multiset.denseForm(scratch));
+    }
+    const uint8_t* base = static_cast<const uint8_t*>(address);
+    RunArray counts = RunArray::fromBytes(base + header->countsOffset, static_cast<size_t>(header->entryCount), size());
+    RunArray caps = RunArray::fromBytes(base + header->capsOffset,
+                                        static_cast<size_t>(header->fileSize - header->capsOffset), size());
+    vector<int> capValues(size());
+    caps.decode(capValues.data());
+    return RunLengthMultiset(getBitWidth(), makeCapArray(capValues), counts);
+}
+
+AdaptiveMultiset loadMultiset(const string& path) {
+    MappedMultiset mapped(path);
+    return mapped.load();
+}
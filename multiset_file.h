@@ -0,0 +1,86 @@
+#ifndef MULTISET_FILE_H
+#define MULTISET_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "adaptive_multiset.h"
+#include "rle_multiset.h"
+
+using namespace std;
+
+// Binary multiset file, laid out so it can be used in place after mmap:
+//   header (64 bytes)
+//   multiplicities: dense  -> int32[universe size]
+//                   sparse -> {uint32 rank, int32 multiplicity}[entry count], sorted by rank
+//   caps:           int32[universe size]
+// Both arrays start on 64-byte boundaries. Run-length files (flag
+// MULTISET_FILE_RUN_LENGTH) hold two RunArray byte streams instead, the
+// multiplicities (entryCount bytes) and the caps (up to fileSize), so a
+// clustered multiset is written and read in a few bytes per run. Values are in host byte order;
+// the byteOrder field lets a reader reject a file from the other endianness.
+const char MULTISET_FILE_MAGIC[8] = {'G', 'R', 'A', 'Y', 'M', 'S', 'E', 'T'};
+const uint32_t MULTISET_FILE_VERSION = 1;
+const uint32_t MULTISET_FILE_BYTE_ORDER = 0x01020304u;
+const uint32_t MULTISET_FILE_SPARSE = 1u;     // flags bits
+const uint32_t MULTISET_FILE_RUN_LENGTH = 2u;
+
+struct MultisetFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t bitWidth;
+    uint32_t counterWidth;  // bytes per multiplicity and cap (only 4 is supported)
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t entryCount;    // dense: universe size, sparse: number of entries, run-length: stream bytes
+    uint64_t countsOffset;  // byte offset of the multiplicity array
+    uint64_t capsOffset;    // byte offset of the caps array
+    uint64_t fileSize;
+};
+
+// Writers (throw runtime_error on I/O failure)
+void saveMultiset(const string& path, const DenseView& multiset);
+void saveMultiset(const string& path, const SparseView& multiset);
+void saveMultiset(const string& path, const DenseMultiset& multiset);
+void saveMultiset(const string& path, const SparseMultiset& multiset);
+void saveMultiset(const string& path, const AdaptiveMultiset& multiset);
+void saveMultiset(const string& path, const RunLengthMultiset& multiset);
+
+// Read-only memory mapping of a multiset file. The views point straight
+// into the mapped pages, so operations run on them without parsing or copying.
+// Opening validates the header fields, that every array lies inside the
+// file, and that sparse ranks are strictly increasing and inside the
+// universe. Multiplicities and caps are not checked, and run-length runs
+// are only parsed by load() and loadRunLength().
+class MappedMultiset {
+private:
+    void* address;
+    size_t length;
+    const MultisetFileHeader* header;
+
+    MappedMultiset(const MappedMultiset&);
+    MappedMultiset& operator=(const MappedMultiset&);
+
+public:
+    explicit MappedMultiset(const string& path); // throws runtime_error on a missing or malformed file
+    ~MappedMultiset();
+
+    int getBitWidth() const { return static_cast<int>(header->bitWidth); }
+    bool isSparse() const { return (header->flags & MULTISET_FILE_SPARSE) != 0; }
+    bool isRunLength() const { return (header->flags & MULTISET_FILE_RUN_LENGTH) != 0; }
+    size_t size() const { return size_t(1) << header->bitWidth; }
+
+    DenseView denseView() const;   // requires !isSparse() and !isRunLength()
+    SparseView sparseView() const; // requires isSparse()
+
+    AdaptiveMultiset load() const;            // copy into memory (run-length files are decoded)
+    RunLengthMultiset loadRunLength() const;  // any file, as runs
+};
+
+// Convenience: map, copy, unmap
+AdaptiveMultiset loadMultiset(const string& path);
+
+#endif // MULTISET_FILE_H
@@ -0,0 +1,254 @@
+#include "multiset_ingest.h"
+#include "gray_code.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Bounded hand-off between the reader and the counting threads
+class ChunkQueue {
+private:
+    mutex lock;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    deque<vector<char> > chunks;
+    size_t capacity;
+    bool closed;
+
+public:
+    explicit ChunkQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    void push(vector<char>& chunk) {
+        unique_lock<mutex> guard(lock);
+        while (chunks.size() >= capacity) notFull.wait(guard);
+        chunks.push_back(vector<char>());
+        chunks.back().swap(chunk);
+        notEmpty.notify_one();
+    }
+
+    // False once the queue is closed and drained
+    bool pop(vector<char>& chunk) {
+        unique_lock<mutex> guard(lock);
+        while (chunks.empty() && !closed) notEmpty.wait(guard);
+        if (chunks.empty()) return false;
+        chunk.swap(chunks.front());
+        chunks.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+inline bool isSeparator(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',' || c == '\f' || c == '\v';
+}
+
+struct Counter {
+    int bitWidth;
+    size_t universe;
+    const int* caps;
+    IngestKeyFormat format;
+    vector<int> histogram;
+    uint64_t tokens;
+    uint64_t ignored;
+
+    Counter(int bitWidth, const int* caps, IngestKeyFormat format)
+        : bitWidth(bitWidth), universe(size_t(1) << bitWidth), caps(caps), format(format),
+          histogram(universe, 0), tokens(0), ignored(0) {}
+
+    // Rank named by an integer token, or universe if it is not a valid key
+    size_t integerRank(const char* begin, const char* end) const {
+        if (end - begin > 20) return universe;
+        uint64_t value = 0;
+        for (const char* p = begin; p != end; ++p) {
+            if (*p < '0' || *p > '9') return universe;
+            value = value * 10 + static_cast<uint64_t>(*p - '0');
+            if (value >= universe) return universe;
+        }
+        return static_cast<size_t>(value);
+    }
+
+    void add(size_t rank, int* h) const {
+        h[rank] += h[rank] < caps[rank]; // saturate at the cap so counters cannot overflow
+    }
+
+    // Gray-code tokens are parsed into a block of codes that the batch
+    // converter turns into ranks in one go
+    void addCodes(uint32_t* codes, size_t n, int* h) const {
+        grayDecodeBatch(codes, codes, n);
+        for (size_t i = 0; i < n; i++) add(codes[i], h);
+    }
+
+    // Chunks always end on a separator, so no token is split between them
+    void count(const vector<char>& chunk) {
+        const size_t BLOCK = 256;
+        uint32_t codes[BLOCK] = {};
+        size_t pending = 0;
+        const char* p = chunk.data();
+        const char* end = p + chunk.size();
+        int* h = histogram.data();
+        uint64_t valid = 0, invalid = 0; // kept local so threads do not share a cache line
+        while (p != end) {
+            while (p != end && isSeparator(*p)) ++p;
+            const char* begin = p;
+            while (p != end && !isSeparator(*p)) ++p;
+            if (begin == p) break;
+            if (format == KEYS_GRAY_CODE) {
+                size_t length = static_cast<size_t>(p - begin);
+                if (length == static_cast<size_t>(bitWidth) && parseGrayCode(begin, length, codes[pending])) {
+                    valid++;
+                    if (++pending == BLOCK) {
+                        addCodes(codes, pending, h);
+                        pending = 0;
+                    }
+                } else {
+                    invalid++;
+                }
+                continue;
+            }
+            size_t rank = integerRank(begin, p);
+            if (rank < universe) {
+                add(rank, h);
+                valid++;
+            } else {
+                invalid++;
+            }
+        }
+        addCodes(codes, pending, h);
+        tokens += valid;
+        ignored += invalid;
+    }
+};
+
+void countChunks(ChunkQueue* queue, Counter* counter) {
+    vector<char> chunk;
+    while (queue->pop(chunk)) {
+        counter->count(chunk);
+    }
+}
+
+// result[r] = min(sum of histograms[r], cap[r]) for ranks in [begin, end)
+void mergeHistograms(const vector<Counter>* counters, const int* caps, int* result, size_t begin, size_t end) {
+    for (size_t rank = begin; rank < end; rank++) {
+        long long total = 0;
+        for (size_t t = 0; t < counters->size(); t++) {
+            total += (*counters)[t].histogram[rank];
+        }
+        result[rank] = static_cast<int>(min(total, static_cast<long long>(caps[rank])));
+    }
+}
+
+} // namespace
+
+DenseMultiset ingestMultiset(istream& in, int bitWidth, const CapArray& caps, const IngestOptions& options,
+                             IngestStats* stats) {
+    DenseMultiset result(bitWidth, caps);
+    unsigned threads = options.threads != 0 ? options.threads : getThreadCount();
+    size_t chunkBytes = max(options.chunkBytes, size_t(64));
+
+    vector<Counter> counters;
+    counters.reserve(threads); // workers hold pointers into it
+    vector<thread> workers;
+    ChunkQueue queue(2 * threads);
+    uint64_t bytes = 0;
+    uint64_t overlong = 0; // tokens too long to be a key, skipped by the reader
+    size_t maxToken = options.format == KEYS_GRAY_CODE ? static_cast<size_t>(MAX_GRAY_BITS) : 20;
+    try {
+        for (unsigned t = 0; t < threads; t++) {
+            counters.push_back(Counter(bitWidth, caps->data(), options.format));
+        }
+        for (unsigned t = 0; t < threads; t++) {
+            workers.push_back(thread(countChunks, &queue, &counters[t]));
+        }
+
+        // Read fixed-size blocks; the partial token after the last separator
+        // is carried over to the start of the next chunk. No key is longer
+        // than maxToken, so a longer token is skipped up to the next
+        // separator and counted as ignored, and the carry stays small.
+        vector<char> carry;
+        bool skipping = false;
+        while (in) {
+            vector<char> chunk;
+            chunk.swap(carry);
+            chunk.reserve(chunk.size() + chunkBytes);
+            size_t kept = chunk.size();
+            chunk.resize(kept + chunkBytes);
+            in.read(chunk.data() + kept, static_cast<streamsize>(chunkBytes));
+            size_t got = static_cast<size_t>(in.gcount());
+            bytes += got;
+            chunk.resize(kept + got);
+            if (skipping) {
+                size_t skip = 0;
+                while (skip < chunk.size() && !isSeparator(chunk[skip])) skip++;
+                skipping = skip == chunk.size();
+                chunk.erase(chunk.begin(), chunk.begin() + static_cast<ptrdiff_t>(skip));
+            }
+            if (!in) { // end of input: the last token needs no separator
+                if (!chunk.empty()) queue.push(chunk);
+                break;
+            }
+            size_t cut = chunk.size();
+            while (cut > 0 && !isSeparator(chunk[cut - 1])) cut--;
+            if (chunk.size() - cut > maxToken) {
+                overlong++;
+                skipping = true;
+            } else {
+                carry.assign(chunk.begin() + static_cast<ptrdiff_t>(cut), chunk.end());
+            }
+            chunk.resize(cut);
+            if (!chunk.empty()) queue.push(chunk);
+        }
+        if (!carry.empty()) queue.push(carry);
+    } catch (...) {
+        queue.close();
+        for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+        throw;
+    }
+    queue.close();
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+    // Merge in parallel over disjoint rank ranges (serially for small universes)
+    unsigned mergeThreads = result.size() >= (size_t(1) << 16) ? threads : 1;
+    vector<thread> mergers;
+    size_t slice = (result.size() + mergeThreads - 1) / mergeThreads;
+    for (unsigned t = 0; t < mergeThreads; t++) {
+        size_t begin = min(result.size(), t * slice);
+        size_t end = min(result.size(), begin + slice);
+        if (begin < end) {
+            mergers.push_back(thread(mergeHistograms, &counters, caps->data(), result.data(), begin, end));
+        }
+    }
+    for (size_t t = 0; t < mergers.size(); t++) mergers[t].join();
+
+    if (stats) {
+        stats->bytes = bytes;
+        stats->tokens = 0;
+        stats->ignored = overlong;
+        for (size_t t = 0; t < counters.size(); t++) {
+            stats->tokens += counters[t].tokens;
+            stats->ignored += counters[t].ignored;
+        }
+    }
+    return result;
+}
+
+DenseMultiset ingestMultisetFile(const string& path, int bitWidth, const CapArray& caps,
+                                 const IngestOptions& options, IngestStats* stats) {
+    ifstream in(path.c_str(), ios::binary);
+    if (!in) {
+        throw runtime_error("cannot open " + path);
+    }
+    return ingestMultiset(in, bitWidth, caps, options, stats);
+}
@@ -0,0 +1,42 @@
+#ifndef MULTISET_INGEST_H
+#define MULTISET_INGEST_H
+
+#include <iostream>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+
+using namespace std;
+
+// How tokens in the input name elements
+enum IngestKeyFormat {
+    KEYS_GRAY_CODE = 0, // "0110": a Gray code of exactly bitWidth characters
+    KEYS_INTEGER = 1    // "6": decimal value, i.e. the Gray rank of the element
+};
+
+struct IngestOptions {
+    IngestKeyFormat format;
+    unsigned threads;  // 0 = getThreadCount()
+    size_t chunkBytes; // size of each read from the input
+
+    IngestOptions() : format(KEYS_GRAY_CODE), threads(0), chunkBytes(size_t(1) << 20) {}
+};
+
+struct IngestStats {
+    uint64_t bytes;   // bytes read
+    uint64_t tokens;  // tokens that named an element of the universe
+    uint64_t ignored; // malformed or out-of-universe tokens
+};
+
+// Builds a multiset by counting occurrences of keys in a stream. Tokens are
+// separated by whitespace or commas. The input is read in chunks that worker
+// threads count into private histograms, which are then merged and clamped
+// to the caps. Memory is (threads + 1) histograms plus a few chunks,
+// independent of the input size.
+DenseMultiset ingestMultiset(istream& in, int bitWidth, const CapArray& caps,
+                             const IngestOptions& options = IngestOptions(), IngestStats* stats = 0);
+DenseMultiset ingestMultisetFile(const string& path, int bitWidth, const CapArray& caps,
+                                 const IngestOptions& options = IngestOptions(), IngestStats* stats = 0);
+
+#endif // MULTISET_INGEST_H
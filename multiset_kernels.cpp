@@ -0,0 +1,268 @@
+#include "multiset_kernels.h"
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MULTISET_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Scalar kernels (also used for the tails of the vector kernels)
+void unionScalar(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = unionElement(a[i], b[i], cap[i]);
+}
+
+void intersectionScalar(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = intersectionElement(a[i], b[i], cap[i]);
+}
+
+void differenceScalar(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = differenceElement(a[i], b[i], cap[i]);
+}
+
+void symmetricDifferenceScalar(const int* a, const int* b, const int* capA, const int* capB,
+                               int* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = symmetricDifferenceElement(a[i], b[i], capA[i], capB[i]);
+}
+
+void complementScalar(const int* a, const int* cap, int* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = complementElement(a[i], cap[i]);
+}
+
+#ifdef MULTISET_X86_KERNELS
+
+// SSE4.1 kernels: 4 lanes of int32
+__attribute__((target("sse4.1")))
+inline __m128i differenceSse41(__m128i a, __m128i b, __m128i cap) {
+    __m128i diff = _mm_sub_epi32(a, b);
+    __m128i positive = _mm_cmpgt_epi32(diff, _mm_setzero_si128());
+    return _mm_and_si128(positive, _mm_min_epi32(diff, cap));
+}
+
+__attribute__((target("sse4.1")))
+void unionSse41(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cap + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epi32(_mm_max_epi32(va, vb), vc));
+    }
+    unionScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+void intersectionSse41(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cap + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epi32(_mm_min_epi32(va, vb), vc));
+    }
+    intersectionScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+void differenceSse41(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cap + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), differenceSse41(va, vb, vc));
+    }
+    differenceScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+void symmetricDifferenceSse41(const int* a, const int* b, const int* capA, const int* capB,
+                              int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i vca = _mm_loadu_si128(reinterpret_cast<const __m128i*>(capA + i));
+        __m128i vcb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(capB + i));
+        __m128i d = _mm_max_epi32(differenceSse41(va, vb, vca), differenceSse41(vb, va, vcb));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epi32(d, vca));
+    }
+    symmetricDifferenceScalar(a + i, b + i, capA + i, capB + i, out + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+void complementSse41(const int* a, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cap + i));
+        __m128i empty = _mm_cmpeq_epi32(va, _mm_setzero_si128());
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_and_si128(empty, vc));
+    }
+    complementScalar(a + i, cap + i, out + i, n - i);
+}
+
+// AVX2 kernels: 8 lanes of int32
+__attribute__((target("avx2")))
+inline __m256i differenceAvx2(__m256i a, __m256i b, __m256i cap) {
+    __m256i diff = _mm256_sub_epi32(a, b);
+    __m256i positive = _mm256_cmpgt_epi32(diff, _mm256_setzero_si256());
+    return _mm256_and_si256(positive, _mm256_min_epi32(diff, cap));
+}
+
+__attribute__((target("avx2")))
+void unionAvx2(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cap + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_min_epi32(_mm256_max_epi32(va, vb), vc));
+    }
+    unionScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void intersectionAvx2(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cap + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_min_epi32(_mm256_min_epi32(va, vb), vc));
+    }
+    intersectionScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void differenceAvx2(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cap + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), differenceAvx2(va, vb, vc));
+    }
+    differenceScalar(a + i, b + i, cap + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void symmetricDifferenceAvx2(const int* a, const int* b, const int* capA, const int* capB,
+                             int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vca = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(capA + i));
+        __m256i vcb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(capB + i));
+        __m256i d = _mm256_max_epi32(differenceAvx2(va, vb, vca), differenceAvx2(vb, va, vcb));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_min_epi32(d, vca));
+    }
+    symmetricDifferenceScalar(a + i, b + i, capA + i, capB + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void complementAvx2(const int* a, const int* cap, int* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cap + i));
+        __m256i empty = _mm256_cmpeq_epi32(va, _mm256_setzero_si256());
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_and_si256(empty, vc));
+    }
+    complementScalar(a + i, cap + i, out + i, n - i);
+}
+
+#endif // MULTISET_X86_KERNELS
+
+struct KernelTable {
+    void (*unionOp)(const int*, const int*, const int*, int*, size_t);
+    void (*intersectionOp)(const int*, const int*, const int*, int*, size_t);
+    void (*differenceOp)(const int*, const int*, const int*, int*, size_t);
+    void (*symmetricDifferenceOp)(const int*, const int*, const int*, const int*, int*, size_t);
+    void (*complementOp)(const int*, const int*, int*, size_t);
+};
+
+const KernelTable scalarTable = {
+    unionScalar, intersectionScalar, differenceScalar, symmetricDifferenceScalar, complementScalar
+};
+
+#ifdef MULTISET_X86_KERNELS
+const KernelTable sse41Table = {
+    unionSse41, intersectionSse41, differenceSse41, symmetricDifferenceSse41, complementSse41
+};
+const KernelTable avx2Table = {
+    unionAvx2, intersectionAvx2, differenceAvx2, symmetricDifferenceAvx2, complementAvx2
+};
+#endif
+
+const KernelTable* tableFor(SimdLevel level) {
+#ifdef MULTISET_X86_KERNELS
+    if (level == SIMD_AVX2) return &avx2Table;
+    if (level == SIMD_SSE41) return &sse41Table;
+#endif
+    (void)level;
+    return &scalarTable;
+}
+
+std::atomic<int> activeLevel(-1); // -1 until the CPU has been probed
+
+const KernelTable& activeTable() {
+    int level = activeLevel.load(std::memory_order_relaxed);
+    if (level < 0) {
+        level = detectSimdLevel();
+        activeLevel.store(level, std::memory_order_relaxed);
+    }
+    return *tableFor(static_cast<SimdLevel>(level));
+}
+
+} // namespace
+
+SimdLevel detectSimdLevel() {
+#ifdef MULTISET_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+#endif
+    return SIMD_SCALAR;
+}
+
+SimdLevel getSimdLevel() {
+    activeTable();
+    return static_cast<SimdLevel>(activeLevel.load(std::memory_order_relaxed));
+}
+
+void setSimdLevel(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+    activeLevel.store(level > supported ? supported : level, std::memory_order_relaxed);
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE41: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+void unionKernel(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    activeTable().unionOp(a, b, cap, out, n);
+}
+
+void intersectionKernel(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    activeTable().intersectionOp(a, b, cap, out, n);
+}
+
+void differenceKernel(const int* a, const int* b, const int* cap, int* out, size_t n) {
+    activeTable().differenceOp(a, b, cap, out, n);
+}
+
+void symmetricDifferenceKernel(const int* a, const int* b, const int* capA, const int* capB,
+                               int* out, size_t n) {
+    activeTable().symmetricDifferenceOp(a, b, capA, capB, out, n);
+}
+
+void complementKernel(const int* a, const int* cap, int* out, size_t n) {
+    activeTable().complementOp(a, cap, out, n);
+}
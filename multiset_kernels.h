@@ -0,0 +1,59 @@
+#ifndef MULTISET_KERNELS_H
+#define MULTISET_KERNELS_H
+
+#include <cstddef>
+
+// Element-wise kernels over dense multiplicity arrays. Every variant gives
+// bit-identical results to the scalar definitions:
+//   union         out = min(max(a, b), cap)
+//   intersection  out = min(min(a, b), cap)
+//   difference    out = (a - b > 0) ? min(a - b, cap) : 0
+//   symmetric     out = min(max(diff(a, b, capA), diff(b, a, capB)), capA)
+//   complement    out = (a == 0) ? cap : 0
+// Subtraction wraps like two's complement instead of being undefined.
+
+// Scalar definitions for a single element
+inline int differenceElement(int a, int b, int cap) {
+    int diff = static_cast<int>(static_cast<unsigned>(a) - static_cast<unsigned>(b));
+    return diff > 0 ? (diff < cap ? diff : cap) : 0;
+}
+
+inline int unionElement(int a, int b, int cap) {
+    int value = a > b ? a : b;
+    return value < cap ? value : cap;
+}
+
+inline int intersectionElement(int a, int b, int cap) {
+    int value = a < b ? a : b;
+    return value < cap ? value : cap;
+}
+
+inline int symmetricDifferenceElement(int a, int b, int capA, int capB) {
+    int d1 = differenceElement(a, b, capA);
+    int d2 = differenceElement(b, a, capB);
+    return unionElement(d1, d2, capA);
+}
+
+inline int complementElement(int a, int cap) {
+    return a == 0 ? cap : 0;
+}
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE41 = 1,
+    SIMD_AVX2 = 2
+};
+
+SimdLevel detectSimdLevel();           // best level the CPU supports
+SimdLevel getSimdLevel();              // level currently used by the kernels
+void setSimdLevel(SimdLevel level);    // force a level (clamped to what the CPU supports)
+const char* simdLevelName(SimdLevel level);
+
+void unionKernel(const int* a, const int* b, const int* cap, int* out, size_t n);
+void intersectionKernel(const int* a, const int* b, const int* cap, int* out, size_t n);
+void differenceKernel(const int* a, const int* b, const int* cap, int* out, size_t n);
+void symmetricDifferenceKernel(const int* a, const int* b, const int* capA, const int* capB,
+                               int* out, size_t n);
+void complementKernel(const int* a, const int* cap, int* out, size_t n);
+
+#endif // MULTISET_KERNELS_H
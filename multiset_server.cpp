@@ -0,0 +1,217 @@
+#include "multiset_server.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Longest request line; a client that sends more without a newline is dropped
+static const size_t SERVER_MAX_LINE = size_t(1) << 20;
+
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw runtime_error(string("MultisetServer: fcntl failed: ") + strerror(errno));
+    }
+}
+
+MultisetServer::MultisetServer(const string& socketPath)
+    : path(socketPath), listenFd(-1), stopping(false) {
+    wakeFds[0] = wakeFds[1] = -1;
+    stats.connections = stats.requests = stats.batches = stats.evaluated = 0;
+    session.allowStdout(false); // the records would go to the server's stdout, not the client
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("MultisetServer: socket path must be 1 to " +
+                            to_string(sizeof(address.sun_path) - 1) + " characters");
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    try {
+        if (pipe(wakeFds) < 0) throw runtime_error(string("MultisetServer: pipe failed: ") + strerror(errno));
+        setNonBlocking(wakeFds[0]);
+        setNonBlocking(wakeFds[1]);
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) throw runtime_error(string("MultisetServer: socket failed: ") + strerror(errno));
+        unlink(path.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listenFd, 64) < 0) {
+            throw runtime_error("MultisetServer: cannot listen on " + path + ": " + strerror(errno));
+        }
+        setNonBlocking(listenFd);
+    } catch (...) {
+        if (listenFd >= 0) close(listenFd);
+        if (wakeFds[0] >= 0) close(wakeFds[0]);
+        if (wakeFds[1] >= 0) close(wakeFds[1]);
+        throw;
+    }
+}
+
+MultisetServer::~MultisetServer() {
+    for (size_t i = 0; i < clients.size(); i++) close(clients[i].fd);
+    close(listenFd);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+    unlink(path.c_str());
+}
+
+void MultisetServer::stop() {
+    char byte = 1;
+    ssize_t written = write(wakeFds[1], &byte, 1); // a full pipe already holds a wake-up
+    (void)written;
+}
+
+void MultisetServer::acceptClients() {
+    for (;;) {
+        int fd = accept(listenFd, 0, 0);
+        if (fd < 0) return; // EAGAIN: no more pending connections
+        try {
+            setNonBlocking(fd);
+        } catch (const runtime_error&) {
+            close(fd);
+            continue;
+        }
+        Client client;
+        client.fd = fd;
+        client.closing = false;
+        clients.push_back(client);
+        stats.connections++;
+    }
+}
+
+bool MultisetServer::readClient(Client& client) {
+    char buffer[65536];
+    for (;;) {
+        ssize_t got = read(client.fd, buffer, sizeof(buffer));
+        if (got > 0) {
+            client.input.append(buffer, static_cast<size_t>(got));
+            continue;
+        }
+        if (got < 0 && errno == EINTR) continue;
+        return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+// Splits the complete lines of every client into one batch, runs it, and
+// routes each answer back to the client that asked
+void MultisetServer::runBatch() {
+    vector<string> lines;
+    vector<size_t> owners;
+    vector<size_t> controls; // "quit" / "shutdown" lines, answered here
+    for (size_t c = 0; c < clients.size(); c++) {
+        Client& client = clients[c];
+        size_t start = 0, end;
+        while (!client.closing && (end = client.input.find('\n', start)) != string::npos) {
+            string line = client.input.substr(start, end - start);
+            start = end + 1;
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            size_t first = line.find_first_not_of(" \t");
+            size_t last = line.find_last_not_of(" \t");
+            string word = first == string::npos ? string() : line.substr(first, last - first + 1);
+            if (word == "quit" || word == "shutdown") {
+                controls.push_back(lines.size());
+                client.closing = true;
+                if (word == "shutdown") stopping = true;
+                line.clear(); // keeps its place in the batch, answered below
+            }
+            lines.push_back(line);
+            owners.push_back(c);
+        }
+        if (client.closing) {
+            client.input.clear(); // nothing after "quit" is answered
+        } else {
+            client.input.erase(0, start);
+        }
+        if (client.input.size() > SERVER_MAX_LINE) {
+            client.output += "error request line too long\n";
+            client.closing = true;
+        }
+    }
+    if (lines.empty()) return;
+
+    vector<string> results;
+    stats.requests += lines.size();
+    stats.batches++;
+    stats.evaluated += session.executeBatch(lines, results);
+    for (size_t i = 0; i < controls.size(); i++) results[controls[i]] = "ok\n";
+    for (size_t i = 0; i < lines.size(); i++) clients[owners[i]].output += results[i];
+}
+
+void MultisetServer::flushClient(Client& client) {
+    size_t sent = 0;
+    while (sent < client.output.size()) {
+        ssize_t wrote = send(client.fd, client.output.data() + sent, client.output.size() - sent, MSG_NOSIGNAL);
+        if (wrote > 0) {
+            sent += static_cast<size_t>(wrote);
+        } else if (wrote < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (wrote < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                client.output.clear(); // the peer is gone
+                client.closing = true;
+                return;
+            }
+            break;
+        }
+    }
+    client.output.erase(0, sent);
+}
+
+void MultisetServer::serve() {
+    vector<pollfd> polled;
+    while (!stopping) {
+        polled.clear();
+        pollfd entry;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        entry.fd = wakeFds[0];
+        polled.push_back(entry);
+        entry.fd = listenFd;
+        polled.push_back(entry);
+        for (size_t i = 0; i < clients.size(); i++) {
+            entry.fd = clients[i].fd;
+            entry.events = static_cast<short>(POLLIN | (clients[i].output.empty() ? 0 : POLLOUT));
+            polled.push_back(entry);
+        }
+        if (poll(&polled[0], polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("MultisetServer: poll failed: ") + strerror(errno));
+        }
+
+        if (polled[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wakeFds[0], drain, sizeof(drain)) > 0) {
+            }
+            stopping = true;
+        }
+        vector<bool> hungUp(clients.size(), false);
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (polled[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) hungUp[i] = !readClient(clients[i]);
+        }
+        runBatch();
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (hungUp[i]) clients[i].closing = true;
+            flushClient(clients[i]);
+        }
+
+        // Drop finished connections once their answers are written (a
+        // failed write discards them)
+        size_t kept = 0;
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (clients[i].closing && clients[i].output.empty()) {
+                close(clients[i].fd);
+            } else {
+                clients[kept++] = clients[i];
+            }
+        }
+        clients.resize(kept);
+        if (polled[1].revents & POLLIN) acceptClients();
+    }
+    // Answer what was already computed, e.g. the "ok" to "shutdown"
+    for (size_t i = 0; i < clients.size(); i++) flushClient(clients[i]);
+}
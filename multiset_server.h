@@ -0,0 +1,68 @@
+#ifndef MULTISET_SERVER_H
+#define MULTISET_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "batch_session.h"
+
+using namespace std;
+
+struct ServerStats {
+    uint64_t connections; // clients accepted
+    uint64_t requests;    // command lines received
+    uint64_t batches;     // executeBatch calls
+    uint64_t evaluated;   // commands actually run (repeated queries are shared)
+};
+
+// Long-running server that keeps one BatchSession, with its universe and
+// named multisets, resident between requests. Clients connect to a Unix
+// domain socket and speak the batch line protocol: one command per line,
+// one "ok ..." or "error ..." line back, in order. "quit" closes the
+// connection and "shutdown" stops the server.
+//
+// A single thread polls all clients. Every wake-up collects the complete
+// lines that arrived from all of them into one batch for executeBatch, so
+// a query that several clients ask at once runs once. Answers are written
+// without blocking; a slow reader only delays itself.
+class MultisetServer {
+private:
+    struct Client {
+        int fd;
+        string input;  // bytes after the last complete line
+        string output; // answers not yet written
+        bool closing;  // close once output is flushed
+    };
+
+    string path;
+    int listenFd;
+    int wakeFds[2]; // stop() writes to [1] to interrupt poll
+    bool stopping;
+    BatchSession session;
+    vector<Client> clients;
+    ServerStats stats;
+
+    void acceptClients();
+    bool readClient(Client& client); // false once the peer has hung up
+    void runBatch();
+    void flushClient(Client& client);
+
+    MultisetServer(const MultisetServer&);
+    MultisetServer& operator=(const MultisetServer&);
+
+public:
+    // Binds and listens; an existing socket file at path is replaced.
+    // Throws runtime_error if the socket cannot be set up.
+    explicit MultisetServer(const string& socketPath);
+    ~MultisetServer(); // closes every connection and removes the socket file
+
+    void serve(); // returns after "shutdown" or stop()
+    void stop();  // async-signal-safe; callable from any thread
+
+    const string& getPath() const { return path; }
+    const ServerStats& getStats() const { return stats; }
+    BatchSession& getSession() { return session; }
+};
+
+#endif // MULTISET_SERVER_H
@@ -0,0 +1,176 @@
+#include "op_stats.h"
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+std::atomic<bool> opStatsFlag(false);
+
+namespace {
+
+const int LATENCY_BUCKETS = 64; // bucket b holds latencies in [2^b, 2^(b+1)) ns
+
+struct OpStatSlot {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> maxNs;
+    std::atomic<uint64_t> elements;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+};
+
+OpStatSlot slots[MAX_OP_STATS];
+string slotNames[MAX_OP_STATS];
+int slotCount = 0;
+std::mutex registryLock;
+
+int bucketOf(uint64_t ns) {
+    int bucket = 0;
+    while (ns > 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+struct OpStatSnapshot {
+    string name;
+    uint64_t calls;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t elements;
+    uint64_t bytes;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
+// Latency at the given quantile, interpolated linearly inside its bucket
+double percentileNs(const OpStatSnapshot& s, double quantile) {
+    double target = quantile * static_cast<double>(s.calls);
+    double seen = 0.0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        double count = static_cast<double>(s.buckets[b]);
+        if (count > 0 && seen + count >= target) {
+            double low = b == 0 ? 0.0 : static_cast<double>(uint64_t(1) << b);
+            double high = static_cast<double>(uint64_t(2) << b);
+            double value = low + (high - low) * (target - seen) / count;
+            return value < static_cast<double>(s.maxNs) ? value : static_cast<double>(s.maxNs);
+        }
+        seen += count;
+    }
+    return static_cast<double>(s.maxNs);
+}
+
+vector<OpStatSnapshot> snapshot() {
+    vector<OpStatSnapshot> result;
+    std::lock_guard<std::mutex> guard(registryLock);
+    for (int i = 0; i < slotCount; i++) {
+        OpStatSnapshot s;
+        s.name = slotNames[i];
+        s.calls = slots[i].calls.load(std::memory_order_relaxed);
+        if (s.calls == 0) continue;
+        s.totalNs = slots[i].totalNs.load(std::memory_order_relaxed);
+        s.maxNs = slots[i].maxNs.load(std::memory_order_relaxed);
+        s.elements = slots[i].elements.load(std::memory_order_relaxed);
+        s.bytes = slots[i].bytes.load(std::memory_order_relaxed);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) s.buckets[b] = slots[i].buckets[b].load(std::memory_order_relaxed);
+        result.push_back(s);
+    }
+    return result;
+}
+
+} // namespace
+
+void setOpStatsEnabled(bool enabled) {
+    opStatsFlag.store(enabled, std::memory_order_relaxed);
+}
+
+int registerOpStat(const string& name) {
+    std::lock_guard<std::mutex> guard(registryLock);
+    for (int i = 0; i < slotCount; i++) {
+        if (slotNames[i] == name) return i;
+    }
+    if (slotCount == MAX_OP_STATS) {
+        return MAX_OP_STATS - 1; // overflow shares the last slot
+    }
+    slotNames[slotCount] = name;
+    return slotCount++;
+}
+
+void recordOpStat(int id, uint64_t ns, uint64_t elements, uint64_t bytes) {
+    OpStatSlot& slot = slots[id];
+    slot.calls.fetch_add(1, std::memory_order_relaxed);
+    slot.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    slot.elements.fetch_add(elements, std::memory_order_relaxed);
+    slot.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    slot.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t previous = slot.maxNs.load(std::memory_order_relaxed);
+    while (ns > previous && !slot.maxNs.compare_exchange_weak(previous, ns, std::memory_order_relaxed)) {
+    }
+}
+
+OpStatTimer::~OpStatTimer() {
+    if (active) {
+        chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - start;
+        recordOpStat(id, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()),
+                     elements, bytes);
+    }
+}
+
+void resetOpStats() {
+    std::lock_guard<std::mutex> guard(registryLock);
+    for (int i = 0; i < MAX_OP_STATS; i++) {
+        slots[i].calls = 0;
+        slots[i].totalNs = 0;
+        slots[i].maxNs = 0;
+        slots[i].elements = 0;
+        slots[i].bytes = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) slots[i].buckets[b] = 0;
+    }
+}
+
+uint64_t estimateMapBytes(size_t entries, int bitWidth) {
+    // Tree node: colour, three links, then the value; codes longer than the
+    // small-string buffer add their own heap block
+    uint64_t node = 4 * sizeof(void*) + sizeof(pair<const string, int>);
+    if (bitWidth >= 16) node += static_cast<uint64_t>(bitWidth) + 1;
+    return static_cast<uint64_t>(entries) * node;
+}
+
+void printOpStats(ostream& out) {
+    vector<OpStatSnapshot> stats = snapshot();
+    out << "\n=== Operation Statistics ===\n";
+    if (stats.empty()) {
+        out << "(no operations recorded)\n";
+        return;
+    }
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << left << setw(22) << "operation" << right << setw(8) << "calls" << setw(12) << "total ms"
+        << setw(11) << "p50 us" << setw(11) << "p90 us" << setw(11) << "p99 us" << setw(13) << "elements"
+        << setw(12) << "bytes" << "\n";
+    for (size_t i = 0; i < stats.size(); i++) {
+        const OpStatSnapshot& s = stats[i];
+        out << left << setw(22) << s.name << right << setw(8) << s.calls << fixed << setprecision(3)
+            << setw(12) << static_cast<double>(s.totalNs) / 1e6 << setprecision(1)
+            << setw(11) << percentileNs(s, 0.50) / 1e3 << setw(11) << percentileNs(s, 0.90) / 1e3
+            << setw(11) << percentileNs(s, 0.99) / 1e3 << setw(13) << s.elements << setw(12) << s.bytes << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void writeOpStatsJson(ostream& out) {
+    vector<OpStatSnapshot> stats = snapshot();
+    out << "[";
+    for (size_t i = 0; i < stats.size(); i++) {
+        const OpStatSnapshot& s = stats[i];
+        out << (i == 0 ? "\n" : ",\n") << "  {\"operation\": \"" << s.name << "\", \"calls\": " << s.calls
+            << ", \"total_ns\": " << s.totalNs << ", \"max_ns\": " << s.maxNs
+            << ", \"p50_ns\": " << static_cast<uint64_t>(percentileNs(s, 0.50))
+            << ", \"p90_ns\": " << static_cast<uint64_t>(percentileNs(s, 0.90))
+            << ", \"p99_ns\": " << static_cast<uint64_t>(percentileNs(s, 0.99))
+            << ", \"elements\": " << s.elements << ", \"bytes\": " << s.bytes << "}";
+    }
+    out << (stats.empty() ? "]\n" : "\n]\n");
+}
@@ -0,0 +1,70 @@
+#ifndef OP_STATS_H
+#define OP_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Per-operation instrumentation: call count, total and percentile latency,
+// elements processed and estimated bytes allocated. Recording is off until
+// setOpStatsEnabled(true); while off, an instrumented call costs one relaxed
+// load. Building with MULTISET_STATS=0 (CMake option MULTISET_ENABLE_STATS)
+// removes the instrumentation entirely.
+#ifndef MULTISET_STATS
+#define MULTISET_STATS 1
+#endif
+
+extern std::atomic<bool> opStatsFlag;
+inline bool opStatsEnabled() { return opStatsFlag.load(std::memory_order_relaxed); }
+void setOpStatsEnabled(bool enabled);
+
+// Same name, same id; at most MAX_OP_STATS distinct names
+const int MAX_OP_STATS = 64;
+int registerOpStat(const string& name);
+void recordOpStat(int id, uint64_t ns, uint64_t elements, uint64_t bytes);
+
+void resetOpStats();
+void printOpStats(ostream& out);     // table of the operations called so far
+void writeOpStatsJson(ostream& out);
+
+// Approximate heap footprint of a map<string, int> multiset result
+uint64_t estimateMapBytes(size_t entries, int bitWidth);
+
+// Times one call from construction to destruction when recording is on
+class OpStatTimer {
+private:
+    int id;
+    bool active;
+    uint64_t elements;
+    uint64_t bytes;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit OpStatTimer(int id) : id(id), active(opStatsEnabled()), elements(0), bytes(0) {
+        if (active) start = chrono::steady_clock::now();
+    }
+    ~OpStatTimer();
+
+    bool isActive() const { return active; }
+    void addElements(uint64_t n) { elements += n; }
+    void addBytes(uint64_t n) { bytes += n; }
+};
+
+#if MULTISET_STATS
+// The element and byte expressions are evaluated only while recording
+#define OP_STATS_SCOPE(var, name) \
+    static const int var##Id = registerOpStat(name); \
+    OpStatTimer var(var##Id)
+#define OP_STATS_ELEMENTS(var, n) do { if (var.isActive()) var.addElements(n); } while (0)
+#define OP_STATS_BYTES(var, n) do { if (var.isActive()) var.addBytes(n); } while (0)
+#else
+#define OP_STATS_SCOPE(var, name) ((void)0)
+#define OP_STATS_ELEMENTS(var, n) ((void)0)
+#define OP_STATS_BYTES(var, n) ((void)0)
+#endif
+
+#endif // OP_STATS_H
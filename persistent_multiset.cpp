@@ -0,0 +1,257 @@
+#include "persistent_multiset.h"
+#include "multiset_kernels.h"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+typedef PersistentMultiset::Node Node;
+typedef PersistentMultiset::NodePtr NodePtr;
+
+static long long wrappedAdd(long long a, long long b) {
+    return static_cast<long long>(static_cast<unsigned long long>(a) + static_cast<unsigned long long>(b));
+}
+
+static NodePtr makeLeaf(size_t rank, int multiplicity) {
+    if (multiplicity == 0) return NodePtr();
+    shared_ptr<Node> leaf = make_shared<Node>();
+    leaf->total = multiplicity;
+    leaf->weighted = static_cast<long long>(static_cast<unsigned long long>(multiplicity) * rank);
+    return leaf;
+}
+
+// Empty blocks collapse to null, so equal contents never hide behind an empty node
+static NodePtr makeBranch(const NodePtr& left, const NodePtr& right) {
+    if (!left && !right) return NodePtr();
+    shared_ptr<Node> node = make_shared<Node>();
+    node->total = (left ? left->total : 0) + (right ? right->total : 0);
+    node->weighted = wrappedAdd(left ? left->weighted : 0, right ? right->weighted : 0);
+    node->child[0] = left;
+    node->child[1] = right;
+    return node;
+}
+
+static const NodePtr& childOf(const NodePtr& node, int side) {
+    static const NodePtr empty;
+    return node ? node->child[side] : empty;
+}
+
+static int leafCount(const NodePtr& node) {
+    return node ? static_cast<int>(node->total) : 0;
+}
+
+// Reuses an existing node when the rebuilt children are exactly its own
+static NodePtr rebuild(const NodePtr& a, const NodePtr& b, const NodePtr& left, const NodePtr& right) {
+    if (a && a->child[0] == left && a->child[1] == right) return a;
+    if (b && b->child[0] == left && b->child[1] == right) return b;
+    return makeBranch(left, right);
+}
+
+enum PersistentOp { PERSISTENT_UNION, PERSISTENT_INTERSECTION, PERSISTENT_DIFFERENCE, PERSISTENT_SYMMETRIC };
+
+struct PersistentOps {
+    int bitWidth;
+    PersistentOp op;
+    const int* capA;
+    const int* capB;
+    bool sharedCaps; // both operands use one CapArray and lie within it
+
+    NodePtr merge(const NodePtr& a, const NodePtr& b, int depth, size_t first) const {
+        if (sharedCaps) {
+            if (a == b) return op == PERSISTENT_UNION || op == PERSISTENT_INTERSECTION ? a : NodePtr();
+            if (!a) return op == PERSISTENT_UNION || op == PERSISTENT_SYMMETRIC ? b : NodePtr();
+            if (!b) return op == PERSISTENT_INTERSECTION ? NodePtr() : a;
+        } else if (!a && !b) {
+            return NodePtr(); // every operation maps (0, 0) to 0
+        }
+        if (depth == bitWidth) {
+            int x = leafCount(a), y = leafCount(b), value = 0;
+            switch (op) {
+            case PERSISTENT_UNION: value = unionElement(x, y, capA[first]); break;
+            case PERSISTENT_INTERSECTION: value = intersectionElement(x, y, capA[first]); break;
+            case PERSISTENT_DIFFERENCE: value = differenceElement(x, y, capA[first]); break;
+            case PERSISTENT_SYMMETRIC: value = symmetricDifferenceElement(x, y, capA[first], capB[first]); break;
+            }
+            if (value == x && a) return a;
+            if (value == y && b) return b;
+            return makeLeaf(first, value);
+        }
+        size_t half = size_t(1) << (bitWidth - depth - 1);
+        NodePtr left = merge(childOf(a, 0), childOf(b, 0), depth + 1, first);
+        NodePtr right = merge(childOf(a, 1), childOf(b, 1), depth + 1, first + half);
+        return rebuild(a, b, left, right);
+    }
+
+    static PersistentMultiset combine(const PersistentMultiset& m1, const PersistentMultiset& m2, PersistentOp op) {
+        if (!m1.sameUniverse(m2)) {
+            throw invalid_argument("PersistentMultiset: operands belong to different universes");
+        }
+        PersistentOps ops;
+        ops.bitWidth = m1.bitWidth;
+        ops.op = op;
+        ops.capA = m1.caps ? m1.caps->data() : 0;
+        ops.capB = m2.caps ? m2.caps->data() : 0;
+        ops.sharedCaps = m1.caps == m2.caps;
+        return PersistentMultiset(m1.bitWidth, m1.caps, ops.merge(m1.root, m2.root, 0, 0));
+    }
+
+    static NodePtr build(const int* counts, int bitWidth, int depth, size_t first) {
+        if (depth == bitWidth) return makeLeaf(first, counts[first]);
+        size_t half = size_t(1) << (bitWidth - depth - 1);
+        NodePtr left = build(counts, bitWidth, depth + 1, first);
+        NodePtr right = build(counts, bitWidth, depth + 1, first + half);
+        return makeBranch(left, right);
+    }
+
+    static void collect(const NodePtr& node, int bitWidth, int depth, size_t first, int* out) {
+        if (!node) return;
+        if (depth == bitWidth) {
+            out[first] = static_cast<int>(node->total);
+            return;
+        }
+        size_t half = size_t(1) << (bitWidth - depth - 1);
+        collect(node->child[0], bitWidth, depth + 1, first, out);
+        collect(node->child[1], bitWidth, depth + 1, first + half, out);
+    }
+
+    static void differences(const NodePtr& a, const NodePtr& b, int bitWidth, int depth, size_t first,
+                            vector<size_t>& out) {
+        if (a == b) return;
+        if (depth == bitWidth) {
+            if (leafCount(a) != leafCount(b)) out.push_back(first);
+            return;
+        }
+        size_t half = size_t(1) << (bitWidth - depth - 1);
+        differences(childOf(a, 0), childOf(b, 0), bitWidth, depth + 1, first, out);
+        differences(childOf(a, 1), childOf(b, 1), bitWidth, depth + 1, first + half, out);
+    }
+};
+
+PersistentMultiset::PersistentMultiset() : bitWidth(0) {}
+
+PersistentMultiset::PersistentMultiset(int bitWidth, const CapArray& caps, const NodePtr& root)
+    : bitWidth(bitWidth), caps(caps), root(root) {}
+
+PersistentMultiset::PersistentMultiset(int bitWidth, const CapArray& caps) : bitWidth(bitWidth), caps(caps) {
+    if (!caps || caps->size() != (size_t(1) << bitWidth)) {
+        throw invalid_argument("PersistentMultiset: caps do not match the bit width");
+    }
+}
+
+PersistentMultiset::PersistentMultiset(const DenseMultiset& multiset)
+    : bitWidth(multiset.getBitWidth()), caps(multiset.sharedCaps()) {
+    for (size_t i = 0; i < multiset.size(); i++) {
+        if (multiset.count(i) < 0 || multiset.count(i) > multiset.cap(i)) {
+            throw invalid_argument("PersistentMultiset: multiplicities must be between 0 and the cap");
+        }
+    }
+    if (multiset.size() > 0) root = PersistentOps::build(multiset.data(), bitWidth, 0, 0);
+}
+
+int PersistentMultiset::count(size_t rank) const {
+    if (rank >= size()) throw out_of_range("PersistentMultiset: rank outside the universe");
+    const Node* node = root.get();
+    for (int depth = 0; node && depth < bitWidth; depth++) {
+        node = node->child[(rank >> (bitWidth - depth - 1)) & 1].get();
+    }
+    return node ? static_cast<int>(node->total) : 0;
+}
+
+// Path copying: the nodes from the root to the leaf are rebuilt, their
+// other children are shared with this version
+PersistentMultiset PersistentMultiset::set(size_t rank, int multiplicity) const {
+    if (rank >= size()) throw out_of_range("PersistentMultiset: rank outside the universe");
+    if (multiplicity < 0 || multiplicity > cap(rank)) {
+        throw invalid_argument("PersistentMultiset: multiplicity must be between 0 and " + to_string(cap(rank)));
+    }
+    vector<const Node*> path(bitWidth + 1, 0);
+    path[0] = root.get();
+    for (int depth = 0; depth < bitWidth; depth++) {
+        path[depth + 1] = path[depth] ? path[depth]->child[(rank >> (bitWidth - depth - 1)) & 1].get() : 0;
+    }
+    if ((path[bitWidth] ? path[bitWidth]->total : 0) == multiplicity) return *this;
+
+    NodePtr node = makeLeaf(rank, multiplicity);
+    for (int depth = bitWidth - 1; depth >= 0; depth--) {
+        int side = (rank >> (bitWidth - depth - 1)) & 1;
+        NodePtr sibling = path[depth] ? path[depth]->child[1 - side] : NodePtr();
+        node = side == 0 ? makeBranch(node, sibling) : makeBranch(sibling, node);
+    }
+    return PersistentMultiset(bitWidth, caps, node);
+}
+
+PersistentMultiset PersistentMultiset::insert(size_t rank, int copies) const {
+    int current = count(rank);
+    if (copies <= 0) return *this;
+    return set(rank, copies > cap(rank) - current ? cap(rank) : current + copies);
+}
+
+PersistentMultiset PersistentMultiset::remove(size_t rank, int copies) const {
+    int current = count(rank);
+    if (copies <= 0) return *this;
+    return set(rank, copies > current ? 0 : current - copies);
+}
+
+DenseMultiset PersistentMultiset::toDense() const {
+    if (!caps) return DenseMultiset();
+    DenseMultiset result(bitWidth, caps);
+    PersistentOps::collect(root, bitWidth, 0, 0, result.data());
+    return result;
+}
+
+bool PersistentMultiset::sameUniverse(const PersistentMultiset& other) const {
+    return bitWidth == other.bitWidth && size() == other.size();
+}
+
+PersistentMultiset unionMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2) {
+    return PersistentOps::combine(m1, m2, PERSISTENT_UNION);
+}
+
+PersistentMultiset intersectionMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2) {
+    return PersistentOps::combine(m1, m2, PERSISTENT_INTERSECTION);
+}
+
+PersistentMultiset differenceMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2) {
+    return PersistentOps::combine(m1, m2, PERSISTENT_DIFFERENCE);
+}
+
+PersistentMultiset symmetricDifferenceMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2) {
+    return PersistentOps::combine(m1, m2, PERSISTENT_SYMMETRIC);
+}
+
+PersistentMultiset complementMultiset(const PersistentMultiset& multiset) {
+    DenseMultiset dense = multiset.toDense();
+    int* counts = dense.data();
+    const int* caps = dense.capData();
+    for (size_t i = 0; i < dense.size(); i++) counts[i] = complementElement(counts[i], caps[i]);
+    return PersistentMultiset(dense);
+}
+
+int sumMultisets(const PersistentMultiset& multiset) {
+    return static_cast<int>(multiset.cardinality());
+}
+
+long long weightedSum(const PersistentMultiset& multiset) {
+    return multiset.weightedSum();
+}
+
+vector<size_t> changedRanks(const PersistentMultiset& m1, const PersistentMultiset& m2) {
+    if (!m1.sameUniverse(m2)) {
+        throw invalid_argument("PersistentMultiset: operands belong to different universes");
+    }
+    vector<size_t> ranks;
+    PersistentOps::differences(m1.getRoot(), m2.getRoot(), m1.getBitWidth(), 0, 0, ranks);
+    return ranks;
+}
+
+static void gatherNodes(const Node* node, set<const Node*>& seen) {
+    if (!node || !seen.insert(node).second) return; // a shared subtree is counted once
+    gatherNodes(node->child[0].get(), seen);
+    gatherNodes(node->child[1].get(), seen);
+}
+
+size_t distinctNodes(const vector<PersistentMultiset>& versions) {
+    set<const Node*> seen;
+    for (size_t i = 0; i < versions.size(); i++) gatherNodes(versions[i].getRoot().get(), seen);
+    return seen.size();
+}
@@ -0,0 +1,82 @@
+#ifndef PERSISTENT_MULTISET_H
+#define PERSISTENT_MULTISET_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "dense_multiset.h"
+
+using namespace std;
+
+// Immutable multiset stored as a binary trie over the bits of the Gray rank
+// (high bit first), so every subtree is a block of ranks and therefore a
+// code prefix. Each node keeps the cardinality and weighted sum of its
+// block; empty blocks are null. An update copies the path to one leaf and
+// shares everything else with the old version, so a snapshot is a copy of
+// the root pointer (O(1)) and set / insert / remove are O(bitWidth).
+//
+// Versions built from one another share their caps. For such operands the
+// set operations return a shared subtree as is when both inputs hold the
+// same one, and so cost time in proportion to where they differ.
+class PersistentMultiset {
+public:
+    struct Node {
+        long long total;    // sum of multiplicities in the block
+        long long weighted; // sum of rank * multiplicity, wrapping like weightedSum
+        shared_ptr<const Node> child[2];
+    };
+    typedef shared_ptr<const Node> NodePtr;
+
+private:
+    int bitWidth;
+    CapArray caps;
+    NodePtr root;
+
+    friend struct PersistentOps;
+    PersistentMultiset(int bitWidth, const CapArray& caps, const NodePtr& root);
+
+public:
+    PersistentMultiset();
+    PersistentMultiset(int bitWidth, const CapArray& caps); // empty
+    explicit PersistentMultiset(const DenseMultiset& multiset); // O(n); throws if over a cap
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return caps ? caps->size() : 0; }
+    int cap(size_t rank) const { return (*caps)[rank]; }
+    const CapArray& sharedCaps() const { return caps; }
+    const NodePtr& getRoot() const { return root; }
+
+    int count(size_t rank) const; // O(bitWidth)
+    long long cardinality() const { return root ? root->total : 0; }
+    long long weightedSum() const { return root ? root->weighted : 0; }
+
+    // New versions; this one is unchanged. set throws invalid_argument
+    // outside [0, cap]; insert and remove stop at the cap and at 0.
+    PersistentMultiset set(size_t rank, int multiplicity) const;
+    PersistentMultiset insert(size_t rank, int copies = 1) const;
+    PersistentMultiset remove(size_t rank, int copies = 1) const;
+
+    DenseMultiset toDense() const;
+    bool sameUniverse(const PersistentMultiset& other) const;
+    bool sameVersion(const PersistentMultiset& other) const { return root == other.root && caps == other.caps; }
+};
+
+// Set operations (same results as the dense ones; caps of the first operand)
+PersistentMultiset unionMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2);
+PersistentMultiset intersectionMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2);
+PersistentMultiset differenceMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2);
+PersistentMultiset symmetricDifferenceMultisets(const PersistentMultiset& m1, const PersistentMultiset& m2);
+PersistentMultiset complementMultiset(const PersistentMultiset& multiset); // visits every rank
+
+// O(1) aggregates from the root
+int sumMultisets(const PersistentMultiset& multiset);
+long long weightedSum(const PersistentMultiset& multiset);
+
+// Ranks whose multiplicity differs between two versions, in rank order,
+// visiting only the subtrees they do not share
+vector<size_t> changedRanks(const PersistentMultiset& m1, const PersistentMultiset& m2);
+
+// Distinct trie nodes held by a group of versions: their combined memory
+size_t distinctNodes(const vector<PersistentMultiset>& versions);
+
+#endif // PERSISTENT_MULTISET_H
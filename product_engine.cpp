@@ -0,0 +1,394 @@
+#include "product_engine.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+BigInt::BigInt() : negative(false) {}
+
+BigInt::BigInt(long long value) : negative(value < 0) {
+    uint64_t magnitude = value < 0 ? uint64_t(0) - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    while (magnitude != 0) {
+        limbs.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+size_t BigInt::bitLength() const {
+    if (limbs.empty()) return 0;
+    size_t bits = 32 * (limbs.size() - 1);
+    for (uint32_t top = limbs.back(); top != 0; top >>= 1) bits++;
+    return bits;
+}
+
+bool BigInt::toLongLong(long long& value) const {
+    if (limbs.size() > 2) return false;
+    uint64_t magnitude = 0;
+    for (size_t i = limbs.size(); i-- > 0;) magnitude = (magnitude << 32) | limbs[i];
+    uint64_t limit = static_cast<uint64_t>(numeric_limits<long long>::max()) + (negative ? 1 : 0);
+    if (magnitude > limit) return false;
+    value = negative ? static_cast<long long>(uint64_t(0) - magnitude) : static_cast<long long>(magnitude);
+    return true;
+}
+
+BigInt& BigInt::multiplySmall(uint32_t factor) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < limbs.size(); i++) {
+        uint64_t value = static_cast<uint64_t>(limbs[i]) * factor + carry;
+        limbs[i] = static_cast<uint32_t>(value);
+        carry = value >> 32;
+    }
+    if (carry != 0) limbs.push_back(static_cast<uint32_t>(carry));
+    if (factor == 0) limbs.clear();
+    if (limbs.empty()) negative = false;
+    return *this;
+}
+
+BigInt& BigInt::operator*=(const BigInt& other) {
+    if (limbs.empty() || other.limbs.empty()) {
+        limbs.clear();
+        negative = false;
+        return *this;
+    }
+    // Schoolbook multiplication, 32x32 -> 64-bit partial products
+    vector<uint32_t> result(limbs.size() + other.limbs.size(), 0);
+    for (size_t i = 0; i < limbs.size(); i++) {
+        uint64_t carry = 0;
+        uint64_t a = limbs[i];
+        for (size_t j = 0; j < other.limbs.size(); j++) {
+            uint64_t value = a * other.limbs[j] + result[i + j] + carry;
+            result[i + j] = static_cast<uint32_t>(value);
+            carry = value >> 32;
+        }
+        result[i + other.limbs.size()] = static_cast<uint32_t>(carry);
+    }
+    while (!result.empty() && result.back() == 0) result.pop_back();
+    limbs.swap(result);
+    negative = negative != other.negative;
+    return *this;
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    BigInt result = a;
+    result *= b;
+    return result;
+}
+
+string BigInt::toString() const {
+    if (limbs.empty()) return "0";
+    // Repeated division by 10^9, collecting base-10^9 digits from the bottom
+    vector<uint32_t> work = limbs;
+    vector<uint32_t> chunks;
+    while (!work.empty()) {
+        uint64_t remainder = 0;
+        for (size_t i = work.size(); i-- > 0;) {
+            uint64_t value = (remainder << 32) | work[i];
+            work[i] = static_cast<uint32_t>(value / 1000000000u);
+            remainder = value % 1000000000u;
+        }
+        chunks.push_back(static_cast<uint32_t>(remainder));
+        while (!work.empty() && work.back() == 0) work.pop_back();
+    }
+    ostringstream out;
+    if (negative) out << '-';
+    out << chunks.back();
+    for (size_t i = chunks.size() - 1; i-- > 0;) out << setw(9) << setfill('0') << chunks[i];
+    return out.str();
+}
+
+BigInt bigPower(const BigInt& base, uint64_t exponent) {
+    BigInt result(1);
+    BigInt square = base;
+    while (exponent != 0) {
+        if (exponent & 1) result *= square;
+        exponent >>= 1;
+        if (exponent != 0) square *= square;
+    }
+    return result;
+}
+
+long double powerBySquaring(long double base, uint64_t exponent) {
+    long double result = 1.0L;
+    while (exponent != 0) {
+        if (exponent & 1) result *= base;
+        exponent >>= 1;
+        if (exponent != 0) base *= base;
+    }
+    return result;
+}
+
+uint64_t mulMod(uint64_t a, uint64_t b, uint64_t modulus) {
+#if defined(__SIZEOF_INT128__)
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) % modulus);
+#else
+    // Double and add; a, b < modulus
+    uint64_t result = 0;
+    while (b != 0) {
+        if (b & 1) result = (result >= modulus - a) ? result - (modulus - a) : result + a;
+        b >>= 1;
+        a = (a >= modulus - a) ? a - (modulus - a) : a + a;
+    }
+    return result;
+#endif
+}
+
+uint64_t powerMod(uint64_t base, uint64_t exponent, uint64_t modulus) {
+    if (modulus == 0) throw invalid_argument("powerMod: modulus must be positive");
+    uint64_t result = 1 % modulus;
+    base %= modulus;
+    while (exponent != 0) {
+        if (exponent & 1) result = mulMod(result, base, modulus);
+        exponent >>= 1;
+        if (exponent != 0) base = mulMod(base, base, modulus);
+    }
+    return result;
+}
+
+bool isPrime(uint64_t n) {
+    // The first twelve primes as bases decide every n < 2^64
+    static const uint64_t bases[12] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+    if (n < 2) return false;
+    for (int i = 0; i < 12; i++) {
+        if (n % bases[i] == 0) return n == bases[i];
+    }
+    uint64_t odd = n - 1;
+    int twos = 0;
+    while ((odd & 1) == 0) {
+        odd >>= 1;
+        twos++;
+    }
+    for (int i = 0; i < 12; i++) {
+        uint64_t x = powerMod(bases[i], odd, n);
+        if (x == 1 || x == n - 1) continue;
+        bool witness = true;
+        for (int r = 1; r < twos && witness; r++) {
+            x = mulMod(x, x, n);
+            if (x == n - 1) witness = false;
+        }
+        if (witness) return false;
+    }
+    return true;
+}
+
+static uint64_t magnitudeOf(long long value) {
+    return value < 0 ? uint64_t(0) - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+}
+
+static bool checkedMultiply(uint64_t a, uint64_t b, uint64_t& out) {
+    if (a != 0 && b > numeric_limits<uint64_t>::max() / a) return false;
+    out = a * b;
+    return true;
+}
+
+void ProductEngine::multiply(long long value, uint64_t exponent) {
+    if (exponent != 0) factors.push_back(make_pair(value, exponent));
+}
+
+bool ProductEngine::isZero() const {
+    for (size_t i = 0; i < factors.size(); i++) {
+        if (factors[i].first == 0) return true;
+    }
+    return false;
+}
+
+bool ProductEngine::isNegative() const {
+    if (isZero()) return false;
+    bool negative = false;
+    for (size_t i = 0; i < factors.size(); i++) {
+        if (factors[i].first < 0 && (factors[i].second & 1)) negative = !negative;
+    }
+    return negative;
+}
+
+BigInt ProductEngine::exact() const {
+    if (isZero()) return BigInt(0);
+    double bits = logMagnitude() / log(2.0);
+    if (bits > static_cast<double>(PRODUCT_EXACT_MAX_BITS)) {
+        ostringstream message;
+        message << "exact product has about " << static_cast<uint64_t>(bits) << " bits, over the limit of "
+                << PRODUCT_EXACT_MAX_BITS << "; use log or mod";
+        throw runtime_error(message.str());
+    }
+    BigInt result(1);
+    // Single small factors are gathered into one 32-bit limb before they
+    // touch the big number, which cuts the number of long multiplications
+    uint64_t pending = 1;
+    for (size_t i = 0; i < factors.size(); i++) {
+        uint64_t magnitude = magnitudeOf(factors[i].first);
+        if (factors[i].second == 1 && magnitude <= 0xffffffffu) {
+            if (pending * magnitude > 0xffffffffu) {
+                result.multiplySmall(static_cast<uint32_t>(pending));
+                pending = 1;
+            }
+            pending *= magnitude;
+        } else if (magnitude > static_cast<uint64_t>(numeric_limits<long long>::max())) {
+            BigInt base(numeric_limits<long long>::min()); // the only magnitude past LLONG_MAX
+            result *= bigPower(base, factors[i].second);
+        } else {
+            result *= bigPower(BigInt(static_cast<long long>(magnitude)), factors[i].second);
+        }
+    }
+    result.multiplySmall(static_cast<uint32_t>(pending));
+    if (isNegative() != result.isNegative()) result *= BigInt(-1);
+    return result;
+}
+
+double ProductEngine::logMagnitude() const {
+    if (isZero()) return -numeric_limits<double>::infinity();
+    long double total = 0.0L;
+    for (size_t i = 0; i < factors.size(); i++) {
+        total += static_cast<long double>(factors[i].second) * logl(static_cast<long double>(magnitudeOf(factors[i].first)));
+    }
+    return static_cast<double>(total);
+}
+
+uint64_t ProductEngine::modular(uint64_t modulus) const {
+    if (modulus == 0) throw invalid_argument("ProductEngine: modulus must be positive");
+    uint64_t result = 1 % modulus;
+    for (size_t i = 0; i < factors.size(); i++) {
+        result = mulMod(result, powerMod(magnitudeOf(factors[i].first), factors[i].second, modulus), modulus);
+    }
+    return (isNegative() && result != 0) ? modulus - result : result;
+}
+
+long double ProductEngine::approximate() const {
+    if (isZero()) return 0.0L;
+    long double result = 1.0L;
+    for (size_t i = 0; i < factors.size(); i++) {
+        result *= powerBySquaring(static_cast<long double>(magnitudeOf(factors[i].first)), factors[i].second);
+    }
+    return isNegative() ? -result : result;
+}
+
+bool ProductEngine::checked(long long& out) const {
+    if (isZero()) {
+        out = 0;
+        return true;
+    }
+    uint64_t magnitude = 1;
+    for (size_t i = 0; i < factors.size(); i++) {
+        uint64_t base = magnitudeOf(factors[i].first);
+        uint64_t power = 1;
+        for (uint64_t exponent = factors[i].second; exponent != 0;) {
+            if ((exponent & 1) && !checkedMultiply(power, base, power)) return false;
+            exponent >>= 1;
+            if (exponent != 0 && !checkedMultiply(base, base, base)) return false;
+        }
+        if (!checkedMultiply(magnitude, power, magnitude)) return false;
+    }
+    bool negative = isNegative();
+    uint64_t limit = static_cast<uint64_t>(numeric_limits<long long>::max()) + (negative ? 1 : 0);
+    if (magnitude > limit) return false;
+    out = negative ? static_cast<long long>(uint64_t(0) - magnitude) : static_cast<long long>(magnitude);
+    return true;
+}
+
+bool ProductEngine::checked(int& out) const {
+    long long value;
+    if (!checked(value) || value < numeric_limits<int>::min() || value > numeric_limits<int>::max()) {
+        return false;
+    }
+    out = static_cast<int>(value);
+    return true;
+}
+
+string ProductEngine::format(ProductMode mode, uint64_t modulus) const {
+    ostringstream out;
+    if (mode == PRODUCT_EXACT) {
+        out << exact().toString();
+    } else if (mode == PRODUCT_LOG) {
+        out << setprecision(17) << logMagnitude();
+    } else if (mode == PRODUCT_CHECKED) {
+        long long value;
+        if (checked(value)) {
+            out << value;
+        } else {
+            out << "ln " << setprecision(17) << logMagnitude();
+        }
+    } else {
+        out << modular(modulus);
+    }
+    return out.str();
+}
+
+int checkedIntProduct(const ProductEngine& engine) {
+    int value;
+    if (!engine.checked(value)) {
+        ostringstream message;
+        message << "product does not fit in int (ln|product| = " << setprecision(6) << engine.logMagnitude() << ")";
+        throw overflow_error(message.str());
+    }
+    return value;
+}
+
+ProductHistogram mergeProductHistograms(ProductHistogram a, const ProductHistogram& b) {
+    for (ProductHistogram::const_iterator it = b.begin(); it != b.end(); ++it) a[it->first] += it->second;
+    return a;
+}
+
+// Plain products: equal multiplicities are grouped into one power
+ProductEngine groupedFactors(const ProductHistogram& histogram) {
+    ProductEngine engine;
+    for (ProductHistogram::const_iterator it = histogram.begin(); it != histogram.end(); ++it) {
+        engine.multiply(it->first, it->second);
+    }
+    return engine;
+}
+
+ProductEngine productFactors(const DenseView& multiset) {
+    const int* counts = multiset.counts;
+    ProductHistogram histogram = parallelReduce(multiset.size, ProductHistogram(), [counts](size_t begin, size_t end) {
+        ProductHistogram partial;
+        for (size_t i = begin; i < end; i++) {
+            if (counts[i] != 0) partial[counts[i]]++;
+        }
+        return partial;
+    }, mergeProductHistograms);
+    return groupedFactors(histogram);
+}
+
+ProductEngine productFactors(const SparseView& multiset) {
+    ProductHistogram histogram;
+    for (size_t i = 0; i < multiset.support; i++) {
+        if (multiset.entries[i].multiplicity != 0) histogram[multiset.entries[i].multiplicity]++;
+    }
+    return groupedFactors(histogram);
+}
+
+ProductEngine productFactors(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) return ProductEngine(); // every present multiplicity is 1
+    return multiset.isSparse() ? productFactors(multiset.getSparse().view()) : productFactors(multiset.getDense().view());
+}
+
+ProductEngine weightedProductFactors(const DenseView& multiset) {
+    ProductEngine engine;
+    for (size_t i = 0; i < multiset.size; i++) {
+        if (multiset.counts[i] > 0) engine.multiply(static_cast<long long>(i), static_cast<uint64_t>(multiset.counts[i]));
+    }
+    return engine;
+}
+
+ProductEngine weightedProductFactors(const SparseView& multiset) {
+    ProductEngine engine;
+    for (size_t i = 0; i < multiset.support; i++) {
+        const SparseEntry& entry = multiset.entries[i];
+        if (entry.multiplicity > 0) engine.multiply(entry.rank, static_cast<uint64_t>(entry.multiplicity));
+    }
+    return engine;
+}
+
+ProductEngine weightedProductFactors(const AdaptiveMultiset& multiset) {
+    if (multiset.isBitset()) {
+        ProductEngine engine;
+        const BitsetMultiset& bits = multiset.getBitset();
+        for (size_t i = 0; i < bits.size(); i++) {
+            if (bits.test(i)) engine.multiply(static_cast<long long>(i), 1);
+        }
+        return engine;
+    }
+    return multiset.isSparse() ? weightedProductFactors(multiset.getSparse().view())
+                               : weightedProductFactors(multiset.getDense().view());
+}
@@ -0,0 +1,115 @@
+#ifndef PRODUCT_ENGINE_H
+#define PRODUCT_ENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "adaptive_multiset.h"
+
+using namespace std;
+
+// Arbitrary-precision signed integer, just enough for exact products:
+// multiplication and decimal output. Magnitude in base 2^32, least
+// significant limb first, no leading zero limbs (zero has none).
+class BigInt {
+private:
+    vector<uint32_t> limbs;
+    bool negative;
+
+public:
+    BigInt();
+    BigInt(long long value);
+
+    bool isZero() const { return limbs.empty(); }
+    bool isNegative() const { return negative; }
+    size_t bitLength() const;
+    bool toLongLong(long long& value) const; // false when it does not fit
+
+    BigInt& operator*=(const BigInt& other);
+    BigInt& multiplySmall(uint32_t factor);
+    bool operator==(const BigInt& other) const { return negative == other.negative && limbs == other.limbs; }
+    bool operator!=(const BigInt& other) const { return !(*this == other); }
+
+    string toString() const;
+};
+
+BigInt operator*(const BigInt& a, const BigInt& b);
+
+// Powers by repeated squaring: O(log exponent) multiplications
+BigInt bigPower(const BigInt& base, uint64_t exponent);
+long double powerBySquaring(long double base, uint64_t exponent);
+uint64_t powerMod(uint64_t base, uint64_t exponent, uint64_t modulus);
+uint64_t mulMod(uint64_t a, uint64_t b, uint64_t modulus); // a, b < modulus
+bool isPrime(uint64_t n); // deterministic Miller-Rabin, exact for every uint64_t
+
+// Result modes of a product: the exact integer, ln|product| for comparing
+// magnitudes, the residue modulo a prime for hashing and fingerprints, or
+// the value when it fits in a long long and ln|product| otherwise
+enum ProductMode {
+    PRODUCT_EXACT = 0,
+    PRODUCT_LOG = 1,
+    PRODUCT_MODULAR = 2,
+    PRODUCT_CHECKED = 3
+};
+
+const uint64_t PRODUCT_DEFAULT_MODULUS = (uint64_t(1) << 61) - 1; // Mersenne prime
+
+// Largest exact product computed (about 79,000 decimal digits). Big
+// integer multiplication and formatting are quadratic, so exact() throws
+// runtime_error past this size instead of running for seconds.
+const size_t PRODUCT_EXACT_MAX_BITS = size_t(1) << 18;
+
+// A product collected as value^exponent factors. Callers with repeated
+// values (plain products: many elements share a multiplicity) should pass
+// each value once with its total exponent; every mode then costs
+// O(log exponent) per factor instead of one step per unit of multiplicity.
+class ProductEngine {
+private:
+    vector<pair<long long, uint64_t> > factors;
+
+public:
+    void multiply(long long value, uint64_t exponent = 1);
+    size_t factorCount() const { return factors.size(); }
+
+    bool isZero() const;
+    bool isNegative() const;
+
+    BigInt exact() const; // throws runtime_error past PRODUCT_EXACT_MAX_BITS
+    double logMagnitude() const; // ln|product|, -infinity for 0
+    uint64_t modular(uint64_t modulus = PRODUCT_DEFAULT_MODULUS) const; // in [0, modulus)
+    long double approximate() const;
+
+    // Overflow-checked values: false (and out untouched) when the product
+    // does not fit the type
+    bool checked(long long& out) const;
+    bool checked(int& out) const;
+
+    // PRODUCT_CHECKED gives the integer, or "ln <ln|product|>" when it
+    // does not fit in a long long
+    string format(ProductMode mode, uint64_t modulus = PRODUCT_DEFAULT_MODULUS) const;
+};
+
+// The int value of a plain product (productMultisets). Throws
+// overflow_error when it does not fit in an int, instead of wrapping.
+int checkedIntProduct(const ProductEngine& engine);
+
+// Count of elements by multiplicity; plain products are built from it
+typedef map<int, uint64_t> ProductHistogram;
+ProductHistogram mergeProductHistograms(ProductHistogram a, const ProductHistogram& b);
+ProductEngine groupedFactors(const ProductHistogram& histogram);
+
+// Factors of productMultisets (non-zero multiplicities, grouped by value)
+// and of weightedProduct (rank ^ multiplicity for positive multiplicities)
+ProductEngine productFactors(const DenseView& multiset);
+ProductEngine productFactors(const SparseView& multiset);
+ProductEngine productFactors(const AdaptiveMultiset& multiset);
+ProductEngine weightedProductFactors(const DenseView& multiset);
+ProductEngine weightedProductFactors(const SparseView& multiset);
+ProductEngine weightedProductFactors(const AdaptiveMultiset& multiset);
+
+#endif // PRODUCT_ENGINE_H
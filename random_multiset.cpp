@@ -0,0 +1,289 @@
+#include "random_multiset.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+static uint64_t mix64(uint64_t z) {
+    // SplitMix64 finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t counterHash(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint64_t key = mix64(seed + mix64(stream + 0x9e3779b97f4a7c15ull));
+    return mix64(key + (counter + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+// log(Gamma(x)) for x >= 1: Stirling series, shifted up to x >= 7.
+// Local so that concurrent samplers do not share lgamma's sign global.
+static double logGamma(double x) {
+    static const double coefficients[10] = {
+        8.333333333333333e-02, -2.777777777777778e-03, 7.936507936507937e-04, -5.952380952380952e-04,
+        8.417508417508418e-04, -1.917526917526918e-03, 6.410256410256410e-03, -2.955065359477124e-02,
+        1.796443723688307e-01, -1.39243221690590e+00};
+    if (x == 1.0 || x == 2.0) return 0.0;
+    int shift = x < 7.0 ? static_cast<int>(7.0 - x) : 0;
+    double x0 = x + shift;
+    double inverseSquare = 1.0 / (x0 * x0);
+    double series = coefficients[9];
+    for (int k = 8; k >= 0; k--) series = series * inverseSquare + coefficients[k];
+    double result = series / x0 + 0.9189385332046727 + (x0 - 0.5) * log(x0) - x0; // 0.5 * log(2 pi)
+    for (int k = 0; k < shift; k++) {
+        x0 -= 1.0;
+        result -= log(x0);
+    }
+    return result;
+}
+
+// Minority items among m drawn from minority + majority items. Small
+// samples draw one item at a time; larger ones use ratio-of-uniforms
+// rejection (Stadlober's HRUA), whose cost does not depend on m.
+static uint64_t minorityDrawn(CounterRng& rng, uint64_t minority, uint64_t majority, uint64_t m) {
+    uint64_t total = minority + majority;
+    if (m <= 10) {
+        uint64_t drawn = 0;
+        uint64_t left = minority;
+        for (uint64_t i = 0; i < m; i++) {
+            if (rng.uniform() * static_cast<double>(total - i) < static_cast<double>(left)) {
+                drawn++;
+                left--;
+            }
+        }
+        return drawn;
+    }
+    const double D1 = 1.7155277699214135; // 2 sqrt(2 / e)
+    const double D2 = 0.8989161620588988; // 3 - 2 sqrt(3 / e)
+    double N = static_cast<double>(total);
+    double M = static_cast<double>(minority);
+    double K = static_cast<double>(majority);
+    double n = static_cast<double>(m);
+    double p = M / N;
+    double mean = n * p + 0.5;
+    double spread = sqrt(n * (N - n) * p * (1.0 - p) / (N - 1.0) + 0.5);
+    double width = D1 * spread + D2;
+    double mode = floor((n + 1.0) * (M + 1.0) / (N + 2.0));
+    double logAtMode = logGamma(mode + 1.0) + logGamma(M - mode + 1.0) + logGamma(n - mode + 1.0) +
+                       logGamma(K - n + mode + 1.0);
+    double limit = min(min(n, M) + 1.0, floor(mean + 16.0 * spread));
+    for (;;) {
+        double x = 1.0 - rng.uniform(); // (0, 1]
+        double y = rng.uniform();
+        double w = mean + width * (y - 0.5) / x;
+        if (w < 0.0 || w >= limit) continue;
+        double z = floor(w);
+        double t = logAtMode - (logGamma(z + 1.0) + logGamma(M - z + 1.0) + logGamma(n - z + 1.0) +
+                                logGamma(K - n + z + 1.0));
+        if (x * (4.0 - x) - 3.0 <= t) return static_cast<uint64_t>(z); // quick accept
+        if (x * (x - t) >= 1.0) continue;                              // quick reject
+        if (2.0 * log(x) <= t) return static_cast<uint64_t>(z);
+    }
+}
+
+// Successes in n trials of probability p <= 1/2. Small means search the
+// distribution from 0 (inversion); larger ones use the ratio-of-uniforms
+// rejection of minorityDrawn with the binomial probabilities.
+static uint64_t rareSuccesses(CounterRng& rng, uint64_t trials, double p) {
+    double n = static_cast<double>(trials);
+    double q = 1.0 - p;
+    if (n * p < 10.0) {
+        double ratio = p / q;
+        double probability = exp(n * log1p(-p)); // P(0)
+        double u = rng.uniform();
+        uint64_t k = 0;
+        while (u > probability && k < trials) {
+            u -= probability;
+            k++;
+            probability *= ratio * (n - static_cast<double>(k) + 1.0) / static_cast<double>(k);
+        }
+        return k;
+    }
+    const double D1 = 1.7155277699214135; // 2 sqrt(2 / e)
+    const double D2 = 0.8989161620588988; // 3 - 2 sqrt(3 / e)
+    double logP = log(p);
+    double logQ = log1p(-p);
+    double mean = n * p + 0.5;
+    double spread = sqrt(n * p * q + 0.5);
+    double width = D1 * spread + D2;
+    double mode = floor((n + 1.0) * p);
+    double logAtMode = -logGamma(mode + 1.0) - logGamma(n - mode + 1.0) + mode * logP + (n - mode) * logQ;
+    double limit = min(n + 1.0, floor(mean + 16.0 * spread));
+    for (;;) {
+        double x = 1.0 - rng.uniform(); // (0, 1]
+        double y = rng.uniform();
+        double w = mean + width * (y - 0.5) / x;
+        if (w < 0.0 || w >= limit) continue;
+        double z = floor(w);
+        double t = -logGamma(z + 1.0) - logGamma(n - z + 1.0) + z * logP + (n - z) * logQ - logAtMode;
+        if (x * (4.0 - x) - 3.0 <= t) return static_cast<uint64_t>(z); // quick accept
+        if (x * (x - t) >= 1.0) continue;                              // quick reject
+        if (2.0 * log(x) <= t) return static_cast<uint64_t>(z);
+    }
+}
+
+uint64_t sampleHypergeometric(CounterRng& rng, uint64_t good, uint64_t bad, uint64_t sample) {
+    uint64_t total = good + bad;
+    if (sample > total) {
+        throw invalid_argument("sampleHypergeometric: sample exceeds population");
+    }
+    if (sample == 0 || good == 0) return 0;
+    if (bad == 0) return sample;
+    if (sample == total) return good;
+    // Draw the smaller of the sample and its complement and count the rarer kind
+    uint64_t m = min(sample, total - sample);
+    uint64_t drawn = minorityDrawn(rng, min(good, bad), max(good, bad), m);
+    if (good > bad) drawn = m - drawn;
+    if (m < sample) drawn = good - drawn;
+    return drawn;
+}
+
+uint64_t sampleBinomial(CounterRng& rng, uint64_t trials, double p) {
+    if (trials == 0 || p <= 0.0) return 0;
+    if (p >= 1.0) return trials;
+    // Sample the rarer outcome and flip back; the samplers below are local
+    // rather than std::binomial_distribution, which calls lgamma (a data race
+    // on its sign global) and draws different values on every standard library
+    bool flip = p > 0.5;
+    double rare = flip ? 1.0 - p : p;
+    uint64_t successes = rareSuccesses(rng, trials, rare);
+    return flip ? trials - successes : successes;
+}
+
+uint64_t totalCapacity(const DenseMultiset& multiset) {
+    const int* caps = multiset.capData();
+    return parallelReduce(multiset.size(), uint64_t(0), [caps](size_t begin, size_t end) {
+        uint64_t partial = 0;
+        for (size_t i = begin; i < end; i++) partial += caps[i] > 0 ? static_cast<uint64_t>(caps[i]) : 0;
+        return partial;
+    }, [](uint64_t a, uint64_t b) { return a + b; });
+}
+
+namespace {
+
+const size_t CAP_BLOCK = 64; // granularity of the capacity prefix sums
+
+// Units are split down the binary tree of aligned rank ranges; node k has
+// children 2k and 2k + 1 and draws from counter stream k
+struct RandomFill {
+    const int* caps;
+    int* counts;
+    vector<uint64_t> prefix; // prefix[j] = capacity of ranks [0, j * CAP_BLOCK)
+    uint64_t seed;
+    RandomDistribution distribution;
+
+    uint64_t capSum(size_t begin, size_t end) const {
+        uint64_t total = 0;
+        for (size_t i = begin; i < end; i++) total += caps[i] > 0 ? static_cast<uint64_t>(caps[i]) : 0;
+        return total;
+    }
+
+    // Ranges of CAP_BLOCK ranks or more are aligned, so they come from the prefix
+    uint64_t capacity(size_t begin, size_t end) const {
+        if (end - begin >= CAP_BLOCK) return prefix[end / CAP_BLOCK] - prefix[begin / CAP_BLOCK];
+        return capSum(begin, end);
+    }
+
+    // Units for the left half of a node holding `units` of `total` capacity
+    uint64_t leftShare(uint64_t node, uint64_t units, uint64_t leftCapacity, uint64_t rightCapacity) const {
+        CounterRng rng(seed, node);
+        if (distribution == RANDOM_UNIFORM) {
+            return sampleHypergeometric(rng, leftCapacity, rightCapacity, units);
+        }
+        uint64_t left = sampleBinomial(rng, units, 0.5); // halves hold equally many elements
+        left = min(left, leftCapacity);
+        if (units - left > rightCapacity) left = units - rightCapacity;
+        return left;
+    }
+
+    void fillConstant(size_t begin, size_t end, bool full) {
+        for (size_t i = begin; i < end; i++) counts[i] = full && caps[i] > 0 ? caps[i] : 0;
+    }
+
+    // Distributes units over [begin, end) down to ranges of blockSize,
+    // calling leaf(node, begin, end, units) for each of them
+    template <typename Leaf>
+    void split(uint64_t node, size_t begin, size_t end, uint64_t units, uint64_t total, size_t blockSize,
+               Leaf& leaf) {
+        if (end - begin <= blockSize) {
+            leaf(node, begin, end, units, total);
+            return;
+        }
+        size_t mid = begin + (end - begin) / 2;
+        uint64_t leftCapacity = capacity(begin, mid);
+        uint64_t left = (units == 0 || units == total) ? (units == 0 ? 0 : leftCapacity)
+                                                       : leftShare(node, units, leftCapacity, total - leftCapacity);
+        split(2 * node, begin, mid, left, leftCapacity, blockSize, leaf);
+        split(2 * node + 1, mid, end, units - left, total - leftCapacity, blockSize, leaf);
+    }
+
+    void fill(uint64_t node, size_t begin, size_t end, uint64_t units, uint64_t total) {
+        if (units == 0 || units == total) {
+            fillConstant(begin, end, units != 0);
+            return;
+        }
+        if (end - begin == 1) {
+            counts[begin] = static_cast<int>(units);
+            return;
+        }
+        size_t mid = begin + (end - begin) / 2;
+        uint64_t leftCapacity = capacity(begin, mid);
+        uint64_t left = leftShare(node, units, leftCapacity, total - leftCapacity);
+        fill(2 * node, begin, mid, left, leftCapacity);
+        fill(2 * node + 1, mid, end, units - left, total - leftCapacity);
+    }
+};
+
+} // namespace
+
+void fillRandomMultiset(DenseMultiset& dst, uint64_t cardinality, uint64_t seed, RandomDistribution distribution) {
+    size_t size = dst.size();
+    RandomFill state;
+    state.caps = dst.capData();
+    state.counts = dst.data();
+    state.seed = seed;
+    state.distribution = distribution;
+
+    // Capacity prefix sums, one entry per CAP_BLOCK ranks
+    size_t capBlocks = (size + CAP_BLOCK - 1) / CAP_BLOCK;
+    state.prefix.assign(capBlocks + 1, 0);
+    uint64_t* prefix = state.prefix.data();
+    const RandomFill& constState = state;
+    parallelFor(capBlocks, [&](size_t, size_t begin, size_t end) {
+        for (size_t j = begin; j < end; j++) {
+            prefix[j + 1] = constState.capSum(j * CAP_BLOCK, min(size, (j + 1) * CAP_BLOCK));
+        }
+    });
+    for (size_t j = 0; j < capBlocks; j++) prefix[j + 1] += prefix[j];
+    uint64_t total = prefix[capBlocks];
+    if (cardinality > total) {
+        throw invalid_argument("random multiset: cardinality exceeds the total capacity of the universe");
+    }
+
+    // The top of the tree is split serially into one share per block; the
+    // blocks then continue the same tree in parallel
+    size_t blocks = parallelBlockCount(size);
+    size_t blockSize = size / blocks;
+    vector<uint64_t> shares(blocks), capacities(blocks);
+    struct Collect {
+        vector<uint64_t>& shares;
+        vector<uint64_t>& capacities;
+        size_t blockSize;
+        void operator()(uint64_t, size_t begin, size_t, uint64_t units, uint64_t total) {
+            shares[begin / blockSize] = units;
+            capacities[begin / blockSize] = total;
+        }
+    } collect = {shares, capacities, blockSize};
+    state.split(1, 0, size, cardinality, total, blockSize, collect);
+    parallelFor(size, blocks, [&](size_t block, size_t begin, size_t end) {
+        state.fill(blocks + block, begin, end, shares[block], capacities[block]);
+    });
+}
+
+DenseMultiset randomMultiset(int bitWidth, const CapArray& caps, uint64_t cardinality, uint64_t seed,
+                             RandomDistribution distribution) {
+    DenseMultiset result(bitWidth, caps);
+    fillRandomMultiset(result, cardinality, seed, distribution);
+    return result;
+}
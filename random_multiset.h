@@ -0,0 +1,63 @@
+#ifndef RANDOM_MULTISET_H
+#define RANDOM_MULTISET_H
+
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+
+using namespace std;
+
+// Counter-based random numbers: value number `counter` of stream `stream`
+// is a pure function of (seed, stream, counter), so any part of a
+// computation can draw its numbers without touching shared state.
+uint64_t counterHash(uint64_t seed, uint64_t stream, uint64_t counter);
+
+// One stream as a UniformRandomBitGenerator (usable with <random>)
+class CounterRng {
+private:
+    uint64_t seed;
+    uint64_t stream;
+    uint64_t counter;
+
+public:
+    typedef uint64_t result_type;
+
+    CounterRng(uint64_t seed, uint64_t stream) : seed(seed), stream(stream), counter(0) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return ~result_type(0); }
+    result_type operator()() { return counterHash(seed, stream, counter++); }
+    double uniform() { return static_cast<double>((*this)() >> 11) * (1.0 / 9007199254740992.0); } // [0, 1)
+};
+
+// Number of good items among `sample` drawn without replacement from
+// good + bad items (sample <= good + bad)
+uint64_t sampleHypergeometric(CounterRng& rng, uint64_t good, uint64_t bad, uint64_t sample);
+// Successes in `trials` independent trials of probability p
+uint64_t sampleBinomial(CounterRng& rng, uint64_t trials, double p);
+
+// How the units of a random multiset are spread over the universe:
+//   RANDOM_UNIFORM      every set of `cardinality` capacity units is equally
+//                       likely (multivariate hypergeometric over the caps)
+//   RANDOM_MULTINOMIAL  each unit picks an element uniformly; where part of
+//                       the universe would overflow its caps, the excess
+//                       goes to the neighbouring part
+enum RandomDistribution {
+    RANDOM_UNIFORM = 0,
+    RANDOM_MULTINOMIAL = 1
+};
+
+// Sum of the caps (negative caps count as 0)
+uint64_t totalCapacity(const DenseMultiset& multiset);
+
+// Fills dst with exactly `cardinality` units within its caps. Units are
+// split down a fixed binary tree over the ranks, each split drawing from
+// its own counter stream, so large universes are filled on the thread pool
+// and the result depends only on the seed, never on the thread count.
+// Throws invalid_argument if the cardinality exceeds the total capacity.
+void fillRandomMultiset(DenseMultiset& dst, uint64_t cardinality, uint64_t seed,
+                        RandomDistribution distribution = RANDOM_UNIFORM);
+DenseMultiset randomMultiset(int bitWidth, const CapArray& caps, uint64_t cardinality, uint64_t seed,
+                             RandomDistribution distribution = RANDOM_UNIFORM);
+
+#endif // RANDOM_MULTISET_H
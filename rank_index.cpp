@@ -0,0 +1,125 @@
+#include "rank_index.h"
+#include "gray_code.h"
+#include <stdexcept>
+
+void grayPrefixRange(int bitWidth, uint32_t prefix, int prefixBits, size_t& first, size_t& last) {
+    if (prefixBits < 0 || prefixBits > bitWidth) {
+        throw invalid_argument("grayPrefixRange: prefix is longer than the codes");
+    }
+    if (prefixBits < 32 && (prefix >> prefixBits) != 0) {
+        throw invalid_argument("grayPrefixRange: prefix has more bits than prefixBits");
+    }
+    // The top bits of rank ^ (rank >> 1) are the Gray code of the top bits of rank
+    size_t block = size_t(1) << (bitWidth - prefixBits);
+    first = static_cast<size_t>(grayDecode(prefix)) * block;
+    last = first + block;
+}
+
+RankIndex::RankIndex() : bitWidth(0), highestStep(0) {}
+
+RankIndex::RankIndex(const DenseView& multiset) : bitWidth(multiset.bitWidth) {
+    vector<long long> values(multiset.size), weights(multiset.size);
+    for (size_t i = 0; i < multiset.size; i++) {
+        values[i] = multiset.counts[i];
+        weights[i] = static_cast<long long>(static_cast<unsigned long long>(multiset.counts[i]) * i);
+    }
+    build(values, counts);
+    build(weights, weighted);
+}
+
+RankIndex::RankIndex(const DenseMultiset& multiset) : RankIndex(multiset.view()) {}
+
+RankIndex::RankIndex(const SparseMultiset& multiset) : bitWidth(multiset.getBitWidth()) {
+    vector<long long> values(multiset.size(), 0), weights(multiset.size(), 0);
+    const vector<SparseEntry>& entries = multiset.getEntries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        values[entries[i].rank] = entries[i].multiplicity;
+        weights[entries[i].rank] =
+            static_cast<long long>(static_cast<unsigned long long>(entries[i].multiplicity) * entries[i].rank);
+    }
+    build(values, counts);
+    build(weights, weighted);
+}
+
+// Linear-time construction: each node passes its sum on to its parent
+void RankIndex::build(const vector<long long>& values, vector<long long>& tree) {
+    size_t n = values.size();
+    tree.assign(n + 1, 0);
+    for (size_t i = 1; i <= n; i++) {
+        tree[i] = static_cast<long long>(static_cast<unsigned long long>(tree[i]) + static_cast<unsigned long long>(values[i - 1]));
+        size_t parent = i + (i & (0 - i));
+        if (parent <= n) {
+            tree[parent] = static_cast<long long>(static_cast<unsigned long long>(tree[parent]) + static_cast<unsigned long long>(tree[i]));
+        }
+    }
+    highestStep = 1;
+    while (highestStep * 2 <= n) highestStep *= 2;
+}
+
+long long RankIndex::prefixOf(const vector<long long>& tree, size_t end) const {
+    if (end > size()) throw out_of_range("RankIndex: rank outside the universe");
+    unsigned long long sum = 0;
+    for (size_t i = end; i > 0; i -= i & (0 - i)) sum += static_cast<unsigned long long>(tree[i]);
+    return static_cast<long long>(sum);
+}
+
+void RankIndex::add(size_t rank, long long delta) {
+    if (rank >= size()) throw out_of_range("RankIndex: rank outside the universe");
+    unsigned long long weight = static_cast<unsigned long long>(delta) * rank;
+    for (size_t i = rank + 1; i <= size(); i += i & (0 - i)) {
+        counts[i] = static_cast<long long>(static_cast<unsigned long long>(counts[i]) + static_cast<unsigned long long>(delta));
+        weighted[i] = static_cast<long long>(static_cast<unsigned long long>(weighted[i]) + weight);
+    }
+}
+
+long long RankIndex::rangeCount(size_t first, size_t last) const {
+    if (first > last) return 0;
+    return prefixCount(last + 1) - prefixCount(first);
+}
+
+long long RankIndex::rangeWeightedSum(size_t first, size_t last) const {
+    if (first > last) return 0;
+    return static_cast<long long>(static_cast<unsigned long long>(prefixWeightedSum(last + 1)) -
+                                  static_cast<unsigned long long>(prefixWeightedSum(first)));
+}
+
+long long RankIndex::codePrefixCount(uint32_t prefix, int prefixBits) const {
+    size_t first, last;
+    grayPrefixRange(bitWidth, prefix, prefixBits, first, last);
+    return rangeCount(first, last - 1);
+}
+
+long long RankIndex::codePrefixWeightedSum(uint32_t prefix, int prefixBits) const {
+    size_t first, last;
+    grayPrefixRange(bitWidth, prefix, prefixBits, first, last);
+    return rangeWeightedSum(first, last - 1);
+}
+
+static uint32_t parsePrefix(const string& bits) {
+    uint32_t prefix = 0;
+    if (!bits.empty() && !parseGrayCode(bits, prefix)) {
+        throw invalid_argument("RankIndex: '" + bits + "' is not a bit prefix");
+    }
+    return prefix;
+}
+
+long long RankIndex::codePrefixCount(const string& bits) const {
+    return codePrefixCount(parsePrefix(bits), static_cast<int>(bits.size()));
+}
+
+long long RankIndex::codePrefixWeightedSum(const string& bits) const {
+    return codePrefixWeightedSum(parsePrefix(bits), static_cast<int>(bits.size()));
+}
+
+size_t RankIndex::kth(long long k) const {
+    if (k < 0 || k >= total()) throw out_of_range("RankIndex::kth: fewer units than requested");
+    // Descend the implicit tree: skip every block whose units all lie before k
+    size_t position = 0;
+    for (size_t step = highestStep; step > 0; step >>= 1) {
+        if (position + step <= size() && counts[position + step] <= k) {
+            position += step;
+            k -= counts[position];
+        }
+    }
+    return position; // 0-based rank of the (position + 1)-th tree slot
+}
@@ -0,0 +1,64 @@
+#ifndef RANK_INDEX_H
+#define RANK_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+
+using namespace std;
+
+// Ranks of the elements whose Gray code starts with the top `prefixBits`
+// bits `prefix`: the leading bits of a code depend only on the leading bits
+// of its rank, so they form the single block [first, last) of 2^(bitWidth -
+// prefixBits) ranks. Throws invalid_argument if prefixBits > bitWidth.
+void grayPrefixRange(int bitWidth, uint32_t prefix, int prefixBits, size_t& first, size_t& last);
+
+// Fenwick trees over Gray rank for the multiplicities and the weighted
+// values (rank * multiplicity). Range sums, bit-prefix sums and the k-th
+// unit take O(log n); so does a point update. Because every code prefix is
+// a rank block (see grayPrefixRange), the tree doubles as the prefix trie
+// over the Gray bits. Costs two 64-bit words per rank.
+class RankIndex {
+private:
+    int bitWidth;
+    vector<long long> counts;   // 1-based Fenwick tree of multiplicities
+    vector<long long> weighted; // of rank * multiplicity, wrapping like weightedSum
+    size_t highestStep;         // largest power of two <= size()
+
+    void build(const vector<long long>& values, vector<long long>& tree);
+    long long prefixOf(const vector<long long>& tree, size_t end) const;
+
+public:
+    RankIndex();
+    explicit RankIndex(const DenseMultiset& multiset);
+    explicit RankIndex(const DenseView& multiset);
+    explicit RankIndex(const SparseMultiset& multiset);
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return counts.empty() ? 0 : counts.size() - 1; }
+
+    // Point update: the multiplicity of rank changes by delta
+    void add(size_t rank, long long delta);
+
+    // Sums over ranks [0, end), over [first, last] inclusive, and over the
+    // elements whose code starts with the given bits ("01" or prefix/bits)
+    long long prefixCount(size_t end) const { return prefixOf(counts, end); }
+    long long prefixWeightedSum(size_t end) const { return prefixOf(weighted, end); }
+    long long rangeCount(size_t first, size_t last) const;
+    long long rangeWeightedSum(size_t first, size_t last) const;
+    long long codePrefixCount(uint32_t prefix, int prefixBits) const;
+    long long codePrefixWeightedSum(uint32_t prefix, int prefixBits) const;
+    long long codePrefixCount(const string& bits) const;
+    long long codePrefixWeightedSum(const string& bits) const;
+    long long total() const { return prefixCount(size()); }
+
+    // Rank holding unit k (0-based) when the units are laid out in rank
+    // order; requires non-negative multiplicities. Throws out_of_range if
+    // k >= total().
+    size_t kth(long long k) const;
+};
+
+#endif // RANK_INDEX_H
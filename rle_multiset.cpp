@@ -0,0 +1,385 @@
+#include "rle_multiset.h"
+#include "multiset_kernels.h"
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+// Varints: 7 bits per byte, low groups first, high bit set on all but the last
+static void writeVarint(vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool readVarint(const uint8_t*& position, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (position == end) return false;
+        uint8_t byte = *position++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Zigzag keeps small negative values short: 0, -1, 1, -2 -> 0, 1, 2, 3
+static uint64_t zigzag(int value) {
+    return (static_cast<uint64_t>(static_cast<int64_t>(value)) << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+
+static int unzigzag(uint64_t value) {
+    return static_cast<int>(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+}
+
+// Sequential reader
+RunArray::Reader::Reader(const RunArray& array)
+    : position(array.bytes.data()), end(array.bytes.data() + array.bytes.size()), left(0), current(0) {
+    load();
+}
+
+void RunArray::Reader::load() {
+    uint64_t length, value;
+    if (position == end || !readVarint(position, end, length) || !readVarint(position, end, value)) {
+        left = 0; // streams are validated when built, so this is the end
+        current = 0;
+        return;
+    }
+    left = static_cast<size_t>(length) + 1;
+    current = unzigzag(value);
+}
+
+void RunArray::Reader::advance(size_t count) {
+    left -= count;
+    if (left == 0) load();
+}
+
+// Builder
+RunArrayBuilder::RunArrayBuilder() : pendingLength(0), pendingValue(0) {}
+
+void RunArrayBuilder::flush() {
+    if (pendingLength == 0) return;
+    if (array.runs % RUN_INDEX_STRIDE == 0) {
+        RunArray::Checkpoint checkpoint = {array.length, array.bytes.size()};
+        array.index.push_back(checkpoint);
+    }
+    writeVarint(array.bytes, pendingLength - 1);
+    writeVarint(array.bytes, zigzag(pendingValue));
+    array.runs++;
+    array.length += pendingLength;
+    pendingLength = 0;
+}
+
+void RunArrayBuilder::append(size_t length, int value) {
+    if (length == 0) return;
+    if (pendingLength > 0 && value == pendingValue) {
+        pendingLength += length;
+        return;
+    }
+    flush();
+    pendingLength = length;
+    pendingValue = value;
+}
+
+RunArray RunArrayBuilder::finish() {
+    flush();
+    RunArray result;
+    swap(result, array);
+    return result;
+}
+
+// Run array
+RunArray::RunArray() : length(0), runs(0) {}
+
+int RunArray::at(size_t i) const {
+    if (i >= length) throw out_of_range("RunArray::at: index outside the array");
+    // Last checkpoint at or before i, then at most a stride of runs
+    size_t lo = 0, hi = index.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].start <= i) lo = mid;
+        else hi = mid;
+    }
+    const uint8_t* position = bytes.data() + index[lo].offset;
+    const uint8_t* end = bytes.data() + bytes.size();
+    uint64_t start = index[lo].start;
+    for (;;) {
+        uint64_t runLength, value;
+        readVarint(position, end, runLength);
+        readVarint(position, end, value);
+        start += runLength + 1;
+        if (i < start) return unzigzag(value);
+    }
+}
+
+void RunArray::decode(int* out) const {
+    for (Reader reader(*this); !reader.done(); reader.next()) {
+        out = fill_n(out, reader.remaining(), reader.value());
+    }
+}
+
+RunArray RunArray::encode(const int* values, size_t count) {
+    RunArrayBuilder builder;
+    size_t i = 0;
+    while (i < count) {
+        size_t j = i + 1;
+        while (j < count && values[j] == values[i]) j++;
+        builder.append(j - i, values[i]);
+        i = j;
+    }
+    return builder.finish();
+}
+
+RunArray RunArray::fromBytes(const uint8_t* data, size_t byteCount, size_t count) {
+    RunArrayBuilder builder;
+    const uint8_t* position = data;
+    const uint8_t* end = data + byteCount;
+    uint64_t covered = 0;
+    while (covered < count) {
+        uint64_t runLength, value;
+        if (!readVarint(position, end, runLength) || !readVarint(position, end, value) ||
+            runLength >= count - covered) {
+            throw runtime_error("run-length stream is malformed or does not match the universe");
+        }
+        builder.append(static_cast<size_t>(runLength) + 1, unzigzag(value));
+        covered += runLength + 1;
+    }
+    return builder.finish();
+}
+
+// Run-length multiset
+RunLengthMultiset::RunLengthMultiset() : bitWidth(0), withinCaps(true) {}
+
+RunLengthMultiset::RunLengthMultiset(int bitWidth, const CapArray& caps, const RunArray& counts, bool withinCaps)
+    : bitWidth(bitWidth), counts(counts), caps(caps), withinCaps(withinCaps) {}
+
+RunLengthMultiset::RunLengthMultiset(int bitWidth, const CapArray& caps, const RunArray& counts)
+    : bitWidth(bitWidth), counts(counts), caps(caps), withinCaps(true) {
+    if (!caps || caps->size() != (size_t(1) << bitWidth) || counts.size() != caps->size()) {
+        throw invalid_argument("RunLengthMultiset: runs and caps do not match the universe size");
+    }
+    const int* capData = caps->data();
+    size_t rank = 0;
+    for (RunArray::Reader reader(counts); !reader.done() && withinCaps; reader.next()) {
+        int value = reader.value();
+        if (value < 0) withinCaps = false;
+        for (size_t i = rank; value > 0 && i < rank + reader.remaining(); i++) {
+            if (value > capData[i]) {
+                withinCaps = false;
+                break;
+            }
+        }
+        rank += reader.remaining();
+    }
+}
+
+bool RunLengthMultiset::sameUniverse(const RunLengthMultiset& other) const {
+    return bitWidth == other.bitWidth && size() == other.size();
+}
+
+// Conversion
+RunLengthMultiset toRunLength(const DenseMultiset& multiset) {
+    return RunLengthMultiset(multiset.getBitWidth(), multiset.sharedCaps(),
+                             RunArray::encode(multiset.data(), multiset.size()));
+}
+
+RunLengthMultiset toRunLength(const SparseMultiset& multiset) {
+    RunArrayBuilder builder;
+    size_t next = 0;
+    const vector<SparseEntry>& entries = multiset.getEntries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        builder.append(entries[i].rank - next, 0);
+        builder.append(1, entries[i].multiplicity);
+        next = entries[i].rank + size_t(1);
+    }
+    builder.append(multiset.size() - next, 0);
+    return RunLengthMultiset(multiset.getBitWidth(), multiset.sharedCaps(), builder.finish());
+}
+
+DenseMultiset toDense(const RunLengthMultiset& multiset) {
+    DenseMultiset result(multiset.getBitWidth(), multiset.sharedCaps());
+    multiset.getRuns().decode(result.data());
+    return result;
+}
+
+// Binary operations walk both run lists at once, one step per segment
+// where neither operand changes value. If the operands share caps and lie
+// within them, no element definition can reach a cap (each result is at most
+// one of the inputs), so a segment is one evaluation; otherwise the caps
+// are consulted element by element.
+struct RunLengthOps {
+    template <typename ElementOp>
+    static RunLengthMultiset combine(const RunLengthMultiset& m1, const RunLengthMultiset& m2, ElementOp op) {
+        if (!m1.sameUniverse(m2)) {
+            throw invalid_argument("RunLengthMultiset: operands belong to different universes");
+        }
+        bool capFree = m1.sharedCaps() == m2.sharedCaps() && m1.isWithinCaps() && m2.isWithinCaps();
+        const int* capA = m1.sharedCaps() ? m1.sharedCaps()->data() : 0;
+        const int* capB = m2.sharedCaps() ? m2.sharedCaps()->data() : 0;
+        RunArrayBuilder builder;
+        bool within = true;
+        size_t rank = 0;
+        RunArray::Reader a(m1.getRuns()), b(m2.getRuns());
+        while (!a.done()) {
+            size_t step = min(a.remaining(), b.remaining());
+            if (capFree) {
+                builder.append(step, op(a.value(), b.value(), INT_MAX, INT_MAX));
+            } else {
+                for (size_t i = rank; i < rank + step; i++) {
+                    int value = op(a.value(), b.value(), capA[i], capB[i]);
+                    within = within && value >= 0 && value <= capA[i];
+                    builder.append(1, value);
+                }
+            }
+            rank += step;
+            a.advance(step);
+            b.advance(step);
+        }
+        return RunLengthMultiset(m1.getBitWidth(), m1.sharedCaps(), builder.finish(), capFree || within);
+    }
+
+    static RunLengthMultiset complement(const RunLengthMultiset& multiset) {
+        const int* caps = multiset.sharedCaps() ? multiset.sharedCaps()->data() : 0;
+        RunArrayBuilder builder;
+        bool within = true;
+        size_t rank = 0;
+        for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+            size_t end = rank + reader.remaining();
+            if (reader.value() == 0) {
+                for (size_t i = rank; i < end; i++) {
+                    within = within && caps[i] >= 0;
+                    builder.append(1, caps[i]);
+                }
+            } else {
+                builder.append(end - rank, 0);
+            }
+            rank = end;
+        }
+        return RunLengthMultiset(multiset.getBitWidth(), multiset.sharedCaps(), builder.finish(), within);
+    }
+};
+
+RunLengthMultiset unionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    return RunLengthOps::combine(m1, m2, [](int a, int b, int capA, int) { return unionElement(a, b, capA); });
+}
+
+RunLengthMultiset intersectionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    return RunLengthOps::combine(m1, m2, [](int a, int b, int capA, int) { return intersectionElement(a, b, capA); });
+}
+
+RunLengthMultiset differenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    return RunLengthOps::combine(m1, m2, [](int a, int b, int capA, int) { return differenceElement(a, b, capA); });
+}
+
+RunLengthMultiset symmetricDifferenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    return RunLengthOps::combine(m1, m2, [](int a, int b, int capA, int capB) {
+        return symmetricDifferenceElement(a, b, capA, capB);
+    });
+}
+
+RunLengthMultiset complementMultiset(const RunLengthMultiset& multiset) {
+    return RunLengthOps::complement(multiset);
+}
+
+// Arithmetic operations (sums wrap like the dense reductions, products are checked)
+
+int sumMultisets(const RunLengthMultiset& multiset) {
+    unsigned sum = 0;
+    for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+        sum += static_cast<unsigned>(reader.value()) * static_cast<unsigned>(reader.remaining());
+    }
+    return static_cast<int>(sum);
+}
+
+int arithmeticDifferenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return max(0, diff); // Ensure non-negative result
+}
+
+int productMultisets(const RunLengthMultiset& multiset) {
+    return checkedIntProduct(productFactors(multiset));
+}
+
+int divisionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    int sum2 = sumMultisets(m2);
+    if (sum2 == 0) {
+        cout << "Division by zero error!\n";
+        return 0;
+    }
+    return sumMultisets(m1) / sum2; // Integer division
+}
+
+// Gray-weighted arithmetic
+long long weightedSum(const RunLengthMultiset& multiset) {
+    unsigned long long total = 0;
+    unsigned long long rank = 0;
+    for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+        unsigned long long length = reader.remaining();
+        // rank + ... + (rank + length - 1), halving the even factor first
+        unsigned long long ends = 2 * rank + length - 1;
+        unsigned long long rankSum = length % 2 == 0 ? (length / 2) * ends : length * (ends / 2);
+        total += static_cast<unsigned long long>(static_cast<long long>(reader.value())) * rankSum;
+        rank += length;
+    }
+    return static_cast<long long>(total);
+}
+
+long long weightedDifference(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+long double weightedProduct(const RunLengthMultiset& multiset) {
+    long double product = 1.0L;
+    size_t rank = 0;
+    for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+        size_t end = rank + reader.remaining();
+        if (reader.value() > 0) {
+            if (rank == 0) {
+                return 0.0L; // any zero value to positive power makes whole product zero
+            }
+            for (size_t i = rank; i < end; i++) {
+                product *= powerBySquaring(static_cast<long double>(i), static_cast<uint64_t>(reader.value()));
+            }
+        }
+        rank = end;
+    }
+    return product;
+}
+
+double weightedDivision(const RunLengthMultiset& m1, const RunLengthMultiset& m2) {
+    long long denom = weightedSum(m2);
+    if (denom == 0) {
+        cout << "Division by zero error!\n";
+        return 0.0;
+    }
+    long long numer = weightedSum(m1);
+    return static_cast<double>(numer) / static_cast<double>(denom);
+}
+
+ProductEngine productFactors(const RunLengthMultiset& multiset) {
+    map<int, uint64_t> histogram;
+    for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+        if (reader.value() != 0) histogram[reader.value()] += reader.remaining();
+    }
+    ProductEngine engine;
+    for (map<int, uint64_t>::const_iterator it = histogram.begin(); it != histogram.end(); ++it) {
+        engine.multiply(it->first, it->second);
+    }
+    return engine;
+}
+
+ProductEngine weightedProductFactors(const RunLengthMultiset& multiset) {
+    ProductEngine engine;
+    size_t rank = 0;
+    for (RunArray::Reader reader(multiset.getRuns()); !reader.done(); reader.next()) {
+        size_t end = rank + reader.remaining();
+        for (size_t i = rank; reader.value() > 0 && i < end; i++) {
+            engine.multiply(static_cast<long long>(i), static_cast<uint64_t>(reader.value()));
+        }
+        rank = end;
+    }
+    return engine;
+}
@@ -0,0 +1,152 @@
+#ifndef RLE_MULTISET_H
+#define RLE_MULTISET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "dense_multiset.h"
+#include "sparse_multiset.h"
+#include "product_engine.h"
+
+using namespace std;
+
+// Integer array stored as runs of equal values in rank order. A run is two
+// LEB128 varints, length - 1 and the zigzag-encoded value, so a run of small
+// multiplicities takes two bytes however long it is. Adjacent runs always
+// differ, which makes the encoding canonical. A checkpoint every
+// RUN_INDEX_STRIDE runs makes at() O(log runs + stride).
+const size_t RUN_INDEX_STRIDE = 32;
+
+class RunArray {
+public:
+    struct Checkpoint {
+        uint64_t start;  // first index covered by the run
+        uint64_t offset; // byte offset of the run
+    };
+
+    // Sequential access: the value and remaining length of the current run
+    class Reader {
+    private:
+        const uint8_t* position;
+        const uint8_t* end;
+        size_t left;
+        int current;
+
+        void load();
+
+    public:
+        explicit Reader(const RunArray& array);
+        size_t remaining() const { return left; }
+        int value() const { return current; }
+        bool done() const { return left == 0; }
+        void advance(size_t count); // count <= remaining()
+        void next() { advance(left); }
+    };
+
+private:
+    size_t length;
+    size_t runs;
+    vector<uint8_t> bytes;
+    vector<Checkpoint> index;
+
+    friend class RunArrayBuilder;
+
+public:
+    RunArray();
+
+    size_t size() const { return length; }
+    size_t runCount() const { return runs; }
+    size_t byteSize() const { return bytes.size() + index.size() * sizeof(Checkpoint); }
+    const vector<uint8_t>& getBytes() const { return bytes; }
+
+    int at(size_t i) const;
+    void decode(int* out) const; // size() values
+
+    static RunArray encode(const int* values, size_t count);
+    // Checks and re-indexes an encoded stream; throws runtime_error if it is
+    // malformed or does not cover exactly `count` values
+    static RunArray fromBytes(const uint8_t* data, size_t byteCount, size_t count);
+
+    bool operator==(const RunArray& other) const { return length == other.length && bytes == other.bytes; }
+    bool operator!=(const RunArray& other) const { return !(*this == other); }
+};
+
+// Appends runs in order, merging neighbours with equal values
+class RunArrayBuilder {
+private:
+    RunArray array;
+    size_t pendingLength;
+    int pendingValue;
+
+    void flush();
+
+public:
+    RunArrayBuilder();
+    void append(size_t length, int value);
+    RunArray finish(); // the builder is empty again afterwards
+};
+
+// Multiset over a Gray-code universe whose multiplicities are a RunArray.
+// Gray order keeps neighbouring elements one bit apart, so clustered data
+// forms long runs and takes a few bytes per run instead of four per element.
+// The caps stay a shared CapArray. Operations and reductions walk the runs
+// directly; two multisets that share their caps and lie within them need no
+// per-element work at all. Immutable: build with toRunLength or a RunArrayBuilder.
+class RunLengthMultiset {
+private:
+    int bitWidth;
+    RunArray counts;
+    CapArray caps;
+    bool withinCaps; // 0 <= multiplicity <= cap everywhere
+
+    friend struct RunLengthOps;
+    RunLengthMultiset(int bitWidth, const CapArray& caps, const RunArray& counts, bool withinCaps);
+
+public:
+    RunLengthMultiset();
+    RunLengthMultiset(int bitWidth, const CapArray& caps, const RunArray& counts); // throws on a size mismatch
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return counts.size(); }
+    size_t runCount() const { return counts.runCount(); }
+    size_t byteSize() const { return counts.byteSize(); } // multiplicities only; the caps are shared
+
+    int count(size_t rank) const { return counts.at(rank); }
+    int cap(size_t rank) const { return (*caps)[rank]; }
+    bool isWithinCaps() const { return withinCaps; }
+    const RunArray& getRuns() const { return counts; }
+    const CapArray& sharedCaps() const { return caps; }
+
+    bool sameUniverse(const RunLengthMultiset& other) const;
+};
+
+// Conversion
+RunLengthMultiset toRunLength(const DenseMultiset& multiset);
+RunLengthMultiset toRunLength(const SparseMultiset& multiset);
+DenseMultiset toDense(const RunLengthMultiset& multiset);
+
+// Set operations (same results as the dense ones; caps of the first operand)
+RunLengthMultiset unionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+RunLengthMultiset intersectionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+RunLengthMultiset differenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+RunLengthMultiset symmetricDifferenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+RunLengthMultiset complementMultiset(const RunLengthMultiset& multiset);
+
+// Arithmetic operations, one step per run
+int sumMultisets(const RunLengthMultiset& multiset);
+int arithmeticDifferenceMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+int productMultisets(const RunLengthMultiset& multiset);
+int divisionMultisets(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+
+// Gray-weighted arithmetic; the weighted sum of a run is its value times
+// the sum of its ranks
+long long weightedSum(const RunLengthMultiset& multiset);
+long long weightedDifference(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+long double weightedProduct(const RunLengthMultiset& multiset);
+double weightedDivision(const RunLengthMultiset& m1, const RunLengthMultiset& m2);
+
+// Product factors as in product_engine.h; a run is one value^length factor
+ProductEngine productFactors(const RunLengthMultiset& multiset);
+ProductEngine weightedProductFactors(const RunLengthMultiset& multiset);
+
+#endif // RLE_MULTISET_H
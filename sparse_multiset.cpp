@@ -0,0 +1,374 @@
+#include "sparse_multiset.h"
+#include "multiset_kernels.h"
+#include "product_engine.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+SparseMultiset::SparseMultiset() : bitWidth(0), caps(makeCapArray(vector<int>(1, 0))) {}
+
+SparseMultiset::SparseMultiset(int bitWidth, const CapArray& caps) : bitWidth(bitWidth), caps(caps) {
+    if (!caps || caps->size() != (size_t(1) << bitWidth)) {
+        throw invalid_argument("SparseMultiset: caps array does not match universe size");
+    }
+}
+
+static bool rankLess(const SparseEntry& entry, size_t rank) {
+    return entry.rank < rank;
+}
+
+int SparseMultiset::count(size_t rank) const {
+    vector<SparseEntry>::const_iterator it = lower_bound(entries.begin(), entries.end(), rank, rankLess);
+    return (it != entries.end() && it->rank == rank) ? it->multiplicity : 0;
+}
+
+void SparseMultiset::set(size_t rank, int multiplicity) {
+    vector<SparseEntry>::iterator it = lower_bound(entries.begin(), entries.end(), rank, rankLess);
+    bool found = it != entries.end() && it->rank == rank;
+    if (multiplicity == 0) {
+        if (found) entries.erase(it);
+    } else if (found) {
+        it->multiplicity = multiplicity;
+    } else {
+        SparseEntry entry = {static_cast<uint32_t>(rank), multiplicity};
+        entries.insert(it, entry);
+    }
+}
+
+void SparseMultiset::append(size_t rank, int multiplicity) {
+    if (!entries.empty() && entries.back().rank >= rank) {
+        throw invalid_argument("SparseMultiset::append: ranks must be increasing");
+    }
+    if (multiplicity != 0) {
+        SparseEntry entry = {static_cast<uint32_t>(rank), multiplicity};
+        entries.push_back(entry);
+    }
+}
+
+void SparseMultiset::adoptUniverse(int width, const CapArray& newCaps) {
+    if (!newCaps || newCaps->size() != (size_t(1) << width)) {
+        throw invalid_argument("SparseMultiset: caps array does not match universe size");
+    }
+    bitWidth = width;
+    caps = newCaps;
+}
+
+void SparseMultiset::swapEntries(vector<SparseEntry>& sorted) {
+    entries.swap(sorted);
+}
+
+SparseView SparseMultiset::view() const {
+    SparseView result = {bitWidth, caps->size(), entries.data(), entries.size(), caps->data()};
+    return result;
+}
+
+bool SparseMultiset::sameUniverse(const SparseMultiset& other) const {
+    return bitWidth == other.bitWidth && size() == other.size();
+}
+
+static void requireSameUniverse(const SparseView& m1, const SparseView& m2) {
+    if (m1.bitWidth != m2.bitWidth || m1.size != m2.size) {
+        throw invalid_argument("SparseMultiset: operands belong to different universes");
+    }
+}
+
+// Result for an operation: shares the caps when the operand owns them
+static SparseMultiset resultFor(const SparseView& m, const CapArray& caps) {
+    if (caps) {
+        return SparseMultiset(m.bitWidth, caps);
+    }
+    return SparseMultiset(m.bitWidth, makeCapArray(vector<int>(m.caps, m.caps + m.size)));
+}
+
+// Conversion
+SparseMultiset toSparse(const DenseMultiset& multiset) {
+    SparseMultiset result(multiset.getBitWidth(), multiset.sharedCaps());
+    const int* a = multiset.data();
+    for (size_t i = 0; i < multiset.size(); i++) {
+        if (a[i] != 0) result.append(i, a[i]);
+    }
+    return result;
+}
+
+DenseMultiset toDense(const SparseMultiset& multiset) {
+    DenseMultiset result(multiset.getBitWidth(), multiset.sharedCaps());
+    const vector<SparseEntry>& entries = multiset.getEntries();
+    for (size_t i = 0; i < entries.size(); i++) {
+        result.set(entries[i].rank, entries[i].multiplicity);
+    }
+    return result;
+}
+
+// One linear pass over the union of both supports. Ranks outside both
+// supports give 0 for every operation, so they are never visited. out is
+// cleared first and must not be one of the operands' entry arrays.
+template <typename ElementOp>
+static void mergeEntries(const SparseView& m1, const SparseView& m2, ElementOp op, vector<SparseEntry>& out) {
+    requireSameUniverse(m1, m2);
+    const SparseEntry* a = m1.entries;
+    const SparseEntry* b = m2.entries;
+    out.clear();
+    out.reserve(m1.support + m2.support);
+
+    size_t i = 0, j = 0;
+    while (i < m1.support || j < m2.support) {
+        uint32_t rank;
+        int va = 0, vb = 0;
+        if (j == m2.support || (i < m1.support && a[i].rank < b[j].rank)) {
+            rank = a[i].rank;
+            va = a[i++].multiplicity;
+        } else if (i == m1.support || b[j].rank < a[i].rank) {
+            rank = b[j].rank;
+            vb = b[j++].multiplicity;
+        } else {
+            rank = a[i].rank;
+            va = a[i++].multiplicity;
+            vb = b[j++].multiplicity;
+        }
+        int value = op(va, vb, m1.caps[rank], m2.caps[rank]);
+        if (value != 0) {
+            SparseEntry entry = {rank, value};
+            out.push_back(entry);
+        }
+    }
+}
+
+template <typename ElementOp>
+static SparseMultiset mergeMultisets(const SparseView& m1, const SparseView& m2, const CapArray& caps, ElementOp op) {
+    SparseMultiset result = resultFor(m1, caps);
+    vector<SparseEntry> entries;
+    mergeEntries(m1, m2, op, entries);
+    result.swapEntries(entries);
+    return result;
+}
+
+static int unionOp(int a, int b, int capA, int) { return unionElement(a, b, capA); }
+static int intersectionOp(int a, int b, int capA, int) { return intersectionElement(a, b, capA); }
+static int differenceOp(int a, int b, int capA, int) { return differenceElement(a, b, capA); }
+static int symmetricDifferenceOp(int a, int b, int capA, int capB) {
+    return symmetricDifferenceElement(a, b, capA, capB);
+}
+
+// The complement covers the gaps between entries, so walk the whole universe
+static void complementEntries(const SparseView& multiset, vector<SparseEntry>& out) {
+    out.clear();
+    size_t next = 0;
+    for (size_t rank = 0; rank < multiset.size; rank++) {
+        int a = 0;
+        if (next < multiset.support && multiset.entries[next].rank == rank) {
+            a = multiset.entries[next++].multiplicity;
+        }
+        int value = complementElement(a, multiset.caps[rank]);
+        if (value != 0) {
+            SparseEntry entry = {static_cast<uint32_t>(rank), value};
+            out.push_back(entry);
+        }
+    }
+}
+
+static SparseMultiset complementOf(const SparseView& multiset, const CapArray& caps) {
+    SparseMultiset result = resultFor(multiset, caps);
+    vector<SparseEntry> entries;
+    complementEntries(multiset, entries);
+    result.swapEntries(entries);
+    return result;
+}
+
+// Set operations
+SparseMultiset unionMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return mergeMultisets(m1.view(), m2.view(), m1.sharedCaps(), unionOp);
+}
+
+SparseMultiset intersectionMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return mergeMultisets(m1.view(), m2.view(), m1.sharedCaps(), intersectionOp);
+}
+
+SparseMultiset differenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return mergeMultisets(m1.view(), m2.view(), m1.sharedCaps(), differenceOp);
+}
+
+SparseMultiset symmetricDifferenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return mergeMultisets(m1.view(), m2.view(), m1.sharedCaps(), symmetricDifferenceOp);
+}
+
+SparseMultiset complementMultiset(const SparseMultiset& multiset) {
+    return complementOf(multiset.view(), multiset.sharedCaps());
+}
+
+SparseMultiset unionMultisets(const SparseView& m1, const SparseView& m2) {
+    return mergeMultisets(m1, m2, CapArray(), unionOp);
+}
+
+SparseMultiset intersectionMultisets(const SparseView& m1, const SparseView& m2) {
+    return mergeMultisets(m1, m2, CapArray(), intersectionOp);
+}
+
+SparseMultiset differenceMultisets(const SparseView& m1, const SparseView& m2) {
+    return mergeMultisets(m1, m2, CapArray(), differenceOp);
+}
+
+SparseMultiset symmetricDifferenceMultisets(const SparseView& m1, const SparseView& m2) {
+    return mergeMultisets(m1, m2, CapArray(), symmetricDifferenceOp);
+}
+
+SparseMultiset complementMultiset(const SparseView& multiset) {
+    return complementOf(multiset, CapArray());
+}
+
+// Output-parameter and in-place forms. The merge writes into a per-thread
+// scratch buffer that is swapped with dst's entries, so once both buffers
+// have grown to the working size nothing is allocated, and dst may be an operand.
+static vector<SparseEntry>& scratchEntries() {
+    static thread_local vector<SparseEntry> scratch;
+    return scratch;
+}
+
+template <typename ElementOp>
+static void mergeInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2, ElementOp op) {
+    CapArray caps = m1.sharedCaps(); // m1 may be dst
+    vector<SparseEntry>& scratch = scratchEntries();
+    mergeEntries(m1.view(), m2.view(), op, scratch);
+    dst.adoptUniverse(m1.getBitWidth(), caps);
+    dst.swapEntries(scratch);
+}
+
+void unionInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2) {
+    mergeInto(dst, m1, m2, unionOp);
+}
+
+void intersectionInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2) {
+    mergeInto(dst, m1, m2, intersectionOp);
+}
+
+void differenceInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2) {
+    mergeInto(dst, m1, m2, differenceOp);
+}
+
+void symmetricDifferenceInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2) {
+    mergeInto(dst, m1, m2, symmetricDifferenceOp);
+}
+
+void complementInto(SparseMultiset& dst, const SparseMultiset& multiset) {
+    CapArray caps = multiset.sharedCaps();
+    vector<SparseEntry>& scratch = scratchEntries();
+    complementEntries(multiset.view(), scratch);
+    dst.adoptUniverse(multiset.getBitWidth(), caps);
+    dst.swapEntries(scratch);
+}
+
+SparseMultiset& operator|=(SparseMultiset& m1, const SparseMultiset& m2) {
+    unionInto(m1, m1, m2);
+    return m1;
+}
+
+SparseMultiset& operator&=(SparseMultiset& m1, const SparseMultiset& m2) {
+    intersectionInto(m1, m1, m2);
+    return m1;
+}
+
+SparseMultiset& operator-=(SparseMultiset& m1, const SparseMultiset& m2) {
+    differenceInto(m1, m1, m2);
+    return m1;
+}
+
+SparseMultiset& operator^=(SparseMultiset& m1, const SparseMultiset& m2) {
+    symmetricDifferenceInto(m1, m1, m2);
+    return m1;
+}
+
+// Arithmetic operations
+// Unsigned accumulation: overflow wraps exactly as in the dense engine
+int sumMultisets(const SparseView& multiset) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < multiset.support; i++) {
+        sum += static_cast<unsigned>(multiset.entries[i].multiplicity);
+    }
+    return static_cast<int>(sum);
+}
+
+int arithmeticDifferenceMultisets(const SparseView& m1, const SparseView& m2) {
+    int diff = sumMultisets(m1) - sumMultisets(m2);
+    return max(0, diff); // Ensure non-negative result
+}
+
+int productMultisets(const SparseView& multiset) {
+    return checkedIntProduct(productFactors(multiset));
+}
+
+int divisionMultisets(const SparseView& m1, const SparseView& m2) {
+    int sum2 = sumMultisets(m2);
+    if (sum2 == 0) {
+        cout << "Division by zero error!\n";
+        return 0;
+    }
+    return sumMultisets(m1) / sum2; // Integer division
+}
+
+int sumMultisets(const SparseMultiset& multiset) {
+    return sumMultisets(multiset.view());
+}
+
+int arithmeticDifferenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return arithmeticDifferenceMultisets(m1.view(), m2.view());
+}
+
+int productMultisets(const SparseMultiset& multiset) {
+    return productMultisets(multiset.view());
+}
+
+int divisionMultisets(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return divisionMultisets(m1.view(), m2.view());
+}
+
+// Gray-weighted arithmetic
+long long weightedSum(const SparseView& multiset) {
+    unsigned long long total = 0;
+    for (size_t i = 0; i < multiset.support; i++) {
+        total += static_cast<unsigned long long>(static_cast<long long>(multiset.entries[i].multiplicity) *
+                                                 static_cast<long long>(multiset.entries[i].rank));
+    }
+    return static_cast<long long>(total);
+}
+
+long long weightedDifference(const SparseView& m1, const SparseView& m2) {
+    return weightedSum(m1) - weightedSum(m2);
+}
+
+long double weightedProduct(const SparseView& multiset) {
+    long double product = 1.0L;
+    for (size_t i = 0; i < multiset.support; i++) {
+        const SparseEntry& entry = multiset.entries[i];
+        if (entry.multiplicity <= 0) continue;
+        if (entry.rank == 0) {
+            return 0.0L; // any zero value to positive power makes whole product zero
+        }
+        product *= powerBySquaring(static_cast<long double>(entry.rank), static_cast<uint64_t>(entry.multiplicity));
+    }
+    return product;
+}
+
+double weightedDivision(const SparseView& m1, const SparseView& m2) {
+    long long denom = weightedSum(m2);
+    if (denom == 0) {
+        cout << "Division by zero error!\n";
+        return 0.0;
+    }
+    long long numer = weightedSum(m1);
+    return static_cast<double>(numer) / static_cast<double>(denom);
+}
+
+long long weightedSum(const SparseMultiset& multiset) {
+    return weightedSum(multiset.view());
+}
+
+long long weightedDifference(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return weightedDifference(m1.view(), m2.view());
+}
+
+long double weightedProduct(const SparseMultiset& multiset) {
+    return weightedProduct(multiset.view());
+}
+
+double weightedDivision(const SparseMultiset& m1, const SparseMultiset& m2) {
+    return weightedDivision(m1.view(), m2.view());
+}
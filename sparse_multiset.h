@@ -0,0 +1,110 @@
+#ifndef SPARSE_MULTISET_H
+#define SPARSE_MULTISET_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+
+using namespace std;
+
+struct SparseEntry {
+    uint32_t rank;
+    int multiplicity;
+};
+
+// Read-only view of sorted entries and caps owned elsewhere
+// (a SparseMultiset or a memory-mapped file)
+struct SparseView {
+    int bitWidth;
+    size_t size;                // universe size
+    const SparseEntry* entries; // sorted by rank
+    size_t support;
+    const int* caps;
+};
+
+// Multiset over a Gray-code universe stored as (rank, multiplicity) pairs
+// sorted by rank. Only non-zero multiplicities are kept, so memory follows
+// the support of the multiset rather than the universe size.
+class SparseMultiset {
+private:
+    int bitWidth;
+    vector<SparseEntry> entries; // sorted by rank, multiplicity != 0
+    CapArray caps;               // max cardinality by Gray rank (shared)
+
+public:
+    SparseMultiset();
+    SparseMultiset(int bitWidth, const CapArray& caps);
+
+    int getBitWidth() const { return bitWidth; }
+    size_t size() const { return caps->size(); }   // universe size
+    size_t support() const { return entries.size(); }
+
+    int count(size_t rank) const;                  // binary search
+    int cap(size_t rank) const { return (*caps)[rank]; }
+    void set(size_t rank, int multiplicity);       // keeps entries sorted
+    void append(size_t rank, int multiplicity);    // rank must exceed every stored rank
+    void clear() { entries.clear(); }
+    void reserve(size_t n) { entries.reserve(n); }
+    void adoptUniverse(int bitWidth, const CapArray& caps); // keeps the entries
+    void swapEntries(vector<SparseEntry>& sorted);          // sorted by rank, no zero multiplicities
+
+    const vector<SparseEntry>& getEntries() const { return entries; }
+    const CapArray& sharedCaps() const { return caps; }
+    SparseView view() const;
+
+    bool sameUniverse(const SparseMultiset& other) const;
+};
+
+// Conversion between the two rank-indexed forms
+SparseMultiset toSparse(const DenseMultiset& multiset);
+DenseMultiset toDense(const SparseMultiset& multiset);
+
+// Set operations as single-pass merges over the sorted entries
+SparseMultiset unionMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset intersectionMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset differenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset symmetricDifferenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset complementMultiset(const SparseMultiset& multiset);
+
+// Same operations on views; the result gets its own copy of the caps
+SparseMultiset unionMultisets(const SparseView& m1, const SparseView& m2);
+SparseMultiset intersectionMultisets(const SparseView& m1, const SparseView& m2);
+SparseMultiset differenceMultisets(const SparseView& m1, const SparseView& m2);
+SparseMultiset symmetricDifferenceMultisets(const SparseView& m1, const SparseView& m2);
+SparseMultiset complementMultiset(const SparseView& multiset);
+
+// Output-parameter and in-place forms, as for DenseMultiset: no allocation
+// once the buffers have grown to the working size; dst may be an operand
+void unionInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2);
+void intersectionInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2);
+void differenceInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2);
+void symmetricDifferenceInto(SparseMultiset& dst, const SparseMultiset& m1, const SparseMultiset& m2);
+void complementInto(SparseMultiset& dst, const SparseMultiset& multiset);
+
+SparseMultiset& operator|=(SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset& operator&=(SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset& operator-=(SparseMultiset& m1, const SparseMultiset& m2);
+SparseMultiset& operator^=(SparseMultiset& m1, const SparseMultiset& m2);
+
+// Arithmetic operations (products throw overflow_error, as for DenseMultiset)
+int sumMultisets(const SparseMultiset& multiset);
+int arithmeticDifferenceMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+int productMultisets(const SparseMultiset& multiset);
+int divisionMultisets(const SparseMultiset& m1, const SparseMultiset& m2);
+int sumMultisets(const SparseView& multiset);
+int arithmeticDifferenceMultisets(const SparseView& m1, const SparseView& m2);
+int productMultisets(const SparseView& multiset);
+int divisionMultisets(const SparseView& m1, const SparseView& m2);
+
+// Gray-weighted arithmetic
+long long weightedSum(const SparseMultiset& multiset);
+long long weightedDifference(const SparseMultiset& m1, const SparseMultiset& m2);
+long double weightedProduct(const SparseMultiset& multiset);
+double weightedDivision(const SparseMultiset& m1, const SparseMultiset& m2);
+long long weightedSum(const SparseView& multiset);
+long long weightedDifference(const SparseView& m1, const SparseView& m2);
+long double weightedProduct(const SparseView& multiset);
+double weightedDivision(const SparseView& m1, const SparseView& m2);
+
+#endif // SPARSE_MULTISET_H
@@ -1,9 +1,85 @@
 #include "funcs.h"
+#include "multiset_kernels.h"
+#include "adaptive_multiset.h"
+#include "batch_session.h"
+#include "multiset_file.h"
+#include "multiset_ingest.h"
+#include "thread_pool.h"
+#include "op_stats.h"
+#include "multiset_expr.h"
+#include "bitset_multiset.h"
+#include "product_engine.h"
+#include "random_multiset.h"
+#include "tracked_multiset.h"
+#include "multiset_collection.h"
+#include "rle_multiset.h"
+#include "rank_index.h"
+#include "concurrent_multiset.h"
+#include "persistent_multiset.h"
+#include "multiset_server.h"
+#include "fixed_multiset.h"
+#include "multiset_export.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <thread>
 #include <cassert>
+#include <climits>
+#include <cmath>
 #include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
+// Counts every heap allocation made through operator new, for the
+// allocation-free checks in testInPlaceOperations
+static std::atomic<long> heapAllocations(0);
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size == 0 ? 1 : size);
+}
+
+// GCC pairs the inlined malloc above with these frees and warns otherwise
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+// An int product, or LLONG_MIN when it overflows, so two product paths can be
+// compared on the same random data whether or not the product fits
+template <typename Product>
+static long long productOrOverflow(Product product) {
+    try {
+        return product();
+    } catch (const overflow_error&) {
+        return LLONG_MIN;
+    }
+}
+
 void runComprehensiveTests() {
     cout << "=== Comprehensive Test Suite ===\n\n";
     
@@ -209,7 +285,1988 @@ void runComprehensiveTests() {
     cout << "The multiset operations program is working correctly.\n";
 }
 
+void testDenseMultiset() {
+    cout << "\nTest 6: Dense Multiset Engine\n";
+    cout << "-----------------------------\n";
+
+    MultisetProgram program;
+    program.initializeUniverse(3, {3, 1, 2, 3, 1, 2, 3, 1});
+
+    map<string, int> m1 = {{"000", 2}, {"001", 1}, {"011", 3}, {"110", 1}};
+    map<string, int> m2 = {{"001", 1}, {"011", 1}, {"010", 2}, {"100", 1}};
+    DenseMultiset d1 = program.toDense(m1);
+    DenseMultiset d2 = program.toDense(m2);
+
+    // Round trip through the dense form
+    assert(program.fromDense(d1) == m1);
+    assert(d1.count(MultisetProgram::grayToInt("011")) == 3);
+    assert(d1.cap(MultisetProgram::grayToInt("100")) == 1);
+    cout << "✓ Map <-> dense conversion PASSED\n";
+
+    // Every operation must agree with the map implementation
+    assert(program.fromDense(unionMultisets(d1, d2)) == program.unionMultisets(m1, m2));
+    assert(program.fromDense(intersectionMultisets(d1, d2)) == program.intersectionMultisets(m1, m2));
+    assert(program.fromDense(differenceMultisets(d1, d2)) == program.differenceMultisets(m1, m2));
+    assert(program.fromDense(differenceMultisets(d2, d1)) == program.differenceMultisets(m2, m1));
+    assert(program.fromDense(symmetricDifferenceMultisets(d1, d2)) == program.symmetricDifferenceMultisets(m1, m2));
+    assert(program.fromDense(complementMultiset(d1)) == program.complementMultiset(m1));
+    cout << "✓ Dense set operations PASSED\n";
+
+    assert(sumMultisets(d1) == program.sumMultisets(m1));
+    assert(productOrOverflow([&] { return productMultisets(d1); }) ==
+           productOrOverflow([&] { return program.productMultisets(m1); }));
+    assert(arithmeticDifferenceMultisets(d1, d2) == program.arithmeticDifferenceMultisets(m1, m2));
+    assert(divisionMultisets(d1, d2) == program.divisionMultisets(m1, m2));
+    assert(weightedSum(d1) == program.weightedSum(m1));
+    assert(weightedDifference(d1, d2) == program.weightedDifference(m1, m2));
+    assert(weightedProduct(d2) == program.weightedProduct(m2));
+    assert(weightedDivision(d1, d2) == program.weightedDivision(m1, m2));
+    cout << "✓ Dense arithmetic PASSED\n";
+}
+
+void testSimdKernels() {
+    cout << "\nTest 7: SIMD Kernels\n";
+    cout << "--------------------\n";
+    cout << "Detected SIMD level: " << simdLevelName(detectSimdLevel()) << endl;
+
+    // Odd length so the scalar tails run; include extreme values
+    const size_t n = 1003;
+    vector<int> a(n), b(n), capA(n), capB(n);
+    mt19937 g(12345);
+    uniform_int_distribution<int> small(-2, 12);
+    for (size_t i = 0; i < n; i++) {
+        a[i] = small(g);
+        b[i] = small(g);
+        capA[i] = small(g);
+        capB[i] = small(g);
+    }
+    a[0] = numeric_limits<int>::min(); b[0] = 1;
+    a[1] = numeric_limits<int>::max(); b[1] = -1;
+    a[2] = 0; b[2] = numeric_limits<int>::min();
+
+    setSimdLevel(SIMD_SCALAR);
+    vector<int> expected[5];
+    for (int k = 0; k < 5; k++) expected[k].resize(n);
+    unionKernel(a.data(), b.data(), capA.data(), expected[0].data(), n);
+    intersectionKernel(a.data(), b.data(), capA.data(), expected[1].data(), n);
+    differenceKernel(a.data(), b.data(), capA.data(), expected[2].data(), n);
+    symmetricDifferenceKernel(a.data(), b.data(), capA.data(), capB.data(), expected[3].data(), n);
+    complementKernel(a.data(), capA.data(), expected[4].data(), n);
+
+    for (int level = SIMD_SSE41; level <= detectSimdLevel(); level++) {
+        setSimdLevel(static_cast<SimdLevel>(level));
+        vector<int> out(n);
+        unionKernel(a.data(), b.data(), capA.data(), out.data(), n);
+        assert(out == expected[0]);
+        intersectionKernel(a.data(), b.data(), capA.data(), out.data(), n);
+        assert(out == expected[1]);
+        differenceKernel(a.data(), b.data(), capA.data(), out.data(), n);
+        assert(out == expected[2]);
+        symmetricDifferenceKernel(a.data(), b.data(), capA.data(), capB.data(), out.data(), n);
+        assert(out == expected[3]);
+        complementKernel(a.data(), capA.data(), out.data(), n);
+        assert(out == expected[4]);
+        cout << "✓ " << simdLevelName(static_cast<SimdLevel>(level)) << " matches scalar\n";
+    }
+    setSimdLevel(detectSimdLevel());
+    cout << "✓ SIMD kernels PASSED\n";
+}
+
+void testIntegerGrayCode() {
+    cout << "\nTest 8: Integer Gray Code Generator\n";
+    cout << "-----------------------------------\n";
+
+    MultisetProgram program;
+    for (int bits = 1; bits <= 10; bits++) {
+        vector<string> strings = program.generateGrayCode(bits);
+        vector<uint32_t> codes(static_cast<size_t>(grayCodeCount(bits)));
+        fillGrayCodes(bits, codes.data());
+        assert(strings.size() == codes.size());
+        for (size_t i = 0; i < codes.size(); i++) {
+            assert(grayCodeToString(codes[i], bits) == strings[i]);
+            assert(grayDecode(codes[i]) == i);
+        }
+    }
+    cout << "✓ Bulk generation matches string codes for 1-10 bits\n";
+
+    // 32-bit range is lazy: only touched codes are produced
+    GrayCodeRange range(32);
+    assert(range.size() == (uint64_t(1) << 32));
+    uint32_t samples[] = {0u, 1u, 12345678u, 0x7FFFFFFFu, 0x80000000u, 0xFFFFFFFEu, 0xFFFFFFFFu};
+    for (uint32_t rank : samples) {
+        assert(grayDecode(range[rank]) == rank);
+        if (rank != 0xFFFFFFFFu) {
+            assert(__builtin_popcount(range[rank] ^ range[uint64_t(rank) + 1]) == 1); // exactly one bit flips
+        }
+        uint32_t parsed = 0;
+        bool ok = parseGrayCode(range.toString(rank), parsed);
+        assert(ok && parsed == range[rank]);
+        (void)ok;
+    }
+    vector<uint32_t> window(16);
+    fillGrayCodes(0xFFFFFFF0u, window.size(), window.data());
+    assert(window.back() == grayEncode(0xFFFFFFFFu));
+    size_t visited = 0;
+    for (GrayCodeRange::iterator it = GrayCodeRange(4).begin(); it != GrayCodeRange(4).end(); ++it) {
+        assert(*it == grayEncode(static_cast<uint32_t>(visited)));
+        visited++;
+    }
+    assert(visited == 16);
+    cout << "✓ Visited " << visited << " codes of the 4-bit range\n";
+    cout << "✓ 32-bit codes, lazy range and parsing PASSED\n";
+
+    // Universe caps are stored by rank; strings only on demand
+    program.initializeUniverse(20, vector<int>(1 << 20, 2));
+    assert(program.universeSize() == (size_t(1) << 20));
+    assert(program.cardinalityOf(program.elementAt(777)) == 2);
+    assert(program.cardinalityOf("101") == 0);
+    cout << "✓ Rank-indexed universe PASSED\n";
+}
+
+void testSparseMultiset() {
+    cout << "\nTest 9: Sparse Multiset and Storage Policy\n";
+    cout << "------------------------------------------\n";
+
+    MultisetProgram program;
+    program.initializeUniverse(3, {3, 1, 2, 3, 1, 2, 3, 1});
+    map<string, int> m1 = {{"000", 2}, {"001", 1}, {"011", 3}, {"110", 1}};
+    map<string, int> m2 = {{"001", 1}, {"011", 1}, {"010", 2}, {"100", 1}};
+    SparseMultiset s1 = program.toSparse(m1);
+    SparseMultiset s2 = program.toSparse(m2);
+
+    assert(s1.support() == 4 && s1.size() == 8);
+    assert(program.fromSparse(s1) == m1);
+    assert(program.fromDense(toDense(s1)) == m1);
+    assert(program.fromSparse(toSparse(program.toDense(m2))) == m2);
+    cout << "✓ Sparse conversion PASSED\n";
+
+    assert(program.fromSparse(unionMultisets(s1, s2)) == program.unionMultisets(m1, m2));
+    assert(program.fromSparse(intersectionMultisets(s1, s2)) == program.intersectionMultisets(m1, m2));
+    assert(program.fromSparse(differenceMultisets(s1, s2)) == program.differenceMultisets(m1, m2));
+    assert(program.fromSparse(differenceMultisets(s2, s1)) == program.differenceMultisets(m2, m1));
+    assert(program.fromSparse(symmetricDifferenceMultisets(s1, s2)) == program.symmetricDifferenceMultisets(m1, m2));
+    assert(program.fromSparse(complementMultiset(s1)) == program.complementMultiset(m1));
+    assert(sumMultisets(s1) == program.sumMultisets(m1));
+    assert(productOrOverflow([&] { return productMultisets(s1); }) ==
+           productOrOverflow([&] { return program.productMultisets(m1); }));
+    assert(weightedSum(s1) == program.weightedSum(m1));
+    assert(weightedProduct(s2) == program.weightedProduct(m2));
+    cout << "✓ Sparse merge operations PASSED\n";
+
+    // 16-bit universe with a handful of elements stays sparse under AUTO
+    vector<int> caps(1 << 16, 4);
+    SparseMultiset big1(16, makeCapArray(caps));
+    SparseMultiset big2(16, big1.sharedCaps());
+    big1.set(10, 3); big1.set(40000, 2); big1.set(7, 9);
+    big2.set(10, 1); big2.set(65535, 4);
+    AdaptiveMultiset a1(big1), a2(big2);
+    assert(a1.isSparse() && a2.isSparse());
+    AdaptiveMultiset u = unionMultisets(a1, a2);
+    assert(u.isSparse() && u.support() == 4);
+    assert(u.count(7) == 4 && u.count(10) == 3 && u.count(65535) == 4);
+    AdaptiveMultiset c = complementMultiset(a1);
+    assert(!c.isSparse() && sumMultisets(c) == 4 * ((1 << 16) - 3));
+    // Mixed operands: the dense one is used in place, only the sparse one is converted
+    assert(unionMultisets(c, a1).toDense().getCounts() == unionMultisets(c.getDense(), toDense(big1)).getCounts());
+    assert(differenceMultisets(a2, c).toDense().getCounts() ==
+           differenceMultisets(toDense(big2), c.getDense()).getCounts());
+    cout << "✓ AUTO picks sparse for " << u.support() << " of " << u.size() << " elements, dense for the complement\n";
+
+    setStorageMode(STORAGE_DENSE);
+    AdaptiveMultiset forcedDense = unionMultisets(a1, a2);
+    assert(!forcedDense.isSparse());
+    setStorageMode(STORAGE_SPARSE);
+    AdaptiveMultiset forcedSparse = complementMultiset(AdaptiveMultiset(toDense(big1)));
+    assert(forcedSparse.isSparse());
+    assert(program.fromDense(forcedDense.toDense()) == program.fromSparse(u.toSparse()));
+    setStorageMode(STORAGE_AUTO);
+    cout << "✓ Forced storage modes PASSED\n";
+}
+
+void testBatchSession() {
+    cout << "\nTest 10: Batch Mode\n";
+    cout << "-------------------\n";
+
+    istringstream script(
+        "# two multisets over a 3-bit universe\n"
+        "universe 3 5 1\n"
+        "cap 000 5\ncap 001 5\ncap 011 5\ncap 010 5\n"
+        "set a 000:1 001:2 011:3\n"
+        "set b 001:1 010:2\n"
+        "union u a b\n"
+        "print u\n"
+        "difference d a b\n"
+        "print d\n"
+        "sum u\n"
+        "wsum a\n"
+        "set empty\n"
+        "div a empty\n"
+        "print missing\n"
+        "quit\n"
+        "sum a\n");
+    ostringstream output;
+    MultisetProgram program;
+    int failures = program.runBatch(script, output);
+
+    string expected =
+        "ok 8\nok\nok\nok\nok\n"
+        "ok 3\nok 2\nok 4\n"
+        "ok 4 000:1 001:2 011:3 010:2\n"
+        "ok 3\n"
+        "ok 3 000:1 001:1 011:3\n"
+        "ok 8\nok 8\nok 0\n"
+        "error division by zero\n"
+        "error unknown multiset 'missing'\n"
+        "ok\n";
+    cout << output.str();
+    assert(output.str() == expected);
+    assert(failures == 2);
+    cout << "✓ Batch script PASSED (" << failures << " expected errors)\n";
+
+    // The session keeps its universe and multisets across many commands
+    BatchSession session;
+    ostringstream sink;
+    session.execute("universe 10 3 7", sink);
+    session.execute("random a 500 11", sink);
+    session.execute("random b 500 12", sink);
+    for (int i = 0; i < 1000; i++) {
+        session.execute("intersection c a b", sink);
+    }
+    assert(session.hasMultiset("c") && session.getBitWidth() == 10);
+    assert(sumMultisets(session.getMultiset("a")) == 500);
+    cout << "✓ Session reuse PASSED\n";
+
+    // A cap change reaches the resident multisets, so union stays commutative
+    BatchSession capped;
+    ostringstream replies;
+    capped.execute("universe 2 5 1", replies);
+    capped.execute("set a 00:1 01:1 11:1 10:1", replies);
+    capped.execute("cap 00 0", replies);
+    capped.execute("set b 01:1", replies);
+    capped.execute("union u a b", replies);
+    capped.execute("union v b a", replies);
+    assert(replies.str() == "ok 4\nok 4\nok\nok 1\nok 3\nok 3\n");
+    assert(capped.getMultiset("a").count(0) == 0 && capped.getMultiset("a").count(1) == 1);
+    cout << "✓ Cap changes reach resident multisets PASSED\n";
+}
+
+void testMultisetFile() {
+    cout << "\nTest 11: Memory-Mapped Multiset Files\n";
+    cout << "-------------------------------------\n";
+
+    const int bits = 12;
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = 1 + static_cast<int>(i % 6);
+    CapArray caps = makeCapArray(capValues);
+
+    DenseMultiset a(bits, caps), b(bits, caps);
+    for (size_t i = 0; i < a.size(); i += 3) a.set(i, a.cap(i));
+    for (size_t i = 0; i < b.size(); i += 5) b.set(i, 1);
+    SparseMultiset s(bits, caps);
+    s.append(1, 2);
+    s.append(100, 1);
+    s.append(4000, 3);
+
+    const string densePath = "/tmp/multiset_test_dense.bin";
+    const string sparsePath = "/tmp/multiset_test_sparse.bin";
+    saveMultiset(densePath, a);
+    saveMultiset(sparsePath, s);
+    {
+        MappedMultiset mappedA(densePath);
+        MappedMultiset mappedS(sparsePath);
+        assert(!mappedA.isSparse() && mappedS.isSparse());
+        assert(mappedA.getBitWidth() == bits && mappedA.size() == a.size());
+
+        // Operations run on the mapped pages and match the in-memory results
+        DenseMultiset fromFile = unionMultisets(mappedA.denseView(), b.view());
+        assert(fromFile.getCounts() == unionMultisets(a, b).getCounts());
+        assert(fromFile.getCaps() == capValues);
+        assert(weightedSum(mappedA.denseView()) == weightedSum(a));
+        assert(sumMultisets(mappedS.sparseView()) == 6);
+        assert(weightedSum(mappedS.sparseView()) == weightedSum(s));
+    }
+    cout << "✓ Operations on mapped files PASSED\n";
+
+    AdaptiveMultiset loaded = loadMultiset(sparsePath);
+    assert(loaded.isSparse() && loaded.count(4000) == 3 && loaded.support() == 3);
+    AdaptiveMultiset loadedDense = loadMultiset(densePath);
+    assert(!loadedDense.isSparse() && loadedDense.getDense().getCounts() == a.getCounts());
+    cout << "✓ Round trip PASSED\n";
+
+    // A truncated copy is rejected while mapping
+    const string brokenPath = "/tmp/multiset_test_broken.bin";
+    char head[100];
+    FILE* in = fopen(densePath.c_str(), "rb");
+    size_t headBytes = fread(head, 1, sizeof(head), in);
+    fclose(in);
+    FILE* out = fopen(brokenPath.c_str(), "wb");
+    fwrite(head, 1, headBytes, out);
+    fclose(out);
+    bool threw = false;
+    try {
+        MappedMultiset broken(brokenPath);
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Sparse copies with the entries over the header, or a rank past the universe
+    auto rejectsPatched = [&](size_t offset, const void* bytes, size_t count) {
+        FILE* source = fopen(sparsePath.c_str(), "rb");
+        string content;
+        char chunk[4096];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), source)) > 0) content.append(chunk, got);
+        fclose(source);
+        memcpy(&content[offset], bytes, count);
+        FILE* patched = fopen(brokenPath.c_str(), "wb");
+        fwrite(content.data(), 1, content.size(), patched);
+        fclose(patched);
+        try {
+            MappedMultiset broken(brokenPath);
+        } catch (const runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    uint64_t zeroOffset = 0;
+    uint32_t farRank = 1u << bits;
+    assert(rejectsPatched(offsetof(MultisetFileHeader, countsOffset), &zeroOffset, sizeof(zeroOffset)));
+    assert(rejectsPatched(sizeof(MultisetFileHeader) + sizeof(SparseEntry), &farRank, sizeof(farRank)));
+    (void)threw; (void)zeroOffset; (void)farRank; (void)rejectsPatched;
+    remove(brokenPath.c_str());
+    remove(densePath.c_str());
+    remove(sparsePath.c_str());
+    cout << "✓ Malformed file rejected PASSED\n";
+
+    // Batch sessions can save and load by name
+    BatchSession session;
+    ostringstream output;
+    session.execute("universe 6 4 3", output);
+    session.execute("random a 40 5", output);
+    session.execute("save a " + sparsePath, output);
+    BatchSession other;
+    other.execute("load a " + sparsePath, output);
+    assert(other.getBitWidth() == 6 && sumMultisets(other.getMultiset("a")) == 40);
+    // A session with other caps refuses the file instead of mixing universes
+    BatchSession unitCaps;
+    unitCaps.execute("universe 6 1 3", output);
+    ostringstream refused;
+    unitCaps.execute("load a " + sparsePath, refused);
+    assert(refused.str() == "error file caps differ from the session's universe\n");
+    remove(sparsePath.c_str());
+    cout << "✓ Batch save/load PASSED\n";
+}
+
+void testMultisetIngest() {
+    cout << "\nTest 12: Streaming Ingest\n";
+    cout << "-------------------------\n";
+
+    const int bits = 10;
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 50);
+    CapArray caps = makeCapArray(capValues);
+
+    // Serial reference counts for a token stream with some noise in it
+    ostringstream text;
+    vector<long long> expected(capValues.size(), 0);
+    unsigned state = 12345;
+    for (int i = 0; i < 200000; i++) {
+        state = state * 1103515245u + 12345u;
+        size_t rank = (state >> 8) % capValues.size();
+        text << grayCodeToString(grayEncode(static_cast<uint32_t>(rank)), bits) << (i % 7 == 0 ? "\n" : " ");
+        expected[rank]++;
+        if (i % 1000 == 0) text << "junk 01 ";
+    }
+    text << grayCodeToString(grayEncode(3), bits); // last token without a trailing separator
+    expected[3]++;
+
+    for (unsigned threads = 1; threads <= 4; threads *= 2) {
+        IngestOptions options;
+        options.threads = threads;
+        options.chunkBytes = 4096; // many chunk boundaries inside tokens
+        IngestStats stats;
+        istringstream in(text.str());
+        DenseMultiset multiset = ingestMultiset(in, bits, caps, options, &stats);
+        for (size_t r = 0; r < capValues.size(); r++) {
+            assert(multiset.count(r) == static_cast<int>(min(expected[r], static_cast<long long>(capValues[r]))));
+        }
+        assert(stats.tokens == 200001 && stats.ignored == 400 && stats.bytes == text.str().size());
+    }
+    cout << "✓ Gray-code keys, clamped to caps, 1/2/4 threads PASSED\n";
+
+    IngestOptions options;
+    options.format = KEYS_INTEGER;
+    options.threads = 3;
+    IngestStats stats;
+    istringstream in("5,5,5 1023\n1024 -1 7x 0");
+    DenseMultiset multiset = ingestMultiset(in, bits, caps, options, &stats);
+    assert(multiset.count(5) == 3 && multiset.count(1023) == 1 && multiset.count(0) == 0);
+    assert(stats.tokens == 5 && stats.ignored == 3);
+
+    // A token with no separator for many chunks is skipped, not carried
+    options.chunkBytes = 64;
+    istringstream longToken("7 " + string(200000, '9') + " 5\n6 " + string(1000, '1'));
+    multiset = ingestMultiset(longToken, bits, caps, options, &stats);
+    assert(multiset.count(7) == 1 && multiset.count(5) == 1 && multiset.count(6) == 1);
+    assert(stats.tokens == 3 && stats.ignored == 2);
+    cout << "✓ Integer keys PASSED\n";
+}
+
+void testParallelOperations() {
+    cout << "\nTest 13: Parallel Operations\n";
+    cout << "----------------------------\n";
+
+    // 2^21 elements, above the default threshold; multiplicities large enough
+    // that sum and product overflow and wrap
+    const int bits = 21;
+    vector<int> capValues(size_t(1) << bits);
+    DenseMultiset a, b;
+    {
+        unsigned state = 99;
+        for (size_t i = 0; i < capValues.size(); i++) {
+            state = state * 1664525u + 1013904223u;
+            capValues[i] = static_cast<int>(state >> 12);
+        }
+        CapArray caps = makeCapArray(capValues);
+        a = DenseMultiset(bits, caps);
+        b = DenseMultiset(bits, caps);
+        for (size_t i = 0; i < a.size(); i++) {
+            state = state * 1664525u + 1013904223u;
+            a.set(i, (state >> 28) == 0 ? 0 : static_cast<int>(state >> 11));
+            b.set(i, (static_cast<int>(state >> 13) % 5000) | 1); // odd, never 0
+        }
+    }
+
+    setThreadCount(1);
+    assert(parallelBlockCount(a.size()) == 1);
+    DenseMultiset serialUnion = unionMultisets(a, b);
+    DenseMultiset serialSym = symmetricDifferenceMultisets(a, b);
+    DenseMultiset serialComplement = complementMultiset(a);
+    int serialSum = sumMultisets(a);
+    uint64_t serialProduct = productFactors(b.view()).modular(); // the int product overflows
+    long long serialWeighted = weightedSum(a);
+
+    for (unsigned threads = 2; threads <= 5; threads += 3) {
+        setThreadCount(threads);
+        assert(parallelBlockCount(a.size()) > 1);
+        assert(unionMultisets(a, b).getCounts() == serialUnion.getCounts());
+        assert(symmetricDifferenceMultisets(a, b).getCounts() == serialSym.getCounts());
+        assert(complementMultiset(a).getCounts() == serialComplement.getCounts());
+        assert(sumMultisets(a) == serialSum);
+        assert(productFactors(b.view()).modular() == serialProduct);
+        assert(weightedSum(a) == serialWeighted);
+        assert(sumMultisets(toSparse(a)) == serialSum);
+    }
+    bool overflowed = false;
+    try { productMultisets(b); } catch (const overflow_error&) { overflowed = true; }
+    assert(overflowed);
+    (void)overflowed;
+    // Spot-check against the element definitions
+    for (size_t i = 0; i < a.size(); i += 4097) {
+        assert(serialUnion.count(i) == unionElement(a.count(i), b.count(i), capValues[i]));
+    }
+    cout << "✓ 1/2/5 threads give identical results (sum " << serialSum << ", product mod 2^61-1 " << serialProduct
+         << ", weighted " << serialWeighted << ") PASSED\n";
+
+    // Below the threshold everything stays on the calling thread
+    DenseMultiset parallelIntersection = intersectionMultisets(a, b);
+    size_t originalThreshold = getParallelThreshold();
+    setParallelThreshold(size_t(1) << 22);
+    assert(parallelBlockCount(a.size()) == 1);
+    assert(intersectionMultisets(a, b).getCounts() == parallelIntersection.getCounts());
+    setParallelThreshold(originalThreshold);
+    setThreadCount(0);
+    cout << "✓ Threshold switches the parallel path off PASSED\n";
+}
+
+void testOpStats() {
+    cout << "\nTest 14: Operation Statistics\n";
+    cout << "-----------------------------\n";
+#if MULTISET_STATS
+    MultisetProgram program;
+    program.initializeUniverse(4, vector<int>(16, 3));
+    map<string, int> m1, m2;
+    m1["0000"] = 2; m1["0001"] = 1;
+    m2["0001"] = 3; m2["0011"] = 1;
+
+    resetOpStats();
+    setOpStatsEnabled(false);
+    program.unionMultisets(m1, m2);
+    ostringstream empty;
+    writeOpStatsJson(empty);
+    assert(empty.str() == "[]\n");
+    cout << "✓ Nothing recorded while disabled PASSED\n";
+
+    setOpStatsEnabled(true);
+    program.unionMultisets(m1, m2);
+    program.unionMultisets(m1, m2);
+    program.symmetricDifferenceMultisets(m1, m2);
+    program.weightedSum(m1);
+    setOpStatsEnabled(false);
+    program.weightedSum(m1);
+
+    ostringstream json;
+    writeOpStatsJson(json);
+    // symmetric difference is a single merge, recorded once: no union, difference or _into
+    assert(json.str().find("\"operation\": \"union\", \"calls\": 2,") != string::npos);
+    assert(json.str().find("\"operation\": \"difference\"") == string::npos);
+    assert(json.str().find("\"operation\": \"symmetric_difference\", \"calls\": 1,") != string::npos);
+    assert(json.str().find("\"operation\": \"symmetric_difference_into\"") == string::npos);
+    assert(json.str().find("\"operation\": \"weighted_sum\", \"calls\": 1,") != string::npos);
+    assert(json.str().find("\"elements\": 8, \"bytes\": ") != string::npos); // two unions of 2 + 2 entries
+    printOpStats(cout);
+    resetOpStats();
+    cout << "✓ Calls, elements and bytes recorded PASSED\n";
+#else
+    cout << "(built with MULTISET_STATS=0, instrumentation compiled out)\n";
+#endif
+}
+
+void testInPlaceOperations() {
+    cout << "\nTest 15: In-Place and Output-Parameter Operations\n";
+    cout << "--------------------------------------------------\n";
+
+    const int bits = 16; // 16-character codes do not fit the small-string buffer
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = 1 + static_cast<int>(i % 7);
+    CapArray caps = makeCapArray(capValues);
+    DenseMultiset a(bits, caps), b(bits, caps);
+    unsigned state = 5;
+    for (int k = 0; k < 300; k++) {
+        state = state * 1103515245u + 12345u;
+        size_t r1 = (state >> 4) % a.size();
+        state = state * 1103515245u + 12345u;
+        size_t r2 = (state >> 4) % a.size();
+        a.set(r1, 1 + static_cast<int>(state % 9));
+        b.set(r2, 1 + static_cast<int>((state >> 9) % 9));
+        b.set(r1, static_cast<int>((state >> 13) % 4));
+    }
+
+    // Dense: results match the by-value forms, and the steady state allocates nothing
+    DenseMultiset dst, work;
+    unionInto(dst, a, b);
+    assert(dst.getCounts() == unionMultisets(a, b).getCounts());
+    intersectionInto(dst, a, b);
+    assert(dst.getCounts() == intersectionMultisets(a, b).getCounts());
+    differenceInto(dst, a, b);
+    assert(dst.getCounts() == differenceMultisets(a, b).getCounts());
+    symmetricDifferenceInto(dst, a, b);
+    assert(dst.getCounts() == symmetricDifferenceMultisets(a, b).getCounts());
+    complementInto(dst, a);
+    assert(dst.getCounts() == complementMultiset(a).getCounts());
+    work = a;
+    work |= b;
+    assert(work.getCounts() == unionMultisets(a, b).getCounts());
+    work = a;
+    work ^= b;
+    assert(work.getCounts() == symmetricDifferenceMultisets(a, b).getCounts());
+    long before = heapAllocations.load();
+    for (int iteration = 0; iteration < 200; iteration++) {
+        unionInto(dst, a, b);
+        intersectionInto(dst, dst, b);
+        symmetricDifferenceInto(dst, a, dst);
+        complementInto(work, dst);
+        work |= a;
+        work &= b;
+        work -= a;
+        work ^= dst;
+    }
+    long denseAllocations = heapAllocations.load() - before;
+    assert(denseAllocations == 0);
+    cout << "✓ Dense Into/|=/&=/-=/^= match and allocate nothing PASSED\n";
+
+    // Sparse: the first rounds grow the buffers, then nothing is allocated
+    SparseMultiset sa = toSparse(a), sb = toSparse(b), sdst, swork;
+    unionInto(sdst, sa, sb);
+    assert(toDense(sdst).getCounts() == unionMultisets(a, b).getCounts());
+    swork = sa;
+    swork -= sb;
+    assert(toDense(swork).getCounts() == differenceMultisets(a, b).getCounts());
+    swork = sa;
+    swork &= sb;
+    assert(toDense(swork).getCounts() == intersectionMultisets(a, b).getCounts());
+    long sparseAllocations = 0;
+    for (int iteration = 0; iteration < 200; iteration++) {
+        if (iteration == 3) before = heapAllocations.load();
+        unionInto(sdst, sa, sb);
+        symmetricDifferenceInto(swork, sa, sb);
+        swork |= sdst;
+        swork &= sa;
+        differenceInto(sdst, sdst, swork);
+    }
+    sparseAllocations = heapAllocations.load() - before;
+    assert(sparseAllocations == 0);
+    cout << "✓ Sparse Into and compound assignment allocate nothing in steady state PASSED\n";
+
+    // Map form: same results as the by-value functions, also when dst is an operand
+    MultisetProgram program;
+    program.initializeUniverse(bits, capValues);
+    map<string, int> m1 = program.fromDense(a), m2 = program.fromDense(b);
+    m1[program.elementAt(3)] = 0; // explicit zero entries behave as in the by-value forms
+    map<string, int> out, self;
+    program.unionInto(out, m1, m2);
+    assert(out == program.unionMultisets(m1, m2));
+    program.intersectionInto(out, m1, m2);
+    assert(out == program.intersectionMultisets(m1, m2));
+    program.differenceInto(out, m1, m2);
+    assert(out == program.differenceMultisets(m1, m2));
+    program.symmetricDifferenceInto(out, m1, m2);
+    assert(out == program.symmetricDifferenceMultisets(m1, m2));
+    program.complementInto(out, m1);
+    assert(out == program.complementMultiset(m1));
+    self = m1;
+    program.unionInto(self, self, m2);
+    assert(self == program.unionMultisets(m1, m2));
+    self = m2;
+    program.differenceInto(self, m1, self);
+    assert(self == program.differenceMultisets(m1, m2));
+    self = m1;
+    program.symmetricDifferenceInto(self, self, m2);
+    assert(self == program.symmetricDifferenceMultisets(m1, m2));
+    self = m1;
+    program.complementInto(self, self);
+    assert(self == program.complementMultiset(m1));
+
+    map<string, int> u, c;
+    program.unionInto(u, m1, m2);
+    program.complementInto(c, m1);
+    before = heapAllocations.load();
+    for (int iteration = 0; iteration < 20; iteration++) {
+        program.unionInto(u, m1, m2);
+        program.complementInto(c, m1);
+    }
+    long mapAllocations = heapAllocations.load() - before;
+    assert(mapAllocations == 0);
+    cout << "✓ Map Into forms match and reuse nodes (" << u.size() << " + " << c.size() << " entries) PASSED\n";
+    (void)denseAllocations;
+    (void)sparseAllocations;
+    (void)mapAllocations;
+}
+
+void testMultisetExpressions() {
+    cout << "\nTest 16: Lazy Multiset Expressions\n";
+    cout << "----------------------------------\n";
+
+    const int bits = 10;
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = 1 + static_cast<int>(i % 5);
+    DenseMultiset a(bits, capValues), b(bits, capValues), c(bits, capValues);
+    b.setCap(7, 2); // different caps on the right operand matter for symmetric difference
+    for (size_t i = 0; i < a.size(); i++) {
+        a.set(i, static_cast<int>((i * 7) % 6));
+        b.set(i, static_cast<int>((i * 3) % 5));
+        c.set(i, static_cast<int>((i * 11) % 4));
+    }
+
+    // Fused trees match the chain of materialized operations
+    DenseMultiset sym = evaluate((a - b) | (b - a));
+    assert(sym.getCounts() == symmetricDifferenceMultisets(a, b).getCounts());
+    assert(evaluate(a ^ b).getCounts() == sym.getCounts());
+    DenseMultiset nested = evaluate(~((a & b) | (c - a)));
+    assert(nested.getCounts() ==
+           complementMultiset(unionMultisets(intersectionMultisets(a, b), differenceMultisets(c, a))).getCounts());
+    assert(nested.getCaps() == a.getCaps());
+    assert(evaluate(a.view() | b).getCounts() == unionMultisets(a, b).getCounts());
+    cout << "✓ Fused evaluation matches materialized operations PASSED\n";
+
+    // Reductions fuse onto the expression
+    assert(weightedSum(a & b) == weightedSum(intersectionMultisets(a, b)));
+    assert(sumMultisets((a - b) | c) == sumMultisets(unionMultisets(differenceMultisets(a, b), c)));
+    assert(productOrOverflow([&] { return productMultisets(a | b); }) ==
+           productOrOverflow([&] { return productMultisets(unionMultisets(a, b)); }));
+    cout << "✓ Reductions over expressions PASSED\n";
+
+    // Clamp, evaluation into an operand, universe checks
+    DenseMultiset raw(bits, capValues);
+    raw.set(3, 100);
+    raw.set(4, -2);
+    DenseMultiset clamped = evaluate(clampToCaps(raw));
+    assert(clamped.count(3) == raw.cap(3) && clamped.count(4) == 0);
+    DenseMultiset expected = unionMultisets(b, a);
+    DenseMultiset target = a;
+    evaluateInto(target, b | target);
+    assert(target.getCounts() == expected.getCounts());
+    assert(target.getCaps() == b.getCaps());
+    bool threw = false;
+    try {
+        evaluate(a | DenseMultiset(bits - 1));
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+    (void)threw;
+    cout << "✓ Clamp, aliasing and universe checks PASSED\n";
+
+    // Large universe: the fused pass runs on the pool like the kernels
+    setThreadCount(4);
+    setParallelThreshold(1);
+    DenseMultiset big1(18), big2(18);
+    for (size_t i = 0; i < big1.size(); i++) {
+        big1.setCap(i, 9);
+        big1.set(i, static_cast<int>(i % 10));
+        big2.set(i, static_cast<int>((i >> 3) % 3));
+    }
+    assert(evaluate((big1 - big2) | (big2 - big1)).getCounts() == symmetricDifferenceMultisets(big1, big2).getCounts());
+    assert(weightedSum(big1 & big2) == weightedSum(intersectionMultisets(big1, big2)));
+    setThreadCount(0);
+    setParallelThreshold(size_t(1) << 20);
+    cout << "✓ Parallel fused evaluation PASSED\n";
+}
+
+void testBitsetMultiset() {
+    cout << "\nTest 17: Bitset Multisets\n";
+    cout << "-------------------------\n";
+
+    // Presence-only multisets: same results as the dense engine with caps 1
+    for (int bits = 1; bits <= 12; bits += 11) {
+        CapArray unit = makeCapArray(vector<int>(size_t(1) << bits, 1));
+        DenseMultiset d1(bits, unit), d2(bits, unit);
+        for (size_t i = 0; i < d1.size(); i++) {
+            d1.set(i, (i * 5 + 1) % 3 == 0 ? 1 : 0);
+            d2.set(i, (i * 7 + 1) % 4 != 0 ? 1 : 0);
+        }
+        assert(hasUnitCaps(d1.getCaps()));
+        BitsetMultiset b1 = toBitset(d1), b2 = toBitset(d2);
+        assert(toDense(b1).getCounts() == d1.getCounts());
+        assert(toDense(unionMultisets(b1, b2)).getCounts() == unionMultisets(d1, d2).getCounts());
+        assert(toDense(intersectionMultisets(b1, b2)).getCounts() == intersectionMultisets(d1, d2).getCounts());
+        assert(toDense(differenceMultisets(b1, b2)).getCounts() == differenceMultisets(d1, d2).getCounts());
+        assert(toDense(symmetricDifferenceMultisets(b1, b2)).getCounts() ==
+               symmetricDifferenceMultisets(d1, d2).getCounts());
+        assert(toDense(complementMultiset(b1)).getCounts() == complementMultiset(d1).getCounts());
+        assert(sumMultisets(b1) == sumMultisets(d1));
+        assert(productOrOverflow([&] { return productMultisets(b1); }) ==
+               productOrOverflow([&] { return productMultisets(d1); }));
+        assert(weightedSum(b1) == weightedSum(d1));
+        assert(weightedProduct(b2) == weightedProduct(d2));
+        assert(divisionMultisets(b1, b2) == divisionMultisets(d1, d2));
+    }
+    cout << "✓ Word-wide set operations and popcount arithmetic PASSED\n";
+
+    // Mixed with counted multisets: the bitset acts as 0/1 counts with caps 1
+    const int bits = 9;
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 4);
+    DenseMultiset counted(bits, capValues), present(bits, makeCapArray(vector<int>(capValues.size(), 1)));
+    BitsetMultiset bitset(bits);
+    for (size_t i = 0; i < counted.size(); i++) {
+        counted.set(i, static_cast<int>((i * 3) % 5));
+        bitset.set(i, i % 3 != 0);
+        present.set(i, bitset.count(i));
+    }
+    assert(unionMultisets(counted, bitset).getCounts() == unionMultisets(counted, present).getCounts());
+    assert(intersectionMultisets(counted, bitset).getCounts() == intersectionMultisets(counted, present).getCounts());
+    assert(differenceMultisets(counted, bitset).getCounts() == differenceMultisets(counted, present).getCounts());
+    assert(symmetricDifferenceMultisets(counted, bitset).getCounts() ==
+           symmetricDifferenceMultisets(counted, present).getCounts());
+    assert(toDense(unionMultisets(bitset, counted)).getCounts() == unionMultisets(present, counted).getCounts());
+    assert(toDense(intersectionMultisets(bitset, counted)).getCounts() ==
+           intersectionMultisets(present, counted).getCounts());
+    assert(toDense(differenceMultisets(bitset, counted)).getCounts() == differenceMultisets(present, counted).getCounts());
+    assert(toDense(symmetricDifferenceMultisets(bitset, counted)).getCounts() ==
+           symmetricDifferenceMultisets(present, counted).getCounts());
+    cout << "✓ Mixed bitset/counted operations PASSED\n";
+
+    // One bit per element
+    BitsetMultiset large(20);
+    assert(large.wordCount() * sizeof(uint64_t) * 32 == DenseMultiset(20).getCounts().size() * sizeof(int));
+    cout << "✓ Bitset uses 1/32 of the dense memory PASSED\n";
+
+    // The automatic storage policy picks the bitset for presence-only multisets
+    CapArray unit = makeCapArray(vector<int>(size_t(1) << 8, 1));
+    DenseMultiset d1(8, unit), d2(8, unit);
+    for (size_t i = 0; i < d1.size(); i++) {
+        d1.set(i, i % 3 == 0 ? 1 : 0);
+        d2.set(i, i % 5 != 0 ? 1 : 0);
+    }
+    AdaptiveMultiset a1(d1), a2(d2);
+    assert(a1.isBitset() && a2.isBitset());
+    AdaptiveMultiset joined = unionMultisets(a1, a2);
+    assert(joined.isBitset() && joined.toDense().getCounts() == unionMultisets(d1, d2).getCounts());
+    assert(symmetricDifferenceMultisets(a1, a2).toDense().getCounts() == symmetricDifferenceMultisets(d1, d2).getCounts());
+    assert(sumMultisets(a1) == sumMultisets(d1) && weightedSum(a2) == weightedSum(d2));
+    assert(weightedProduct(a2) == weightedProduct(d2));
+    joined.adoptUniverse(8, makeCapArray(vector<int>(d1.size(), 2)));
+    joined.set(1, 2);
+    assert(!joined.isBitset() && joined.count(1) == 2 && joined.count(3) == 1);
+    setStorageMode(STORAGE_DENSE);
+    a1.applyStoragePolicy();
+    assert(!a1.isBitset() && !a1.isSparse() && a1.getDense().getCounts() == d1.getCounts());
+    setStorageMode(STORAGE_AUTO);
+    a1.applyStoragePolicy();
+    assert(a1.isBitset());
+    cout << "✓ Automatic storage selects the bitset PASSED\n";
+}
+
+void testProductEngine() {
+    cout << "\nTest 18: Product Engine\n";
+    cout << "-----------------------\n";
+
+    // Big integers and powers by squaring
+    assert(bigPower(BigInt(2), 100).toString() == "1267650600228229401496703205376");
+    assert(bigPower(BigInt(-3), 5).toString() == "-243");
+    assert((BigInt(1000000007) * BigInt(-998244353)).toString() == "-998244359987710471");
+    assert(powerMod(3, 1000000, 1000000007) == 64935414);
+    assert(powerBySquaring(1.5L, 10) == 57.6650390625L);
+    long long fits;
+    assert(BigInt(numeric_limits<long long>::min()).toLongLong(fits) && fits == numeric_limits<long long>::min());
+    assert(!bigPower(BigInt(2), 63).toLongLong(fits));
+    cout << "✓ BigInt and power by squaring PASSED\n";
+
+    // A plain product that overflows int: 40 elements of multiplicity 3 and 7 of multiplicity 2
+    const int bits = 6;
+    DenseMultiset m(bits, vector<int>(size_t(1) << bits, 10));
+    for (int i = 0; i < 40; i++) m.set(static_cast<size_t>(i), 3);
+    for (int i = 40; i < 47; i++) m.set(static_cast<size_t>(i), 2);
+    ProductEngine plain = productFactors(m.view());
+    assert(plain.factorCount() == 2); // grouped by multiplicity
+    BigInt expected = bigPower(BigInt(3), 40) * bigPower(BigInt(2), 7);
+    assert(plain.exact() == expected);
+    assert(plain.exact().toString() == "1556181178759286886528");
+    int small;
+    assert(!plain.checked(fits) && !plain.checked(small));
+    assert(fabs(plain.logMagnitude() - (40 * log(3.0) + 7 * log(2.0))) < 1e-9);
+    assert(plain.modular(1000000007) == (powerMod(3, 40, 1000000007) * powerMod(2, 7, 1000000007)) % 1000000007);
+    bool overflowed = false;
+    try { productMultisets(m); } catch (const overflow_error&) { overflowed = true; } // no longer wraps
+    assert(overflowed);
+    (void)overflowed;
+    SparseMultiset sparse = toSparse(m);
+    assert(productFactors(sparse.view()).exact() == expected);
+    cout << "✓ Exact, log and modular plain products PASSED\n";
+
+    // Weighted: rank ^ multiplicity, exact where the long double loses digits
+    DenseMultiset w(bits, vector<int>(size_t(1) << bits, 50));
+    w.set(3, 40);
+    w.set(63, 17);
+    ProductEngine weighted = weightedProductFactors(w.view());
+    assert(weighted.exact() == bigPower(BigInt(3), 40) * bigPower(BigInt(63), 17));
+    assert(fabsl(weighted.approximate() / weightedProduct(w) - 1.0L) < 1e-15L);
+    assert(weighted.checked(fits) == false);
+    DenseMultiset withZero = w;
+    withZero.set(0, 1);
+    assert(weightedProductFactors(withZero.view()).isZero());
+    assert(weightedProductFactors(withZero.view()).exact().toString() == "0");
+    assert(weightedProduct(withZero) == 0.0L);
+    MultisetProgram program;
+    program.initializeUniverse(bits, vector<int>(size_t(1) << bits, 50));
+    map<string, int> wm = program.fromDense(w);
+    assert(program.weightedProductFactors(wm).exact() == weighted.exact());
+    assert(program.productFactors(program.fromDense(m)).exact() == expected);
+    cout << "✓ Weighted products and the map version PASSED\n";
+
+    // Values that fit are checked exactly
+    DenseMultiset tiny(2, vector<int>(4, 5));
+    tiny.set(1, 4);
+    tiny.set(2, 5);
+    assert(productFactors(tiny.view()).checked(small) && small == 20);
+    assert(weightedProductFactors(tiny.view()).checked(fits) && fits == 32);
+    cout << "✓ Overflow-checked int/long long products PASSED\n";
+
+    // Exact products past the size limit are refused before any multiplication
+    DenseMultiset huge(14, vector<int>(size_t(1) << 14, 1 << 30));
+    for (size_t i = 0; i < huge.size(); i++) huge.set(i, 1 << 30);
+    ProductEngine hugeProduct = productFactors(huge.view());
+    bool refused = false;
+    try { hugeProduct.exact(); } catch (const runtime_error&) { refused = true; }
+    assert(refused);
+    assert(hugeProduct.format(PRODUCT_CHECKED).compare(0, 3, "ln ") == 0);
+    (void)refused;
+    cout << "✓ Exact size limit PASSED\n";
+
+    // Batch commands pick the mode
+    BatchSession session;
+    session.putMultiset("m", AdaptiveMultiset(m));
+    ostringstream out;
+    session.putMultiset("tiny", AdaptiveMultiset(tiny));
+    session.execute("product m", out);
+    session.execute("product tiny", out);
+    session.execute("product m exact", out);
+    session.execute("product m log", out);
+    session.execute("product m mod 1000000007", out);
+    session.execute("wproduct m exact", out);
+    session.execute("product m bogus", out);
+    istringstream lines(out.str());
+    string line;
+    getline(lines, line);
+    assert(line.compare(0, 11, "ok ln 48.79") == 0); // checked by default, log once it overflows
+    getline(lines, line);
+    assert(line == "ok 20");
+    getline(lines, line);
+    assert(line == "ok 1556181178759286886528");
+    getline(lines, line);
+    assert(line.compare(0, 8, "ok 48.79") == 0);
+    getline(lines, line);
+    assert(line == "ok " + to_string(plain.modular(1000000007)));
+    getline(lines, line);
+    assert(line == "ok " + weightedProductFactors(m.view()).exact().toString());
+    getline(lines, line);
+    assert(line.compare(0, 5, "error") == 0);
+    cout << "✓ Batch product modes PASSED\n";
+    (void)fits;
+    (void)small;
+}
+
+void testGrayConversion() {
+    cout << "\nTest 19: Gray-to-Binary Conversion\n";
+    cout << "----------------------------------\n";
+
+    // Branchless decode against the bit-by-bit prefix XOR
+    unsigned state = 11;
+    vector<uint32_t> codes(1003);
+    for (size_t i = 0; i < codes.size(); i++) {
+        state = state * 1103515245u + 12345u;
+        codes[i] = i < 3 ? (i == 0 ? 0u : i == 1 ? 0xffffffffu : 0x80000000u) : state ^ (state << 7);
+        uint32_t expected = 0, bit = 0;
+        for (int b = 31; b >= 0; b--) {
+            bit ^= (codes[i] >> b) & 1u;
+            expected |= bit << b;
+        }
+        assert(grayDecode(codes[i]) == expected);
+        assert(grayEncode(grayDecode(codes[i])) == codes[i]);
+    }
+    cout << "✓ Branchless grayDecode PASSED\n";
+
+    // Batch converter: every SIMD level, odd lengths, in place
+    SimdLevel saved = getSimdLevel();
+    for (int level = SIMD_SCALAR; level <= detectSimdLevel(); level++) {
+        setSimdLevel(static_cast<SimdLevel>(level));
+        for (size_t n = 0; n <= codes.size(); n += 97) {
+            vector<uint32_t> values(n);
+            grayDecodeBatch(codes.data(), values.data(), n);
+            for (size_t i = 0; i < n; i++) assert(values[i] == grayDecode(codes[i]));
+        }
+        vector<uint32_t> inPlace = codes;
+        grayDecodeBatch(inPlace.data(), inPlace.data(), inPlace.size());
+        for (size_t i = 0; i < codes.size(); i++) assert(inPlace[i] == grayDecode(codes[i]));
+    }
+    setSimdLevel(saved);
+    cout << "✓ grayDecodeBatch at every SIMD level PASSED\n";
+
+    // Eight-character parsing: every length, bad characters at every position
+    for (int bits = 1; bits <= MAX_GRAY_BITS; bits++) {
+        uint32_t code = codes[static_cast<size_t>(bits)] & (bits == 32 ? 0xffffffffu : (1u << bits) - 1);
+        string text = grayCodeToString(code, bits);
+        uint32_t parsed = 0;
+        assert(parseGrayCode(text, parsed) && parsed == code);
+        assert(MultisetProgram::grayToInt(text) == static_cast<int>(grayDecode(code)));
+        for (int pos = 0; pos < bits; pos++) {
+            string bad = text;
+            bad[pos] = pos % 2 ? '2' : '/';
+            assert(!parseGrayCode(bad, parsed));
+        }
+        (void)parsed;
+    }
+    uint32_t parsed;
+    assert(!parseGrayCode(string(33, '0'), parsed));
+    assert(MultisetProgram::grayToInt("1x1") == 6); // non-0/1 characters still count as 0
+    (void)parsed;
+    cout << "✓ parseGrayCode and grayToInt PASSED\n";
+}
+
+void testRandomMultiset() {
+    cout << "\nTest 20: Seeded Random Multisets\n";
+    cout << "--------------------------------\n";
+
+    // Counter streams are pure functions of (seed, stream, counter)
+    CounterRng r1(42, 3), r2(42, 3), r3(42, 4);
+    uint64_t first = r1();
+    assert(first == r2() && first == counterHash(42, 3, 0));
+    assert(r1() == counterHash(42, 3, 1));
+    assert(r3() != first);
+    (void)first;
+
+    // Hypergeometric draws: exact edge cases, mean and variance for the
+    // sequential (small sample) and rejection (large sample) paths
+    CounterRng edge(1, 1);
+    assert(sampleHypergeometric(edge, 0, 10, 5) == 0);
+    assert(sampleHypergeometric(edge, 10, 0, 5) == 5);
+    assert(sampleHypergeometric(edge, 7, 3, 10) == 7);
+    bool threw = false;
+    try {
+        sampleHypergeometric(edge, 2, 2, 5);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+    (void)threw;
+    const uint64_t params[2][3] = {{3, 7, 6}, {3000, 7000, 4000}};
+    for (int c = 0; c < 2; c++) {
+        double good = static_cast<double>(params[c][0]), bad = static_cast<double>(params[c][1]);
+        double n = static_cast<double>(params[c][2]), total = good + bad;
+        double mean = n * good / total;
+        double variance = n * (good / total) * (bad / total) * (total - n) / (total - 1);
+        const int draws = 4000;
+        double sum = 0, squares = 0;
+        for (int i = 0; i < draws; i++) {
+            CounterRng rng(99, static_cast<uint64_t>(i));
+            uint64_t k = sampleHypergeometric(rng, params[c][0], params[c][1], params[c][2]);
+            assert(k <= params[c][0] && k <= params[c][2]);
+            sum += static_cast<double>(k);
+            squares += static_cast<double>(k) * static_cast<double>(k);
+        }
+        double sampleMean = sum / draws;
+        double sampleVariance = squares / draws - sampleMean * sampleMean;
+        assert(fabs(sampleMean - mean) < 5 * sqrt(variance / draws));
+        assert(fabs(sampleVariance / variance - 1.0) < 0.15);
+        (void)mean;
+        (void)variance;
+        (void)sampleVariance;
+    }
+    cout << "✓ Counter streams and hypergeometric draws PASSED\n";
+
+    // Binomial draws: inversion (small mean) and rejection (large mean), on
+    // both sides of p = 1/2
+    assert(sampleBinomial(edge, 0, 0.5) == 0 && sampleBinomial(edge, 9, 0.0) == 0 && sampleBinomial(edge, 9, 1.0) == 9);
+    const double binomialParams[4][2] = {{20, 0.1}, {20, 0.9}, {100000, 0.5}, {5000, 0.7}};
+    for (int c = 0; c < 4; c++) {
+        uint64_t trials = static_cast<uint64_t>(binomialParams[c][0]);
+        double p = binomialParams[c][1];
+        double mean = binomialParams[c][0] * p;
+        double variance = mean * (1.0 - p);
+        const int draws = 4000;
+        double sum = 0, squares = 0;
+        for (int i = 0; i < draws; i++) {
+            CounterRng rng(77, static_cast<uint64_t>(i));
+            uint64_t k = sampleBinomial(rng, trials, p);
+            assert(k <= trials);
+            sum += static_cast<double>(k);
+            squares += static_cast<double>(k) * static_cast<double>(k);
+        }
+        double sampleMean = sum / draws;
+        double sampleVariance = squares / draws - sampleMean * sampleMean;
+        assert(fabs(sampleMean - mean) < 5 * sqrt(variance / draws));
+        assert(fabs(sampleVariance / variance - 1.0) < 0.15);
+        (void)mean;
+        (void)variance;
+        (void)sampleVariance;
+    }
+    cout << "✓ Binomial draws PASSED\n";
+
+    // Exact cardinality within the caps, for both distributions
+    vector<int> capValues(1 << 10);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 5); // some caps are 0
+    CapArray caps = makeCapArray(capValues);
+    uint64_t capacity = 0;
+    for (size_t i = 0; i < capValues.size(); i++) capacity += static_cast<uint64_t>(capValues[i]);
+    const uint64_t cardinalities[5] = {0, 1, 777, capacity - 1, capacity};
+    for (int distribution = 0; distribution < 2; distribution++) {
+        for (int c = 0; c < 5; c++) {
+            DenseMultiset m = randomMultiset(10, caps, cardinalities[c], 5, static_cast<RandomDistribution>(distribution));
+            uint64_t units = 0;
+            for (size_t i = 0; i < m.size(); i++) {
+                assert(m.count(i) >= 0 && m.count(i) <= capValues[i]);
+                units += static_cast<uint64_t>(m.count(i));
+            }
+            assert(units == cardinalities[c]);
+            (void)units;
+        }
+    }
+    assert(totalCapacity(DenseMultiset(10, caps)) == capacity);
+    threw = false;
+    try {
+        randomMultiset(10, caps, capacity + 1, 5);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Units land evenly: each half of the universe holds about half of them
+    DenseMultiset spread = randomMultiset(10, caps, 1000, 8);
+    int lowHalf = 0;
+    for (size_t i = 0; i < spread.size() / 2; i++) lowHalf += spread.count(i);
+    assert(lowHalf > 400 && lowHalf < 600);
+    (void)lowHalf;
+    cout << "✓ Exact cardinality within caps PASSED\n";
+
+    // Same seed, same multiset for any thread count; other seeds differ
+    vector<int> wideCaps(size_t(1) << 16);
+    for (size_t i = 0; i < wideCaps.size(); i++) wideCaps[i] = static_cast<int>(i % 9 + 1);
+    CapArray wide = makeCapArray(wideCaps);
+    size_t originalThreshold = getParallelThreshold();
+    setParallelThreshold(1);
+    vector<DenseMultiset> results;
+    const unsigned threadCounts[3] = {1, 2, 4};
+    for (int t = 0; t < 3; t++) {
+        setThreadCount(threadCounts[t]);
+        results.push_back(randomMultiset(16, wide, 123456, 2024));
+        results.push_back(randomMultiset(16, wide, 123456, 2024, RANDOM_MULTINOMIAL));
+    }
+    setThreadCount(0);
+    setParallelThreshold(originalThreshold);
+    for (size_t r = 2; r < results.size(); r++) {
+        assert(memcmp(results[r].data(), results[r % 2].data(), results[r].size() * sizeof(int)) == 0);
+    }
+    DenseMultiset other = randomMultiset(16, wide, 123456, 2025);
+    assert(memcmp(other.data(), results[0].data(), other.size() * sizeof(int)) != 0);
+    cout << "✓ Reproducible for any thread count PASSED\n";
+
+    // Billions of units: the work depends on the universe, not the cardinality
+    vector<int> hugeCaps(size_t(1) << 12, 1 << 30);
+    DenseMultiset huge = randomMultiset(12, makeCapArray(hugeCaps), 3000000000ull, 77);
+    uint64_t hugeUnits = 0;
+    for (size_t i = 0; i < huge.size(); i++) hugeUnits += static_cast<uint64_t>(huge.count(i));
+    assert(hugeUnits == 3000000000ull);
+    (void)hugeUnits;
+    cout << "✓ Three billion units PASSED\n";
+
+    // The interactive program reproduces its multisets from the seed
+    vector<int> programCaps(8, 3);
+    map<string, int> runs[2];
+    for (int run = 0; run < 2; run++) {
+        MultisetProgram program;
+        program.initializeUniverse(3, programCaps);
+        program.setRandomSeed(31337);
+        streambuf* saved = cout.rdbuf();
+        ostringstream sink;
+        cout.rdbuf(sink.rdbuf());
+        program.createMultisetAutomatically(runs[run], "A", 10);
+        cout.rdbuf(saved);
+    }
+    assert(runs[0] == runs[1]);
+    int programUnits = 0;
+    for (map<string, int>::const_iterator it = runs[0].begin(); it != runs[0].end(); ++it) programUnits += it->second;
+    assert(programUnits == 10);
+    (void)programUnits;
+    cout << "✓ Seeded interactive creation PASSED\n";
+}
+
+void testTrackedMultiset() {
+    cout << "\nTest 21: Incrementally Tracked Aggregates\n";
+    cout << "-----------------------------------------\n";
+
+    // Random single-element updates, checked against full rescans; the small
+    // prime 7 makes some multiplicities and ranks vanish modulo it
+    vector<int> capValues(1 << 8);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 13 + 1);
+    CapArray caps = makeCapArray(capValues);
+    const uint64_t moduli[2] = {PRODUCT_DEFAULT_MODULUS, 7};
+    for (int m = 0; m < 2; m++) {
+        TrackedMultiset tracked(8, caps, moduli[m]);
+        assert(tracked.cardinality() == 0 && tracked.support() == 0);
+        assert(tracked.productModular() == 1 % moduli[m] && tracked.productLog() == 0.0);
+        unsigned state = 5;
+        for (int step = 0; step < 5000; step++) {
+            state = state * 1103515245u + 12345u;
+            size_t rank = (state >> 8) % capValues.size();
+            int copies = static_cast<int>((state >> 20) % 4 + 1);
+            switch ((state >> 24) % 3) {
+            case 0: tracked.insert(rank, copies); break;
+            case 1: tracked.remove(rank, copies); break;
+            default: tracked.set(rank, static_cast<int>((state >> 4) % (static_cast<unsigned>(capValues[rank]) + 1)));
+            }
+            if (step % 97 != 0) continue;
+            const DenseMultiset& dense = tracked.dense();
+            size_t support = 0;
+            for (size_t i = 0; i < dense.size(); i++) support += dense.count(i) > 0 ? 1 : 0;
+            assert(tracked.cardinality() == sumMultisets(dense));
+            assert(sumMultisets(tracked) == sumMultisets(dense));
+            assert(weightedSum(tracked) == weightedSum(dense));
+            assert(tracked.support() == support);
+            ProductEngine plain = productFactors(dense.view());
+            ProductEngine weighted = weightedProductFactors(dense.view());
+            assert(tracked.productModular() == plain.modular(moduli[m]));
+            assert(tracked.weightedProductModular() == weighted.modular(moduli[m]));
+            assert(fabs(tracked.productLog() - plain.logMagnitude()) < 1e-9 * (1.0 + fabs(plain.logMagnitude())));
+            if (dense.count(0) > 0) {
+                assert(std::isinf(tracked.weightedProductLog()) && tracked.weightedProductLog() < 0);
+            } else {
+                assert(fabs(tracked.weightedProductLog() - weighted.logMagnitude()) <
+                       1e-9 * (1.0 + fabs(weighted.logMagnitude())));
+            }
+            (void)support;
+        }
+    }
+    cout << "✓ Aggregates follow single-element updates PASSED\n";
+
+    // insert and remove stop at the cap and at 0; set rejects values outside them
+    TrackedMultiset small(2, makeCapArray(vector<int>(4, 3)));
+    assert(small.insert(1, 5) == 3 && small.count(1) == 3);
+    assert(small.insert(1) == 0);
+    assert(small.remove(1, 2) == 2 && small.remove(1, 9) == 1 && small.count(1) == 0);
+    bool threw = false;
+    try {
+        small.set(2, 4);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Inverses need a prime modulus; composites are refused up front
+    assert(isPrime(2) && isPrime(7) && isPrime(PRODUCT_DEFAULT_MODULUS) && isPrime(18446744073709551557ull));
+    assert(!isPrime(0) && !isPrime(1) && !isPrime(4) && !isPrime(3215031751ull) && !isPrime(18446744073709551615ull));
+    threw = false;
+    try {
+        TrackedMultiset composite(2, makeCapArray(vector<int>(4, 3)), 4);
+    } catch (const invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+    (void)threw;
+
+    // Built from an existing multiset, cleared, and rebuilt
+    DenseMultiset source(2, vector<int>(4, 3));
+    source.set(1, 2);
+    source.set(3, 3);
+    TrackedMultiset built(source);
+    assert(built.cardinality() == 5 && built.weightedSum() == 1 * 2 + 3 * 3 && built.support() == 2);
+    assert(built.productModular() == 6 && built.weightedProductModular() == 27);
+    built.clear();
+    assert(built.cardinality() == 0 && built.weightedSum() == 0 && built.productModular() == 1);
+    cout << "✓ Caps, construction and clear PASSED\n";
+}
+
+void testMultisetCollection() {
+    cout << "\nTest 22: N-ary Collection Operations\n";
+    cout << "------------------------------------\n";
+
+    // 40 multisets over 2^13 ranks (several tiles), sparse and dense ones
+    const int bits = 13;
+    vector<int> capValues(size_t(1) << bits);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 6 + 1);
+    CapArray caps = makeCapArray(capValues);
+    const size_t K = 40;
+    vector<DenseMultiset> dense;
+    vector<SparseMultiset> sparse;
+    for (size_t k = 0; k < K; k++) {
+        uint64_t cardinality = k % 2 == 0 ? 300 : 9000; // sparse / dense fill
+        dense.push_back(randomMultiset(bits, caps, cardinality, 1000 + k));
+        sparse.push_back(toSparse(dense.back()));
+    }
+    vector<const DenseMultiset*> denseInputs;
+    vector<const SparseMultiset*> sparseInputs;
+    vector<AdaptiveMultiset> adaptive;
+    for (size_t k = 0; k < K; k++) {
+        denseInputs.push_back(&dense[k]);
+        sparseInputs.push_back(&sparse[k]);
+        adaptive.push_back(k % 3 == 0 ? AdaptiveMultiset(sparse[k]) : AdaptiveMultiset(dense[k]));
+    }
+    vector<const AdaptiveMultiset*> adaptiveInputs;
+    for (size_t k = 0; k < K; k++) adaptiveInputs.push_back(&adaptive[k]);
+
+    // Expected values: pairwise folds for union and intersection, element
+    // definitions for the sum and the threshold
+    DenseMultiset foldUnion = dense[0], foldIntersection = dense[0];
+    for (size_t k = 1; k < K; k++) {
+        foldUnion = unionMultisets(foldUnion, dense[k]);
+        foldIntersection = intersectionMultisets(foldIntersection, dense[k]);
+    }
+    const size_t threshold = 7;
+    vector<int> expectedSum(capValues.size()), expectedAtLeast(capValues.size());
+    for (size_t i = 0; i < capValues.size(); i++) {
+        long long total = 0;
+        size_t present = 0;
+        for (size_t k = 0; k < K; k++) {
+            total += dense[k].count(i);
+            present += dense[k].count(i) > 0;
+        }
+        expectedSum[i] = static_cast<int>(min<long long>(total, capValues[i]));
+        expectedAtLeast[i] = present >= threshold ? 1 : 0;
+    }
+
+    size_t originalThreshold = getParallelThreshold();
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            setParallelThreshold(1);
+            setThreadCount(4);
+        }
+        DenseMultiset u = unionAll(denseInputs), n = intersectionAll(denseInputs);
+        DenseMultiset s = additiveUnionAll(denseInputs), t = atLeastAll(denseInputs, threshold);
+        DenseMultiset su = toDense(unionAll(sparseInputs)), sn = toDense(intersectionAll(sparseInputs));
+        DenseMultiset ss = toDense(additiveUnionAll(sparseInputs)), st = toDense(atLeastAll(sparseInputs, threshold));
+        DenseMultiset au = unionAll(adaptiveInputs).toDense(), an = intersectionAll(adaptiveInputs).toDense();
+        DenseMultiset as = additiveUnionAll(adaptiveInputs).toDense(), at = atLeastAll(adaptiveInputs, threshold).toDense();
+        assert(u.getCounts() == foldUnion.getCounts() && su.getCounts() == u.getCounts() && au.getCounts() == u.getCounts());
+        assert(n.getCounts() == foldIntersection.getCounts() && sn.getCounts() == n.getCounts() &&
+               an.getCounts() == n.getCounts());
+        assert(s.getCounts() == expectedSum && ss.getCounts() == expectedSum && as.getCounts() == expectedSum);
+        assert(t.getCounts() == expectedAtLeast && st.getCounts() == expectedAtLeast && at.getCounts() == expectedAtLeast);
+    }
+    setThreadCount(0);
+    setParallelThreshold(originalThreshold);
+    cout << "✓ Dense pass, k-way merge and mixed inputs match the folds PASSED\n";
+
+    // Named collection and its errors
+    MultisetCollection collection(bits, caps);
+    for (size_t k = 0; k < 5; k++) collection.add("m" + to_string(k), adaptive[k]);
+    assert(collection.size() == 5 && collection.contains("m3") && collection.names()[0] == "m0");
+    vector<string> pair2;
+    pair2.push_back("m1");
+    pair2.push_back("m2");
+    assert(collection.unionAll(pair2).toDense().getCounts() == unionMultisets(dense[1], dense[2]).getCounts());
+    assert(collection.atLeast(5).toDense().getCounts() == atLeastAll(vector<const DenseMultiset*>(denseInputs.begin(), denseInputs.begin() + 5), 5).getCounts());
+    assert(collection.remove("m4") && !collection.remove("m4"));
+    int errors = 0;
+    try { collection.get("missing"); } catch (const invalid_argument&) { errors++; }
+    try { unionAll(vector<const DenseMultiset*>()); } catch (const invalid_argument&) { errors++; }
+    try { atLeastAll(denseInputs, 0); } catch (const invalid_argument&) { errors++; }
+    DenseMultiset other(2, vector<int>(4, 1));
+    try { collection.add("small", AdaptiveMultiset(other)); } catch (const invalid_argument&) { errors++; }
+    assert(errors == 4);
+    (void)errors;
+    cout << "✓ Named collection PASSED\n";
+
+    // Batch commands
+    BatchSession session;
+    ostringstream output;
+    session.execute("universe 3 4 9", output);
+    session.execute("cap 000 4", output);
+    session.execute("cap 001 4", output);
+    session.execute("cap 011 4", output);
+    session.execute("set a 000:2 001:1", output);
+    session.execute("set b 000:1 011:3", output);
+    session.execute("set c 000:4 001:2 011:1", output);
+    output.str("");
+    session.execute("unionall u a b c", output);
+    session.execute("intersectall n a b c", output);
+    session.execute("atleast t 2 a b c", output);
+    assert(output.str() == "ok 3\nok 1\nok 3\n");
+    assert(session.getMultiset("n").count(0) == 1 && session.getMultiset("t").count(2) == 1);
+    cout << "✓ Batch unionall / intersectall / atleast PASSED\n";
+}
+
+void testRunLengthMultiset() {
+    cout << "\nTest 23: Run-Length Encoded Multisets\n";
+    cout << "-------------------------------------\n";
+
+    // Varint runs round-trip any values, including negative and large ones
+    const int raw[10] = {0, 0, 0, -1, -1, 7, 2147483647, -2147483647 - 1, 5, 5};
+    RunArray array = RunArray::encode(raw, 10);
+    assert(array.size() == 10 && array.runCount() == 6);
+    int decoded[10];
+    array.decode(decoded);
+    for (int i = 0; i < 10; i++) assert(decoded[i] == raw[i] && array.at(static_cast<size_t>(i)) == raw[i]);
+    assert(RunArray::fromBytes(array.getBytes().data(), array.getBytes().size(), 10) == array);
+    int rejected = 0;
+    try { RunArray::fromBytes(array.getBytes().data(), array.getBytes().size(), 11); } catch (const runtime_error&) { rejected++; }
+    try { RunArray::fromBytes(array.getBytes().data(), array.getBytes().size() - 1, 10); } catch (const runtime_error&) { rejected++; }
+    assert(rejected == 2);
+    (void)rejected;
+    cout << "✓ Varint runs PASSED\n";
+
+    // Clustered multisets: long runs of equal multiplicities along Gray order
+    const int bits = 16;
+    const size_t n = size_t(1) << bits;
+    CapArray caps = makeCapArray(vector<int>(n, 8));
+    vector<int> otherCaps(n);
+    for (size_t i = 0; i < n; i++) otherCaps[i] = static_cast<int>(i % 7 + 2);
+    CapArray varied = makeCapArray(otherCaps);
+    DenseMultiset d1(bits, caps), d2(bits, caps), d3(bits, varied);
+    unsigned state = 21;
+    for (int pass = 0; pass < 3; pass++) {
+        DenseMultiset& target = pass == 0 ? d1 : pass == 1 ? d2 : d3;
+        size_t i = 0;
+        while (i < n) {
+            state = state * 1103515245u + 12345u;
+            size_t length = (state >> 8) % 300 + 1;
+            int value = static_cast<int>((state >> 20) % 3 == 0 ? 0 : (state >> 4) % 3 + 1);
+            for (size_t j = i; j < min(n, i + length); j++) target.set(j, value);
+            i += length;
+        }
+    }
+    RunLengthMultiset r1 = toRunLength(d1), r2 = toRunLength(d2), r3 = toRunLength(d3);
+    assert(r1.byteSize() * 50 < n * sizeof(int)); // a few bytes per run instead of four per element
+    assert(r1.isWithinCaps() && toDense(r1).getCounts() == d1.getCounts());
+    assert(toRunLength(toSparse(d1)).getRuns() == r1.getRuns());
+    for (size_t i = 0; i < n; i += 97) assert(r1.count(i) == d1.count(i));
+
+    // Shared caps (run by run) and different caps (element by element)
+    for (int pass = 0; pass < 2; pass++) {
+        const DenseMultiset& b = pass == 0 ? d2 : d3;
+        const RunLengthMultiset& rb = pass == 0 ? r2 : r3;
+        assert(toDense(unionMultisets(r1, rb)).getCounts() == unionMultisets(d1, b).getCounts());
+        assert(toDense(intersectionMultisets(r1, rb)).getCounts() == intersectionMultisets(d1, b).getCounts());
+        assert(toDense(differenceMultisets(r1, rb)).getCounts() == differenceMultisets(d1, b).getCounts());
+        assert(toDense(differenceMultisets(rb, r1)).getCounts() == differenceMultisets(b, d1).getCounts());
+        assert(toDense(symmetricDifferenceMultisets(r1, rb)).getCounts() ==
+               symmetricDifferenceMultisets(d1, b).getCounts());
+        assert(toDense(complementMultiset(rb)).getCounts() == complementMultiset(b).getCounts());
+        assert(arithmeticDifferenceMultisets(r1, rb) == arithmeticDifferenceMultisets(d1, b));
+        assert(divisionMultisets(r1, rb) == divisionMultisets(d1, b));
+        assert(weightedDifference(r1, rb) == weightedDifference(d1, b));
+        assert(weightedDivision(r1, rb) == weightedDivision(d1, b));
+        (void)b;
+        (void)rb;
+    }
+    // The result of an operation is a run-length multiset in canonical form
+    assert(unionMultisets(r1, r2).getRuns() == toRunLength(unionMultisets(d1, d2)).getRuns());
+    cout << "✓ Set operations on runs PASSED\n";
+
+    assert(sumMultisets(r1) == sumMultisets(d1) && weightedSum(r1) == weightedSum(d1));
+    assert(productOrOverflow([&] { return productMultisets(r1); }) ==
+           productOrOverflow([&] { return productMultisets(d1); }));
+    assert(weightedProduct(r1) == weightedProduct(d1));
+    assert(productFactors(r1).modular() == productFactors(d1.view()).modular());
+    DenseMultiset small(4, vector<int>(16, 3));
+    small.set(3, 2);
+    small.set(4, 2);
+    small.set(9, 1);
+    RunLengthMultiset smallRuns = toRunLength(small);
+    assert(weightedProduct(smallRuns) == weightedProduct(small));
+    assert(weightedProductFactors(smallRuns).exact() == weightedProductFactors(small.view()).exact());
+    cout << "✓ Reductions on runs PASSED\n";
+
+    // Run-length files: a few bytes per run, read back as runs or as a multiset
+    const string path = "/tmp/multiset_test_rle.bin";
+    saveMultiset(path, r1); // uniform caps compress to one run
+    FILE* file = fopen(path.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    long fileBytes = ftell(file);
+    fclose(file);
+    assert(static_cast<size_t>(fileBytes) * 10 < n * sizeof(int));
+    (void)fileBytes;
+    saveMultiset(path, r3);
+    {
+        MappedMultiset mapped(path);
+        assert(mapped.isRunLength() && !mapped.isSparse());
+        RunLengthMultiset loaded = mapped.loadRunLength();
+        assert(loaded.getRuns() == r3.getRuns() && *loaded.sharedCaps() == otherCaps);
+        assert(mapped.load().toDense().getCounts() == d3.getCounts());
+        bool threw = false;
+        try {
+            mapped.denseView();
+        } catch (const logic_error&) {
+            threw = true;
+        }
+        assert(threw);
+        (void)threw;
+    }
+    BatchSession session;
+    ostringstream output;
+    session.execute("load c " + path, output);
+    session.execute("save c " + path + " rle", output);
+    session.execute("load e " + path, output);
+    assert(session.getMultiset("e").toDense().getCounts() == d3.getCounts());
+    remove(path.c_str());
+    cout << "✓ Run-length files PASSED\n";
+}
+
+void testRankIndex() {
+    cout << "\nTest 24: Rank Range and Prefix Index\n";
+    cout << "------------------------------------\n";
+
+    // Every code prefix is one block of ranks
+    for (int bits = 1; bits <= 6; bits++) {
+        for (int length = 0; length <= bits; length++) {
+            for (uint32_t prefix = 0; prefix < (1u << length); prefix++) {
+                size_t first, last;
+                grayPrefixRange(bits, prefix, length, first, last);
+                assert(last - first == (size_t(1) << (bits - length)));
+                for (size_t rank = 0; rank < (size_t(1) << bits); rank++) {
+                    bool matches = (grayEncode(static_cast<uint32_t>(rank)) >> (bits - length)) == prefix;
+                    assert(matches == (rank >= first && rank < last));
+                    (void)matches;
+                }
+            }
+        }
+    }
+
+    // Random point updates through a tracked multiset, checked against scans
+    vector<int> capValues(1 << 7);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 9 + 1);
+    CapArray caps = makeCapArray(capValues);
+    TrackedMultiset tracked(7, caps);
+    tracked.attachRankIndex();
+    unsigned state = 11;
+    for (int step = 0; step < 3000; step++) {
+        state = state * 1103515245u + 12345u;
+        size_t rank = (state >> 8) % capValues.size();
+        if ((state >> 24) % 2 == 0) tracked.insert(rank, static_cast<int>((state >> 20) % 3 + 1));
+        else tracked.remove(rank, static_cast<int>((state >> 20) % 3 + 1));
+        if (step % 53 != 0) continue;
+
+        const RankIndex& index = tracked.rankIndex();
+        const DenseMultiset& dense = tracked.dense();
+        assert(index.total() == tracked.cardinality());
+        size_t a = (state >> 4) % dense.size(), b = (state >> 12) % dense.size();
+        if (a > b) swap(a, b);
+        long long count = 0, weighted = 0;
+        for (size_t i = a; i <= b; i++) {
+            count += dense.count(i);
+            weighted += static_cast<long long>(dense.count(i)) * static_cast<long long>(i);
+        }
+        assert(index.rangeCount(a, b) == count && index.rangeWeightedSum(a, b) == weighted);
+
+        string bits = grayCodeToString(grayEncode(static_cast<uint32_t>(a)), 7).substr(0, (state >> 16) % 8);
+        long long prefixCount = 0;
+        for (size_t i = 0; i < dense.size(); i++) {
+            if (grayCodeToString(grayEncode(static_cast<uint32_t>(i)), 7).compare(0, bits.size(), bits) == 0) {
+                prefixCount += dense.count(i);
+            }
+        }
+        assert(index.codePrefixCount(bits) == prefixCount);
+
+        // The k-th unit lands on the rank whose running total passes k
+        long long seen = 0;
+        for (size_t i = 0; i < dense.size(); i++) {
+            for (int c = 0; c < dense.count(i); c += 3) assert(index.kth(seen + c) == i);
+            seen += dense.count(i);
+        }
+        (void)index; (void)count; (void)weighted; (void)prefixCount;
+    }
+
+    // Bulk changes rebuild the index; bad queries throw
+    tracked.clear();
+    assert(tracked.rankIndex().total() == 0 && tracked.rankIndex().rangeCount(0, 127) == 0);
+    bool threw = false;
+    try { tracked.rankIndex().kth(0); } catch (const out_of_range&) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { tracked.rankIndex().codePrefixCount("0120"); } catch (const invalid_argument&) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { tracked.rankIndex().codePrefixCount("00000000"); } catch (const invalid_argument&) { threw = true; }
+    assert(threw);
+    tracked.detachRankIndex();
+    threw = false;
+    try { tracked.rankIndex(); } catch (const logic_error&) { threw = true; }
+    assert(threw);
+    (void)threw;
+
+    // Built directly from the other representations
+    DenseMultiset dense(7, caps);
+    for (size_t i = 0; i < dense.size(); i += 5) dense.set(i, capValues[i]);
+    RankIndex fromDense(dense), fromSparse(toSparse(dense));
+    assert(fromDense.total() == sumMultisets(dense) && fromSparse.total() == fromDense.total());
+    assert(fromSparse.prefixWeightedSum(128) == weightedSum(dense));
+    assert(fromDense.codePrefixCount("1") == fromSparse.codePrefixCount(1, 1));
+
+    cout << "✓ Rank index PASSED\n";
+}
+
+void testConcurrentMultiset() {
+    cout << "\nTest 25: Concurrent Multiset\n";
+    cout << "----------------------------\n";
+
+    vector<int> capValues(1 << 6);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 5 + 1);
+    capValues[3] = 1500;
+    CapArray caps = makeCapArray(capValues);
+
+    // Single thread: the same clamping as TrackedMultiset
+    ConcurrentMultiset single(6, caps, 2);
+    assert(single.insert(1, 10) == 2 && single.count(1) == 2 && single.insert(1) == 0);
+    assert(single.remove(1, 5) == 2 && single.remove(1) == 0);
+    single.insert(3, 40);
+    single.makeHot(3);
+    assert(single.isHot(3) && !single.isHot(4) && single.count(3) == 40);
+    assert(single.insert(3, 2000) == 1460 && single.count(3) == 1500 && single.insert(3) == 0);
+    assert(single.remove(3, 1000) == 1000 && single.snapshot().count(3) == 500);
+    bool threw = false;
+    try { single.insert(64); } catch (const out_of_range&) { threw = true; }
+    assert(threw);
+    threw = false;
+    DenseMultiset over(6, caps);
+    over.set(0, 2);
+    try { ConcurrentMultiset bad(over); } catch (const invalid_argument&) { threw = true; }
+    assert(threw);
+    (void)threw;
+
+    // Several writers against ordinary and hot keys while snapshots are taken
+    const int writers = 4;
+    ConcurrentMultiset shared(6, caps, writers);
+    shared.makeHot(3);
+    vector<long long> net(writers, 0);
+    vector<thread> threads;
+    atomic<bool> stop(false);
+    for (int w = 0; w < writers; w++) {
+        threads.push_back(thread([&shared, &net, &capValues, w]() {
+            unsigned state = 17u + static_cast<unsigned>(w);
+            for (int step = 0; step < 20000; step++) {
+                state = state * 1103515245u + 12345u;
+                size_t rank = (state >> 16) % 4 == 0 ? 3 : (state >> 8) % capValues.size();
+                int copies = static_cast<int>((state >> 20) % 3 + 1);
+                if ((state >> 24) % 3 != 0) net[w] += shared.insert(rank, copies);
+                else net[w] -= shared.remove(rank, copies);
+            }
+        }));
+    }
+    int snapshots = 0;
+    thread observer([&]() {
+        while (!stop.load()) {
+            DenseMultiset view = shared.snapshot();
+            for (size_t i = 0; i < view.size(); i++) assert(view.count(i) >= 0 && view.count(i) <= view.cap(i));
+            snapshots++;
+        }
+    });
+    shared.makeHot(10); // while the writers run
+    for (int w = 0; w < writers; w++) threads[w].join();
+    stop.store(true);
+    observer.join();
+    DenseMultiset settled = shared.snapshot();
+    long long expected = 0;
+    for (int w = 0; w < writers; w++) expected += net[w];
+    assert(sumMultisets(settled) == expected);
+    for (size_t i = 0; i < settled.size(); i++) {
+        assert(settled.count(i) >= 0 && settled.count(i) <= settled.cap(i) && shared.count(i) == settled.count(i));
+    }
+    assert(shared.isHot(10) && snapshots > 0);
+    (void)expected;
+
+    // Contended inserts into a hot key fill it exactly to the cap
+    ConcurrentMultiset filled(6, caps, writers);
+    filled.makeHot(3);
+    atomic<int> inserted(0);
+    threads.clear();
+    for (int w = 0; w < writers; w++) {
+        threads.push_back(thread([&filled, &inserted]() {
+            for (int step = 0; step < 1000; step++) inserted += filled.insert(3);
+        }));
+    }
+    for (int w = 0; w < writers; w++) threads[w].join();
+    assert(inserted.load() == 1500 && filled.count(3) == 1500);
+
+    // The snapshot feeds the ordinary operations
+    DenseMultiset both = intersectionMultisets(settled, filled.snapshot());
+    assert(both.count(3) == min(settled.count(3), 1500));
+
+    cout << "✓ Concurrent multiset PASSED\n";
+}
+
+void testPersistentMultiset() {
+    cout << "\nTest 26: Persistent Multisets\n";
+    cout << "-----------------------------\n";
+
+    vector<int> capValues(1 << 8);
+    for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 7 + 1);
+    CapArray caps = makeCapArray(capValues);
+
+    // Every version stays readable after later updates
+    vector<PersistentMultiset> versions(1, PersistentMultiset(8, caps));
+    vector<DenseMultiset> expected(1, DenseMultiset(8, caps));
+    unsigned state = 3;
+    for (int step = 0; step < 400; step++) {
+        state = state * 1103515245u + 12345u;
+        size_t rank = (state >> 8) % capValues.size();
+        int copies = static_cast<int>((state >> 20) % 4 + 1);
+        DenseMultiset next = expected.back();
+        if ((state >> 24) % 3 != 0) {
+            versions.push_back(versions.back().insert(rank, copies));
+            next.set(rank, min(next.count(rank) + copies, capValues[rank]));
+        } else {
+            versions.push_back(versions.back().remove(rank, copies));
+            next.set(rank, max(next.count(rank) - copies, 0));
+        }
+        expected.push_back(next);
+    }
+    for (size_t v = 0; v < versions.size(); v += 37) {
+        assert(versions[v].toDense().getCounts() == expected[v].getCounts());
+        assert(sumMultisets(versions[v]) == sumMultisets(expected[v]));
+        assert(weightedSum(versions[v]) == weightedSum(expected[v]));
+    }
+
+    // One update copies one path: bitWidth + 1 new nodes at most
+    size_t before = distinctNodes(vector<PersistentMultiset>(1, versions.back()));
+    vector<PersistentMultiset> pair;
+    pair.push_back(versions.back());
+    pair.push_back(versions.back().set(5, versions.back().count(5) == 0 ? 1 : 0));
+    assert(distinctNodes(pair) <= before + 9);
+    assert(versions.back().set(7, versions.back().count(7)).sameVersion(versions.back()));
+    (void)before;
+
+    // Set operations match the dense ones, and shared subtrees come back as is
+    const PersistentMultiset& a = versions[300];
+    const PersistentMultiset& b = versions[400];
+    DenseMultiset da = a.toDense(), db = b.toDense();
+    assert(unionMultisets(a, b).toDense().getCounts() == unionMultisets(da, db).getCounts());
+    assert(intersectionMultisets(a, b).toDense().getCounts() == intersectionMultisets(da, db).getCounts());
+    assert(differenceMultisets(a, b).toDense().getCounts() == differenceMultisets(da, db).getCounts());
+    assert(symmetricDifferenceMultisets(a, b).toDense().getCounts() ==
+           symmetricDifferenceMultisets(da, db).getCounts());
+    assert(complementMultiset(a).toDense().getCounts() == complementMultiset(da).getCounts());
+    assert(unionMultisets(a, a).sameVersion(a) && differenceMultisets(a, a).cardinality() == 0);
+    vector<PersistentMultiset> close;
+    close.push_back(versions[399]);
+    close.push_back(intersectionMultisets(versions[399], versions[400]));
+    assert(distinctNodes(close) <= distinctNodes(vector<PersistentMultiset>(1, versions[399])) + 9);
+
+    // Differences between versions
+    vector<size_t> changed = changedRanks(a, b);
+    size_t differing = 0;
+    for (size_t i = 0; i < da.size(); i++) differing += da.count(i) != db.count(i) ? 1 : 0;
+    assert(changed.size() == differing);
+    for (size_t i = 0; i < changed.size(); i++) assert(da.count(changed[i]) != db.count(changed[i]));
+    assert(changedRanks(versions[10], versions[11]).size() <= 1);
+    (void)differing;
+
+    // Separately built caps take the element-by-element path
+    PersistentMultiset copy(DenseMultiset(8, capValues));
+    copy = copy.insert(1, 2).insert(200, 5);
+    DenseMultiset dc = copy.toDense();
+    assert(unionMultisets(copy, a).toDense().getCounts() == unionMultisets(dc, da).getCounts());
+    assert(symmetricDifferenceMultisets(a, copy).toDense().getCounts() ==
+           symmetricDifferenceMultisets(da, dc).getCounts());
+
+    bool threw = false;
+    try { a.set(0, 2); } catch (const invalid_argument&) { threw = true; }
+    assert(threw);
+    threw = false;
+    try { a.count(256); } catch (const out_of_range&) { threw = true; }
+    assert(threw);
+    (void)threw;
+
+    cout << "✓ Persistent multiset PASSED\n";
+}
+
+static string serverRoundTrip(const string& path, const string& request) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    int connected = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    assert(connected == 0);
+    (void)connected;
+    ssize_t sent = send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    assert(sent == static_cast<ssize_t>(request.size()));
+    (void)sent;
+    string response;
+    char buffer[4096];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) response.append(buffer, static_cast<size_t>(got));
+    close(fd);
+    return response;
+}
+
+void testMultisetServer() {
+    cout << "\nTest 27: Server Mode and Request Batching\n";
+    cout << "-----------------------------------------\n";
+
+    // Repeated queries in one batch run once until something changes state
+    BatchSession session;
+    vector<string> lines;
+    lines.push_back("universe 3 4 1");
+    lines.push_back("cap 000 4");
+    lines.push_back("set a 000:3 001:1");
+    lines.push_back("sum a");
+    lines.push_back("  sum   a ");
+    lines.push_back("# comment");
+    lines.push_back("wsum a");
+    lines.push_back("set a 000:1");
+    lines.push_back("sum a");
+    lines.push_back("sum b");
+    vector<string> results;
+    size_t evaluated = session.executeBatch(lines, results);
+    assert(evaluated == 8 && results.size() == lines.size());
+    assert(results[3] == "ok 4\n" && results[4] == results[3] && results[5].empty());
+    assert(results[8] == "ok 1\n" && results[9].compare(0, 6, "error ") == 0);
+    (void)evaluated;
+
+    // Round trips over the socket; the session outlives each connection
+    const string path = "/tmp/multiset_test_server.sock";
+    MultisetServer server(path);
+    thread loop([&server]() { server.serve(); });
+    string first = serverRoundTrip(path, "universe 3 4 1\ncap 000 4\nset a 000:2 011:1\nsum a\nbogus\nquit\nsum a\n");
+    assert(first == "ok 8\nok\nok 2\nok 3\nerror unknown command 'bogus'\nok\n");
+    string second = serverRoundTrip(path, "sum a\r\nwsum a\nexport a -\nquit\n");
+    assert(second == "ok 3\nok 2\nerror export to stdout is not available in this session; give a path\nok\n");
+    string last = serverRoundTrip(path, "list\nshutdown\n");
+    assert(last == "ok 1 a\nok\n");
+    loop.join();
+    assert(server.getStats().connections == 3 && server.getStats().requests == 12);
+    assert(server.getSession().hasMultiset("a"));
+    (void)first; (void)second; (void)last;
+
+    // stop() ends serve() from another thread
+    MultisetServer idle(path);
+    thread waiting([&idle]() { idle.serve(); });
+    idle.stop();
+    waiting.join();
+
+    bool threw = false;
+    try { MultisetServer bad("/nonexistent-dir/multiset.sock"); } catch (const runtime_error&) { threw = true; }
+    assert(threw);
+    (void)threw;
+
+    cout << "✓ Server mode PASSED\n";
+}
+
+// The Gray tables are built by the compiler
+static_assert(FixedGrayTable<3>::codes[2] == 3 && FixedGrayTable<3>::ranks[3] == 2, "Gray table");
+static_assert(FixedMultiset<6>::rankOf(FixedMultiset<6>::codeOf(45)) == 45, "Gray table round trip");
+
+void testFixedMultiset() {
+    cout << "\nTest 28: Compile-Time Fixed Widths\n";
+    cout << "----------------------------------\n";
+
+    // Every specialized width gives the dense results
+    int checked = 0;
+    for (int bits = 1; bits <= FIXED_MAX_BITS; bits++) {
+        vector<int> capValues(size_t(1) << bits);
+        for (size_t i = 0; i < capValues.size(); i++) capValues[i] = static_cast<int>(i % 6 + 1);
+        DenseMultiset d1(bits, capValues), d2(bits, capValues);
+        unsigned state = static_cast<unsigned>(bits) * 7919u;
+        for (size_t i = 0; i < d1.size(); i++) {
+            state = state * 1103515245u + 12345u;
+            d1.set(i, static_cast<int>((state >> 16) % static_cast<unsigned>(capValues[i] + 1)));
+            d2.set(i, static_cast<int>((state >> 8) % static_cast<unsigned>(capValues[i] + 1)));
+        }
+        bool specialized = dispatchFixedWidth(bits, [&](auto width) {
+            constexpr int B = decltype(width)::value;
+            FixedMultiset<B> f1 = toFixed<B>(d1), f2 = toFixed<B>(d2);
+            assert(toDense(unionMultisets(f1, f2)).getCounts() == unionMultisets(d1, d2).getCounts());
+            assert(toDense(intersectionMultisets(f1, f2)).getCounts() == intersectionMultisets(d1, d2).getCounts());
+            assert(toDense(differenceMultisets(f1, f2)).getCounts() == differenceMultisets(d1, d2).getCounts());
+            assert(toDense(symmetricDifferenceMultisets(f1, f2)).getCounts() ==
+                   symmetricDifferenceMultisets(d1, d2).getCounts());
+            assert(toDense(complementMultiset(f1)).getCounts() == complementMultiset(d1).getCounts());
+            assert(sumMultisets(f1) == sumMultisets(d1));
+            assert(productOrOverflow([&] { return productMultisets(f1); }) ==
+                   productOrOverflow([&] { return productMultisets(d1); }));
+            assert(arithmeticDifferenceMultisets(f1, f2) == arithmeticDifferenceMultisets(d1, d2));
+            assert(weightedSum(f1) == weightedSum(d1) && weightedDifference(f1, f2) == weightedDifference(d1, d2));
+            assert(weightedProduct(f2) == weightedProduct(d2));
+            if (sumMultisets(d2) != 0) assert(divisionMultisets(f1, f2) == divisionMultisets(d1, d2));
+            if (weightedSum(d2) != 0) assert(weightedDivision(f1, f2) == weightedDivision(d1, d2));
+            for (size_t i = 0; i < FixedMultiset<B>::Size; i++) {
+                assert(f1.countOfCode(grayEncode(static_cast<uint32_t>(i))) == d1.count(i));
+            }
+            (void)f1; (void)f2;
+            checked++;
+        });
+        assert(specialized);
+        (void)specialized;
+    }
+    assert(checked == FIXED_MAX_BITS && !dispatchFixedWidth(FIXED_MAX_BITS + 1, [](auto) {}));
+
+    // Round trip through the map-based program
+    MultisetProgram program;
+    vector<int> caps(16, 3);
+    program.initializeUniverse(4, caps);
+    map<string, int> m1, m2;
+    m1["0000"] = 2; m1["0110"] = 3; m1["1000"] = 1;
+    m2["0110"] = 1; m2["1111"] = 3;
+    FixedMultiset<4> f1 = program.toFixed<4>(m1), f2 = program.toFixed<4>(m2);
+    assert(f1.countOfCode(0x6) == 3 && f1.cap(5) == 3);
+    assert(program.fromFixed(f1) == m1);
+    assert(toDense(unionMultisets(f1, f2)).getCounts() == program.toDense(program.unionMultisets(m1, m2)).getCounts());
+    assert(toDense(differenceMultisets(f1, f2)).getCounts() ==
+           program.toDense(program.differenceMultisets(m1, m2)).getCounts());
+    assert(weightedSum(f1) == program.weightedSum(m1));
+
+    bool threw = false;
+    try { program.toFixed<5>(m1); } catch (const invalid_argument&) { threw = true; }
+    assert(threw);
+    (void)threw; (void)f1; (void)f2;
+
+    cout << "✓ Fixed-width multiset PASSED\n";
+}
+
+static string readExportFile(const string& path) {
+    string content;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return content;
+    char chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) content.append(chunk, got);
+    fclose(file);
+    return content;
+}
+
+void testMultisetExport() {
+    cout << "\nTest 29: Buffered Export\n";
+    cout << "------------------------\n";
+
+    // Integer formatting matches to_string at the digit-pair boundaries
+    char digits[24];
+    long long samples[] = {0, 7, 10, 99, 100, 12345, -1, -90, 2147483647LL, -2147483648LL,
+                           9223372036854775807LL, -9223372036854775807LL - 1};
+    for (long long value : samples) {
+        assert(string(digits, formatInteger(value, digits)) == to_string(value));
+        (void)value;
+    }
+    assert(string(digits, formatUnsigned(18446744073709551615ULL, digits)) == "18446744073709551615");
+
+    DenseMultiset dense(3, vector<int>{1, 2, 3, 4, 5, 6, 7, 8});
+    dense.set(0, 1);
+    dense.set(4, 3);
+    dense.set(7, -2);
+    AdaptiveMultiset multiset(dense);
+    ExportFormat format;
+    assert(parseExportFormat("jsonl", format) && format == EXPORT_JSON_LINES && !parseExportFormat("xml", format));
+
+    string path = "/tmp/multiset_test_export.out";
+    ExportOptions options;
+    ExportStats stats = exportMultisetFile(path, multiset, options);
+    string csv = "code,rank,multiplicity,cap\n000,0,1,1\n110,4,3,5\n100,7,-2,8\n";
+    assert(readExportFile(path) == csv && stats.records == 3 && stats.bytes == csv.size());
+
+    options.format = EXPORT_JSON_LINES;
+    stats = exportMultisetFile(path, AdaptiveMultiset(multiset.toSparse()), options);
+    assert(readExportFile(path) == "{\"code\":\"000\",\"rank\":0,\"multiplicity\":1,\"cap\":1}\n"
+                                   "{\"code\":\"110\",\"rank\":4,\"multiplicity\":3,\"cap\":5}\n"
+                                   "{\"code\":\"100\",\"rank\":7,\"multiplicity\":-2,\"cap\":8}\n");
+
+    // Zeros included: the sparse walk fills the gaps like the dense one
+    options.format = EXPORT_CSV;
+    options.includeZeros = true;
+    stats = exportMultisetFile(path, AdaptiveMultiset(multiset.toSparse()), options);
+    string sparseCsv = readExportFile(path);
+    exportMultisetFile(path, multiset, options);
+    assert(stats.records == 8 && sparseCsv == readExportFile(path));
+
+    // A large binary dump through a small buffer reads back exactly
+    DenseMultiset large(16);
+    for (size_t i = 0; i < large.size(); i++) large.set(i, static_cast<int>(i * 2654435761u % 1000));
+    options.format = EXPORT_BINARY;
+    options.bufferBytes = 4096;
+    stats = exportMultisetFile(path, AdaptiveMultiset(large), options);
+    string binary = readExportFile(path);
+    assert(stats.records == large.size() && binary.size() == large.size() * 12 && stats.bytes == binary.size());
+    bool matches = true;
+    for (size_t i = 0; i < large.size(); i++) {
+        int32_t record[3];
+        memcpy(record, binary.data() + i * 12, sizeof(record));
+        matches = matches && record[0] == static_cast<int32_t>(i) && record[1] == large.count(i) && record[2] == large.cap(i);
+    }
+    assert(matches);
+
+    // Batch command
+    BatchSession session;
+    ostringstream out;
+    session.execute("universe 3 4 11", out);
+    session.execute("set a 000:1 110:2", out);
+    session.execute("export a " + path + " jsonl", out);
+    session.execute("export a " + path + " xml", out);
+    string lines = out.str();
+    assert(lines.find("ok 2 ") != string::npos && lines.find("error unknown export format 'xml'") != string::npos);
+
+    bool threw = false;
+    try { exportMultisetFile("/nonexistent-dir/out.csv", multiset); } catch (const runtime_error&) { threw = true; }
+    assert(threw);
+    remove(path.c_str());
+    (void)stats; (void)format; (void)matches; (void)threw; (void)samples; (void)digits;
+
+    cout << "✓ Buffered export PASSED\n";
+}
+
 int main() {
     runComprehensiveTests();
+    testDenseMultiset();
+    testSimdKernels();
+    testIntegerGrayCode();
+    testSparseMultiset();
+    testBatchSession();
+    testMultisetFile();
+    testMultisetIngest();
+    testParallelOperations();
+    testOpStats();
+    testInPlaceOperations();
+    testMultisetExpressions();
+    testBitsetMultiset();
+    testProductEngine();
+    testGrayConversion();
+    testRandomMultiset();
+    testTrackedMultiset();
+    testMultisetCollection();
+    testRunLengthMultiset();
+    testRankIndex();
+    testConcurrentMultiset();
+    testPersistentMultiset();
+    testMultisetServer();
+    testFixedMultiset();
+    testMultisetExport();
     return 0;
 }
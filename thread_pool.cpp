@@ -0,0 +1,165 @@
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+std::atomic<unsigned> configuredThreads(0);
+std::atomic<size_t> parallelThreshold(size_t(1) << 20);
+
+const size_t MIN_BLOCK = size_t(1) << 14; // ranks per block, keeps scheduling cost negligible
+const size_t BLOCKS_PER_THREAD = 4;       // some slack for uneven progress
+
+unsigned resolvedThreads() {
+    unsigned threads = configuredThreads.load(std::memory_order_relaxed);
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+thread_local bool insideJob = false; // set while a thread runs pool blocks
+
+// Fixed set of workers that pull block indices from a shared counter.
+// The calling thread works too, so a pool of n threads has n - 1 workers.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    BlockBody jobBody;
+    void* jobContext;
+    size_t jobSize;
+    size_t jobBlocks;
+    std::atomic<size_t> nextBlock;
+    unsigned busy;           // workers still on the current job
+    unsigned long generation; // bumped for every job
+    bool stopping;
+
+    void work(BlockBody body, void* context, size_t size, size_t blocks) {
+        insideJob = true;
+        for (size_t block = nextBlock++; block < blocks; block = nextBlock++) {
+            body(context, block, size * block / blocks, size * (block + 1) / blocks);
+        }
+        insideJob = false;
+    }
+
+    void workerLoop() {
+        unsigned long seen = 0;
+        for (;;) {
+            BlockBody body;
+            void* context;
+            size_t size, blocks;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!stopping && generation == seen) wake.wait(guard);
+                if (stopping) return;
+                seen = generation;
+                body = jobBody;
+                context = jobContext;
+                size = jobSize;
+                blocks = jobBlocks;
+            }
+            work(body, context, size, blocks);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned threads)
+        : jobBody(0), jobContext(0), jobSize(0), jobBlocks(0), nextBlock(0), busy(0), generation(0), stopping(false) {
+        for (unsigned i = 1; i < threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+            wake.notify_all();
+        }
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    void run(BlockBody body, void* context, size_t size, size_t blocks) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobBody = body;
+            jobContext = context;
+            jobSize = size;
+            jobBlocks = blocks;
+            nextBlock = 0;
+            busy = static_cast<unsigned>(workers.size());
+            generation++;
+            wake.notify_all();
+        }
+        work(body, context, size, blocks);
+        std::unique_lock<std::mutex> guard(lock);
+        while (busy != 0) finished.wait(guard);
+    }
+};
+
+// One job at a time; a caller that finds the pool busy (or is itself a
+// pool thread) runs its blocks serially instead of waiting
+std::mutex poolLock;
+ThreadPool* pool = 0;
+
+struct PoolCleanup {
+    ~PoolCleanup() { delete pool; }
+} poolCleanup;
+
+} // namespace
+
+unsigned getThreadCount() {
+    return resolvedThreads();
+}
+
+void setThreadCount(unsigned threads) {
+    configuredThreads.store(threads, std::memory_order_relaxed);
+}
+
+size_t getParallelThreshold() {
+    return parallelThreshold.load(std::memory_order_relaxed);
+}
+
+void setParallelThreshold(size_t elements) {
+    parallelThreshold.store(elements, std::memory_order_relaxed);
+}
+
+size_t parallelBlockCount(size_t size) {
+    unsigned threads = resolvedThreads();
+    if (threads <= 1 || size < getParallelThreshold() || size < 2 * MIN_BLOCK) {
+        return 1;
+    }
+    // Power-of-two block count, so each block is one Gray prefix of a 2^k universe
+    size_t blocks = 1;
+    while (blocks < threads * BLOCKS_PER_THREAD && size / (blocks * 2) >= MIN_BLOCK) {
+        blocks *= 2;
+    }
+    return blocks;
+}
+
+void parallelForBlocks(size_t size, size_t blocks, BlockBody body, void* context) {
+    std::unique_lock<std::mutex> guard(poolLock, std::defer_lock);
+    if (blocks > 1 && !insideJob) {
+        guard.try_lock();
+    }
+    if (!guard.owns_lock()) {
+        // Same block layout as the parallel path, run in order
+        for (size_t i = 0; i < blocks; i++) {
+            body(context, i, size * i / blocks, size * (i + 1) / blocks);
+        }
+        return;
+    }
+    unsigned threads = resolvedThreads();
+    if (!pool || pool->size() != threads) {
+        delete pool;
+        pool = new ThreadPool(threads);
+    }
+    pool->run(body, context, size, blocks);
+}
@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Worker threads shared by the dense operations. Work on a universe of
+// 2^k ranks is cut into 2^p blocks: block i holds every rank whose Gray
+// code starts with the p-bit Gray prefix of i, so blocks are contiguous
+// and aligned. Small inputs (below the threshold) stay on the caller's thread.
+unsigned getThreadCount();              // threads used, including the caller
+void setThreadCount(unsigned threads);  // 0 = hardware concurrency
+size_t getParallelThreshold();          // minimum elements for the parallel path
+void setParallelThreshold(size_t elements);
+
+// Number of blocks parallelFor uses for this many elements (1 = serial)
+size_t parallelBlockCount(size_t size);
+
+// Calls body(context, block, begin, end) once for each of the given number of
+// blocks (normally parallelBlockCount(size)), on the pool when there is more
+// than one. Blocks cover [0, size) in order; body must not throw.
+typedef void (*BlockBody)(void* context, size_t block, size_t begin, size_t end);
+void parallelForBlocks(size_t size, size_t blocks, BlockBody body, void* context);
+
+template <typename Body>
+void invokeBlockBody(void* context, size_t block, size_t begin, size_t end) {
+    (*static_cast<const Body*>(context))(block, begin, end);
+}
+
+// Same with any callable body(block, begin, end); nothing is allocated
+template <typename Body>
+void parallelFor(size_t size, size_t blocks, const Body& body) {
+    parallelForBlocks(size, blocks, &invokeBlockBody<Body>, const_cast<void*>(static_cast<const void*>(&body)));
+}
+
+template <typename Body>
+void parallelFor(size_t size, const Body& body) {
+    parallelFor(size, parallelBlockCount(size), body);
+}
+
+// Reduction with a fixed block layout: partial results are combined in block
+// order, so any associative combine gives the same result on every thread count
+template <typename T, typename Block, typename Combine>
+T parallelReduce(size_t size, T identity, Block block, Combine combine) {
+    size_t blocks = parallelBlockCount(size);
+    if (blocks == 1) {
+        return combine(identity, block(size_t(0), size));
+    }
+    vector<T> partial(blocks, identity);
+    parallelFor(size, blocks, [&](size_t index, size_t begin, size_t end) { partial[index] = block(begin, end); });
+    T result = identity;
+    for (size_t i = 0; i < partial.size(); i++) {
+        result = combine(result, partial[i]);
+    }
+    return result;
+}
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,163 @@
+#include "tracked_multiset.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+void TrackedMultiset::LogSum::add(long double value) {
+    long double y = value - carry;
+    long double t = sum + y;
+    carry = (t - sum) - y;
+    sum = t;
+}
+
+TrackedMultiset::TrackedMultiset() : modulus(PRODUCT_DEFAULT_MODULUS), indexed(false) {
+    reset();
+}
+
+TrackedMultiset::TrackedMultiset(int bitWidth, const CapArray& caps, uint64_t modulus)
+    : multiset(bitWidth, caps), modulus(modulus), indexed(false) {
+    if (!isPrime(modulus)) throw invalid_argument("TrackedMultiset: modulus must be a prime");
+    reset();
+}
+
+TrackedMultiset::TrackedMultiset(const DenseMultiset& multiset, uint64_t modulus)
+    : modulus(modulus), indexed(false) {
+    if (!isPrime(modulus)) throw invalid_argument("TrackedMultiset: modulus must be a prime");
+    assign(multiset);
+}
+
+void TrackedMultiset::reset() {
+    total = 0;
+    weighted = 0;
+    present = 0;
+    productLogSum = LogSum();
+    productResidue = 1 % modulus;
+    productZeros = 0;
+    weightedLogSum = LogSum();
+    weightedResidue = 1 % modulus;
+    weightedZeros = 0;
+}
+
+// Adjusts every aggregate for one element going from `from` to `to` copies
+void TrackedMultiset::account(size_t rank, int from, int to) {
+    if (from == to) return;
+    long long delta = static_cast<long long>(to) - from;
+    total += delta;
+    weighted = static_cast<long long>(static_cast<unsigned long long>(weighted) +
+                                      static_cast<unsigned long long>(delta) * rank); // wraps like weightedSum
+    if ((from > 0) != (to > 0)) present += to > 0 ? 1 : size_t(-1);
+
+    // Plain product: the factor `from` leaves, the factor `to` joins
+    uint64_t removed = 1, added = 1;
+    if (from > 0) {
+        productLogSum.add(-logl(static_cast<long double>(from)));
+        if (static_cast<uint64_t>(from) % modulus == 0) productZeros--;
+        else removed = static_cast<uint64_t>(from);
+    }
+    if (to > 0) {
+        productLogSum.add(logl(static_cast<long double>(to)));
+        if (static_cast<uint64_t>(to) % modulus == 0) productZeros++;
+        else added = static_cast<uint64_t>(to);
+    }
+    if (removed != 1) added = mulMod(added % modulus, powerMod(removed, modulus - 2, modulus), modulus);
+    if (added != 1) productResidue = mulMod(productResidue, added % modulus, modulus);
+
+    // Weighted product: rank ^ multiplicity, so the exponent moves by delta
+    if (rank > 0) weightedLogSum.add(static_cast<long double>(delta) * logl(static_cast<long double>(rank)));
+    if (rank % modulus == 0) {
+        if ((from > 0) != (to > 0)) weightedZeros += to > 0 ? 1 : size_t(-1);
+    } else {
+        // rank^-d is rank^(p-1-d) modulo a prime p
+        uint64_t exponent = delta > 0 ? static_cast<uint64_t>(delta)
+                                      : (modulus - 1) - static_cast<uint64_t>(-delta) % (modulus - 1);
+        weightedResidue = mulMod(weightedResidue, powerMod(rank, exponent, modulus), modulus);
+    }
+}
+
+void TrackedMultiset::set(size_t rank, int multiplicity) {
+    if (multiplicity < 0 || multiplicity > multiset.cap(rank)) {
+        throw invalid_argument("TrackedMultiset: multiplicity must be between 0 and " + to_string(multiset.cap(rank)));
+    }
+    int from = multiset.count(rank);
+    account(rank, from, multiplicity);
+    if (indexed) index.add(rank, static_cast<long long>(multiplicity) - from);
+    multiset.set(rank, multiplicity);
+}
+
+int TrackedMultiset::insert(size_t rank, int copies) {
+    int from = multiset.count(rank);
+    int moved = copies > 0 ? min(copies, multiset.cap(rank) - from) : 0;
+    if (moved > 0) set(rank, from + moved);
+    return max(moved, 0);
+}
+
+int TrackedMultiset::remove(size_t rank, int copies) {
+    int from = multiset.count(rank);
+    int moved = copies > 0 ? min(copies, from) : 0;
+    if (moved > 0) set(rank, from - moved);
+    return moved;
+}
+
+void TrackedMultiset::clear() {
+    multiset.clear();
+    reset();
+    if (indexed) index = RankIndex(multiset);
+}
+
+void TrackedMultiset::assign(const DenseMultiset& source) {
+    for (size_t i = 0; i < source.size(); i++) {
+        if (source.count(i) < 0 || source.count(i) > source.cap(i)) {
+            throw invalid_argument("TrackedMultiset: multiplicities must be between 0 and the cap");
+        }
+    }
+    multiset = source;
+    recompute();
+}
+
+void TrackedMultiset::recompute() {
+    reset();
+    for (size_t i = 0; i < multiset.size(); i++) account(i, 0, multiset.count(i));
+    if (indexed) index = RankIndex(multiset);
+}
+
+void TrackedMultiset::attachRankIndex() {
+    index = RankIndex(multiset);
+    indexed = true;
+}
+
+void TrackedMultiset::detachRankIndex() {
+    index = RankIndex();
+    indexed = false;
+}
+
+const RankIndex& TrackedMultiset::rankIndex() const {
+    if (!indexed) throw logic_error("TrackedMultiset: no rank index attached");
+    return index;
+}
+
+double TrackedMultiset::productLog() const {
+    return static_cast<double>(productLogSum.sum);
+}
+
+uint64_t TrackedMultiset::productModular() const {
+    return productZeros > 0 ? 0 : productResidue;
+}
+
+double TrackedMultiset::weightedProductLog() const {
+    if (multiset.size() > 0 && multiset.count(0) > 0) return -numeric_limits<double>::infinity();
+    return static_cast<double>(weightedLogSum.sum);
+}
+
+uint64_t TrackedMultiset::weightedProductModular() const {
+    return weightedZeros > 0 ? 0 : weightedResidue;
+}
+
+int sumMultisets(const TrackedMultiset& multiset) {
+    return static_cast<int>(static_cast<unsigned>(multiset.cardinality())); // wraps like the scanning version
+}
+
+long long weightedSum(const TrackedMultiset& multiset) {
+    return multiset.weightedSum();
+}
@@ -0,0 +1,93 @@
+#ifndef TRACKED_MULTISET_H
+#define TRACKED_MULTISET_H
+
+#include <cstddef>
+#include <cstdint>
+#include "dense_multiset.h"
+#include "product_engine.h"
+#include "rank_index.h"
+
+using namespace std;
+
+// Dense multiset that keeps its aggregates up to date on every update, so
+// that cardinality, weighted sum, support size and the product states are
+// O(1) queries instead of scans. Each insert / remove / set adjusts them by
+// the difference between the old and new multiplicity of one element.
+//
+// Products are kept in the two modes of ProductEngine that can be updated
+// by difference: ln|product| (compensated long double sums) and the residue
+// modulo a prime (removals multiply by modular inverses). The modulus must
+// be prime; factors divisible by it are counted instead of multiplied in.
+//
+// An optional RankIndex adds O(log n) range, code-prefix and k-th queries;
+// once attached, every update also adjusts it.
+class TrackedMultiset {
+private:
+    // Kahan-compensated running sum of logarithms
+    struct LogSum {
+        long double sum;
+        long double carry;
+        LogSum() : sum(0.0L), carry(0.0L) {}
+        void add(long double value);
+    };
+
+    DenseMultiset multiset;
+    uint64_t modulus;
+    long long total;       // sum of multiplicities
+    long long weighted;    // sum of rank * multiplicity
+    size_t present;        // elements with positive multiplicity
+    LogSum productLogSum;  // sum of ln(multiplicity) over present elements
+    uint64_t productResidue;
+    size_t productZeros;   // present multiplicities divisible by the modulus
+    LogSum weightedLogSum; // sum of multiplicity * ln(rank) over present ranks > 0
+    uint64_t weightedResidue;
+    size_t weightedZeros;  // present ranks divisible by the modulus
+    bool indexed;
+    RankIndex index;
+
+    void reset();
+    void account(size_t rank, int from, int to);
+
+public:
+    TrackedMultiset();
+    TrackedMultiset(int bitWidth, const CapArray& caps, uint64_t modulus = PRODUCT_DEFAULT_MODULUS);
+    explicit TrackedMultiset(const DenseMultiset& multiset, uint64_t modulus = PRODUCT_DEFAULT_MODULUS);
+
+    int getBitWidth() const { return multiset.getBitWidth(); }
+    size_t size() const { return multiset.size(); }
+    int count(size_t rank) const { return multiset.count(rank); }
+    int cap(size_t rank) const { return multiset.cap(rank); }
+    uint64_t getModulus() const { return modulus; }
+    const DenseMultiset& dense() const { return multiset; }
+
+    // Updates. set throws invalid_argument outside [0, cap]; insert and
+    // remove stop at the cap and at 0 and return how many copies they moved.
+    void set(size_t rank, int multiplicity);
+    int insert(size_t rank, int copies = 1);
+    int remove(size_t rank, int copies = 1);
+    void clear();
+    void assign(const DenseMultiset& multiset); // takes the universe and caps too
+    void recompute(); // rebuilds the aggregates from the counts, dropping rounding
+
+    // Range queries. attachRankIndex builds the index in O(n); rankIndex
+    // throws logic_error while none is attached.
+    void attachRankIndex();
+    void detachRankIndex();
+    bool hasRankIndex() const { return indexed; }
+    const RankIndex& rankIndex() const;
+
+    // Aggregates
+    long long cardinality() const { return total; }
+    long long weightedSum() const { return weighted; }
+    size_t support() const { return present; }
+    double productLog() const;                 // ln of the product of positive multiplicities
+    uint64_t productModular() const;           // the same product modulo the modulus
+    double weightedProductLog() const;         // ln of prod rank^multiplicity, -infinity with rank 0
+    uint64_t weightedProductModular() const;
+};
+
+// O(1) counterparts of the scanning functions
+int sumMultisets(const TrackedMultiset& multiset);
+long long weightedSum(const TrackedMultiset& multiset);
+
+#endif // TRACKED_MULTISET_H